@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+#=================================================================================
+# Name        : bench.sh
+# Version     : 0.1
+#
+# Description :
+#     End-to-end benchmark of sipserv on loopback. sipbench starts sipserv with
+#     sipserv-bench.cfg, answers its registration and calls it in steps of
+#     rising load. Extra arguments go to sipbench, e.g.
+#     ./bench.sh -c 1,4,8,16 -cps 1,2,5,10 -n 50 -o bench.csv
+#
+#     --wideband runs both sides with the wideband media profile (wb=1),
+#     --bypass runs sipserv without the conference bridge (bp=1). --compare
+#     runs all four: narrowband and wideband, with and without the bridge.
+#     --load is the load test of the call sessions: up to 32 calls at the
+#     same time (mc=32 in sipserv-bench.cfg), held long enough to overlap.
+#
+#================================================================================
+#This script is free software; you can redistribute it and/or
+#modify it under the terms of the GNU Lesser General Public
+#License as published by the Free Software Foundation; either
+#version 2.1 of the License, or (at your option) any later version.
+#================================================================================
+
+cd "$(dirname "$0")" || exit 1
+
+# run one benchmark; $1 = 0 (narrowband) or 1 (wideband), $2 = 0 (bridge)
+# or 1 (bypass), the rest goes to sipbench
+run() {
+	wb=$1
+	bp=$2
+	shift 2
+	cfg=sipserv-bench.cfg
+	if [ "$wb" = 1 ] || [ "$bp" = 1 ]; then
+		cfg=$(mktemp /tmp/sipserv-bench.XXXXXX) || exit 1
+		{ cat sipserv-bench.cfg; echo "wb=$wb"; echo "bp=$bp"; } > "$cfg"
+	fi
+	./sipbench -x "exec ./sipserv --config-file $cfg -s 1" -wb "$wb" \
+		-c 1,2,4,8 -cps 1,2,4,8 -n 20 -hold 4000 -dtmf 1 -dd 1000 -wav ansage.wav "$@"
+	status=$?
+	[ "$cfg" != sipserv-bench.cfg ] && rm -f "$cfg"
+	return $status
+}
+
+wb=0
+bp=0
+while :; do
+	case "$1" in
+	--wideband) wb=1; shift ;;
+	--bypass) bp=1; shift ;;
+	--load)
+		shift
+		run "$wb" "$bp" -c 8,16,24,32 -cps 8 -n 64 -hold 8000 "$@"
+		exit $?
+		;;
+	--compare)
+		shift
+		for wb in 0 1; do
+			for bp in 0 1; do
+				[ "$wb" = 1 ] && echo "Wideband (16 kHz, G.722/Opus first)," || echo "Narrowband (8 kHz, default codecs),"
+				[ "$bp" = 1 ] && echo "bypassing the conference bridge:" || echo "through the conference bridge:"
+				run "$wb" "$bp" "$@" || exit 1
+				echo
+			done
+		done
+		exit 0
+		;;
+	*) break ;;
+	esac
+done
+
+run "$wb" "$bp" "$@"
@@ -0,0 +1,463 @@
+/*
+=================================================================================
+ Name        : campaign.c
+ Version     : 0.1
+
+ Description :
+     Target lists and outcome files of sipcall campaigns.
+
+     List format, one target per line:
+     - CSV: number[,text], fields may be quoted ("..." with "" for a quote);
+       an unquoted text runs to the end of the line, commas included
+     - JSON: {"number": "...", "text": "...", "wav": "...", "record": "...",
+       "repeat": n, "timeout": s}, only number is required, others are ignored
+     - lines starting with '#' and empty lines are skipped, as is a CSV
+       header line starting with "number"
+     - targets without text get the text given with -tts
+
+     Outcome file (CSV): number,result,sip_code,reason,ring_ms,talk_ms,plays
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "campaign.h"
+#include "log.h"
+
+// growing string for the parsers
+struct text {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static int text_put(struct text *text, char c)
+{
+	if (text->len + 1 >= text->size)
+	{
+		size_t size = text->size ? text->size * 2 : 64;
+		char *data = realloc(text->data, size);
+		if (data == NULL) return 1;
+		text->data = data;
+		text->size = size;
+	}
+	text->data[text->len++] = c;
+	text->data[text->len] = '\0';
+	return 0;
+}
+
+// take the string out of text, an empty string gives NULL
+static char *text_take(struct text *text)
+{
+	char *data = text->data;
+	if (data != NULL && text->len == 0)
+	{
+		free(data);
+		data = NULL;
+	}
+	memset(text, 0, sizeof(struct text));
+	return data;
+}
+
+// read a CSV field starting at *p, returns 0 on success; the last field
+// of the line takes the rest of it, nothing may follow a quoted one
+static int csv_field(const char **p, struct text *field, int last)
+{
+	const char *s = *p;
+
+	while (*s == ' ' || *s == '\t') s++;
+
+	if (*s == '"')
+	{
+		for (s++; ; s++)
+		{
+			if (*s == '\0') return 1;
+			if (*s == '"')
+			{
+				if (s[1] != '"') break;
+				s++;
+			}
+			if (text_put(field, *s) != 0) return 1;
+		}
+		s++;
+		while (*s == ' ' || *s == '\t') s++;
+	}
+	else
+	{
+		for (; *s && (last || *s != ','); s++)
+		{
+			if (text_put(field, *s) != 0) return 1;
+		}
+		// trailing blanks are not part of the field
+		while (field->len > 0 && isspace((unsigned char)field->data[field->len - 1]))
+		{
+			field->data[--field->len] = '\0';
+		}
+	}
+
+	if (*s == ',' && !last) s++;
+	else if (*s != '\0') return 1;
+
+	*p = s;
+	return 0;
+}
+
+static int csv_parse(const char *line, struct campaign_target *target)
+{
+	struct text number = { 0 }, text = { 0 };
+	int error = csv_field(&line, &number, 0) != 0 || csv_field(&line, &text, 1) != 0;
+
+	target->number = text_take(&number);
+	target->text = text_take(&text);
+	return error;
+}
+
+static const char *json_space(const char *s)
+{
+	while (isspace((unsigned char)*s)) s++;
+	return s;
+}
+
+// append a code point as UTF-8
+static int utf8_put(struct text *text, unsigned long c)
+{
+	if (c < 0x80) return text_put(text, c);
+	if (c < 0x800) return text_put(text, 0xc0 | (c >> 6)) || text_put(text, 0x80 | (c & 0x3f));
+	if (c < 0x10000) return text_put(text, 0xe0 | (c >> 12)) || text_put(text, 0x80 | ((c >> 6) & 0x3f))
+		|| text_put(text, 0x80 | (c & 0x3f));
+	return text_put(text, 0xf0 | (c >> 18)) || text_put(text, 0x80 | ((c >> 12) & 0x3f))
+		|| text_put(text, 0x80 | ((c >> 6) & 0x3f)) || text_put(text, 0x80 | (c & 0x3f));
+}
+
+static int json_hex4(const char *s, unsigned long *value)
+{
+	int i;
+	*value = 0;
+	for (i = 0; i < 4; i++)
+	{
+		if (!isxdigit((unsigned char)s[i])) return 1;
+		*value = *value * 16 + (isdigit((unsigned char)s[i]) ? s[i] - '0' : (tolower((unsigned char)s[i]) - 'a' + 10));
+	}
+	return 0;
+}
+
+// read a JSON string at *p (after the opening quote), returns 0 on success
+static int json_string(const char **p, struct text *out)
+{
+	const char *s = *p;
+
+	for (; *s != '"'; s++)
+	{
+		unsigned long c;
+
+		if (*s == '\0') return 1;
+		if (*s != '\\')
+		{
+			if (text_put(out, *s) != 0) return 1;
+			continue;
+		}
+
+		s++;
+		switch (*s)
+		{
+		case '"': case '\\': case '/': c = *s; break;
+		case 'b': c = '\b'; break;
+		case 'f': c = '\f'; break;
+		case 'n': c = '\n'; break;
+		case 'r': c = '\r'; break;
+		case 't': c = '\t'; break;
+		case 'u':
+			if (json_hex4(s + 1, &c) != 0) return 1;
+			s += 4;
+			// surrogate pair
+			if (c >= 0xd800 && c < 0xdc00 && s[1] == '\\' && s[2] == 'u')
+			{
+				unsigned long low;
+				if (json_hex4(s + 3, &low) == 0 && low >= 0xdc00 && low < 0xe000)
+				{
+					c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+					s += 6;
+				}
+			}
+			break;
+		default:
+			return 1;
+		}
+		if (utf8_put(out, c) != 0) return 1;
+	}
+
+	*p = s + 1;
+	return 0;
+}
+
+// take a member of a target object; unknown members are ignored
+static void json_member(struct campaign_target *target, const char *key, struct text *value)
+{
+	char **field = NULL;
+
+	if (!strcmp(key, "number")) field = &target->number;
+	else if (!strcmp(key, "text")) field = &target->text;
+	else if (!strcmp(key, "wav")) field = &target->wav;
+	else if (!strcmp(key, "record")) field = &target->record;
+	else if (!strcmp(key, "repeat")) target->repeat = value->data ? atoi(value->data) : 0;
+	else if (!strcmp(key, "timeout")) target->timeout = value->data ? atoi(value->data) : 0;
+
+	if (field != NULL)
+	{
+		free(*field);
+		*field = text_take(value);
+	}
+	free(value->data);
+	memset(value, 0, sizeof(struct text));
+}
+
+// read a flat JSON object with string, number and literal members
+static int json_parse(const char *line, struct campaign_target *target)
+{
+	const char *s = json_space(line + 1);
+
+	while (*s != '}')
+	{
+		struct text key = { 0 }, value = { 0 };
+
+		if (*s != '"') return 1;
+		s++;
+		int ok = json_string(&s, &key) == 0;
+		if (ok)
+		{
+			s = json_space(s);
+			ok = *s == ':';
+		}
+		if (ok)
+		{
+			s = json_space(s + 1);
+			if (*s == '"')
+			{
+				s++;
+				ok = json_string(&s, &value) == 0;
+			}
+			else
+			{
+				// numbers and true/false/null, nested values are not supported
+				while (*s && *s != ',' && *s != '}' && !isspace((unsigned char)*s))
+				{
+					if (*s == '{' || *s == '[' || text_put(&value, *s) != 0) ok = 0;
+					s++;
+				}
+			}
+		}
+		if (ok && key.data) json_member(target, key.data, &value);
+		free(key.data);
+		free(value.data);
+		if (!ok) return 1;
+
+		s = json_space(s);
+		if (*s == ',') s = json_space(s + 1);
+		else if (*s != '}') return 1;
+	}
+
+	return *json_space(s + 1) != '\0';
+}
+
+// the number ends up in a SIP URI
+static int valid_number(const char *number)
+{
+	const char *p;
+
+	if (number == NULL) return 0;
+	for (p = number; *p; p++)
+	{
+		if (isspace((unsigned char)*p) || strchr("@<>\";:", *p)) return 0;
+	}
+	return 1;
+}
+
+int campaign_parse(const char *line, struct campaign_target *target)
+{
+	const char *s = json_space(line);
+
+	memset(target, 0, sizeof(struct campaign_target));
+	if (*s == '\0' || *s == '#') return -1;
+
+	int error = (*s == '{') ? json_parse(s, target) : csv_parse(s, target);
+	if (error || !valid_number(target->number))
+	{
+		campaign_clear(target);
+		return 1;
+	}
+	return 0;
+}
+
+struct campaign_target *campaign_load(const char *file_name, int *count)
+{
+	FILE *file = fopen(file_name, "r");
+	if (file == NULL)
+	{
+		log_error(LOG_NO_CALL, "Error opening target list %s: %s", file_name, strerror(errno));
+		return NULL;
+	}
+
+	struct campaign_target *targets = NULL;
+	int size = 0;
+	*count = 0;
+
+	char *line = NULL;
+	size_t line_size = 0;
+	int line_no = 0;
+	while (getline(&line, &line_size, file) != -1)
+	{
+		line_no++;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (line_no == 1 && !strncasecmp(json_space(line), "number", 6)) continue;
+
+		struct campaign_target target;
+		int error = campaign_parse(line, &target);
+		if (error < 0) continue;
+		if (error)
+		{
+			log_warn(LOG_NO_CALL, "Ignoring target in line %i of %s", line_no, file_name);
+			continue;
+		}
+		target.line = line_no;
+
+		if (*count == size)
+		{
+			size = size ? size * 2 : 64;
+			struct campaign_target *grown = realloc(targets, size * sizeof(struct campaign_target));
+			if (grown == NULL)
+			{
+				campaign_clear(&target);
+				campaign_free(targets, *count);
+				targets = NULL;
+				break;
+			}
+			targets = grown;
+		}
+		targets[(*count)++] = target;
+	}
+
+	free(line);
+	fclose(file);
+
+	if (targets == NULL) log_error(LOG_NO_CALL, "No targets in %s", file_name);
+	return targets;
+}
+
+void campaign_free(struct campaign_target *targets, int count)
+{
+	int i;
+
+	if (targets == NULL) return;
+	for (i = 0; i < count; i++) campaign_clear(&targets[i]);
+	free(targets);
+}
+
+void campaign_clear(struct campaign_target *target)
+{
+	free(target->number);
+	free(target->text);
+	free(target->wav);
+	free(target->record);
+	memset(target, 0, sizeof(struct campaign_target));
+}
+
+FILE *campaign_open_outcomes(const char *file_name)
+{
+	FILE *file = strcmp(file_name, "-") ? fopen(file_name, "a") : stdout;
+	if (file == NULL)
+	{
+		log_error(LOG_NO_CALL, "Error opening outcome file %s: %s", file_name, strerror(errno));
+		return NULL;
+	}
+
+	if (file == stdout || ftell(file) == 0)
+	{
+		fprintf(file, "number,result,sip_code,reason,ring_ms,talk_ms,plays\n");
+		fflush(file);
+	}
+	return file;
+}
+
+// write a CSV field, quoted if needed
+static void csv_write(FILE *file, const char *value)
+{
+	const char *p;
+
+	if (value == NULL) return;
+	if (strpbrk(value, ",\"\r\n") == NULL)
+	{
+		fputs(value, file);
+		return;
+	}
+
+	fputc('"', file);
+	for (p = value; *p; p++)
+	{
+		if (*p == '"') fputc('"', file);
+		fputc(*p, file);
+	}
+	fputc('"', file);
+}
+
+// write a JSON string
+static void json_write(FILE *file, const char *value)
+{
+	const unsigned char *p;
+
+	fputc('"', file);
+	for (p = (const unsigned char *)value; *p; p++)
+	{
+		if (*p == '"' || *p == '\\') fprintf(file, "\\%c", *p);
+		else if (*p < 0x20) fprintf(file, "\\u%04x", *p);
+		else fputc(*p, file);
+	}
+	fputc('"', file);
+}
+
+void campaign_write_request(FILE *file, const struct campaign_target *target)
+{
+	fputs("{\"number\": ", file);
+	json_write(file, target->number);
+	if (target->text)
+	{
+		fputs(", \"text\": ", file);
+		json_write(file, target->text);
+	}
+	if (target->wav)
+	{
+		fputs(", \"wav\": ", file);
+		json_write(file, target->wav);
+	}
+	if (target->record)
+	{
+		fputs(", \"record\": ", file);
+		json_write(file, target->record);
+	}
+	if (target->repeat > 0) fprintf(file, ", \"repeat\": %i", target->repeat);
+	if (target->timeout > 0) fprintf(file, ", \"timeout\": %i", target->timeout);
+	fputs("}\n", file);
+	fflush(file);
+}
+
+void campaign_write_outcome(FILE *file, const struct campaign_target *target, const struct campaign_outcome *outcome)
+{
+	if (file == NULL) return;
+
+	csv_write(file, target->number);
+	fprintf(file, ",%s,%i,", outcome->result, outcome->sip_code);
+	csv_write(file, outcome->reason);
+	fprintf(file, ",%li,%li,%i\n", outcome->ring_ms, outcome->talk_ms, outcome->plays);
+	fflush(file);
+}
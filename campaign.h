@@ -0,0 +1,67 @@
+/*
+=================================================================================
+ Name        : campaign.h
+ Version     : 0.1
+
+ Description :
+     Target lists and outcome files of sipcall campaigns. A list has one target
+     per line, either as CSV (number[,text]) or as a JSON object
+     ({"number": "...", "text": "..."}); both may be mixed. The sipcall daemon
+     takes requests in the same format.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef CAMPAIGN_H
+#define CAMPAIGN_H
+
+#include <stdio.h>
+
+struct campaign_target {
+	char *number;
+	char *text;   // NULL = use the default text
+	char *wav;    // play this file instead of text, NULL = none
+	char *record; // record to this file, NULL = default
+	int repeat;   // repetitions of the message, 0 = default
+	int timeout;  // ring timeout in seconds, 0 = default
+	int line;     // line in the list file
+};
+
+// result of one target, written as a line of the outcome file
+struct campaign_outcome {
+	const char *result;  // delivered, hangup, no-answer, busy, declined, failed, cancelled
+	int sip_code;        // last SIP status of the call (0 = none)
+	const char *reason;  // SIP reason phrase or error text, may be NULL
+	long ring_ms;        // from dialing to answer or end of call
+	long talk_ms;        // from answer to end of call
+	int plays;           // complete repetitions of the message
+};
+
+// read a target list; returns NULL on error. Bad lines are skipped with a warning.
+struct campaign_target *campaign_load(const char *file_name, int *count);
+
+// parse one line into target; returns 0 on success, 1 for a bad line and
+// -1 for empty and comment lines
+int campaign_parse(const char *line, struct campaign_target *target);
+
+void campaign_free(struct campaign_target *targets, int count);
+
+// free the strings of a target
+void campaign_clear(struct campaign_target *target);
+
+// send a target as a request line (JSON) and flush it
+void campaign_write_request(FILE *file, const struct campaign_target *target);
+
+// open the outcome file for appending, writes the CSV header to new files;
+// "-" is stdout
+FILE *campaign_open_outcomes(const char *file_name);
+
+// append the outcome of a target and flush it
+void campaign_write_outcome(FILE *file, const struct campaign_target *target, const struct campaign_outcome *outcome);
+
+#endif
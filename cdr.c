@@ -0,0 +1,355 @@
+/*
+=================================================================================
+ Name        : cdr.c
+ Version     : 0.1
+
+ Description :
+     Call detail records: one JSON line per call with the monotonic time of
+     every stage from the INVITE to the end of the aftermath command.
+
+     Record (stages in ms after the INVITE, missing stages are left out):
+     {"time":"2024-01-01T12:00:00Z","invite":123456.7,"call":0,"account":0,
+      "number":"0301234",
+      "result":"answered","status":200,"speech_ms":4200,"aftermath":"ok","aftermath_runs":1,
+      "ms":{"screen_start":0.1,"screen_end":0.2,"answer":0.3,"media":40.2,...},
+      "dtmf":[{"digit":"1","at":5200.0,"audio":5650.3}]}
+
+     Records of calls with an aftermath command are written when the command
+     is done, the others when the call ends.
+
+     Stages are marked with atomics, so the media clock never waits for a
+     lock. Records are formatted in memory and appended to the file by a
+     writer thread, so no caller waits for the disk.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cdr.h"
+
+// record waiting for its aftermath job
+struct deferred {
+	struct cdr cdr; // first, so a struct cdr * of a deferred record can be cast back
+	struct deferred *next;
+};
+
+// formatted record waiting for the writer
+struct line {
+	struct line *next;
+	char *text;
+	size_t len;
+};
+
+static struct {
+	pthread_mutex_t lock; // guards the digits, the deferred records and the lines
+	pthread_cond_t cond;
+	FILE *file;           // written by the writer thread only
+	struct deferred *pending;
+	struct line *lines;
+	struct line **lines_tail;
+	int stopping;
+	int writer_started;
+	pthread_t writer;
+} cdrs = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// writer thread: append the formatted records to the file
+static void *cdr_writer(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&cdrs.lock);
+	for (;;)
+	{
+		if (cdrs.lines == NULL)
+		{
+			if (cdrs.stopping) break;
+			pthread_cond_wait(&cdrs.cond, &cdrs.lock);
+			continue;
+		}
+
+		struct line *lines = cdrs.lines;
+		cdrs.lines = NULL;
+		cdrs.lines_tail = &cdrs.lines;
+		pthread_mutex_unlock(&cdrs.lock);
+
+		while (lines)
+		{
+			struct line *line = lines;
+			lines = line->next;
+			fwrite(line->text, 1, line->len, cdrs.file);
+			free(line->text);
+			free(line);
+		}
+		fflush(cdrs.file);
+
+		pthread_mutex_lock(&cdrs.lock);
+	}
+	pthread_mutex_unlock(&cdrs.lock);
+
+	return NULL;
+}
+
+int cdr_open(const char *file)
+{
+	cdrs.lines_tail = &cdrs.lines;
+	cdrs.file = fopen(file, "a");
+	if (cdrs.file == NULL) return 1;
+
+	if (pthread_create(&cdrs.writer, NULL, cdr_writer, NULL) != 0)
+	{
+		fclose(cdrs.file);
+		cdrs.file = NULL;
+		return 1;
+	}
+	cdrs.writer_started = 1;
+	return 0;
+}
+
+double cdr_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+void cdr_begin(struct cdr *cdr, int call_id, const char *number, double received)
+{
+	pthread_mutex_lock(&cdrs.lock);
+	memset(cdr, 0, sizeof(struct cdr));
+	cdr->time = time(NULL);
+	cdr->call_id = call_id;
+	snprintf(cdr->number, sizeof(cdr->number), "%s", number);
+	cdr->invite = received;
+	pthread_mutex_unlock(&cdrs.lock);
+}
+
+void cdr_mark_at(double *stage, double when)
+{
+	// only the first mark counts
+	double unset = 0;
+	__atomic_compare_exchange(stage, &unset, &when, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+// read a stage marked by another thread
+static double stage_get(const double *stage)
+{
+	double value;
+	__atomic_load(stage, &value, __ATOMIC_ACQUIRE);
+	return value;
+}
+
+void cdr_mark(double *stage)
+{
+	cdr_mark_at(stage, cdr_clock());
+}
+
+int cdr_digit(struct cdr *cdr, char digit)
+{
+	int index = -1;
+	double now = cdr_clock();
+
+	pthread_mutex_lock(&cdrs.lock);
+	if (cdr->digit_count < CDR_MAX_DIGITS)
+	{
+		index = cdr->digit_count++;
+		cdr->digits[index].digit = digit;
+		cdr->digits[index].at = now;
+		cdr->digits[index].audio = 0;
+	}
+	pthread_mutex_unlock(&cdrs.lock);
+
+	return index;
+}
+
+// write a string as json, the number comes straight from the sip header
+static void write_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++)
+	{
+		unsigned char c = *str;
+		if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+		else if (c < 0x20) fprintf(out, "\\u%04x", c);
+		else fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+// write a stage relative to the invite, if it has been reached
+static void write_stage(FILE *out, const struct cdr *cdr, const char *name, const double *stage, int *first)
+{
+	double at = stage_get(stage);
+	if (at == 0) return;
+	fprintf(out, "%s\"%s\":%.1f", *first ? "" : ",", name, at - cdr->invite);
+	*first = 0;
+}
+
+// format a record and queue it for the writer (with the lock held)
+static void write_record(const struct cdr *cdr)
+{
+	char timestamp[32];
+	int first = 1, i;
+
+	if (cdrs.file == NULL) return;
+
+	struct line *line = calloc(1, sizeof(struct line));
+	if (line == NULL) return;
+	FILE *out = open_memstream(&line->text, &line->len);
+	if (out == NULL)
+	{
+		free(line);
+		return;
+	}
+
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&cdr->time));
+	fprintf(out, "{\"time\":\"%s\",\"invite\":%.1f,\"call\":%i,\"account\":%i,\"number\":", timestamp, cdr->invite, cdr->call_id, cdr->account);
+	write_string(out, cdr->number);
+	fprintf(out, ",\"result\":\"%s\",\"status\":%i", cdr->result ? cdr->result : "unknown", cdr->status);
+	if (stage_get(&cdr->recorder_closed)) fprintf(out, ",\"speech_ms\":%lu", cdr->speech_ms);
+	if (cdr->aftermath) fprintf(out, ",\"aftermath\":\"%s\",\"aftermath_runs\":%i", cdr->aftermath, cdr->aftermath_runs);
+
+	fputs(",\"ms\":{", out);
+	write_stage(out, cdr, "screen_start", &cdr->screen_start, &first);
+	write_stage(out, cdr, "screen_end", &cdr->screen_end, &first);
+	write_stage(out, cdr, "answer", &cdr->answer, &first);
+	write_stage(out, cdr, "media", &cdr->media, &first);
+	write_stage(out, cdr, "first_frame", &cdr->first_frame, &first);
+	write_stage(out, cdr, "hangup", &cdr->hangup, &first);
+	write_stage(out, cdr, "recorder_closed", &cdr->recorder_closed, &first);
+	write_stage(out, cdr, "aftermath_done", &cdr->aftermath_done, &first);
+	fputc('}', out);
+
+	if (cdr->digit_count > 0)
+	{
+		fputs(",\"dtmf\":[", out);
+		for (i = 0; i < cdr->digit_count; i++)
+		{
+			const struct cdr_digit *d = &cdr->digits[i];
+			fprintf(out, "%s{\"digit\":\"%c\",\"at\":%.1f", i ? "," : "", d->digit, d->at - cdr->invite);
+			if (stage_get(&d->audio)) fprintf(out, ",\"audio\":%.1f", stage_get(&d->audio) - cdr->invite);
+			fputc('}', out);
+		}
+		fputc(']', out);
+	}
+
+	fputs("}\n", out);
+	if (fclose(out) != 0 || line->text == NULL)
+	{
+		free(line->text);
+		free(line);
+		return;
+	}
+
+	*cdrs.lines_tail = line;
+	cdrs.lines_tail = &line->next;
+	pthread_cond_signal(&cdrs.cond);
+}
+
+void cdr_write(struct cdr *cdr)
+{
+	pthread_mutex_lock(&cdrs.lock);
+	write_record(cdr);
+	pthread_mutex_unlock(&cdrs.lock);
+}
+
+struct cdr *cdr_defer(const struct cdr *cdr)
+{
+	if (cdrs.file == NULL) return NULL;
+
+	struct deferred *deferred = malloc(sizeof(struct deferred));
+	if (deferred == NULL) return NULL;
+
+	pthread_mutex_lock(&cdrs.lock);
+	deferred->cdr = *cdr;
+	deferred->cdr.aftermath = "pending";
+	deferred->cdr.aftermath_id = 0;
+	deferred->next = cdrs.pending;
+	cdrs.pending = deferred;
+	pthread_mutex_unlock(&cdrs.lock);
+
+	return &deferred->cdr;
+}
+
+// take a record from the pending list (with the lock held)
+static void unlink_deferred(struct deferred *deferred)
+{
+	struct deferred **p;
+	for (p = &cdrs.pending; *p; p = &(*p)->next)
+	{
+		if (*p == deferred)
+		{
+			*p = deferred->next;
+			return;
+		}
+	}
+}
+
+void cdr_release(struct cdr *cdr)
+{
+	struct deferred *deferred = (struct deferred *)cdr;
+
+	if (deferred == NULL) return;
+
+	pthread_mutex_lock(&cdrs.lock);
+	unlink_deferred(deferred);
+	write_record(&deferred->cdr);
+	pthread_mutex_unlock(&cdrs.lock);
+
+	free(deferred);
+}
+
+void cdr_aftermath_run(unsigned long id, const char *result, int final)
+{
+	struct deferred *deferred;
+	double now = cdr_clock();
+
+	pthread_mutex_lock(&cdrs.lock);
+	for (deferred = cdrs.pending; deferred; deferred = deferred->next)
+	{
+		if (deferred->cdr.aftermath_id == id) break;
+	}
+	if (deferred != NULL)
+	{
+		deferred->cdr.aftermath = result;
+		deferred->cdr.aftermath_runs++;
+		if (final)
+		{
+			deferred->cdr.aftermath_done = now;
+			unlink_deferred(deferred);
+			write_record(&deferred->cdr);
+			free(deferred);
+		}
+	}
+	pthread_mutex_unlock(&cdrs.lock);
+}
+
+void cdr_close(void)
+{
+	pthread_mutex_lock(&cdrs.lock);
+	while (cdrs.pending)
+	{
+		struct deferred *deferred = cdrs.pending;
+		cdrs.pending = deferred->next;
+		write_record(&deferred->cdr);
+		free(deferred);
+	}
+	cdrs.stopping = 1;
+	pthread_cond_signal(&cdrs.cond);
+	pthread_mutex_unlock(&cdrs.lock);
+
+	// the writer empties the queue before it ends
+	if (cdrs.writer_started) pthread_join(cdrs.writer, NULL);
+	cdrs.writer_started = 0;
+	if (cdrs.file) fclose(cdrs.file);
+	cdrs.file = NULL;
+}
@@ -0,0 +1,89 @@
+/*
+=================================================================================
+ Name        : cdr.h
+ Version     : 0.1
+
+ Description :
+     Call detail records: one JSON line per call with the monotonic time of
+     every stage from the INVITE to the end of the aftermath command.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef CDR_H
+#define CDR_H
+
+#include <time.h>
+
+// digits kept per call, later ones are not recorded
+#define CDR_MAX_DIGITS 16
+
+struct cdr_digit {
+	char digit;
+	double at;     // digit received
+	double audio;  // first frame of the answer to it
+};
+
+// stage times are cdr_clock() values, 0 = stage not reached
+struct cdr {
+	time_t time;             // wall clock of the INVITE
+	int call_id;
+	int account;             // index of the account called
+	char number[64];
+	const char *result;      // answered, rejected, busy
+	int status;              // last SIP status of the call
+	unsigned long speech_ms;
+	double invite;
+	double screen_start;
+	double screen_end;
+	double answer;           // 200 OK sent
+	double media;            // media active
+	double first_frame;      // first frame of the prompt
+	double hangup;
+	double recorder_closed;
+	double aftermath_done;
+	const char *aftermath;   // result of the last aftermath run
+	int aftermath_runs;
+	unsigned long aftermath_id;
+	struct cdr_digit digits[CDR_MAX_DIGITS];
+	int digit_count;
+};
+
+// open the record file for appending and start its writer; returns 0 on success
+int cdr_open(const char *file);
+
+// milliseconds on the monotonic clock
+double cdr_clock(void);
+
+// start the record of a new call, received is the cdr_clock() of the INVITE
+void cdr_begin(struct cdr *cdr, int call_id, const char *number, double received);
+
+// set a stage to now / to a given time, unless it is set already (lock free)
+void cdr_mark(double *stage);
+void cdr_mark_at(double *stage, double when);
+
+// note a dtmf digit; returns its index in digits or -1 if there is no room
+int cdr_digit(struct cdr *cdr, char digit);
+
+// queue the record for the writer thread
+void cdr_write(struct cdr *cdr);
+
+// keep a copy of the record until its aftermath job is done; the job id
+// goes to aftermath_id of the copy (see jobqueue_add)
+struct cdr *cdr_defer(const struct cdr *cdr);
+
+// write and drop a deferred record right away (e.g. the job could not be queued)
+void cdr_release(struct cdr *deferred);
+
+// an aftermath run of a deferred record finished; final writes the record
+void cdr_aftermath_run(unsigned long id, const char *result, int final);
+
+// write the deferred records, wait for the writer and close the file
+void cdr_close(void);
+
+#endif
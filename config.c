@@ -0,0 +1,164 @@
+/*
+=================================================================================
+ Name        : config.c
+ Version     : 0.1
+
+ Description :
+     Reader for the key=value config files of sipserv. Lines may be of any
+     length; the file is read as a whole, so the values stay valid as long
+     as the file is kept, and it can be checked completely before any
+     setting is applied.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "config.h"
+#include "log.h"
+
+// remove leading and trailing blanks in place
+static char *trim(char *str)
+{
+	char *end;
+
+	while (isspace((unsigned char)*str)) str++;
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1])) end--;
+	*end = '\0';
+
+	return str;
+}
+
+// append an item, the strings are taken over
+static int add_item(struct config_file *file, char *key, char *value, int line)
+{
+	struct config_item *items = realloc(file->items, (file->count + 1) * sizeof(struct config_item));
+	if (items == NULL) return 1;
+
+	file->items = items;
+	items[file->count].key = key;
+	items[file->count].value = value;
+	items[file->count].line = line;
+	file->count++;
+	return 0;
+}
+
+struct config_file *config_read(const char *path)
+{
+	FILE *in = fopen(path, "r");
+	if (in == NULL) return NULL;
+
+	struct config_file *file = calloc(1, sizeof(struct config_file));
+	if (file == NULL || (file->path = strdup(path)) == NULL)
+	{
+		free(file);
+		fclose(in);
+		return NULL;
+	}
+
+	char *line = NULL;
+	size_t size = 0;
+	int line_no = 0;
+	while (getline(&line, &size, in) != -1)
+	{
+		line_no++;
+
+		char *text = trim(line);
+		if (text[0] == '#' || text[0] == '\0') continue;
+
+		// the value starts after the first '=', it may contain more of them
+		char *eq = strchr(text, '=');
+		if (eq == NULL)
+		{
+			log_error(LOG_NO_CALL, "%s:%i: no '=' in '%s'", path, line_no, text);
+			file->errors++;
+			continue;
+		}
+		*eq = '\0';
+
+		char *key = strdup(trim(text));
+		char *value = strdup(trim(eq + 1));
+		if (key == NULL || value == NULL || add_item(file, key, value, line_no) != 0)
+		{
+			free(key);
+			free(value);
+			free(line);
+			fclose(in);
+			config_free(file);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	free(line);
+	fclose(in);
+	return file;
+}
+
+void config_error(struct config_file *file, const struct config_item *item, const char *message)
+{
+	log_error(LOG_NO_CALL, "%s:%i: %s: %s", file->path, item->line, item->key, message);
+	file->errors++;
+}
+
+int config_int(struct config_file *file, const struct config_item *item, int min, int max, int *value)
+{
+	char *end;
+
+	errno = 0;
+	long number = strtol(item->value, &end, 10);
+	if (item->value[0] == '\0' || *end != '\0' || errno == ERANGE || number < min || number > max)
+	{
+		log_error(LOG_NO_CALL, "%s:%i: %s: '%s' is not a number from %i to %i", file->path, item->line, item->key, item->value, min, max);
+		file->errors++;
+		return 1;
+	}
+
+	*value = number;
+	return 0;
+}
+
+int config_choice(struct config_file *file, const struct config_item *item, const char *const *choices, int *value)
+{
+	int i;
+
+	for (i = 0; choices[i]; i++)
+	{
+		if (!strcasecmp(item->value, choices[i]))
+		{
+			*value = i;
+			return 0;
+		}
+	}
+
+	log_error(LOG_NO_CALL, "%s:%i: %s: unknown value '%s'", file->path, item->line, item->key, item->value);
+	file->errors++;
+	return 1;
+}
+
+void config_free(struct config_file *file)
+{
+	int i;
+
+	if (file == NULL) return;
+
+	for (i = 0; i < file->count; i++)
+	{
+		free(file->items[i].key);
+		free(file->items[i].value);
+	}
+	free(file->items);
+	free(file->path);
+	free(file);
+}
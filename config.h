@@ -0,0 +1,53 @@
+/*
+=================================================================================
+ Name        : config.h
+ Version     : 0.1
+
+ Description :
+     Reader for the key=value config files of sipserv. Lines may be of any
+     length; the file is read as a whole, so the values stay valid as long
+     as the file is kept, and it can be checked completely before any
+     setting is applied.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// one setting, key and value are trimmed
+struct config_item {
+	char *key;
+	char *value;
+	int line;
+};
+
+struct config_file {
+	char *path;
+	struct config_item *items;
+	int count;
+	int errors;     // invalid lines and values found so far
+};
+
+// read a config file; NULL if it can't be read. Lines without '=' are
+// counted as errors, comments (#) and empty lines are skipped.
+struct config_file *config_read(const char *path);
+
+// value conversions; an invalid value is logged with its line, counted in
+// file->errors and *value is left alone. Return 0 if the value was taken.
+int config_int(struct config_file *file, const struct config_item *item, int min, int max, int *value);
+
+// value must be one of the NULL terminated choices, *value is set to its index
+int config_choice(struct config_file *file, const struct config_item *item, const char *const *choices, int *value);
+
+// log and count an error of an item, e.g. a missing or conflicting setting
+void config_error(struct config_file *file, const struct config_item *item, const char *message);
+
+void config_free(struct config_file *file);
+
+#endif
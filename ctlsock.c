@@ -0,0 +1,177 @@
+/*
+=================================================================================
+ Name        : ctlsock.c
+ Version     : 0.1
+
+ Description :
+     Local control socket. A background thread accepts connections on a Unix
+     domain socket and hands the first line of each connection to a handler,
+     which answers on the connection and closes it when it is done.
+
+     The socket is only accessible by the user and group of the process.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "ctlsock.h"
+#include "log.h"
+
+// longest request line
+#define CTLSOCK_LINE_MAX 4096
+
+// a client has this long to send its request
+#define CTLSOCK_READ_TIMEOUT 5
+
+static struct {
+	int fd;
+	char *path;
+	ctlsock_handler handler;
+	pthread_t thread;
+	int running;
+} ctl = { -1 };
+
+static int socket_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+	{
+		log_error(LOG_NO_CALL, "Control socket path too long: %s", path);
+		return 1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+// read the request line, returns its length or -1
+static int read_line(int client, char *line, size_t size)
+{
+	size_t len = 0;
+
+	while (len < size - 1)
+	{
+		ssize_t n = read(client, line + len, 1);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		if (line[len] == '\n') break;
+		len++;
+	}
+	line[len] = '\0';
+
+	if (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+	return len > 0 ? (int)len : -1;
+}
+
+// accept thread: read one line per connection and pass it on
+static void *ctlsock_thread(void *data)
+{
+	char line[CTLSOCK_LINE_MAX];
+	struct timeval timeout = { CTLSOCK_READ_TIMEOUT, 0 };
+
+	(void)data;
+
+	for (;;)
+	{
+		int client = accept(ctl.fd, NULL, NULL);
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break; // socket shut down
+		}
+
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		if (read_line(client, line, sizeof(line)) < 0)
+		{
+			close(client);
+			continue;
+		}
+		ctl.handler(client, line);
+	}
+
+	return NULL;
+}
+
+int ctlsock_open(const char *path, ctlsock_handler handler)
+{
+	struct sockaddr_un addr;
+
+	if (socket_address(path, &addr) != 0) return 1;
+
+	ctl.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (ctl.fd < 0) return 1;
+
+	// a stale socket of an earlier run would make bind fail
+	unlink(path);
+
+	mode_t mask = umask(0117);
+	int error = bind(ctl.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(ctl.fd, 16) != 0;
+	umask(mask);
+	if (error)
+	{
+		log_error(LOG_NO_CALL, "Error opening control socket %s: %s", path, strerror(errno));
+		close(ctl.fd);
+		ctl.fd = -1;
+		return 1;
+	}
+
+	ctl.path = strdup(path);
+	ctl.handler = handler;
+	if (pthread_create(&ctl.thread, NULL, &ctlsock_thread, NULL) != 0)
+	{
+		ctlsock_close();
+		return 1;
+	}
+	ctl.running = 1;
+
+	return 0;
+}
+
+int ctlsock_connect(const char *path)
+{
+	struct sockaddr_un addr;
+
+	if (socket_address(path, &addr) != 0) return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void ctlsock_close(void)
+{
+	if (ctl.fd < 0) return;
+
+	// wakes up accept
+	shutdown(ctl.fd, SHUT_RDWR);
+	if (ctl.running) pthread_join(ctl.thread, NULL);
+	ctl.running = 0;
+
+	close(ctl.fd);
+	ctl.fd = -1;
+
+	if (ctl.path) unlink(ctl.path);
+	free(ctl.path);
+	ctl.path = NULL;
+}
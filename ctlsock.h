@@ -0,0 +1,34 @@
+/*
+=================================================================================
+ Name        : ctlsock.h
+ Version     : 0.1
+
+ Description :
+     Local control socket. A background thread accepts connections on a Unix
+     domain socket and hands the first line of each connection to a handler,
+     which answers on the connection and closes it when it is done.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef CTLSOCK_H
+#define CTLSOCK_H
+
+// called on the socket thread; client belongs to the handler from now on
+typedef void (*ctlsock_handler)(int client, char *line);
+
+// create the socket (an old one is replaced) and start accepting; returns 0 on success
+int ctlsock_open(const char *path, ctlsock_handler handler);
+
+// connect to a control socket; returns the connection or -1
+int ctlsock_connect(const char *path);
+
+// stop accepting and remove the socket
+void ctlsock_close(void);
+
+#endif
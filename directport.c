@@ -0,0 +1,176 @@
+/*
+=================================================================================
+ Name        : directport.c
+ Version     : 0.1
+
+ Description :
+     pjmedia port joining the stream of a call straight to its player and
+     recorder, without the conference bridge. A master port clocks it
+     against the stream: what the call sends comes from the player, what
+     it receives goes to the recorder. Nothing is mixed, levelled or
+     resampled, so it only works when player, recorder and stream share
+     one clock rate.
+
+     The stream's frames follow the packet time, the player's are 20 ms,
+     so the player's output goes through a small queue of samples.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "directport.h"
+
+#define DIRECTPORT_SIGNATURE PJMEDIA_SIG_CLASS_APP('D', 'P')
+
+struct direct_port {
+	pjmedia_port base;
+	pthread_mutex_t lock;       // held by the clock thread while using the ports
+	unsigned samples_per_frame;
+	pjmedia_port *player;
+	pjmedia_port *recorder;
+	short *queue;               // player samples not sent yet
+	unsigned queued;
+	unsigned queue_size;
+};
+
+// next frame to send: the player's samples, silence while it is behind,
+// no frame at all once it is done
+static pj_status_t directport_get_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+	struct direct_port *port = (struct direct_port *)this_port;
+	unsigned spf = port->samples_per_frame;
+	int done = 0;
+
+	pthread_mutex_lock(&port->lock);
+	if (port->player == NULL)
+	{
+		pthread_mutex_unlock(&port->lock);
+		frame->type = PJMEDIA_FRAME_TYPE_NONE;
+		frame->size = 0;
+		return PJ_SUCCESS;
+	}
+
+	unsigned player_spf = PJMEDIA_PIA_SPF(&port->player->info);
+	while (port->queued < spf && port->queued + player_spf <= port->queue_size)
+	{
+		pjmedia_frame f;
+		memset(&f, 0, sizeof(f));
+		f.buf = port->queue + port->queued;
+		f.size = player_spf * sizeof(short);
+		if (pjmedia_port_get_frame(port->player, &f) != PJ_SUCCESS || f.type != PJMEDIA_FRAME_TYPE_AUDIO || f.size == 0)
+		{
+			done = 1;
+			break;
+		}
+		port->queued += f.size / sizeof(short);
+	}
+
+	if (done && port->queued == 0)
+	{
+		frame->type = PJMEDIA_FRAME_TYPE_NONE;
+		frame->size = 0;
+	}
+	else
+	{
+		unsigned n = port->queued < spf ? port->queued : spf;
+		memcpy(frame->buf, port->queue, n * sizeof(short));
+		if (n < spf) memset((short *)frame->buf + n, 0, (spf - n) * sizeof(short));
+		port->queued -= n;
+		memmove(port->queue, port->queue + n, port->queued * sizeof(short));
+		frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+		frame->size = spf * sizeof(short);
+	}
+	pthread_mutex_unlock(&port->lock);
+
+	return PJ_SUCCESS;
+}
+
+// received frame: straight to the recorder
+static pj_status_t directport_put_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+	struct direct_port *port = (struct direct_port *)this_port;
+
+	pthread_mutex_lock(&port->lock);
+	if (port->recorder != NULL) pjmedia_port_put_frame(port->recorder, frame);
+	pthread_mutex_unlock(&port->lock);
+
+	return PJ_SUCCESS;
+}
+
+static pj_status_t directport_on_destroy(pjmedia_port *this_port)
+{
+	struct direct_port *port = (struct direct_port *)this_port;
+
+	free(port->queue);
+	port->queue = NULL;
+	pthread_mutex_destroy(&port->lock);
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t directport_create(pj_pool_t *pool, unsigned clock_rate, unsigned samples_per_frame, pjmedia_port **p_port)
+{
+	struct direct_port *port = PJ_POOL_ZALLOC_T(pool, struct direct_port);
+	if (port == NULL) return PJ_ENOMEM;
+
+	pj_str_t name = pj_str("direct");
+	port->samples_per_frame = samples_per_frame;
+	pjmedia_port_info_init(&port->base.info, &name, DIRECTPORT_SIGNATURE, clock_rate, 1, 16, samples_per_frame);
+	port->base.get_frame = &directport_get_frame;
+	port->base.put_frame = &directport_put_frame;
+	port->base.on_destroy = &directport_on_destroy;
+
+	pthread_mutex_init(&port->lock, NULL);
+
+	*p_port = &port->base;
+	return PJ_SUCCESS;
+}
+
+pj_status_t directport_set_player(pjmedia_port *this_port, pjmedia_port *player)
+{
+	struct direct_port *port = (struct direct_port *)this_port;
+	short *queue = NULL, *old = NULL;
+	unsigned size = 0;
+
+	if (player != NULL)
+	{
+		if (PJMEDIA_PIA_SRATE(&player->info) != PJMEDIA_PIA_SRATE(&this_port->info)) return PJ_EINVAL;
+
+		// room for a frame of the stream and one more of the player
+		size = port->samples_per_frame + PJMEDIA_PIA_SPF(&player->info);
+		queue = malloc(size * sizeof(short));
+		if (queue == NULL) return PJ_ENOMEM;
+	}
+
+	pthread_mutex_lock(&port->lock);
+	old = port->queue;
+	port->player = player;
+	port->queue = queue;
+	port->queue_size = size;
+	port->queued = 0;
+	pthread_mutex_unlock(&port->lock);
+
+	free(old);
+	return PJ_SUCCESS;
+}
+
+pj_status_t directport_set_recorder(pjmedia_port *this_port, pjmedia_port *recorder)
+{
+	struct direct_port *port = (struct direct_port *)this_port;
+
+	if (recorder != NULL && PJMEDIA_PIA_SRATE(&recorder->info) != PJMEDIA_PIA_SRATE(&this_port->info)) return PJ_EINVAL;
+
+	pthread_mutex_lock(&port->lock);
+	port->recorder = recorder;
+	pthread_mutex_unlock(&port->lock);
+
+	return PJ_SUCCESS;
+}
@@ -0,0 +1,43 @@
+/*
+=================================================================================
+ Name        : directport.h
+ Version     : 0.1
+
+ Description :
+     pjmedia port joining the stream of a call straight to its player and
+     recorder, without the conference bridge. A master port clocks it
+     against the stream: what the call sends comes from the player, what
+     it receives goes to the recorder. Nothing is mixed, levelled or
+     resampled, so it only works when player, recorder and stream share
+     one clock rate.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef DIRECTPORT_H
+#define DIRECTPORT_H
+
+// definition of endianess (e.g. needed on raspberry pi)
+#define PJ_IS_LITTLE_ENDIAN 1
+#define PJ_IS_BIG_ENDIAN 0
+
+#include <pjsua-lib/pjsua.h>
+
+// create a mono port of the format of the stream, with nothing attached
+pj_status_t directport_create(pj_pool_t *pool, unsigned clock_rate, unsigned samples_per_frame, pjmedia_port **p_port);
+
+// set the port played into the call (NULL = nothing); its frames may be of
+// another length than the stream's. When it returns, the clock thread is
+// done with the old player, so that can be destroyed
+pj_status_t directport_set_player(pjmedia_port *port, pjmedia_port *player);
+
+// set the port getting the audio of the caller (NULL = nothing), with the
+// same guarantee for the old recorder
+pj_status_t directport_set_recorder(pjmedia_port *port, pjmedia_port *recorder);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+=================================================================================
+ Name        : evloop.c
+ Version     : 0.1
+
+ Description :
+     Main loop of sipcall and sipserv. Signals are received through a signalfd
+     instead of a handler, and other threads (e.g. pjsua callbacks) wake the
+     main thread through an eventfd, so the main thread sleeps until there is
+     something to do and shuts down outside of signal context.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include "evloop.h"
+
+static struct {
+	int signal_fd;
+	int event_fd;
+	unsigned pending;  // posted events, taken by evloop_wait
+} loop = { -1, -1, 0 };
+
+int evloop_init(void)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+	if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) return 1;
+
+	loop.signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+	loop.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (loop.signal_fd < 0 || loop.event_fd < 0)
+	{
+		evloop_close();
+		return 1;
+	}
+	return 0;
+}
+
+void evloop_post(unsigned events)
+{
+	uint64_t one = 1;
+
+	__atomic_or_fetch(&loop.pending, events, __ATOMIC_RELEASE);
+	if (write(loop.event_fd, &one, sizeof(one)) < 0)
+	{
+		// counter overflow is the only error, the loop is awake anyway
+	}
+}
+
+unsigned evloop_wait(int timeout_ms, int *signo)
+{
+	struct pollfd fds[2];
+
+	*signo = 0;
+
+	fds[0].fd = loop.signal_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = loop.event_fd;
+	fds[1].events = POLLIN;
+
+	// events posted before we got here must not be missed
+	unsigned events = __atomic_exchange_n(&loop.pending, 0, __ATOMIC_ACQUIRE);
+	if (events) return events;
+
+	if (poll(fds, 2, timeout_ms) < 0 && errno != EINTR) return 0;
+
+	if (fds[0].revents & POLLIN)
+	{
+		struct signalfd_siginfo info;
+		if (read(loop.signal_fd, &info, sizeof(info)) == sizeof(info)) *signo = info.ssi_signo;
+	}
+	if (fds[1].revents & POLLIN)
+	{
+		uint64_t count;
+		if (read(loop.event_fd, &count, sizeof(count)) < 0)
+		{
+			// nothing to read, someone else was faster
+		}
+	}
+
+	return __atomic_exchange_n(&loop.pending, 0, __ATOMIC_ACQUIRE);
+}
+
+void evloop_close(void)
+{
+	if (loop.signal_fd >= 0) close(loop.signal_fd);
+	if (loop.event_fd >= 0) close(loop.event_fd);
+	loop.signal_fd = loop.event_fd = -1;
+}
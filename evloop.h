@@ -0,0 +1,41 @@
+/*
+=================================================================================
+ Name        : evloop.h
+ Version     : 0.1
+
+ Description :
+     Main loop of sipcall and sipserv. Signals are received through a signalfd
+     instead of a handler, and other threads (e.g. pjsua callbacks) wake the
+     main thread through an eventfd, so the main thread sleeps until there is
+     something to do and shuts down outside of signal context.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+// events posted to the main loop (bit mask)
+#define EVLOOP_QUIT   0x01
+#define EVLOOP_UPDATE 0x02  // some state changed, look again
+
+// block SIGINT, SIGTERM and SIGHUP and create the descriptors; call this
+// before any thread is started, so all threads inherit the signal mask.
+// Returns 0 on success.
+int evloop_init(void);
+
+// wake the main loop with events, may be called from any thread
+void evloop_post(unsigned events);
+
+// wait up to timeout_ms (-1 = forever) for signals or events; returns the
+// posted events and sets *signo to a received signal (0 if none)
+unsigned evloop_wait(int timeout_ms, int *signo);
+
+void evloop_close(void);
+
+#endif
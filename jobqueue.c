@@ -0,0 +1,582 @@
+/*
+=================================================================================
+ Name        : jobqueue.c
+ Version     : 0.1
+
+ Description :
+     Durable queue for aftermath commands. Jobs are kept in an append-only
+     journal, run by a fixed number of worker threads and retried with
+     exponential backoff. Unfinished jobs are picked up again after a restart.
+
+     Journal records, one per line:
+     A <id> <command>          job added
+     R <id> <attempts> <due>   run failed, retry at <due> (unix time)
+     D <id>                    job done
+     F <id>                    job failed too often, given up
+
+     Records are written and synced by a writer thread of the queue, so
+     adding a job never waits for the disk; a job is run only once its A
+     record is on disk. The journal is compacted to the unfinished jobs on
+     every start and, while running, every JOURNAL_COMPACT_RECORDS records.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "jobqueue.h"
+#include "log.h"
+#include "proc.h"
+
+// records written before the journal is rewritten to the unfinished jobs
+#define JOURNAL_COMPACT_RECORDS 1000
+
+// journal records waiting for the writer
+struct records {
+	char *data;
+	size_t len;
+	size_t size;
+	int count;
+};
+
+struct job {
+	struct job *next;
+	unsigned long id;
+	int attempts;
+	time_t due;
+	int running;
+	char *command;
+};
+
+struct jobqueue {
+	struct jobqueue_config cfg;
+	char *journal_path;
+	FILE *journal;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct job *jobs; // in order of arrival
+	unsigned long next_id;
+	int stopping;
+	volatile int cancel;
+
+	// journal writer; jobs with an id below synced_id are on disk
+	pthread_t writer;
+	int writer_started;
+	int writer_stopping;
+	pthread_cond_t writer_cond;
+	struct records pending;
+	int pending_sync;        // pending has an A record
+	int written;             // records since the last compaction
+	unsigned long synced_id;
+
+	pthread_t *threads;
+	int thread_count;
+};
+
+static struct job *job_new(unsigned long id, const char *command)
+{
+	struct job *job = calloc(1, sizeof(struct job));
+	if (job == NULL) return NULL;
+	job->id = id;
+	job->command = strdup(command);
+	if (job->command == NULL)
+	{
+		free(job);
+		return NULL;
+	}
+	return job;
+}
+
+static void job_free(struct job *job)
+{
+	free(job->command);
+	free(job);
+}
+
+static void job_append(struct jobqueue *queue, struct job *job)
+{
+	struct job **tail = &queue->jobs;
+	while (*tail) tail = &(*tail)->next;
+	job->next = NULL;
+	*tail = job;
+}
+
+static struct job *job_find(struct jobqueue *queue, unsigned long id, struct job ***link)
+{
+	struct job **p;
+	for (p = &queue->jobs; *p; p = &(*p)->next)
+	{
+		if ((*p)->id == id)
+		{
+			if (link) *link = p;
+			return *p;
+		}
+	}
+	return NULL;
+}
+
+// append a record to a buffer; returns 0 on success
+static int records_vprintf(struct records *records, const char *format, va_list args)
+{
+	va_list copy;
+
+	va_copy(copy, args);
+	int len = vsnprintf(NULL, 0, format, copy);
+	va_end(copy);
+	if (len < 0) return 1;
+
+	if (records->len + len + 1 > records->size)
+	{
+		size_t size = records->size ? records->size : 256;
+		while (size < records->len + len + 1) size *= 2;
+		char *data = realloc(records->data, size);
+		if (data == NULL) return 1;
+		records->data = data;
+		records->size = size;
+	}
+
+	vsnprintf(records->data + records->len, len + 1, format, args);
+	records->len += len;
+	records->count++;
+	return 0;
+}
+
+static int records_printf(struct records *records, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static int records_printf(struct records *records, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	int status = records_vprintf(records, format, args);
+	va_end(args);
+	return status;
+}
+
+// queue a journal record for the writer (call with the queue locked); sync
+// makes sure it survives a power cut before the job runs
+static void journal_write(struct jobqueue *queue, int sync, const char *format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+static void journal_write(struct jobqueue *queue, int sync, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	if (records_vprintf(&queue->pending, format, args) != 0) log_error(LOG_NO_CALL, "Aftermath journal: out of memory");
+	va_end(args);
+
+	if (sync) queue->pending_sync = 1;
+	pthread_cond_signal(&queue->writer_cond);
+}
+
+// read the journal and rebuild the list of unfinished jobs
+static void journal_replay(struct jobqueue *queue)
+{
+	FILE *file = fopen(queue->journal_path, "r");
+	if (file == NULL) return;
+
+	char *line = NULL;
+	size_t line_size = 0;
+	while (getline(&line, &line_size, file) != -1)
+	{
+		unsigned long id;
+		int attempts, offset = 0;
+		long due;
+		struct job *job, **link;
+
+		line[strcspn(line, "\n")] = '\0';
+
+		switch (line[0])
+		{
+		case 'A':
+			if (sscanf(line, "A %lu %n", &id, &offset) < 1 || offset == 0) break;
+			job = job_new(id, line + offset);
+			if (job) job_append(queue, job);
+			if (id >= queue->next_id) queue->next_id = id + 1;
+			break;
+		case 'R':
+			if (sscanf(line, "R %lu %i %li", &id, &attempts, &due) != 3) break;
+			job = job_find(queue, id, NULL);
+			if (job)
+			{
+				job->attempts = attempts;
+				job->due = due;
+			}
+			break;
+		case 'D':
+		case 'F':
+			if (sscanf(line + 1, " %lu", &id) != 1) break;
+			job = job_find(queue, id, &link);
+			if (job)
+			{
+				*link = job->next;
+				job_free(job);
+			}
+			break;
+		}
+	}
+
+	free(line);
+	fclose(file);
+}
+
+// records of the unfinished jobs (call with the queue locked)
+static int journal_snapshot(struct jobqueue *queue, struct records *records)
+{
+	struct job *job;
+
+	for (job = queue->jobs; job; job = job->next)
+	{
+		if (records_printf(records, "A %lu %s\n", job->id, job->command) != 0) return 1;
+		if (job->attempts > 0 && records_printf(records, "R %lu %i %li\n", job->id, job->attempts, (long)job->due) != 0) return 1;
+	}
+	return 0;
+}
+
+// replace the journal by the given records and reopen it for appending
+// (writer thread or before it runs)
+static int journal_rewrite(struct jobqueue *queue, const struct records *records)
+{
+	char tmp_path[strlen(queue->journal_path) + 5];
+	sprintf(tmp_path, "%s.tmp", queue->journal_path);
+
+	FILE *file = fopen(tmp_path, "w");
+	if (file == NULL) return 1;
+
+	int error = records->len > 0 && fwrite(records->data, records->len, 1, file) != 1;
+	if (fflush(file) != 0 || fdatasync(fileno(file)) != 0) error = 1;
+	fclose(file);
+	if (error || rename(tmp_path, queue->journal_path) != 0)
+	{
+		unlink(tmp_path);
+		return 1;
+	}
+
+	if (queue->journal) fclose(queue->journal);
+	queue->journal = fopen(queue->journal_path, "a");
+	return queue->journal == NULL;
+}
+
+// writer thread: append the queued records, or compact the journal once
+// enough have been written; the queue stays unlocked while on the disk
+static void *journal_thread(void *data)
+{
+	struct jobqueue *queue = data;
+	struct records batch = { 0 }, snapshot = { 0 };
+
+	pthread_mutex_lock(&queue->lock);
+	for (;;)
+	{
+		if (queue->pending.len == 0)
+		{
+			if (queue->writer_stopping) break;
+			pthread_cond_wait(&queue->writer_cond, &queue->lock);
+			continue;
+		}
+
+		// take the records, the state of the jobs includes them from here on
+		struct records taken = queue->pending;
+		queue->pending = batch;
+		batch = taken;
+		int sync = queue->pending_sync;
+		queue->pending_sync = 0;
+		unsigned long synced_id = queue->next_id;
+		queue->written += batch.count;
+
+		// the snapshot covers the taken records too
+		int compact = queue->written >= JOURNAL_COMPACT_RECORDS && journal_snapshot(queue, &snapshot) == 0;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (compact)
+		{
+			// only the writer uses the count; after a failure it tries again later
+			queue->written = 0;
+			if (journal_rewrite(queue, &snapshot) == 0)
+			{
+				batch.len = 0;
+			}
+			else
+			{
+				log_warn(LOG_NO_CALL, "Error compacting aftermath journal %s: %s", queue->journal_path, strerror(errno));
+			}
+		}
+		if (queue->journal && batch.len > 0)
+		{
+			int error = fwrite(batch.data, batch.len, 1, queue->journal) != 1;
+			if (fflush(queue->journal) != 0 || (sync && fdatasync(fileno(queue->journal)) != 0)) error = 1;
+			if (error) log_error(LOG_NO_CALL, "Error writing aftermath journal %s: %s", queue->journal_path, strerror(errno));
+		}
+		batch.len = 0;
+		batch.count = 0;
+		snapshot.len = 0;
+		snapshot.count = 0;
+
+		// jobs run even if the journal failed, they just won't survive a restart
+		pthread_mutex_lock(&queue->lock);
+		queue->synced_id = synced_id;
+		pthread_cond_broadcast(&queue->cond);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	free(batch.data);
+	free(snapshot.data);
+	return NULL;
+}
+
+// seconds to wait before the next run of a job that failed attempts times
+static int backoff_delay(struct jobqueue *queue, int attempts)
+{
+	long delay = queue->cfg.backoff_base;
+	while (--attempts > 0 && delay < queue->cfg.backoff_max) delay *= 2;
+	if (delay > queue->cfg.backoff_max) delay = queue->cfg.backoff_max;
+	return delay;
+}
+
+// worker thread: run due jobs until the queue is closed
+static void *jobqueue_thread(void *data)
+{
+	struct jobqueue *queue = data;
+
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->stopping)
+	{
+		// find the first job that is due, or the time the next one gets due
+		time_t now = time(NULL);
+		time_t next_due = 0;
+		struct job *job;
+		for (job = queue->jobs; job; job = job->next)
+		{
+			if (job->running || job->id >= queue->synced_id) continue;
+			if (job->due <= now) break;
+			if (next_due == 0 || job->due < next_due) next_due = job->due;
+		}
+
+		if (job == NULL)
+		{
+			if (next_due)
+			{
+				struct timespec until = { next_due, 0 };
+				pthread_cond_timedwait(&queue->cond, &queue->lock, &until);
+			}
+			else
+			{
+				pthread_cond_wait(&queue->cond, &queue->lock);
+			}
+			continue;
+		}
+
+		job->running = 1;
+		pthread_mutex_unlock(&queue->lock);
+
+		struct timespec begin, end;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		int status = proc_run(job->command, NULL, 0, queue->cfg.timeout * 1000, &queue->cancel);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		pthread_mutex_lock(&queue->lock);
+		job->running = 0;
+
+		if (status == PROC_CANCELLED)
+		{
+			// shutting down, the job stays in the journal for the next start
+			continue;
+		}
+
+		if (queue->cfg.on_run)
+		{
+			int final = status == PROC_OK || job->attempts + 1 >= queue->cfg.max_attempts;
+			queue->cfg.on_run(job->id, status, final, end.tv_sec - begin.tv_sec + (end.tv_nsec - begin.tv_nsec) / 1e9);
+		}
+
+		struct job **link;
+		if (status == PROC_OK)
+		{
+			journal_write(queue, 0, "D %lu\n", job->id);
+			job_find(queue, job->id, &link);
+			*link = job->next;
+			job_free(job);
+			continue;
+		}
+
+		job->attempts++;
+		if (job->attempts >= queue->cfg.max_attempts)
+		{
+			log_error(LOG_NO_CALL, "Aftermath job %lu failed %i times, giving up: %s", job->id, job->attempts, job->command);
+			journal_write(queue, 0, "F %lu\n", job->id);
+			job_find(queue, job->id, &link);
+			*link = job->next;
+			job_free(job);
+			continue;
+		}
+
+		int delay = backoff_delay(queue, job->attempts);
+		job->due = time(NULL) + delay;
+		log_warn(LOG_NO_CALL, "Aftermath job %lu %s, retry %i in %i s", job->id, status == PROC_TIMEOUT ? "timed out" : "failed", job->attempts, delay);
+		journal_write(queue, 0, "R %lu %i %li\n", job->id, job->attempts, (long)job->due);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return NULL;
+}
+
+struct jobqueue *jobqueue_open(const struct jobqueue_config *cfg)
+{
+	struct jobqueue *queue = calloc(1, sizeof(struct jobqueue));
+	if (queue == NULL) return NULL;
+
+	queue->cfg = *cfg;
+	if (queue->cfg.workers < 1) queue->cfg.workers = 1;
+	if (queue->cfg.max_attempts < 1) queue->cfg.max_attempts = 1;
+	if (queue->cfg.backoff_base < 1) queue->cfg.backoff_base = 1;
+	if (queue->cfg.backoff_max < queue->cfg.backoff_base) queue->cfg.backoff_max = queue->cfg.backoff_base;
+	queue->journal_path = strdup(cfg->journal);
+	queue->next_id = 1;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	pthread_cond_init(&queue->writer_cond, NULL);
+
+	// crash recovery: everything not marked done is run again
+	journal_replay(queue);
+	struct records records = { 0 };
+	int error = journal_snapshot(queue, &records) != 0 || journal_rewrite(queue, &records) != 0;
+	free(records.data);
+	if (error)
+	{
+		log_error(LOG_NO_CALL, "Error opening aftermath journal %s: %s", queue->journal_path, strerror(errno));
+		queue->thread_count = 0;
+		jobqueue_close(queue);
+		return NULL;
+	}
+	queue->synced_id = queue->next_id;
+
+	if (pthread_create(&queue->writer, NULL, journal_thread, queue) != 0)
+	{
+		jobqueue_close(queue);
+		return NULL;
+	}
+	queue->writer_started = 1;
+
+	int recovered = 0;
+	struct job *job;
+	for (job = queue->jobs; job; job = job->next) recovered++;
+	if (recovered) log_info(LOG_NO_CALL, "Recovered %i aftermath jobs", recovered);
+
+	queue->threads = calloc(queue->cfg.workers, sizeof(pthread_t));
+	for (queue->thread_count = 0; queue->threads && queue->thread_count < queue->cfg.workers; queue->thread_count++)
+	{
+		if (pthread_create(&queue->threads[queue->thread_count], NULL, jobqueue_thread, queue) != 0) break;
+	}
+	if (queue->thread_count == 0)
+	{
+		jobqueue_close(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+int jobqueue_add(struct jobqueue *queue, const char *command, unsigned long *id)
+{
+	struct job *job;
+
+	pthread_mutex_lock(&queue->lock);
+	job = job_new(queue->next_id, command);
+	if (job == NULL)
+	{
+		pthread_mutex_unlock(&queue->lock);
+		return 1;
+	}
+	queue->next_id++;
+
+	// one record per line
+	char *nl;
+	while ((nl = strchr(job->command, '\n')) != NULL) *nl = ' ';
+
+	// the writer syncs the record and then wakes a worker
+	journal_write(queue, 1, "A %lu %s\n", job->id, job->command);
+	if (id) *id = job->id;
+	job_append(queue, job);
+	pthread_mutex_unlock(&queue->lock);
+
+	return 0;
+}
+
+void jobqueue_set_retry(struct jobqueue *queue, int max_attempts, int backoff_base)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->cfg.max_attempts = max_attempts < 1 ? 1 : max_attempts;
+	queue->cfg.backoff_base = backoff_base < 1 ? 1 : backoff_base;
+	if (queue->cfg.backoff_max < queue->cfg.backoff_base) queue->cfg.backoff_max = queue->cfg.backoff_base;
+	pthread_mutex_unlock(&queue->lock);
+}
+
+int jobqueue_pending(struct jobqueue *queue)
+{
+	int count = 0;
+	struct job *job;
+
+	pthread_mutex_lock(&queue->lock);
+	for (job = queue->jobs; job; job = job->next) count++;
+	pthread_mutex_unlock(&queue->lock);
+
+	return count;
+}
+
+void jobqueue_close(struct jobqueue *queue)
+{
+	int i;
+
+	if (queue == NULL) return;
+
+	pthread_mutex_lock(&queue->lock);
+	queue->stopping = 1;
+	queue->cancel = 1;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	for (i = 0; i < queue->thread_count; i++)
+	{
+		pthread_join(queue->threads[i], NULL);
+	}
+
+	// the writer empties the queue of records before it ends
+	if (queue->writer_started)
+	{
+		pthread_mutex_lock(&queue->lock);
+		queue->writer_stopping = 1;
+		pthread_cond_signal(&queue->writer_cond);
+		pthread_mutex_unlock(&queue->lock);
+		pthread_join(queue->writer, NULL);
+	}
+
+	while (queue->jobs)
+	{
+		struct job *job = queue->jobs;
+		queue->jobs = job->next;
+		job_free(job);
+	}
+	if (queue->journal) fclose(queue->journal);
+
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->cond);
+	pthread_cond_destroy(&queue->writer_cond);
+	free(queue->pending.data);
+	free(queue->threads);
+	free(queue->journal_path);
+	free(queue);
+}
@@ -0,0 +1,56 @@
+/*
+=================================================================================
+ Name        : jobqueue.h
+ Version     : 0.1
+
+ Description :
+     Durable queue for aftermath commands. Jobs are kept in an append-only
+     journal, run by a fixed number of worker threads and retried with
+     exponential backoff. Unfinished jobs are picked up again after a restart.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+struct jobqueue;
+
+// settings of a job queue
+struct jobqueue_config {
+	const char *journal;  // path of the journal file
+	int workers;          // number of jobs running at the same time
+	int max_attempts;     // give up after this many failed runs
+	int backoff_base;     // seconds to wait after the first failure, doubled each time
+	int backoff_max;      // upper limit of the wait time in seconds
+	int timeout;          // seconds a single run may take
+
+	// called by the worker after each run with the queue locked (optional, keep
+	// it short): status is a PROC_* code, final is set if the job is done or given up
+	void (*on_run)(unsigned long id, int status, int final, double seconds);
+};
+
+// open the journal, recover unfinished jobs and start the workers; NULL on error
+struct jobqueue *jobqueue_open(const struct jobqueue_config *cfg);
+
+// queue a shell command without waiting for the disk; it runs once the
+// journal writer has synced it. Returns 0 on success;
+// the job id (as passed to on_run) is stored in *id before any worker sees the job, id may be NULL
+int jobqueue_add(struct jobqueue *queue, const char *command, unsigned long *id);
+
+// change the retry settings; they count for the next failure of every job,
+// jobs already waiting for a retry keep their time
+void jobqueue_set_retry(struct jobqueue *queue, int max_attempts, int backoff_base);
+
+// number of jobs not yet done (queued, running or waiting for a retry)
+int jobqueue_pending(struct jobqueue *queue);
+
+// stop the workers; running commands are killed and run again after the next start
+void jobqueue_close(struct jobqueue *queue);
+
+#endif
@@ -0,0 +1,352 @@
+/*
+=================================================================================
+ Name        : log.c
+ Version     : 0.1
+
+ Description :
+     Logging with severity levels and per-call context. Messages are put into
+     a lock-free ring buffer and written by a background thread to stderr or
+     to a file, which is rotated when it gets too big. Callbacks never wait
+     for the disk; if the ring is full, messages are dropped and counted.
+
+     The ring is a bounded multi-producer queue: each slot carries a sequence
+     number, producers claim slots with a compare-and-swap on the head, the
+     writer is the only consumer. It sleeps on an eventfd, which producers
+     only signal while it is sleeping.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "log.h"
+
+// slots of the ring, a power of two
+#define LOG_RING_SIZE 512
+
+// longer messages are cut
+#define LOG_LINE_MAX 240
+
+struct log_slot {
+	unsigned long sequence;  // position + 1 when filled, position + LOG_RING_SIZE when free
+	enum log_level level;
+	int call_id;
+	struct timespec time;
+	char text[LOG_LINE_MAX];
+};
+
+static const char *level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+static struct {
+	struct log_slot ring[LOG_RING_SIZE];
+	unsigned long head;      // next position to fill
+	unsigned long tail;      // next position to write, writer only
+	int level;
+	int running;
+	int sleeping;
+	unsigned long dropped;
+	int wake_fd;
+	pthread_t thread;
+
+	// output, writer only
+	FILE *file;
+	char *path;
+	long size;
+	long max_size;
+	int keep;
+} logs = { .level = LOG_INFO, .wake_fd = -1 };
+
+// format a line like "2024-01-01 12:00:00.123 INFO  [call 2] text"
+static int format_line(char *line, size_t size, const struct timespec *time, enum log_level level, int call_id, const char *text)
+{
+	struct tm tm;
+	char stamp[32];
+
+	localtime_r(&time->tv_sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+	if (call_id == LOG_NO_CALL)
+	{
+		return snprintf(line, size, "%s.%03li %-5s %s\n", stamp, time->tv_nsec / 1000000, level_names[level], text);
+	}
+	return snprintf(line, size, "%s.%03li %-5s [call %i] %s\n", stamp, time->tv_nsec / 1000000, level_names[level], call_id, text);
+}
+
+// move file to file.1, file.1 to file.2 and so on, then start a new file
+static void rotate(void)
+{
+	size_t len = strlen(logs.path) + 16;
+	char from[len], to[len];
+	int i;
+
+	fclose(logs.file);
+	for (i = logs.keep; i > 0; i--)
+	{
+		if (i > 1) snprintf(from, len, "%s.%i", logs.path, i - 1);
+		else snprintf(from, len, "%s", logs.path);
+		snprintf(to, len, "%s.%i", logs.path, i);
+		rename(from, to);
+	}
+	if (logs.keep == 0) unlink(logs.path);
+
+	logs.file = fopen(logs.path, "a");
+	logs.size = 0;
+}
+
+// write a line to the output (writer thread)
+static void output(const char *line, int len)
+{
+	FILE *out = logs.file ? logs.file : stderr;
+
+	fwrite(line, 1, len, out);
+	if (logs.file == NULL) return;
+
+	logs.size += len;
+	if (logs.max_size > 0 && logs.size >= logs.max_size) rotate();
+}
+
+// write all queued messages; returns the number written
+static int drain(void)
+{
+	char line[LOG_LINE_MAX + 64];
+	int count = 0;
+
+	for (;;)
+	{
+		struct log_slot *slot = &logs.ring[logs.tail & (LOG_RING_SIZE - 1)];
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != logs.tail + 1) break;
+
+		int len = format_line(line, sizeof(line), &slot->time, slot->level, slot->call_id, slot->text);
+		__atomic_store_n(&slot->sequence, logs.tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+		logs.tail++;
+
+		if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+		output(line, len);
+		count++;
+	}
+
+	unsigned long dropped = __atomic_exchange_n(&logs.dropped, 0, __ATOMIC_RELAXED);
+	if (dropped > 0)
+	{
+		struct timespec now;
+		char text[64];
+		clock_gettime(CLOCK_REALTIME, &now);
+		snprintf(text, sizeof(text), "%lu log messages dropped, ring buffer full", dropped);
+		int len = format_line(line, sizeof(line), &now, LOG_WARN, LOG_NO_CALL, text);
+		output(line, len);
+	}
+
+	if (count > 0)
+	{
+		if (logs.file) fflush(logs.file);
+		else fflush(stderr);
+	}
+	return count;
+}
+
+// check if the next slot is filled (writer thread)
+static int pending(void)
+{
+	struct log_slot *slot = &logs.ring[logs.tail & (LOG_RING_SIZE - 1)];
+	return __atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) == logs.tail + 1;
+}
+
+static void *log_thread(void *arg)
+{
+	(void)arg;
+
+	for (;;)
+	{
+		if (drain() > 0) continue;
+		if (!__atomic_load_n(&logs.running, __ATOMIC_SEQ_CST)) break;
+
+		// announce the sleep, then look once more: a producer either sees
+		// the flag or its message is seen here
+		__atomic_store_n(&logs.sleeping, 1, __ATOMIC_SEQ_CST);
+		if (!pending() && __atomic_load_n(&logs.running, __ATOMIC_SEQ_CST))
+		{
+			struct pollfd pfd = { logs.wake_fd, POLLIN, 0 };
+			poll(&pfd, 1, 1000);
+		}
+		__atomic_store_n(&logs.sleeping, 0, __ATOMIC_SEQ_CST);
+
+		uint64_t value;
+		while (read(logs.wake_fd, &value, sizeof(value)) == sizeof(value));
+	}
+
+	drain();
+	return NULL;
+}
+
+int log_open(const struct log_config *cfg)
+{
+	unsigned long i;
+
+	logs.level = cfg->level;
+	logs.max_size = cfg->max_size;
+	logs.keep = cfg->keep;
+	if (cfg->file && cfg->file[0])
+	{
+		logs.path = strdup(cfg->file);
+		logs.file = fopen(cfg->file, "a");
+		if (logs.path == NULL || logs.file == NULL)
+		{
+			fprintf(stderr, "Error opening log file %s: %s\n", cfg->file, strerror(errno));
+			free(logs.path);
+			logs.path = NULL;
+			return 1;
+		}
+		fseek(logs.file, 0, SEEK_END);
+		logs.size = ftell(logs.file);
+	}
+
+	for (i = 0; i < LOG_RING_SIZE; i++) logs.ring[i].sequence = i;
+	logs.head = 0;
+	logs.tail = 0;
+
+	// kept open after log_close, a late producer may still signal it
+	if (logs.wake_fd < 0) logs.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (logs.wake_fd < 0) return 1;
+
+	__atomic_store_n(&logs.running, 1, __ATOMIC_SEQ_CST);
+	if (pthread_create(&logs.thread, NULL, &log_thread, NULL) != 0)
+	{
+		__atomic_store_n(&logs.running, 0, __ATOMIC_SEQ_CST);
+		return 1;
+	}
+	return 0;
+}
+
+void log_set_level(enum log_level level)
+{
+	__atomic_store_n(&logs.level, level, __ATOMIC_RELAXED);
+}
+
+int log_parse_level(const char *name)
+{
+	int i;
+
+	for (i = 0; i <= LOG_DEBUG; i++)
+	{
+		if (!strcasecmp(name, level_names[i])) return i;
+	}
+	if (name[0] >= '0' && name[0] <= '0' + LOG_DEBUG && name[1] == '\0') return name[0] - '0';
+	return -1;
+}
+
+void log_write(enum log_level level, int call_id, const char *format, ...)
+{
+	va_list args;
+
+	if ((int)level > __atomic_load_n(&logs.level, __ATOMIC_RELAXED)) return;
+
+	// no writer (yet or any more): straight to stderr
+	if (!__atomic_load_n(&logs.running, __ATOMIC_ACQUIRE))
+	{
+		struct timespec now;
+		char text[LOG_LINE_MAX], line[LOG_LINE_MAX + 64];
+		clock_gettime(CLOCK_REALTIME, &now);
+		va_start(args, format);
+		vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		int len = format_line(line, sizeof(line), &now, level, call_id, text);
+		if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+		fwrite(line, 1, len, stderr);
+		return;
+	}
+
+	// claim a slot
+	struct log_slot *slot;
+	unsigned long pos = __atomic_load_n(&logs.head, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		slot = &logs.ring[pos & (LOG_RING_SIZE - 1)];
+		long diff = (long)__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - (long)pos;
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&logs.head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}
+		else if (diff < 0)
+		{
+			// full, the writer is behind
+			__atomic_add_fetch(&logs.dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else
+		{
+			pos = __atomic_load_n(&logs.head, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->level = level;
+	slot->call_id = call_id;
+	clock_gettime(CLOCK_REALTIME, &slot->time);
+	va_start(args, format);
+	vsnprintf(slot->text, sizeof(slot->text), format, args);
+	va_end(args);
+
+	// the newline is added by the writer
+	size_t len = strlen(slot->text);
+	if (len > 0 && slot->text[len - 1] == '\n') slot->text[len - 1] = '\0';
+
+	__atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&logs.sleeping, __ATOMIC_SEQ_CST))
+	{
+		uint64_t one = 1;
+		if (write(logs.wake_fd, &one, sizeof(one)) < 0) { /* the writer is awake anyway */ }
+	}
+}
+
+int log_limit_pass(struct log_limit *limit, int *suppressed)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+	*suppressed = 0;
+
+	// the first caller of a new second resets the window
+	long second = __atomic_load_n(&limit->second, __ATOMIC_RELAXED);
+	if (second != now.tv_sec
+			&& __atomic_compare_exchange_n(&limit->second, &second, now.tv_sec, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n(&limit->count, 0, __ATOMIC_RELAXED);
+		*suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_fetch_add(&limit->count, 1, __ATOMIC_RELAXED) < LOG_LIMIT_BURST) return 1;
+
+	__atomic_add_fetch(&limit->suppressed, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void log_close(void)
+{
+	if (!__atomic_load_n(&logs.running, __ATOMIC_SEQ_CST)) return;
+
+	__atomic_store_n(&logs.running, 0, __ATOMIC_SEQ_CST);
+	uint64_t one = 1;
+	if (write(logs.wake_fd, &one, sizeof(one)) < 0) { /* it wakes up within a second anyway */ }
+	pthread_join(logs.thread, NULL);
+
+	if (logs.file) fclose(logs.file);
+	logs.file = NULL;
+	free(logs.path);
+	logs.path = NULL;
+}
@@ -0,0 +1,85 @@
+/*
+=================================================================================
+ Name        : log.h
+ Version     : 0.1
+
+ Description :
+     Logging with severity levels and per-call context. Messages are put into
+     a lock-free ring buffer and written by a background thread to stderr or
+     to a file, which is rotated when it gets too big. Callbacks never wait
+     for the disk; if the ring is full, messages are dropped and counted.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef LOG_H
+#define LOG_H
+
+enum log_level {
+	LOG_ERROR,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG
+};
+
+// call_id of messages not about a call
+#define LOG_NO_CALL (-1)
+
+// messages per second and call site passed by log_limited
+#define LOG_LIMIT_BURST 5
+
+struct log_config {
+	const char *file;      // NULL = stderr
+	enum log_level level;  // messages above are skipped
+	long max_size;         // bytes before the file is rotated, 0 = never
+	int keep;              // rotated files kept as file.1 .. file.keep
+};
+
+// start the writer; until then messages are written to stderr right away
+int log_open(const struct log_config *cfg);
+
+// change the level of a running log
+void log_set_level(enum log_level level);
+
+// parse error, warn, info or debug (or 0..3); returns -1 if unknown
+int log_parse_level(const char *name);
+
+// queue a message, call_id is LOG_NO_CALL or the pjsua call id
+void log_write(enum log_level level, int call_id, const char *format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+#define log_error(call_id, ...) log_write(LOG_ERROR, call_id, __VA_ARGS__)
+#define log_warn(call_id, ...) log_write(LOG_WARN, call_id, __VA_ARGS__)
+#define log_info(call_id, ...) log_write(LOG_INFO, call_id, __VA_ARGS__)
+#define log_debug(call_id, ...) log_write(LOG_DEBUG, call_id, __VA_ARGS__)
+
+// rate limit of one call site
+struct log_limit {
+	long second;
+	int count;
+	int suppressed;
+};
+
+// check the limit; *suppressed is set to the messages dropped in the last second passed
+int log_limit_pass(struct log_limit *limit, int *suppressed);
+
+// log_write for messages which may come in floods, e.g. one per incoming call
+#define log_limited(level, call_id, ...) do { \
+		static struct log_limit log_limit_; \
+		int log_suppressed_; \
+		if (log_limit_pass(&log_limit_, &log_suppressed_)) \
+		{ \
+			if (log_suppressed_) log_write(level, call_id, "(%i similar messages suppressed)", log_suppressed_); \
+			log_write(level, call_id, __VA_ARGS__); \
+		} \
+	} while (0)
+
+// write what is queued and stop the writer
+void log_close(void);
+
+#endif
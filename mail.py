@@ -100,14 +100,8 @@ def send_mail(args):
         s.sendmail(send_from, send_to, msg.as_string())
     print('OK: email sent')
 
-# FIXME: handle such errors. What to do then?
-# Traceback (most recent call last):
-#   File "./mail.py", line 102, in <module>
-#     send_mail(args)
-#   File "./mail.py", line 91, in send_mail
-#     s.sendmail(send_from, send_to, msg.as_string())
-#   File "/usr/lib/python3.7/smtplib.py", line 888, in sendmail
-#     raise SMTPDataError(code, resp)
+# Errors like the following end the script with a non-zero exit code.
+# sipserv keeps the job in its aftermath queue and tries again later (see ar= and ab=).
 # smtplib.SMTPDataError: (554, b'5.7.0 Your message could not be sent. The limit on the number of allowed outgoing messages was exceeded. Try again later.')
 
 
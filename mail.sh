@@ -3,8 +3,15 @@ echo "compress-then-send script"
 number="$1"
 callerid="$2"
 filename="$3"
-lame "$filename"
 
-filename="${filename%.*}"
+# recordings made with rf=mp3 are already compressed
+case "$filename" in
+*.mp3)
+	;;
+*)
+	lame "$filename" || exit 1
+	filename="${filename%.*}.mp3"
+	;;
+esac
 
-./mail.py "$number" "$callerid" "$filename.mp3"
+exec ./mail.py "$number" "$callerid" "$filename"
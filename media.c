@@ -0,0 +1,99 @@
+/*
+=================================================================================
+ Name        : media.c
+ Version     : 0.1
+
+ Description :
+     Media profiles of the pjsua based tools: narrowband (8 kHz bridge, the
+     codec order of pjsua) or wideband (16 kHz bridge, G.722 and Opus before
+     G.711), codec priority lists and the packet time.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "log.h"
+#include "media.h"
+
+unsigned media_clock_rate(int wideband)
+{
+	return wideband ? MEDIA_WIDEBAND_RATE : MEDIA_NARROWBAND_RATE;
+}
+
+void media_configure(pjsua_media_config *cfg, int wideband, int ptime)
+{
+	cfg->clock_rate = media_clock_rate(wideband);
+	cfg->snd_clock_rate = cfg->clock_rate;
+	if (ptime > 0) cfg->ptime = ptime;
+}
+
+// codec ids look like "G722/16000/1", a name matches up to the first '/'
+static int codec_matches(const pj_str_t *id, const char *name)
+{
+	size_t len = strlen(name);
+
+	if ((size_t)id->slen < len || strncasecmp(id->ptr, name, len) != 0) return 0;
+	return (size_t)id->slen == len || id->ptr[len] == '/';
+}
+
+int media_set_codecs(const char *list, int wideband)
+{
+	pjsua_codec_info codecs[PJMEDIA_CODEC_MGR_MAX_CODECS];
+	pj_uint8_t priority[PJMEDIA_CODEC_MGR_MAX_CODECS];
+	unsigned count = PJ_ARRAY_SIZE(codecs), i;
+	int next = PJMEDIA_CODEC_PRIO_HIGHEST;
+	char order[256] = "";
+	char *copy, *name, *save;
+	int given = list != NULL;
+
+	if (list == NULL && wideband) list = MEDIA_WIDEBAND_CODECS;
+	if (list == NULL) return 0;
+
+	if (pjsua_enum_codecs(codecs, &count) != PJ_SUCCESS) return 1;
+	memset(priority, PJMEDIA_CODEC_PRIO_DISABLED, sizeof(priority));
+
+	copy = strdup(list);
+	if (copy == NULL) return 1;
+	for (name = strtok_r(copy, ", ", &save); name; name = strtok_r(NULL, ", ", &save))
+	{
+		int found = 0;
+
+		for (i = 0; i < count; i++)
+		{
+			if (priority[i] != PJMEDIA_CODEC_PRIO_DISABLED || !codec_matches(&codecs[i].codec_id, name)) continue;
+			priority[i] = next;
+			found = 1;
+
+			size_t len = strlen(order);
+			snprintf(order + len, sizeof(order) - len, "%s%.*s", len ? ", " : "",
+				(int)codecs[i].codec_id.slen, codecs[i].codec_id.ptr);
+		}
+		if (found && next > PJMEDIA_CODEC_PRIO_LOWEST) next--;
+		// the profile list names codecs a build may lack
+		if (!found && given) log_warn(LOG_NO_CALL, "Codec %s is not available", name);
+	}
+	free(copy);
+
+	// a list of typos must not leave the calls without any codec
+	if (next == PJMEDIA_CODEC_PRIO_HIGHEST)
+	{
+		log_error(LOG_NO_CALL, "None of the codecs %s is available, keeping pjsua's order", list);
+		return 1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		pjsua_codec_set_priority(&codecs[i].codec_id, priority[i]);
+	}
+	log_info(LOG_NO_CALL, "Codecs: %s", order);
+	return 0;
+}
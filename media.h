@@ -0,0 +1,46 @@
+/*
+=================================================================================
+ Name        : media.h
+ Version     : 0.1
+
+ Description :
+     Media profiles of the pjsua based tools: narrowband (8 kHz bridge, the
+     codec order of pjsua) or wideband (16 kHz bridge, G.722 and Opus before
+     G.711), codec priority lists and the packet time.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef MEDIA_H
+#define MEDIA_H
+
+// definition of endianess (e.g. needed on raspberry pi)
+#define PJ_IS_LITTLE_ENDIAN 1
+#define PJ_IS_BIG_ENDIAN 0
+
+#include <pjsua-lib/pjsua.h>
+
+#define MEDIA_NARROWBAND_RATE 8000
+#define MEDIA_WIDEBAND_RATE 16000
+
+// codec order of the wideband profile, G.711 as the fallback
+#define MEDIA_WIDEBAND_CODECS "G722,opus,PCMA,PCMU"
+
+// clock rate of the conference bridge; prompts and recordings use it too
+unsigned media_clock_rate(int wideband);
+
+// set bridge rate and packet time (ms, 0 = codec default) before pjsua_init
+void media_configure(pjsua_media_config *cfg, int wideband, int ptime);
+
+// set the codec priorities after pjsua_init: list is a comma separated list
+// of codec names (e.g. "G722,PCMA"), the first is preferred; codecs not in
+// the list are disabled. NULL = the list of the profile (narrowband: keep
+// pjsua's order). Returns 0 if at least one codec of the list is available.
+int media_set_codecs(const char *list, int wideband);
+
+#endif
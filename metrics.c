@@ -0,0 +1,306 @@
+/*
+=================================================================================
+ Name        : metrics.c
+ Version     : 0.1
+
+ Description :
+     Counters, gauges and histograms in the Prometheus text format, served
+     over HTTP on localhost (GET /metrics).
+
+     The registry is a fixed array guarded by one mutex, updates happen a few
+     times per call at most. The server answers one request per connection.
+
+ References  :
+ https://prometheus.io/docs/instrumenting/exposition_formats/
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "log.h"
+#include "metrics.h"
+
+#define METRICS_MAX 64
+#define METRICS_BUCKETS_MAX 16
+
+// a client has this long to send its request
+#define METRICS_READ_TIMEOUT 2
+
+enum metric_type {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM
+};
+
+struct metric {
+	enum metric_type type;
+	const char *name;
+	const char *help;
+	double value;   // counter and gauge; sum of a histogram
+	double bounds[METRICS_BUCKETS_MAX];
+	unsigned long buckets[METRICS_BUCKETS_MAX];
+	int bucket_count;
+	unsigned long count;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct metric metrics[METRICS_MAX];
+	int count;
+	metrics_collector collector;
+	int fd;
+	pthread_t thread;
+	int running;
+} reg = { PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+static const char *type_names[] = { "counter", "gauge", "histogram" };
+
+static struct metric *metric_new(enum metric_type type, const char *name, const char *help)
+{
+	struct metric *metric = NULL;
+
+	pthread_mutex_lock(&reg.lock);
+	if (reg.count < METRICS_MAX)
+	{
+		metric = &reg.metrics[reg.count++];
+		metric->type = type;
+		metric->name = name;
+		metric->help = help;
+	}
+	pthread_mutex_unlock(&reg.lock);
+
+	return metric;
+}
+
+struct metric *metrics_counter(const char *name, const char *help)
+{
+	return metric_new(METRIC_COUNTER, name, help);
+}
+
+struct metric *metrics_gauge(const char *name, const char *help)
+{
+	return metric_new(METRIC_GAUGE, name, help);
+}
+
+struct metric *metrics_histogram(const char *name, const char *help, const double *bounds, int count)
+{
+	struct metric *metric = metric_new(METRIC_HISTOGRAM, name, help);
+	if (metric == NULL) return NULL;
+
+	if (count > METRICS_BUCKETS_MAX) count = METRICS_BUCKETS_MAX;
+	memcpy(metric->bounds, bounds, count * sizeof(double));
+	metric->bucket_count = count;
+	return metric;
+}
+
+void metrics_add(struct metric *metric, double value)
+{
+	if (metric == NULL) return;
+	pthread_mutex_lock(&reg.lock);
+	metric->value += value;
+	pthread_mutex_unlock(&reg.lock);
+}
+
+void metrics_set(struct metric *metric, double value)
+{
+	if (metric == NULL) return;
+	pthread_mutex_lock(&reg.lock);
+	metric->value = value;
+	pthread_mutex_unlock(&reg.lock);
+}
+
+void metrics_observe(struct metric *metric, double value)
+{
+	int i;
+
+	if (metric == NULL) return;
+	pthread_mutex_lock(&reg.lock);
+	for (i = 0; i < metric->bucket_count; i++)
+	{
+		if (value <= metric->bounds[i]) metric->buckets[i]++;
+	}
+	metric->value += value;
+	metric->count++;
+	pthread_mutex_unlock(&reg.lock);
+}
+
+void metrics_set_collector(metrics_collector collector)
+{
+	reg.collector = collector;
+}
+
+void metrics_write_family(FILE *out, const char *name, const char *type, const char *help)
+{
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// length of the family name, without labels
+static int family_len(const char *name)
+{
+	return strcspn(name, "{");
+}
+
+void metrics_write(FILE *out)
+{
+	int i, j;
+	const char *family = NULL;
+
+	pthread_mutex_lock(&reg.lock);
+	for (i = 0; i < reg.count; i++)
+	{
+		struct metric *metric = &reg.metrics[i];
+		int len = family_len(metric->name);
+
+		if (family == NULL || family_len(family) != len || strncmp(family, metric->name, len) != 0)
+		{
+			fprintf(out, "# HELP %.*s %s\n# TYPE %.*s %s\n", len, metric->name, metric->help,
+				len, metric->name, type_names[metric->type]);
+			family = metric->name;
+		}
+
+		if (metric->type != METRIC_HISTOGRAM)
+		{
+			fprintf(out, "%s %.10g\n", metric->name, metric->value);
+			continue;
+		}
+
+		for (j = 0; j < metric->bucket_count; j++)
+		{
+			fprintf(out, "%.*s_bucket{le=\"%g\"} %lu\n", len, metric->name, metric->bounds[j], metric->buckets[j]);
+		}
+		fprintf(out, "%.*s_bucket{le=\"+Inf\"} %lu\n", len, metric->name, metric->count);
+		fprintf(out, "%.*s_sum %.10g\n", len, metric->name, metric->value);
+		fprintf(out, "%.*s_count %lu\n", len, metric->name, metric->count);
+	}
+	pthread_mutex_unlock(&reg.lock);
+
+	if (reg.collector) reg.collector(out);
+}
+
+// write all of buf, returns 0 on success
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return 1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void serve_client(int client)
+{
+	char request[1024];
+	size_t len = 0;
+	struct timeval timeout = { METRICS_READ_TIMEOUT, 0 };
+
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	// the request line is all we need
+	while (len < sizeof(request) - 1 && memchr(request, '\n', len) == NULL)
+	{
+		ssize_t n = read(client, request + len, sizeof(request) - 1 - len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return;
+		len += n;
+	}
+	request[len] = '\0';
+
+	char *body = NULL;
+	size_t body_len = 0;
+	const char *status = "404 Not Found";
+	if (!strncmp(request, "GET /metrics ", 13) || !strncmp(request, "GET /metrics?", 13))
+	{
+		FILE *out = open_memstream(&body, &body_len);
+		if (out == NULL) return;
+		metrics_write(out);
+		fclose(out);
+		status = "200 OK";
+	}
+
+	char header[200];
+	int header_len = snprintf(header, sizeof(header),
+		"HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		status, body_len);
+	if (write_all(client, header, header_len) == 0 && body_len > 0) write_all(client, body, body_len);
+	free(body);
+}
+
+static void *metrics_thread(void *data)
+{
+	(void)data;
+
+	for (;;)
+	{
+		int client = accept(reg.fd, NULL, NULL);
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break; // socket shut down
+		}
+		serve_client(client);
+		close(client);
+	}
+
+	return NULL;
+}
+
+int metrics_serve(int port)
+{
+	struct sockaddr_in addr;
+	int on = 1;
+
+	reg.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (reg.fd < 0) return 1;
+	setsockopt(reg.fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	// local only, there is no authentication
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(reg.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(reg.fd, 8) != 0
+			|| pthread_create(&reg.thread, NULL, &metrics_thread, NULL) != 0)
+	{
+		log_error(LOG_NO_CALL, "Error serving metrics on port %i: %s", port, strerror(errno));
+		close(reg.fd);
+		reg.fd = -1;
+		return 1;
+	}
+	reg.running = 1;
+
+	return 0;
+}
+
+void metrics_close(void)
+{
+	if (reg.fd < 0) return;
+
+	// wakes up accept
+	shutdown(reg.fd, SHUT_RDWR);
+	if (reg.running) pthread_join(reg.thread, NULL);
+	reg.running = 0;
+
+	close(reg.fd);
+	reg.fd = -1;
+}
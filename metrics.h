@@ -0,0 +1,54 @@
+/*
+=================================================================================
+ Name        : metrics.h
+ Version     : 0.1
+
+ Description :
+     Counters, gauges and histograms in the Prometheus text format, served
+     over HTTP on localhost (GET /metrics).
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+struct metric;
+
+// register a metric; name may carry labels (name{label="value"}), metrics
+// of the same family must be registered one after the other. Returns NULL
+// if the registry is full, updates of NULL are ignored.
+struct metric *metrics_counter(const char *name, const char *help);
+struct metric *metrics_gauge(const char *name, const char *help);
+struct metric *metrics_histogram(const char *name, const char *help, const double *bounds, int count);
+
+// counters and gauges
+void metrics_add(struct metric *metric, double value);
+void metrics_set(struct metric *metric, double value);
+
+// histograms
+void metrics_observe(struct metric *metric, double value);
+
+// extra metrics computed at scrape time; runs on the server thread
+typedef void (*metrics_collector)(FILE *out);
+void metrics_set_collector(metrics_collector collector);
+
+// write the HELP and TYPE lines of a family, for collectors
+void metrics_write_family(FILE *out, const char *name, const char *type, const char *help);
+
+// write all metrics
+void metrics_write(FILE *out);
+
+// serve the metrics on 127.0.0.1:port; returns 0 on success
+int metrics_serve(int port);
+
+void metrics_close(void);
+
+#endif
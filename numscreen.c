@@ -0,0 +1,444 @@
+/*
+=================================================================================
+ Name        : numscreen.c
+ Version     : 0.1
+
+ Description :
+     Native call screening for sipserv. Replaces the popen of numcheck.py by a
+     prefix trie built from numbers.txt, which is reloaded when the file changes.
+
+     Each sipserv account may have its own numbers file, so the rules are
+     kept in instances, one per file.
+
+     Every instance has a watcher thread, which rebuilds the trie when the
+     file changes and appends the call log lines, so a check never waits for
+     the disk.
+
+     File format (same as numcheck.py):
+     - one number per line, everything after the first blank or '#' is a comment
+     - lines starting with '#' and empty lines are skipped
+     - a number matches, if it starts with one of the listed numbers
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "log.h"
+#include "numscreen.h"
+
+// digits plus the dial characters '*', '#' and '+'
+#define TRIE_FANOUT 16
+
+// seconds between two looks at the numbers file
+#define RELOAD_CHECK_INTERVAL 1
+
+// trie node, children are indexes into the node array (0 = none, root is 0)
+struct trie_node {
+	int child[TRIE_FANOUT];
+	int terminal;
+};
+
+// immutable rule set, replaced as a whole on reload
+struct rule_set {
+	struct trie_node *nodes;
+	int node_count;
+	int node_size;
+	int prefix_count;
+	int refcount;
+};
+
+// call log line waiting for the watcher
+struct call_line {
+	struct call_line *next;
+	char text[];
+};
+
+// state of a screening instance
+struct numscreen {
+	pthread_mutex_t lock;  // guards the rules, the file state and the lines
+	pthread_cond_t cond;
+	struct rule_set *rules;
+	char *numbers_file;
+	char *log_file;
+	struct timespec file_mtime;
+	off_t file_size;
+	ino_t file_ino;
+	struct call_line *lines;
+	struct call_line **lines_tail;
+	int reload;            // read the file at the next wakeup
+	int stopping;
+	int watcher_started;
+	pthread_t watcher;
+};
+
+// map a dial character to a trie slot (-1 = not dialable)
+static int trie_slot(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c == '*') return 10;
+	if (c == '#') return 11;
+	if (c == '+') return 12;
+	return -1;
+}
+
+// append an empty node, returns its index or -1
+static int trie_new_node(struct rule_set *set)
+{
+	if (set->node_count == set->node_size)
+	{
+		int size = set->node_size ? set->node_size * 2 : 256;
+		struct trie_node *nodes = realloc(set->nodes, size * sizeof(struct trie_node));
+		if (nodes == NULL) return -1;
+		set->nodes = nodes;
+		set->node_size = size;
+	}
+	memset(&set->nodes[set->node_count], 0, sizeof(struct trie_node));
+	return set->node_count++;
+}
+
+// insert a prefix, returns 0 on success
+static int trie_insert(struct rule_set *set, const char *prefix)
+{
+	const char *p;
+	int node = 0;
+
+	// check the whole prefix first, so nothing is inserted half
+	for (p = prefix; *p; p++)
+	{
+		if (trie_slot(*p) < 0) return 1;
+	}
+
+	for (p = prefix; *p; p++)
+	{
+		int slot = trie_slot(*p);
+		if (set->nodes[node].child[slot] == 0)
+		{
+			int next = trie_new_node(set);
+			if (next < 0) return 1;
+			set->nodes[node].child[slot] = next;
+		}
+		node = set->nodes[node].child[slot];
+	}
+
+	if (!set->nodes[node].terminal)
+	{
+		set->nodes[node].terminal = 1;
+		set->prefix_count++;
+	}
+	return 0;
+}
+
+static void rule_set_free(struct rule_set *set)
+{
+	if (set == NULL) return;
+	free(set->nodes);
+	free(set);
+}
+
+// build a new rule set from file, returns NULL if the file can't be read
+static struct rule_set *rule_set_load(const char *file_name)
+{
+	FILE *file = fopen(file_name, "r");
+	if (file == NULL) return NULL;
+
+	struct rule_set *set = calloc(1, sizeof(struct rule_set));
+	if (set == NULL || trie_new_node(set) < 0)
+	{
+		rule_set_free(set);
+		fclose(file);
+		return NULL;
+	}
+	set->refcount = 1;
+
+	char *line = NULL;
+	size_t line_size = 0;
+	while (getline(&line, &line_size, file) != -1)
+	{
+		// skip commented and empty lines
+		if (line[0] == '#' || line[0] == '\n') continue;
+
+		// the number ends at the first blank or comment
+		line[strcspn(line, " \t\r\n#")] = '\0';
+		if (line[0] == '\0') continue;
+
+		if (trie_insert(set, line) != 0)
+		{
+			log_warn(LOG_NO_CALL, "Ignoring screening entry '%s'", line);
+		}
+	}
+
+	free(line);
+	fclose(file);
+	return set;
+}
+
+// drop a reference to a rule set
+static void rule_set_release(struct numscreen *screen, struct rule_set *set)
+{
+	int last;
+
+	if (set == NULL) return;
+
+	pthread_mutex_lock(&screen->lock);
+	last = (--set->refcount == 0);
+	pthread_mutex_unlock(&screen->lock);
+
+	if (last) rule_set_free(set);
+}
+
+// reload the numbers file if it has been changed since the last load
+// (only called by the watcher, or before it is started)
+static void reload_if_changed(struct numscreen *screen)
+{
+	struct stat st;
+
+	pthread_mutex_lock(&screen->lock);
+	if (stat(screen->numbers_file, &st) != 0
+			|| (st.st_mtim.tv_sec == screen->file_mtime.tv_sec
+				&& st.st_mtim.tv_nsec == screen->file_mtime.tv_nsec
+				&& st.st_size == screen->file_size
+				&& st.st_ino == screen->file_ino))
+	{
+		pthread_mutex_unlock(&screen->lock);
+		return;
+	}
+	pthread_mutex_unlock(&screen->lock);
+
+	// build the new trie without holding the lock, lookups go on meanwhile
+	struct rule_set *set = rule_set_load(screen->numbers_file);
+
+	pthread_mutex_lock(&screen->lock);
+	struct rule_set *old = NULL;
+	if (set != NULL)
+	{
+		old = screen->rules;
+		screen->rules = set;
+		screen->file_mtime = st.st_mtim;
+		screen->file_size = st.st_size;
+		screen->file_ino = st.st_ino;
+	}
+	pthread_mutex_unlock(&screen->lock);
+
+	if (set != NULL)
+	{
+		log_info(LOG_NO_CALL, "Screening rules reloaded: %i numbers", set->prefix_count);
+		rule_set_release(screen, old);
+	}
+}
+
+// queue a line for the call log, like numcheck.py writes it
+static void log_call(struct numscreen *screen, const char *number, const char *match)
+{
+	if (screen->log_file == NULL) return;
+
+	size_t size = strlen(number) + (match ? strlen(match) : 0) + 64;
+	struct call_line *line = malloc(sizeof(struct call_line) + size);
+	if (line == NULL) return;
+	line->next = NULL;
+
+	char timestamp[32];
+	time_t now = time(NULL);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", gmtime(&now));
+
+	if (match != NULL)
+	{
+		snprintf(line->text, size, "# %s %s found as %s\n", timestamp, number, match);
+	}
+	else
+	{
+		snprintf(line->text, size, "# %s %s not found.\n", timestamp, number);
+	}
+
+	pthread_mutex_lock(&screen->lock);
+	*screen->lines_tail = line;
+	screen->lines_tail = &line->next;
+	pthread_cond_signal(&screen->cond);
+	pthread_mutex_unlock(&screen->lock);
+}
+
+// append queued lines to the call log
+static void write_calls(struct numscreen *screen, struct call_line *lines)
+{
+	FILE *file = lines ? fopen(screen->log_file, "a") : NULL;
+
+	while (lines)
+	{
+		struct call_line *line = lines;
+		lines = line->next;
+		if (file) fputs(line->text, file);
+		free(line);
+	}
+	if (file) fclose(file);
+}
+
+// watcher thread: write the call log and reload the rules when the file changes
+static void *numscreen_watch(void *arg)
+{
+	struct numscreen *screen = arg;
+	time_t next_check = time(NULL) + RELOAD_CHECK_INTERVAL;
+
+	pthread_mutex_lock(&screen->lock);
+	for (;;)
+	{
+		if (screen->lines == NULL && !screen->reload && !screen->stopping && time(NULL) < next_check)
+		{
+			struct timespec until = { next_check, 0 };
+			pthread_cond_timedwait(&screen->cond, &screen->lock, &until);
+			continue;
+		}
+		if (screen->lines == NULL && screen->stopping) break;
+
+		struct call_line *lines = screen->lines;
+		screen->lines = NULL;
+		screen->lines_tail = &screen->lines;
+		int reload = screen->reload;
+		screen->reload = 0;
+		pthread_mutex_unlock(&screen->lock);
+
+		write_calls(screen, lines);
+		if (reload || time(NULL) >= next_check)
+		{
+			reload_if_changed(screen);
+			next_check = time(NULL) + RELOAD_CHECK_INTERVAL;
+		}
+
+		pthread_mutex_lock(&screen->lock);
+	}
+	pthread_mutex_unlock(&screen->lock);
+
+	return NULL;
+}
+
+struct numscreen *numscreen_open(const char *numbers_file, const char *log_file)
+{
+	struct numscreen *screen = calloc(1, sizeof(struct numscreen));
+	if (screen == NULL) return NULL;
+
+	pthread_mutex_init(&screen->lock, NULL);
+	pthread_cond_init(&screen->cond, NULL);
+	screen->lines_tail = &screen->lines;
+	screen->numbers_file = strdup(numbers_file);
+	screen->log_file = log_file ? strdup(log_file) : NULL;
+	if (screen->numbers_file == NULL || (log_file && screen->log_file == NULL))
+	{
+		numscreen_close(screen);
+		return NULL;
+	}
+
+	// initial load; a missing file gives an empty rule set until it shows up
+	reload_if_changed(screen);
+	if (screen->rules == NULL)
+	{
+		log_warn(LOG_NO_CALL, "Numbers file %s not readable, no calls will match", numbers_file);
+	}
+
+	if (pthread_create(&screen->watcher, NULL, numscreen_watch, screen) != 0)
+	{
+		numscreen_close(screen);
+		return NULL;
+	}
+	screen->watcher_started = 1;
+	return screen;
+}
+
+int numscreen_check(struct numscreen *screen, const char *number, char *match, size_t match_len)
+{
+	// take a reference, so a concurrent reload can't free the rules under us
+	pthread_mutex_lock(&screen->lock);
+	struct rule_set *set = screen->rules;
+	if (set != NULL) set->refcount++;
+	pthread_mutex_unlock(&screen->lock);
+
+	int depth = -1;
+	if (set != NULL)
+	{
+		int node = 0;
+		int i;
+		for (i = 0; number[i]; i++)
+		{
+			int slot = trie_slot(number[i]);
+			if (slot < 0) break;
+			node = set->nodes[node].child[slot];
+			if (node == 0) break;
+			if (set->nodes[node].terminal)
+			{
+				depth = i + 1;
+				break;
+			}
+		}
+	}
+	rule_set_release(screen, set);
+
+	char prefix[64];
+	if (depth > 0)
+	{
+		if (depth >= (int)sizeof(prefix)) depth = sizeof(prefix) - 1;
+		memcpy(prefix, number, depth);
+		prefix[depth] = '\0';
+		if (match != NULL && match_len > 0)
+		{
+			snprintf(match, match_len, "%s", prefix);
+		}
+	}
+	log_call(screen, number, depth > 0 ? prefix : NULL);
+
+	return depth > 0;
+}
+
+void numscreen_reload(struct numscreen *screen)
+{
+	// forget the file state and wake the watcher, it reads the file
+	pthread_mutex_lock(&screen->lock);
+	memset(&screen->file_mtime, 0, sizeof(screen->file_mtime));
+	screen->file_size = -1;
+	screen->reload = 1;
+	pthread_cond_signal(&screen->cond);
+	pthread_mutex_unlock(&screen->lock);
+}
+
+int numscreen_count(struct numscreen *screen)
+{
+	int count;
+	pthread_mutex_lock(&screen->lock);
+	count = screen->rules ? screen->rules->prefix_count : 0;
+	pthread_mutex_unlock(&screen->lock);
+	return count;
+}
+
+const char *numscreen_file(const struct numscreen *screen)
+{
+	return screen->numbers_file;
+}
+
+void numscreen_close(struct numscreen *screen)
+{
+	if (screen == NULL) return;
+
+	// the watcher writes the queued lines before it ends
+	if (screen->watcher_started)
+	{
+		pthread_mutex_lock(&screen->lock);
+		screen->stopping = 1;
+		pthread_cond_signal(&screen->cond);
+		pthread_mutex_unlock(&screen->lock);
+		pthread_join(screen->watcher, NULL);
+	}
+
+	rule_set_release(screen, screen->rules);
+	free(screen->numbers_file);
+	free(screen->log_file);
+	pthread_cond_destroy(&screen->cond);
+	pthread_mutex_destroy(&screen->lock);
+	free(screen);
+}
@@ -0,0 +1,46 @@
+/*
+=================================================================================
+ Name        : numscreen.h
+ Version     : 0.1
+
+ Description :
+     Native call screening for sipserv. Replaces the popen of numcheck.py by a
+     prefix trie built from numbers.txt, which is reloaded when the file changes.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef NUMSCREEN_H
+#define NUMSCREEN_H
+
+#include <stddef.h>
+
+struct numscreen;
+
+// load the numbers file and start the watcher, which reloads it on changes and
+// appends the checks to log_file; log_file may be NULL.
+// A missing file matches nothing until it shows up. NULL if out of memory
+struct numscreen *numscreen_open(const char *numbers_file, const char *log_file);
+
+// check if number starts with one of the listed prefixes (1 = found, 0 = not found)
+// the matched prefix is copied to match, if match is not NULL
+int numscreen_check(struct numscreen *screen, const char *number, char *match, size_t match_len);
+
+// have the watcher read the numbers file again, even if it seems unchanged
+void numscreen_reload(struct numscreen *screen);
+
+// number of prefixes in the active rule set
+int numscreen_count(struct numscreen *screen);
+
+// numbers file of the instance
+const char *numscreen_file(const struct numscreen *screen);
+
+// free the rules and the instance
+void numscreen_close(struct numscreen *screen);
+
+#endif
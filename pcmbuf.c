@@ -0,0 +1,116 @@
+/*
+=================================================================================
+ Name        : pcmbuf.c
+ Version     : 0.1
+
+ Description :
+     Reference counted buffer of 16 bit mono samples. It may still be filled
+     (e.g. by the speech synthesis) while players already read from it.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <stdlib.h>
+#include <string.h>
+#include "pcmbuf.h"
+
+struct pcm_buf *pcm_buf_create(unsigned clock_rate)
+{
+	struct pcm_buf *buf = calloc(1, sizeof(struct pcm_buf));
+	if (buf == NULL) return NULL;
+
+	pthread_mutex_init(&buf->lock, NULL);
+	buf->refcount = 1;
+	buf->clock_rate = clock_rate;
+	return buf;
+}
+
+struct pcm_buf *pcm_buf_ref(struct pcm_buf *buf)
+{
+	pthread_mutex_lock(&buf->lock);
+	buf->refcount++;
+	pthread_mutex_unlock(&buf->lock);
+	return buf;
+}
+
+void pcm_buf_release(struct pcm_buf *buf)
+{
+	int last;
+
+	if (buf == NULL) return;
+
+	pthread_mutex_lock(&buf->lock);
+	last = (--buf->refcount == 0);
+	pthread_mutex_unlock(&buf->lock);
+
+	if (last)
+	{
+		pthread_mutex_destroy(&buf->lock);
+		free(buf->samples);
+		free(buf);
+	}
+}
+
+int pcm_buf_refcount(struct pcm_buf *buf)
+{
+	int refcount;
+	pthread_mutex_lock(&buf->lock);
+	refcount = buf->refcount;
+	pthread_mutex_unlock(&buf->lock);
+	return refcount;
+}
+
+int pcm_buf_append(struct pcm_buf *buf, const short *samples, size_t count)
+{
+	pthread_mutex_lock(&buf->lock);
+	if (buf->count + count > buf->size)
+	{
+		size_t size = buf->size ? buf->size : buf->clock_rate;
+		while (size < buf->count + count) size *= 2;
+
+		short *grown = realloc(buf->samples, size * sizeof(short));
+		if (grown == NULL)
+		{
+			pthread_mutex_unlock(&buf->lock);
+			return 1;
+		}
+		buf->samples = grown;
+		buf->size = size;
+	}
+	memcpy(buf->samples + buf->count, samples, count * sizeof(short));
+	buf->count += count;
+	pthread_mutex_unlock(&buf->lock);
+
+	return 0;
+}
+
+void pcm_buf_finish(struct pcm_buf *buf, int failed)
+{
+	pthread_mutex_lock(&buf->lock);
+	buf->complete = 1;
+	buf->failed = failed;
+	pthread_mutex_unlock(&buf->lock);
+}
+
+size_t pcm_buf_read(struct pcm_buf *buf, size_t pos, short *dst, size_t count, int *complete)
+{
+	size_t n = 0;
+
+	pthread_mutex_lock(&buf->lock);
+	if (pos < buf->count)
+	{
+		n = buf->count - pos;
+		if (n > count) n = count;
+		memcpy(dst, buf->samples + pos, n * sizeof(short));
+	}
+	if (complete) *complete = buf->complete;
+	pthread_mutex_unlock(&buf->lock);
+
+	return n;
+}
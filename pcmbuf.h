@@ -0,0 +1,55 @@
+/*
+=================================================================================
+ Name        : pcmbuf.h
+ Version     : 0.1
+
+ Description :
+     Reference counted buffer of 16 bit mono samples. It may still be filled
+     (e.g. by the speech synthesis) while players already read from it.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef PCMBUF_H
+#define PCMBUF_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+struct pcm_buf {
+	pthread_mutex_t lock;
+	int refcount;
+	unsigned clock_rate;
+	short *samples;
+	size_t count;    // samples available
+	size_t size;     // samples allocated
+	int complete;    // no more samples will be appended
+	int failed;      // filling stopped because of an error
+};
+
+// create an empty buffer with one reference
+struct pcm_buf *pcm_buf_create(unsigned clock_rate);
+
+// take and drop references; the last release frees the buffer
+struct pcm_buf *pcm_buf_ref(struct pcm_buf *buf);
+void pcm_buf_release(struct pcm_buf *buf);
+
+// number of references, used by producers to notice abandoned buffers
+int pcm_buf_refcount(struct pcm_buf *buf);
+
+// append samples, returns 0 on success
+int pcm_buf_append(struct pcm_buf *buf, const short *samples, size_t count);
+
+// mark the buffer as complete (failed != 0 if filling was aborted)
+void pcm_buf_finish(struct pcm_buf *buf, int failed);
+
+// copy up to count samples starting at pos; returns the number copied and
+// sets *complete if the buffer won't grow any more
+size_t pcm_buf_read(struct pcm_buf *buf, size_t pos, short *dst, size_t count, int *complete);
+
+#endif
@@ -0,0 +1,181 @@
+/*
+=================================================================================
+ Name        : pcmport.c
+ Version     : 0.1
+
+ Description :
+     pjmedia port playing a pcm_buf. Used instead of the WAV file player, so
+     prompts come straight from memory and may play while still being rendered.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <pthread.h>
+#include "pcmport.h"
+
+// frame length handed to the conference bridge
+#define PCMPORT_PTIME 20
+
+#define PCMPORT_SIGNATURE PJMEDIA_SIG_CLASS_APP('P', 'C')
+
+struct pcm_port {
+	pjmedia_port base;
+	pthread_mutex_t lock;
+	struct pcm_buf *buf;
+	size_t pos;
+	int loop;
+	int eof_reported;
+	int started;
+	unsigned samples_per_frame;
+	void *eof_user_data;
+	pcmport_eof_cb eof_cb;
+	void *start_user_data;
+	pcmport_start_cb start_cb;
+};
+
+static pj_status_t pcmport_get_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+	struct pcm_port *port = (struct pcm_port *)this_port;
+	short *dst = frame->buf;
+	unsigned spf = port->samples_per_frame;
+	pcmport_eof_cb eof_cb = NULL;
+	pcmport_start_cb start_cb = NULL;
+	int complete = 0;
+
+	pthread_mutex_lock(&port->lock);
+	size_t n = pcm_buf_read(port->buf, port->pos, dst, spf, &complete);
+	port->pos += n;
+
+	// first samples: report them once
+	if (n > 0 && !port->started)
+	{
+		start_cb = port->start_cb;
+		port->started = 1;
+	}
+
+	// end of buffer: report it once per pass
+	if (n < spf && complete && !port->eof_reported)
+	{
+		eof_cb = port->eof_cb;
+		port->eof_reported = 1;
+		if (port->loop)
+		{
+			port->pos = 0;
+			port->eof_reported = 0;
+		}
+	}
+	void *eof_user_data = port->eof_user_data;
+	void *start_user_data = port->start_user_data;
+	pthread_mutex_unlock(&port->lock);
+
+	if (n == 0 && complete && !port->loop)
+	{
+		frame->type = PJMEDIA_FRAME_TYPE_NONE;
+		frame->size = 0;
+	}
+	else
+	{
+		// pad with silence while the buffer is still being filled
+		if (n < spf) memset(dst + n, 0, (spf - n) * sizeof(short));
+		frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+		frame->size = spf * sizeof(short);
+	}
+
+	if (start_cb) start_cb(this_port, start_user_data);
+	if (eof_cb) eof_cb(this_port, eof_user_data);
+
+	return PJ_SUCCESS;
+}
+
+static pj_status_t pcmport_on_destroy(pjmedia_port *this_port)
+{
+	struct pcm_port *port = (struct pcm_port *)this_port;
+
+	pcm_buf_release(port->buf);
+	port->buf = NULL;
+	pthread_mutex_destroy(&port->lock);
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t pcmport_create(pj_pool_t *pool, struct pcm_buf *buf, int loop, pjmedia_port **p_port)
+{
+	struct pcm_port *port = PJ_POOL_ZALLOC_T(pool, struct pcm_port);
+	if (port == NULL) return PJ_ENOMEM;
+
+	pj_str_t name = pj_str("pcm");
+	port->samples_per_frame = buf->clock_rate * PCMPORT_PTIME / 1000;
+	pjmedia_port_info_init(&port->base.info, &name, PCMPORT_SIGNATURE, buf->clock_rate, 1, 16, port->samples_per_frame);
+	port->base.get_frame = &pcmport_get_frame;
+	port->base.on_destroy = &pcmport_on_destroy;
+
+	pthread_mutex_init(&port->lock, NULL);
+	port->buf = pcm_buf_ref(buf);
+	port->loop = loop;
+
+	*p_port = &port->base;
+	return PJ_SUCCESS;
+}
+
+pj_status_t pcmport_set_eof_cb(pjmedia_port *this_port, void *user_data, pcmport_eof_cb cb)
+{
+	struct pcm_port *port = (struct pcm_port *)this_port;
+
+	pthread_mutex_lock(&port->lock);
+	port->eof_user_data = user_data;
+	port->eof_cb = cb;
+	pthread_mutex_unlock(&port->lock);
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t pcmport_set_start_cb(pjmedia_port *this_port, void *user_data, pcmport_start_cb cb)
+{
+	struct pcm_port *port = (struct pcm_port *)this_port;
+
+	pthread_mutex_lock(&port->lock);
+	port->start_user_data = user_data;
+	port->start_cb = cb;
+	pthread_mutex_unlock(&port->lock);
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t pcmport_rewind(pjmedia_port *this_port)
+{
+	struct pcm_port *port = (struct pcm_port *)this_port;
+
+	pthread_mutex_lock(&port->lock);
+	port->pos = 0;
+	port->eof_reported = 0;
+	pthread_mutex_unlock(&port->lock);
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t pcmport_set_buf(pjmedia_port *this_port, struct pcm_buf *buf)
+{
+	struct pcm_port *port = (struct pcm_port *)this_port;
+
+	if (buf->clock_rate != port->base.info.fmt.det.aud.clock_rate) return PJ_EINVAL;
+
+	pcm_buf_ref(buf);
+	pthread_mutex_lock(&port->lock);
+	struct pcm_buf *old = port->buf;
+	port->buf = buf;
+	port->pos = 0;
+	port->eof_reported = 0;
+	port->started = 0;
+	pthread_mutex_unlock(&port->lock);
+
+	// may stop the synthesis of the old prompt, so not with the lock held
+	pcm_buf_release(old);
+
+	return PJ_SUCCESS;
+}
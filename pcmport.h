@@ -0,0 +1,51 @@
+/*
+=================================================================================
+ Name        : pcmport.h
+ Version     : 0.1
+
+ Description :
+     pjmedia port playing a pcm_buf. Used instead of the WAV file player, so
+     prompts come straight from memory and may play while still being rendered.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef PCMPORT_H
+#define PCMPORT_H
+
+// definition of endianess (e.g. needed on raspberry pi)
+#define PJ_IS_LITTLE_ENDIAN 1
+#define PJ_IS_BIG_ENDIAN 0
+
+#include <pjsua-lib/pjsua.h>
+#include "pcmbuf.h"
+
+// callback at the end of the buffer (like pjmedia_wav_player_set_eof_cb)
+typedef pj_status_t (*pcmport_eof_cb)(pjmedia_port *port, void *user_data);
+
+// callback when the first samples of the buffer are played (on the media thread)
+typedef void (*pcmport_start_cb)(pjmedia_port *port, void *user_data);
+
+// create a port playing buf (takes its own reference); loop restarts at the end
+pj_status_t pcmport_create(pj_pool_t *pool, struct pcm_buf *buf, int loop, pjmedia_port **p_port);
+
+// set the callback invoked each time the end of the buffer is reached
+pj_status_t pcmport_set_eof_cb(pjmedia_port *port, void *user_data, pcmport_eof_cb cb);
+
+// set the callback invoked once, when the first samples go out
+pj_status_t pcmport_set_start_cb(pjmedia_port *port, void *user_data, pcmport_start_cb cb);
+
+// play from the start again
+pj_status_t pcmport_rewind(pjmedia_port *port);
+
+// play another buffer of the same clock rate from its start (takes its own
+// reference); the start callback fires again. No new port is needed, so a
+// menu can switch prompts while the port stays in the conference bridge.
+pj_status_t pcmport_set_buf(pjmedia_port *port, struct pcm_buf *buf);
+
+#endif
@@ -0,0 +1,166 @@
+/*
+=================================================================================
+ Name        : proc.c
+ Version     : 0.1
+
+ Description :
+     Run shell commands with a timeout. Replacement for popen()/fgets() in
+     places where a hanging command must not block the caller forever.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "proc.h"
+
+// interval for checking the cancel flag
+#define PROC_POLL_MS 50
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int proc_run(const char *command, char *result, size_t result_size, int timeout_ms, volatile int *cancel)
+{
+	// close-on-exec, so commands started by other threads at the same time
+	// don't hold the write end and delay the EOF; dup2 clears it on stdout
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) != 0) return PROC_FAILED;
+
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		close(fds[0]);
+		close(fds[1]);
+		return PROC_FAILED;
+	}
+
+	if (pid == 0)
+	{
+		// child: own process group, so the whole pipeline can be killed
+		setpgid(0, 0);
+
+		// the event loop blocked these for the threads, not for the command
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+		_exit(127);
+	}
+
+	setpgid(pid, pid);
+	close(fds[1]);
+
+	size_t len = 0;
+	char discard[256];
+	int outcome = PROC_OK;
+	long long deadline = timeout_ms > 0 ? now_ms() + timeout_ms : 0;
+
+	// read output until EOF, timeout or cancel
+	for (;;)
+	{
+		if (cancel && *cancel)
+		{
+			outcome = PROC_CANCELLED;
+			break;
+		}
+
+		int wait_ms = PROC_POLL_MS;
+		if (deadline)
+		{
+			long long left = deadline - now_ms();
+			if (left <= 0)
+			{
+				outcome = PROC_TIMEOUT;
+				break;
+			}
+			if (left < wait_ms) wait_ms = left;
+		}
+
+		struct pollfd pfd = { fds[0], POLLIN, 0 };
+		int ready = poll(&pfd, 1, wait_ms);
+		if (ready < 0 && errno != EINTR)
+		{
+			outcome = PROC_FAILED;
+			break;
+		}
+		if (ready <= 0) continue;
+
+		ssize_t n;
+		if (result != NULL && len + 1 < result_size)
+		{
+			n = read(fds[0], result + len, result_size - len - 1);
+			if (n > 0) len += n;
+		}
+		else
+		{
+			n = read(fds[0], discard, sizeof(discard));
+		}
+		if (n == 0) break; // EOF
+		if (n < 0 && errno != EINTR && errno != EAGAIN)
+		{
+			outcome = PROC_FAILED;
+			break;
+		}
+	}
+	close(fds[0]);
+
+	// the shell may outlive its output (e.g. a command closing stdout),
+	// so the timeout and cancel still count while waiting for it
+	int status = 0;
+	while (outcome == PROC_OK)
+	{
+		pid_t done = waitpid(pid, &status, WNOHANG);
+		if (done == pid) break;
+		if (done < 0 && errno != EINTR)
+		{
+			outcome = PROC_FAILED;
+			break;
+		}
+		if (cancel && *cancel) outcome = PROC_CANCELLED;
+		else if (deadline && now_ms() >= deadline) outcome = PROC_TIMEOUT;
+		else poll(NULL, 0, PROC_POLL_MS);
+	}
+
+	if (outcome != PROC_OK)
+	{
+		// SIGKILL can't be caught or blocked, so the shell (in the group
+		// too) ends and the wait below returns
+		kill(-pid, SIGKILL);
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+	}
+	if (outcome == PROC_OK && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+	{
+		outcome = PROC_FAILED;
+	}
+
+	// keep the first line only, like fgets() did
+	if (result != NULL && result_size > 0)
+	{
+		result[len] = '\0';
+		result[strcspn(result, "\n")] = '\0';
+	}
+
+	return outcome;
+}
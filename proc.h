@@ -0,0 +1,33 @@
+/*
+=================================================================================
+ Name        : proc.h
+ Version     : 0.1
+
+ Description :
+     Run shell commands with a timeout. Replacement for popen()/fgets() in
+     places where a hanging command must not block the caller forever.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef PROC_H
+#define PROC_H
+
+#include <stddef.h>
+
+// results of proc_run
+#define PROC_OK         0 // command ran and exited with status 0
+#define PROC_FAILED     1 // command could not be started or exited with status != 0
+#define PROC_TIMEOUT    2 // command was killed after timeout
+#define PROC_CANCELLED  3 // command was killed because *cancel was set
+
+// run command with /bin/sh, copy the first line of its output to result
+// (may be NULL); timeout_ms <= 0 waits forever; cancel (may be NULL) is polled
+int proc_run(const char *command, char *result, size_t result_size, int timeout_ms, volatile int *cancel);
+
+#endif
@@ -0,0 +1,578 @@
+/*
+=================================================================================
+ Name        : recport.c
+ Version     : 0.1
+
+ Description :
+     pjmedia port recording a call to a WAV or MP3 file. The conference bridge
+     only copies frames into a lock-free ring buffer; a low priority writer
+     thread encodes them and writes them to disk in batches, so slow SD cards
+     can't stall the media clock.
+
+     The ring has a single producer (put_frame on the bridge clock thread) and
+     a single consumer (the writer thread), so head and tail are plain
+     counters published with acquire/release ordering. If the writer falls
+     behind and the ring is full, whole frames are dropped and counted.
+
+     The WAV header is rewritten and the file synced every few seconds, so a
+     recording is playable up to that point even after a crash.
+
+     Every frame passes the voice activity detector. When trimming, frames
+     before the first speech only go to a short pre-roll buffer, and silence
+     after speech is held back in a pending buffer, which is written once
+     speech resumes (or when it gets too long). At the end only a short
+     post-roll of the pending silence is written.
+
+ References  :
+ https://github.com/gypified/libmp3lame/blob/master/API
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <lame/lame.h>
+#include "recport.h"
+#include "vad.h"
+
+// frame length expected from the conference bridge
+#define RECPORT_PTIME 20
+
+// audio the ring can hold, while the writer is stalled
+#define RECPORT_BUFFER_MS 4000
+
+// the writer wakes up this often and writes everything collected meanwhile
+#define RECPORT_FLUSH_MS 500
+
+// rewrite the WAV header and sync the file this often
+#define RECPORT_SYNC_MS 5000
+
+// nice value of the writer threads
+#define RECPORT_NICE 10
+
+// samples encoded per lame call
+#define RECPORT_MP3_CHUNK 4096
+
+// encoder quality, 7 is fast and good enough for speech
+#define RECPORT_MP3_QUALITY 7
+
+#define RECPORT_WAV_HEADER 44
+
+// silence kept before the first and after the last speech when trimming
+#define RECPORT_PREROLL_FRAMES 15
+#define RECPORT_POSTROLL_MS 300
+
+// longer pauses are written, even if no speech follows
+#define RECPORT_MAX_PENDING_MS 10000
+
+#define RECPORT_SIGNATURE PJMEDIA_SIG_CLASS_APP('R', 'C')
+
+struct rec_port {
+	pjmedia_port base;
+	enum recport_format format;
+	unsigned clock_rate;
+	int fd;
+
+	// ring buffer, size is a power of two
+	short *ring;
+	size_t size;
+	size_t head;              // samples written by put_frame
+	size_t tail;              // samples taken by the writer
+
+	// counters, written by put_frame only
+	unsigned long frames;
+	unsigned long overruns;
+	size_t high_water;
+
+	// writer thread
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stopping;
+	int stopped;
+	uint32_t data_bytes;      // WAV data written so far
+	unsigned long written;    // samples written so far
+
+	// voice activity detection and trimming, used by the writer only
+	struct vad vad;
+	int trim;
+	int speech_seen;
+	short *frame;             // frame being collected for the detector
+	unsigned frame_fill;
+	short *preroll;           // last frames before the first speech
+	unsigned preroll_next;
+	unsigned preroll_count;
+	short *pending;           // silence after speech, not written yet
+	size_t pending_count;
+	size_t pending_size;
+
+	// mp3 encoder, used by the writer only
+	lame_t lame;
+	unsigned char *mp3buf;
+	int mp3buf_size;
+};
+
+// summed up statistics of destroyed ports
+static struct {
+	pthread_mutex_t lock;
+	struct recport_stats stats;
+} totals = { PTHREAD_MUTEX_INITIALIZER };
+
+static void put_le16(unsigned char *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+// write the header of a mono 16 bit WAV file with data_bytes of samples
+static int wav_write_header(struct rec_port *port)
+{
+	unsigned char header[RECPORT_WAV_HEADER];
+
+	memcpy(header, "RIFF", 4);
+	put_le32(header + 4, 36 + port->data_bytes);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_le32(header + 16, 16);
+	put_le16(header + 20, 1);                     // PCM
+	put_le16(header + 22, 1);                     // mono
+	put_le32(header + 24, port->clock_rate);
+	put_le32(header + 28, port->clock_rate * 2);  // bytes per second
+	put_le16(header + 32, 2);                     // block align
+	put_le16(header + 34, 16);                    // bits per sample
+	memcpy(header + 36, "data", 4);
+	put_le32(header + 40, port->data_bytes);
+
+	return pwrite(port->fd, header, sizeof(header), 0) == sizeof(header) ? 0 : -1;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// write samples to the file, encoding them first for MP3
+static void write_samples(struct rec_port *port, short *samples, size_t count)
+{
+	port->written += count;
+
+	if (port->format == RECPORT_WAV)
+	{
+		// samples are little endian already (PJ_IS_LITTLE_ENDIAN)
+		if (write_all(port->fd, samples, count * sizeof(short)) == 0)
+		{
+			port->data_bytes += count * sizeof(short);
+		}
+		return;
+	}
+
+	while (count > 0)
+	{
+		int n = count > RECPORT_MP3_CHUNK ? RECPORT_MP3_CHUNK : count;
+		int len = lame_encode_buffer(port->lame, samples, NULL, n, port->mp3buf, port->mp3buf_size);
+		if (len > 0) write_all(port->fd, port->mp3buf, len);
+		samples += n;
+		count -= n;
+	}
+}
+
+static void write_pending(struct rec_port *port, size_t count)
+{
+	write_samples(port, port->pending, count);
+	port->pending_count = 0;
+}
+
+// pass a frame to the detector and write it, hold it back or drop it
+static void process_frame(struct rec_port *port, short *frame)
+{
+	unsigned n = port->vad.frame_size;
+	int speech = vad_process(&port->vad, frame);
+
+	if (!port->trim)
+	{
+		write_samples(port, frame, n);
+		return;
+	}
+
+	if (speech)
+	{
+		if (!port->speech_seen)
+		{
+			// first speech: start the file with the pre-roll, oldest frame first
+			unsigned i;
+			unsigned first = (port->preroll_next + RECPORT_PREROLL_FRAMES - port->preroll_count) % RECPORT_PREROLL_FRAMES;
+			for (i = 0; i < port->preroll_count; i++)
+			{
+				write_samples(port, port->preroll + ((first + i) % RECPORT_PREROLL_FRAMES) * n, n);
+			}
+			port->speech_seen = 1;
+		}
+		else if (port->pending_count > 0)
+		{
+			// just a pause
+			write_pending(port, port->pending_count);
+		}
+		write_samples(port, frame, n);
+	}
+	else if (!port->speech_seen)
+	{
+		memcpy(port->preroll + port->preroll_next * n, frame, n * sizeof(short));
+		port->preroll_next = (port->preroll_next + 1) % RECPORT_PREROLL_FRAMES;
+		if (port->preroll_count < RECPORT_PREROLL_FRAMES) port->preroll_count++;
+	}
+	else
+	{
+		memcpy(port->pending + port->pending_count, frame, n * sizeof(short));
+		port->pending_count += n;
+		if (port->pending_count + n > port->pending_size) write_pending(port, port->pending_count);
+	}
+}
+
+// split samples into detector frames
+static void process_samples(struct rec_port *port, short *samples, size_t count)
+{
+	unsigned n = port->vad.frame_size;
+
+	while (count > 0)
+	{
+		unsigned take = n - port->frame_fill;
+		if (take > count) take = count;
+		memcpy(port->frame + port->frame_fill, samples, take * sizeof(short));
+		port->frame_fill += take;
+		samples += take;
+		count -= take;
+
+		if (port->frame_fill == n)
+		{
+			process_frame(port, port->frame);
+			port->frame_fill = 0;
+		}
+	}
+}
+
+// end of the recording: write the post-roll, drop the rest of the silence
+static void finish_samples(struct rec_port *port)
+{
+	if (!port->trim)
+	{
+		write_samples(port, port->frame, port->frame_fill);
+		return;
+	}
+	if (!port->speech_seen) return;
+
+	memcpy(port->pending + port->pending_count, port->frame, port->frame_fill * sizeof(short));
+	port->pending_count += port->frame_fill;
+
+	size_t postroll = (size_t)port->clock_rate * RECPORT_POSTROLL_MS / 1000;
+	write_pending(port, port->pending_count < postroll ? port->pending_count : postroll);
+}
+
+// move everything from the ring to the file
+static void drain(struct rec_port *port)
+{
+	size_t head = __atomic_load_n(&port->head, __ATOMIC_ACQUIRE);
+	size_t tail = port->tail;
+
+	while (tail != head)
+	{
+		// up to the end of the ring, the rest in the next round
+		size_t offset = tail & (port->size - 1);
+		size_t n = head - tail;
+		if (n > port->size - offset) n = port->size - offset;
+
+		process_samples(port, port->ring + offset, n);
+		tail += n;
+		__atomic_store_n(&port->tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+// make the recording so far survive a crash
+static void sync_file(struct rec_port *port)
+{
+	if (port->format == RECPORT_WAV) wav_write_header(port);
+	fdatasync(port->fd);
+}
+
+static void timespec_add_ms(struct timespec *ts, long ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000)
+	{
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+// writer thread: drain the ring every RECPORT_FLUSH_MS until the port is destroyed
+static void *recport_writer(void *data)
+{
+	struct rec_port *port = data;
+	long since_sync = 0;
+
+	// disk writes are less important than the audio
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), RECPORT_NICE);
+
+	pthread_mutex_lock(&port->lock);
+	while (!port->stopping)
+	{
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		timespec_add_ms(&until, RECPORT_FLUSH_MS);
+		pthread_cond_timedwait(&port->cond, &port->lock, &until);
+		if (port->stopping) break;
+		pthread_mutex_unlock(&port->lock);
+
+		drain(port);
+		since_sync += RECPORT_FLUSH_MS;
+		if (since_sync >= RECPORT_SYNC_MS)
+		{
+			sync_file(port);
+			since_sync = 0;
+		}
+
+		pthread_mutex_lock(&port->lock);
+	}
+	pthread_mutex_unlock(&port->lock);
+
+	// the bridge doesn't call put_frame anymore, write the rest and finish the file
+	drain(port);
+	finish_samples(port);
+	if (port->format == RECPORT_MP3)
+	{
+		int len = lame_encode_flush(port->lame, port->mp3buf, port->mp3buf_size);
+		if (len > 0) write_all(port->fd, port->mp3buf, len);
+	}
+	sync_file(port);
+
+	return NULL;
+}
+
+static unsigned samples_to_ms(struct rec_port *port, size_t samples)
+{
+	return samples * 1000 / port->clock_rate;
+}
+
+static pj_status_t recport_put_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+	struct rec_port *port = (struct rec_port *)this_port;
+
+	if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO) return PJ_SUCCESS;
+
+	size_t count = frame->size / sizeof(short);
+	size_t head = port->head;
+	size_t tail = __atomic_load_n(&port->tail, __ATOMIC_ACQUIRE);
+	size_t used = head - tail;
+
+	__atomic_store_n(&port->frames, port->frames + 1, __ATOMIC_RELAXED);
+	if (count > port->size - used)
+	{
+		// writer is stuck, drop the frame rather than block the bridge
+		__atomic_store_n(&port->overruns, port->overruns + 1, __ATOMIC_RELAXED);
+		return PJ_SUCCESS;
+	}
+
+	size_t offset = head & (port->size - 1);
+	size_t first = count < port->size - offset ? count : port->size - offset;
+	memcpy(port->ring + offset, frame->buf, first * sizeof(short));
+	memcpy(port->ring, (short *)frame->buf + first, (count - first) * sizeof(short));
+	__atomic_store_n(&port->head, head + count, __ATOMIC_RELEASE);
+
+	if (used + count > port->high_water)
+	{
+		__atomic_store_n(&port->high_water, used + count, __ATOMIC_RELAXED);
+	}
+
+	return PJ_SUCCESS;
+}
+
+static pj_status_t recport_get_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+	PJ_UNUSED_ARG(this_port);
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	frame->size = 0;
+	return PJ_SUCCESS;
+}
+
+void recport_stop(pjmedia_port *this_port)
+{
+	struct rec_port *port = (struct rec_port *)this_port;
+	struct recport_stats stats;
+
+	if (port->stopped) return;
+
+	pthread_mutex_lock(&port->lock);
+	port->stopping = 1;
+	pthread_cond_signal(&port->cond);
+	pthread_mutex_unlock(&port->lock);
+	pthread_join(port->writer, NULL);
+	port->stopped = 1;
+
+	recport_get_stats(this_port, &stats);
+	pthread_mutex_lock(&totals.lock);
+	totals.stats.frames += stats.frames;
+	totals.stats.overruns += stats.overruns;
+	if (stats.high_water_ms > totals.stats.high_water_ms) totals.stats.high_water_ms = stats.high_water_ms;
+	if (stats.capacity_ms > totals.stats.capacity_ms) totals.stats.capacity_ms = stats.capacity_ms;
+	totals.stats.speech_ms += stats.speech_ms;
+	totals.stats.written_ms += stats.written_ms;
+	pthread_mutex_unlock(&totals.lock);
+}
+
+static pj_status_t recport_on_destroy(pjmedia_port *this_port)
+{
+	struct rec_port *port = (struct rec_port *)this_port;
+
+	recport_stop(this_port);
+
+	close(port->fd);
+	free(port->pending);
+	if (port->lame) lame_close(port->lame);
+	pthread_mutex_destroy(&port->lock);
+	pthread_cond_destroy(&port->cond);
+
+	return PJ_SUCCESS;
+}
+
+pj_status_t recport_create(pj_pool_t *pool, const char *file, enum recport_format format,
+	unsigned clock_rate, unsigned bitrate, int trim, pjmedia_port **p_port)
+{
+	struct rec_port *port = PJ_POOL_ZALLOC_T(pool, struct rec_port);
+	if (port == NULL) return PJ_ENOMEM;
+
+	port->format = format;
+	port->clock_rate = clock_rate;
+	port->trim = trim;
+
+	vad_init(&port->vad, clock_rate);
+	port->frame = pj_pool_alloc(pool, port->vad.frame_size * sizeof(short));
+	if (port->frame == NULL) return PJ_ENOMEM;
+	if (trim)
+	{
+		port->preroll = pj_pool_alloc(pool, RECPORT_PREROLL_FRAMES * port->vad.frame_size * sizeof(short));
+		if (port->preroll == NULL) return PJ_ENOMEM;
+	}
+
+	// power of two, so the ring index is a mask
+	size_t wanted = (size_t)clock_rate * RECPORT_BUFFER_MS / 1000;
+	for (port->size = 1024; port->size < wanted; port->size *= 2);
+	port->ring = pj_pool_alloc(pool, port->size * sizeof(short));
+	if (port->ring == NULL) return PJ_ENOMEM;
+
+	if (format == RECPORT_MP3)
+	{
+		// worst case size of the encoded data, from the lame API docs
+		port->mp3buf_size = RECPORT_MP3_CHUNK * 5 / 4 + 7200;
+		port->mp3buf = pj_pool_alloc(pool, port->mp3buf_size);
+		if (port->mp3buf == NULL) return PJ_ENOMEM;
+
+		port->lame = lame_init();
+		if (port->lame == NULL) return PJ_ENOMEM;
+		lame_set_num_channels(port->lame, 1);
+		lame_set_mode(port->lame, MONO);
+		lame_set_in_samplerate(port->lame, clock_rate);
+		lame_set_brate(port->lame, bitrate);
+		lame_set_quality(port->lame, RECPORT_MP3_QUALITY);
+		if (lame_init_params(port->lame) < 0)
+		{
+			lame_close(port->lame);
+			return PJ_EINVAL;
+		}
+	}
+
+	// pauses up to RECPORT_MAX_PENDING_MS, rounded up to whole frames
+	if (trim)
+	{
+		port->pending_size = ((size_t)clock_rate * RECPORT_MAX_PENDING_MS / 1000 / port->vad.frame_size + 1) * port->vad.frame_size;
+		port->pending = malloc(port->pending_size * sizeof(short));
+		if (port->pending == NULL)
+		{
+			if (port->lame) lame_close(port->lame);
+			return PJ_ENOMEM;
+		}
+	}
+
+	port->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (port->fd < 0 || (format == RECPORT_WAV && wav_write_header(port) != 0))
+	{
+		if (port->fd >= 0) close(port->fd);
+		if (port->lame) lame_close(port->lame);
+		free(port->pending);
+		return PJ_ENOTFOUND;
+	}
+	if (format == RECPORT_WAV) lseek(port->fd, RECPORT_WAV_HEADER, SEEK_SET);
+
+	pthread_mutex_init(&port->lock, NULL);
+	pthread_cond_init(&port->cond, NULL);
+	if (pthread_create(&port->writer, NULL, &recport_writer, port) != 0)
+	{
+		pthread_mutex_destroy(&port->lock);
+		pthread_cond_destroy(&port->cond);
+		close(port->fd);
+		if (port->lame) lame_close(port->lame);
+		free(port->pending);
+		return PJ_ENOMEM;
+	}
+
+	pj_str_t name = pj_str("rec");
+	pjmedia_port_info_init(&port->base.info, &name, RECPORT_SIGNATURE, clock_rate, 1, 16, clock_rate * RECPORT_PTIME / 1000);
+	port->base.put_frame = &recport_put_frame;
+	port->base.get_frame = &recport_get_frame;
+	port->base.on_destroy = &recport_on_destroy;
+
+	*p_port = &port->base;
+	return PJ_SUCCESS;
+}
+
+void recport_get_stats(pjmedia_port *this_port, struct recport_stats *stats)
+{
+	struct rec_port *port = (struct rec_port *)this_port;
+
+	stats->frames = __atomic_load_n(&port->frames, __ATOMIC_RELAXED);
+	stats->overruns = __atomic_load_n(&port->overruns, __ATOMIC_RELAXED);
+	stats->high_water_ms = samples_to_ms(port, __atomic_load_n(&port->high_water, __ATOMIC_RELAXED));
+	stats->capacity_ms = samples_to_ms(port, port->size);
+	stats->speech_ms = vad_speech_ms(&port->vad);
+	stats->written_ms = samples_to_ms(port, port->written);
+}
+
+void recport_get_totals(struct recport_stats *stats)
+{
+	pthread_mutex_lock(&totals.lock);
+	*stats = totals.stats;
+	pthread_mutex_unlock(&totals.lock);
+}
@@ -0,0 +1,63 @@
+/*
+=================================================================================
+ Name        : recport.h
+ Version     : 0.1
+
+ Description :
+     pjmedia port recording a call to a WAV or MP3 file. The conference bridge
+     only copies frames into a lock-free ring buffer; a low priority writer
+     thread encodes them and writes them to disk in batches, so slow SD cards
+     can't stall the media clock.
+
+     The writer also runs a voice activity detector over the recording and
+     can trim leading and trailing silence.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef RECPORT_H
+#define RECPORT_H
+
+// definition of endianess (e.g. needed on raspberry pi)
+#define PJ_IS_LITTLE_ENDIAN 1
+#define PJ_IS_BIG_ENDIAN 0
+
+#include <pjsua-lib/pjsua.h>
+
+enum recport_format {
+	RECPORT_WAV,
+	RECPORT_MP3
+};
+
+// buffer statistics, of one port or summed up over all ports
+struct recport_stats {
+	unsigned long frames;    // frames received from the bridge
+	unsigned long overruns;  // frames dropped because the buffer was full
+	unsigned high_water_ms;  // highest buffer fill level
+	unsigned capacity_ms;    // buffer size
+	unsigned long speech_ms; // speech detected, final after recport_stop
+	unsigned long written_ms;// audio written to the file, final after recport_stop
+};
+
+// create a port recording mono 16 bit audio to file; bitrate (kbit/s) is
+// used for MP3 only. With trim, silence before the first and after the last
+// speech is left out. The file is finished when the port is destroyed.
+pj_status_t recport_create(pj_pool_t *pool, const char *file, enum recport_format format,
+	unsigned clock_rate, unsigned bitrate, int trim, pjmedia_port **p_port);
+
+// write the rest of the buffer and finish the file (remove the port from the
+// bridge first); called by the destroy as well, if not done before
+void recport_stop(pjmedia_port *port);
+
+// statistics of one port
+void recport_get_stats(pjmedia_port *port, struct recport_stats *stats);
+
+// statistics of all ports since start (high water and capacity are maxima)
+void recport_get_totals(struct recport_stats *stats);
+
+#endif
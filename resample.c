@@ -0,0 +1,276 @@
+/*
+=================================================================================
+ Name        : resample.c
+ Version     : 0.1
+
+ Description :
+     Sample rate conversion of prompts, done once when they are loaded or
+     synthesized, so the conference bridge gets them at its own rate and
+     doesn't resample every frame of every call.
+
+     Polyphase windowed sinc filter: the rates are reduced to up/down, and
+     for each of the up phases a Kaiser windowed sinc of 16 zero crossings
+     is precomputed, with the cutoff just below the lower of the two Nyquist
+     frequencies. This is more than a real-time resampler can afford, but
+     it runs only once per prompt.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resample.h"
+
+#define ZERO_CROSSINGS 16
+#define KAISER_BETA 8.6
+#define ROLLOFF 0.94
+
+// limit of the reduced output rate, i.e. of the filter table
+#define MAX_PHASES 4096
+
+// output samples appended at once
+#define OUT_CHUNK 1024
+
+// samples read from a buffer at once
+#define IN_CHUNK 4096
+
+struct resampler {
+	unsigned up;                // output rate / gcd
+	unsigned down;              // input rate / gcd
+	int half;                   // taps on each side of an output sample
+	float *table;               // up phases of 2 * half taps
+	short *work;                // input still needed, work[0] is input number start
+	size_t work_len;
+	size_t work_size;
+	long long start;            // negative: leading zeros
+	unsigned long long consumed; // input samples so far
+	unsigned long long next;    // number of the next output sample
+};
+
+static unsigned gcd(unsigned a, unsigned b)
+{
+	while (b)
+	{
+		unsigned t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// modified Bessel function of the first kind, order 0
+static double bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	int k;
+
+	for (k = 1; k < 50; k++)
+	{
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+// start with half zeros before the first input sample
+static void reset(struct resampler *rs)
+{
+	memset(rs->work, 0, rs->half * sizeof(short));
+	rs->work_len = rs->half;
+	rs->start = -(long long)rs->half;
+	rs->consumed = 0;
+	rs->next = 0;
+}
+
+struct resampler *resampler_create(unsigned rate_in, unsigned rate_out)
+{
+	if (rate_in == 0 || rate_out == 0) return NULL;
+
+	unsigned g = gcd(rate_in, rate_out);
+	if (rate_out / g > MAX_PHASES) return NULL;
+
+	struct resampler *rs = calloc(1, sizeof(struct resampler));
+	if (rs == NULL) return NULL;
+	rs->up = rate_out / g;
+	rs->down = rate_in / g;
+
+	// cutoff relative to the input Nyquist frequency
+	double cutoff = (rs->up < rs->down ? (double)rs->up / rs->down : 1.0) * ROLLOFF;
+	rs->half = (int)ceil(ZERO_CROSSINGS / cutoff);
+
+	int taps = 2 * rs->half;
+	rs->table = malloc((size_t)rs->up * taps * sizeof(float));
+	rs->work_size = 2 * taps + IN_CHUNK;
+	rs->work = malloc(rs->work_size * sizeof(short));
+	if (rs->table == NULL || rs->work == NULL)
+	{
+		resampler_destroy(rs);
+		return NULL;
+	}
+
+	double norm = bessel_i0(KAISER_BETA);
+	unsigned phase;
+	int k;
+	for (phase = 0; phase < rs->up; phase++)
+	{
+		float *h = rs->table + (size_t)phase * taps;
+		double sum = 0;
+
+		// tap k weighs input (position of the output) - frac + half - 1 - k
+		for (k = 0; k < taps; k++)
+		{
+			double t = (double)phase / rs->up - (k - rs->half + 1);
+			double r = t / rs->half;
+			double w = (r >= -1 && r <= 1) ? bessel_i0(KAISER_BETA * sqrt(1 - r * r)) / norm : 0;
+			double x = M_PI * cutoff * t;
+			h[k] = (x == 0 ? 1 : sin(x) / x) * w;
+			sum += h[k];
+		}
+
+		// unity gain in every phase
+		for (k = 0; k < taps; k++) h[k] /= sum;
+	}
+
+	reset(rs);
+	return rs;
+}
+
+// compute the outputs the input so far allows; at the end (final) only up
+// to the length of the input
+static int produce(struct resampler *rs, struct pcm_buf *out, int final)
+{
+	short chunk[OUT_CHUNK];
+	size_t n = 0;
+	int taps = 2 * rs->half;
+
+	for (;;)
+	{
+		unsigned long long pos = rs->next * rs->down;
+		long long base = pos / rs->up;
+		unsigned phase = pos % rs->up;
+
+		if (final && pos >= rs->consumed * rs->up) break;
+		if (base + rs->half >= rs->start + (long long)rs->work_len) break;
+
+		const float *h = rs->table + (size_t)phase * taps;
+		const short *x = rs->work + (base - rs->half + 1 - rs->start);
+		double acc = 0;
+		int k;
+		for (k = 0; k < taps; k++) acc += h[k] * x[k];
+
+		long sample = lrint(acc);
+		if (sample > 32767) sample = 32767;
+		if (sample < -32768) sample = -32768;
+		chunk[n++] = sample;
+		rs->next++;
+
+		if (n == OUT_CHUNK)
+		{
+			if (pcm_buf_append(out, chunk, n) != 0) return 1;
+			n = 0;
+		}
+	}
+	if (n > 0 && pcm_buf_append(out, chunk, n) != 0) return 1;
+
+	// drop the input no output needs any more
+	long long first = (long long)(rs->next * rs->down / rs->up) - rs->half + 1;
+	if (first > rs->start)
+	{
+		size_t drop = first - rs->start;
+		if (drop > rs->work_len) drop = rs->work_len;
+		memmove(rs->work, rs->work + drop, (rs->work_len - drop) * sizeof(short));
+		rs->work_len -= drop;
+		rs->start += drop;
+	}
+	return 0;
+}
+
+// append input to the work buffer
+static int feed(struct resampler *rs, const short *samples, size_t count)
+{
+	if (rs->work_len + count > rs->work_size)
+	{
+		size_t size = rs->work_len + count + IN_CHUNK;
+		short *grown = realloc(rs->work, size * sizeof(short));
+		if (grown == NULL) return 1;
+		rs->work = grown;
+		rs->work_size = size;
+	}
+	if (samples) memcpy(rs->work + rs->work_len, samples, count * sizeof(short));
+	else memset(rs->work + rs->work_len, 0, count * sizeof(short));
+	rs->work_len += count;
+	return 0;
+}
+
+int resampler_run(struct resampler *rs, const short *samples, size_t count, struct pcm_buf *out)
+{
+	while (count > 0)
+	{
+		size_t n = count < IN_CHUNK ? count : IN_CHUNK;
+		if (feed(rs, samples, n) != 0) return 1;
+		rs->consumed += n;
+		if (produce(rs, out, 0) != 0) return 1;
+		samples += n;
+		count -= n;
+	}
+	return 0;
+}
+
+int resampler_flush(struct resampler *rs, struct pcm_buf *out)
+{
+	// zeros after the end, the last outputs need them
+	int status = feed(rs, NULL, rs->half);
+	if (status == 0) status = produce(rs, out, 1);
+
+	reset(rs);
+	return status;
+}
+
+void resampler_destroy(struct resampler *rs)
+{
+	if (rs == NULL) return;
+	free(rs->table);
+	free(rs->work);
+	free(rs);
+}
+
+struct pcm_buf *resample_buf(struct pcm_buf *in, unsigned rate_out)
+{
+	short samples[IN_CHUNK];
+	size_t pos = 0, n;
+	int status = 0;
+
+	struct resampler *rs = resampler_create(in->clock_rate, rate_out);
+	if (rs == NULL) return NULL;
+
+	struct pcm_buf *out = pcm_buf_create(rate_out);
+	if (out == NULL)
+	{
+		resampler_destroy(rs);
+		return NULL;
+	}
+
+	while (status == 0 && (n = pcm_buf_read(in, pos, samples, IN_CHUNK, NULL)) > 0)
+	{
+		status = resampler_run(rs, samples, n, out);
+		pos += n;
+	}
+	if (status == 0) status = resampler_flush(rs, out);
+	resampler_destroy(rs);
+
+	if (status != 0)
+	{
+		pcm_buf_release(out);
+		return NULL;
+	}
+	pcm_buf_finish(out, 0);
+	return out;
+}
@@ -0,0 +1,43 @@
+/*
+=================================================================================
+ Name        : resample.h
+ Version     : 0.1
+
+ Description :
+     Sample rate conversion of prompts, done once when they are loaded or
+     synthesized, so the conference bridge gets them at its own rate and
+     doesn't resample every frame of every call.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stddef.h>
+#include "pcmbuf.h"
+
+struct resampler;
+
+// create a converter of 16 bit mono samples; NULL if out of memory or the
+// ratio of the rates is too odd (reduced, the output rate is above 4096)
+struct resampler *resampler_create(unsigned rate_in, unsigned rate_out);
+
+// convert the next count samples and append them to out; the output lags
+// the input by the filter length until resampler_flush. Returns 0 on success
+int resampler_run(struct resampler *rs, const short *samples, size_t count, struct pcm_buf *out);
+
+// append the rest of the output, then start over with the next input
+int resampler_flush(struct resampler *rs, struct pcm_buf *out);
+
+void resampler_destroy(struct resampler *rs);
+
+// convert a complete buffer; returns a new complete buffer or NULL
+struct pcm_buf *resample_buf(struct pcm_buf *in, unsigned rate_out);
+
+#endif
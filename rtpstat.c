@@ -0,0 +1,58 @@
+/*
+=================================================================================
+ Name        : rtpstat.c
+ Version     : 0.1
+
+ Description :
+     Receive quality of a call from the RTP/RTCP statistics of its stream:
+     loss, jitter, round trip and a MOS estimate after the E-model.
+
+     The estimate uses the simplified E-model: the jitter buffer adds about
+     twice the jitter to the one-way delay, each percent of loss costs 2.5
+     points of the R factor, and R is mapped to MOS as in ITU-T G.107.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include "rtpstat.h"
+
+// R factor of a clean G.711 call
+#define RTPSTAT_R0 93.2
+
+static double mos_estimate(const struct rtp_quality *quality)
+{
+	double delay = quality->rtt_ms / 2 + quality->jitter_ms * 2 + 10;
+	double r = delay < 160 ? RTPSTAT_R0 - delay / 40 : RTPSTAT_R0 - (delay - 120) / 10;
+
+	r -= quality->loss * 100 * 2.5;
+	if (r < 0) r = 0;
+	if (r > 100) r = 100;
+
+	return 1 + 0.035 * r + 0.000007 * r * (r - 60) * (100 - r);
+}
+
+void rtpstat_quality(const pjmedia_rtcp_stat *stat, struct rtp_quality *quality)
+{
+	quality->packets = stat->rx.pkt;
+	quality->lost = stat->rx.loss;
+	quality->loss = stat->rx.pkt + stat->rx.loss > 0 ? (double)stat->rx.loss / (stat->rx.pkt + stat->rx.loss) : 0;
+	quality->jitter_ms = stat->rx.jitter.n > 0 ? stat->rx.jitter.mean / 1000.0 : 0;
+	quality->rtt_ms = stat->rtt.n > 0 ? stat->rtt.mean / 1000.0 : 0;
+	quality->mos = mos_estimate(quality);
+}
+
+int rtpstat_get(pjsua_call_id call_id, struct rtp_quality *quality)
+{
+	pjsua_stream_stat stat;
+
+	if (pjsua_call_get_stream_stat(call_id, 0, &stat) != PJ_SUCCESS) return 1;
+
+	rtpstat_quality(&stat.rtcp, quality);
+	return 0;
+}
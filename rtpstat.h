@@ -0,0 +1,42 @@
+/*
+=================================================================================
+ Name        : rtpstat.h
+ Version     : 0.1
+
+ Description :
+     Receive quality of a call from the RTP/RTCP statistics of its stream:
+     loss, jitter, round trip and a MOS estimate after the E-model.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef RTPSTAT_H
+#define RTPSTAT_H
+
+// definition of endianess (e.g. needed on raspberry pi)
+#define PJ_IS_LITTLE_ENDIAN 1
+#define PJ_IS_BIG_ENDIAN 0
+
+#include <pjsua-lib/pjsua.h>
+
+struct rtp_quality {
+	unsigned long packets;  // received
+	unsigned long lost;
+	double loss;            // lost / expected, 0..1
+	double jitter_ms;       // mean receive jitter
+	double rtt_ms;          // mean round trip, 0 if unknown
+	double mos;             // estimated listening quality, 1..4.5
+};
+
+// quality from the statistics of a stream
+void rtpstat_quality(const pjmedia_rtcp_stat *stat, struct rtp_quality *quality);
+
+// quality of the audio stream of a running call; returns 0 on success
+int rtpstat_get(pjsua_call_id call_id, struct rtp_quality *quality);
+
+#endif
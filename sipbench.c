@@ -0,0 +1,840 @@
+/*
+=================================================================================
+ Name        : sipbench.c
+ Version     : 0.1
+
+ Description :
+     Loopback load generator for sipserv. Answers REGISTER requests as a
+     registrar stand-in, places calls in steps of rising concurrency and
+     call rate, plays audio and sends DTMF into them, and reports setup
+     latency percentiles, dropped calls and CPU and memory of the server.
+
+ Dependencies:
+	- PJSUA API (PJSIP)
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// definition of endianess (e.g. needed on raspberry pi)
+#define PJ_IS_LITTLE_ENDIAN 1
+#define PJ_IS_BIG_ENDIAN 0
+
+// includes
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <pjsua-lib/pjsua.h>
+#include "evloop.h"
+#include "media.h"
+
+// defaults of the options
+#define DEFAULT_TARGET "sip:sipserv@127.0.0.1:5060"
+#define DEFAULT_LOCAL_PORT 5070
+#define DEFAULT_STEPS "1,2,4"
+#define DEFAULT_CPS "2"
+#define DEFAULT_STEP_CALLS 20
+#define DEFAULT_HOLD 5000
+#define DEFAULT_DTMF_DELAY 1000
+#define DEFAULT_REGISTER_WAIT 30
+
+// a call not confirmed within this time is hung up and counted as failed
+#define SETUP_TIMEOUT 30000
+
+// steps of the ramp (option -c)
+#define MAX_STEPS 16
+
+// longest sleep of the app loop in ms
+#define LOOP_INTERVAL 100
+
+// disable pjsua logging
+#define PJSUA_LOG_LEVEL 0
+
+// struct for app configuration settings
+struct app_config {
+	char *target;
+	int local_port;
+	int steps[MAX_STEPS];    // concurrent calls per step
+	double cps[MAX_STEPS];   // new calls per second per step, 0 = no limit
+	int step_count;
+	int step_calls;
+	int hold;
+	char *dtmf;
+	int dtmf_delay;
+	char *wav;
+	int wideband;
+	char *codecs;
+	char *server;
+	pid_t server_pid;
+	int register_wait;
+	char *csv_file;
+	int silent_mode;
+} app_cfg;
+
+// a call of the benchmark
+struct bench_call {
+	int in_use;
+	pjsua_call_id call_id;
+	double started;         // ms, see clock_ms()
+	double confirmed;       // 0 = not yet
+	int status;
+	int hangup_sent;
+	int disconnected;
+	int digits_sent;
+	double next_digit;
+};
+
+// results of one step
+struct step_result {
+	int concurrency;
+	double cps;
+	int calls;
+	int ok;
+	int failed;             // never confirmed
+	int dropped;            // ended by the server before we hung up
+	double *setup;          // ms from INVITE to confirmed, of the ok and dropped calls
+	int setup_count;
+	double seconds;
+	double cpu_ms;          // cpu time of the server during the step
+	long rss_kb;            // rss of the server at the end of the step
+};
+
+// global vars
+pjsua_acc_id acc_id;
+pjsua_player_id player_id = PJSUA_INVALID_ID;
+struct bench_call *calls;
+int max_calls;
+pthread_mutex_t calls_lock = PTHREAD_MUTEX_INITIALIZER;
+int registrations = 0;
+int stopping = 0;
+
+// header of helper-methods
+static void usage(int);
+static int try_get_argument(int, char *, char **, int, char *[]);
+static void log_message(char *);
+static double clock_ms(void);
+static int parse_list(const char *, double *, int);
+static void parse_arguments(int, char *[]);
+static void setup_sip(void);
+static void start_server(void);
+static void stop_server(void);
+static int server_sample(double *, long *);
+static int wait_for_registration(void);
+static void run_step(int, struct step_result *);
+static void report(struct step_result *, int, long);
+
+// header of callback-methods
+static pj_bool_t on_rx_request(pjsip_rx_data *);
+static void on_call_media_state(pjsua_call_id);
+static void on_call_state(pjsua_call_id, pjsip_event *);
+
+// header of app-control-methods
+static void app_exit();
+static void error_exit(const char *, pj_status_t);
+
+// registrar stand-in: takes the REGISTER requests before pjsua rejects them
+static pjsip_module mod_registrar = {
+	NULL, NULL,                              // prev, next
+	{ "mod-bench-registrar", 19 },           // name
+	-1,                                      // id
+	PJSIP_MOD_PRIORITY_APPLICATION - 1,      // priority
+	NULL, NULL, NULL, NULL,                  // load, start, stop, unload
+	&on_rx_request,                          // on_rx_request
+	NULL, NULL, NULL, NULL,                  // on_rx_response, on_tx_request, on_tx_response, on_tsx_state
+};
+
+int main(int argc, char *argv[])
+{
+	app_cfg.target = DEFAULT_TARGET;
+	app_cfg.local_port = DEFAULT_LOCAL_PORT;
+	app_cfg.step_calls = DEFAULT_STEP_CALLS;
+	app_cfg.hold = DEFAULT_HOLD;
+	app_cfg.dtmf_delay = DEFAULT_DTMF_DELAY;
+	app_cfg.register_wait = DEFAULT_REGISTER_WAIT;
+
+	parse_arguments(argc, argv);
+
+	// print infos
+	log_message("SIP Bench - Loopback load generator for sipserv\n");
+	log_message("===============================================\n");
+
+	// signals are taken by the app loop; this must happen before any thread is started
+	if (evloop_init() != 0)
+	{
+		log_message("Error setting up the event loop\n");
+		exit(1);
+	}
+
+	// as many calls as the largest step places
+	int i;
+	max_calls = 1;
+	for (i = 0; i < app_cfg.step_count; i++)
+	{
+		if (app_cfg.steps[i] > max_calls) max_calls = app_cfg.steps[i];
+	}
+	calls = calloc(max_calls, sizeof(struct bench_call));
+	if (calls == NULL)
+	{
+		log_message("Error allocating calls\n");
+		exit(1);
+	}
+
+	// setup up sip library pjsua, the registrar has to be up before the server starts
+	setup_sip();
+	start_server();
+
+	if (wait_for_registration() != 0)
+	{
+		log_message("Server did not register, giving up.\n");
+		app_exit();
+		return 1;
+	}
+
+	struct step_result results[MAX_STEPS];
+	memset(results, 0, sizeof(results));
+	double cpu;
+	long rss_start = 0;
+	server_sample(&cpu, &rss_start);
+
+	int done;
+	for (done = 0; done < app_cfg.step_count && !stopping; done++)
+	{
+		run_step(done, &results[done]);
+	}
+
+	report(results, done, rss_start);
+
+	for (i = 0; i < done; i++) free(results[i].setup);
+
+	// exit app
+	app_exit();
+
+	return 0;
+}
+
+// helper for displaying usage infos
+static void usage(int error)
+{
+	if (error == 1)
+	{
+		puts("Error, invalid arguments.");
+		puts  ("");
+	}
+	puts  ("Usage:");
+	puts  ("  sipbench [options]");
+	puts  ("");
+	puts  ("Options:");
+	puts  ("  -t=string     Call this uri (default " DEFAULT_TARGET ")");
+	puts  ("  -lp=int       Local sip port, the server registers here (default 5070)");
+	puts  ("  -x=string     Start this server command once the registrar is up, stop it at the end");
+	puts  ("  -pid=int      Measure this running server process instead of -x");
+	puts  ("  -rw=int       Seconds to wait for the server to register (default 30, 0 = don't wait)");
+	puts  ("  -c=list       Concurrent calls of each step (default " DEFAULT_STEPS ")");
+	puts  ("  -cps=list     New calls per second of each step, the last value repeats (default " DEFAULT_CPS ", 0 = no limit)");
+	puts  ("  -n=int        Calls per step (default 20)");
+	puts  ("  -hold=int     Hang up x ms after the call is confirmed (default 5000)");
+	puts  ("  -dtmf=string  Digits to send into each call, one per -dd ms");
+	puts  ("  -dd=int       ms before the first and between the digits (default 1000)");
+	puts  ("  -wav=string   Play this WAV file into each call (looped)");
+	puts  ("  -wb=int       Wideband media profile, offer G.722/Opus first (0/1)");
+	puts  ("  -ac=string    Codecs to offer, preferred first (e.g. G722,PCMA), others are disabled");
+	puts  ("  -o=string     Append the results of each step to this CSV file");
+	puts  ("  -s=int        Silent mode (hide info messages) (0/1)");
+	puts  ("");
+
+	fflush(stdout);
+}
+
+// helper for parsing command-line-argument
+static int try_get_argument(int arg, char *arg_id, char **arg_val, int argc, char *argv[])
+{
+	int found = 0;
+
+	// check if actual argument is searched argument
+	if (!strcasecmp(argv[arg], arg_id))
+	{
+		// check if actual argument has a value
+		if (argc > (arg+1))
+		{
+			// set value
+			*arg_val = argv[arg+1];
+			found = 1;
+		}
+	}
+	return found;
+}
+
+// helper for logging messages to console (disabled if silent mode is active)
+static void log_message(char *message)
+{
+	if (!app_cfg.silent_mode)
+	{
+		fprintf(stderr, "%s", message);
+	}
+}
+
+// milliseconds since some fixed point, for call timings
+static double clock_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// parse a comma separated list of numbers; returns the count, -1 on error
+static int parse_list(const char *list, double *values, int size)
+{
+	int count = 0;
+	const char *p = list;
+
+	while (*p)
+	{
+		char *end;
+		if (count == size) return -1;
+		values[count++] = strtod(p, &end);
+		if (end == p || values[count-1] < 0) return -1;
+		if (*end == ',') end++;
+		else if (*end != '\0') return -1;
+		p = end;
+	}
+	return count;
+}
+
+// parse and handle arguments
+static void parse_arguments(int argc, char *argv[])
+{
+	char *steps = DEFAULT_STEPS;
+	char *cps = DEFAULT_CPS;
+	char *val;
+	int arg;
+
+	for (arg = 1; arg < argc; arg += 2)
+	{
+		if (!strcasecmp(argv[arg], "--help"))
+		{
+			usage(0);
+			exit(0);
+		}
+
+		if (try_get_argument(arg, "-t", &app_cfg.target, argc, argv)) continue;
+		if (try_get_argument(arg, "-x", &app_cfg.server, argc, argv)) continue;
+		if (try_get_argument(arg, "-c", &steps, argc, argv)) continue;
+		if (try_get_argument(arg, "-cps", &cps, argc, argv)) continue;
+		if (try_get_argument(arg, "-dtmf", &app_cfg.dtmf, argc, argv)) continue;
+		if (try_get_argument(arg, "-wav", &app_cfg.wav, argc, argv)) continue;
+		if (try_get_argument(arg, "-ac", &app_cfg.codecs, argc, argv)) continue;
+		if (try_get_argument(arg, "-o", &app_cfg.csv_file, argc, argv)) continue;
+
+		if (try_get_argument(arg, "-lp", &val, argc, argv)) { app_cfg.local_port = atoi(val); continue; }
+		if (try_get_argument(arg, "-pid", &val, argc, argv)) { app_cfg.server_pid = atoi(val); continue; }
+		if (try_get_argument(arg, "-rw", &val, argc, argv)) { app_cfg.register_wait = atoi(val); continue; }
+		if (try_get_argument(arg, "-n", &val, argc, argv)) { app_cfg.step_calls = atoi(val); continue; }
+		if (try_get_argument(arg, "-hold", &val, argc, argv)) { app_cfg.hold = atoi(val); continue; }
+		if (try_get_argument(arg, "-dd", &val, argc, argv)) { app_cfg.dtmf_delay = atoi(val); continue; }
+		if (try_get_argument(arg, "-wb", &val, argc, argv)) { app_cfg.wideband = atoi(val) != 0; continue; }
+		if (try_get_argument(arg, "-s", &val, argc, argv)) { app_cfg.silent_mode = atoi(val); continue; }
+
+		usage(1);
+		exit(1);
+	}
+
+	double values[MAX_STEPS];
+	int i, cps_count;
+	app_cfg.step_count = parse_list(steps, values, MAX_STEPS);
+	for (i = 0; i < app_cfg.step_count; i++)
+	{
+		app_cfg.steps[i] = (int)values[i];
+		if (app_cfg.steps[i] < 1 || app_cfg.steps[i] > PJSUA_MAX_CALLS) app_cfg.step_count = -1;
+	}
+	cps_count = parse_list(cps, values, MAX_STEPS);
+	if (app_cfg.step_count < 1 || cps_count < 1 || app_cfg.step_calls < 1 || app_cfg.local_port < 1)
+	{
+		usage(1);
+		exit(1);
+	}
+	for (i = 0; i < app_cfg.step_count; i++)
+	{
+		app_cfg.cps[i] = values[i < cps_count ? i : cps_count - 1];
+	}
+}
+
+// helper for setting up sip library pjsua
+static void setup_sip(void)
+{
+	pj_status_t status;
+	pjsua_transport_id transport_id;
+
+	log_message("Setting up pjsua ... ");
+
+	// create pjsua
+	status = pjsua_create();
+	if (status != PJ_SUCCESS) error_exit("Error in pjsua_create()", status);
+
+	// configure pjsua
+	pjsua_config cfg;
+	pjsua_config_default(&cfg);
+	cfg.max_calls = max_calls;
+	cfg.cb.on_call_media_state = &on_call_media_state;
+	cfg.cb.on_call_state = &on_call_state;
+
+	// logging configuration
+	pjsua_logging_config log_cfg;
+	pjsua_logging_config_default(&log_cfg);
+	log_cfg.console_level = PJSUA_LOG_LEVEL;
+
+	// every call needs a conference slot, all of them share the player
+	pjsua_media_config media_cfg;
+	pjsua_media_config_default(&media_cfg);
+	media_cfg.max_media_ports = max_calls + 2;
+	media_configure(&media_cfg, app_cfg.wideband, 0);
+
+	// initialize pjsua
+	status = pjsua_init(&cfg, &log_cfg, &media_cfg);
+	if (status != PJ_SUCCESS) error_exit("Error in pjsua_init()", status);
+
+	// the codecs offered decide the codec of the server side
+	media_set_codecs(app_cfg.codecs, app_cfg.wideband);
+
+	status = pjsip_endpt_register_module(pjsua_get_pjsip_endpt(), &mod_registrar);
+	if (status != PJ_SUCCESS) error_exit("Error registering registrar module", status);
+
+	// add udp transport
+	pjsua_transport_config udpcfg;
+	pjsua_transport_config_default(&udpcfg);
+	udpcfg.port = app_cfg.local_port;
+	status = pjsua_transport_create(PJSIP_TRANSPORT_UDP, &udpcfg, &transport_id);
+	if (status != PJ_SUCCESS) error_exit("Error creating transport", status);
+
+	// initialization is done, start pjsua
+	status = pjsua_start();
+	if (status != PJ_SUCCESS) error_exit("Error starting pjsua", status);
+
+	// disable sound - use null sound device
+	status = pjsua_set_null_snd_dev();
+	if (status != PJ_SUCCESS) error_exit("Error disabling audio", status);
+
+	// calls go out from a local account, nothing to register
+	status = pjsua_acc_add_local(transport_id, PJ_TRUE, &acc_id);
+	if (status != PJ_SUCCESS) error_exit("Error adding account", status);
+
+	// one looped player feeds all calls
+	if (app_cfg.wav)
+	{
+		pj_str_t name;
+		status = pjsua_player_create(pj_cstr(&name, app_cfg.wav), 0, &player_id);
+		if (status != PJ_SUCCESS) error_exit("Error opening wav file", status);
+	}
+
+	log_message("Done.\n");
+}
+
+// start the server command (option -x)
+static void start_server(void)
+{
+	if (app_cfg.server == NULL) return;
+
+	char info[300];
+	snprintf(info, sizeof(info), "Starting server: %s\n", app_cfg.server);
+	log_message(info);
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		// the event loop blocked these for us, not for the server
+		sigset_t mask;
+		sigemptyset(&mask);
+		pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+		execl("/bin/sh", "sh", "-c", app_cfg.server, (char *)NULL);
+		_exit(127);
+	}
+	if (pid < 0) error_exit("Error starting server", PJ_EUNKNOWN);
+	app_cfg.server_pid = pid;
+}
+
+// stop the server started by start_server
+static void stop_server(void)
+{
+	if (app_cfg.server == NULL || app_cfg.server_pid <= 0) return;
+
+	kill(app_cfg.server_pid, SIGTERM);
+	waitpid(app_cfg.server_pid, NULL, 0);
+	app_cfg.server_pid = 0;
+}
+
+// cpu time (ms) and rss (kB) of the server; returns 0 on success
+static int server_sample(double *cpu_ms, long *rss_kb)
+{
+	char path[64], line[256];
+	unsigned long utime, stime;
+
+	*cpu_ms = 0;
+	*rss_kb = 0;
+	if (app_cfg.server_pid <= 0) return 1;
+
+	// utime and stime are fields 14 and 15, counted after the command name
+	sprintf(path, "/proc/%i/stat", (int)app_cfg.server_pid);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) return 1;
+	char *stat = fgets(line, sizeof(line), file);
+	fclose(file);
+	if (stat == NULL || (stat = strrchr(line, ')')) == NULL) return 1;
+	if (sscanf(stat + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return 1;
+	*cpu_ms = (utime + stime) * 1000.0 / sysconf(_SC_CLK_TCK);
+
+	sprintf(path, "/proc/%i/status", (int)app_cfg.server_pid);
+	file = fopen(path, "r");
+	if (file == NULL) return 1;
+	while (fgets(line, sizeof(line), file))
+	{
+		if (sscanf(line, "VmRSS: %ld", rss_kb) == 1) break;
+	}
+	fclose(file);
+
+	return 0;
+}
+
+// wait until the server has registered with us
+static int wait_for_registration(void)
+{
+	if (app_cfg.register_wait <= 0) return 0;
+
+	log_message("Waiting for the server to register ... ");
+
+	double deadline = clock_ms() + app_cfg.register_wait * 1000.0;
+	for (;;)
+	{
+		pthread_mutex_lock(&calls_lock);
+		int registered = registrations > 0;
+		pthread_mutex_unlock(&calls_lock);
+		if (registered) break;
+
+		double left = deadline - clock_ms();
+		if (left <= 0) return 1;
+
+		int signo;
+		unsigned events = evloop_wait(left, &signo);
+		if (signo == SIGINT || signo == SIGTERM || signo == SIGHUP || (events & EVLOOP_QUIT)) return 1;
+	}
+
+	log_message("Done.\n");
+	return 0;
+}
+
+// place the calls of one step and collect their results
+static void run_step(int step, struct step_result *result)
+{
+	int concurrency = app_cfg.steps[step];
+	double interval = app_cfg.cps[step] > 0 ? 1000 / app_cfg.cps[step] : 0;
+	int digit_count = app_cfg.dtmf ? strlen(app_cfg.dtmf) : 0;
+	int started = 0, finished = 0, i;
+	double cpu_start, cpu_end;
+	long rss;
+
+	char info[200];
+	sprintf(info, "Step %i: %i concurrent calls, %.1f calls per second, %i calls\n",
+		step + 1, concurrency, app_cfg.cps[step], app_cfg.step_calls);
+	log_message(info);
+
+	result->concurrency = concurrency;
+	result->cps = app_cfg.cps[step];
+	result->setup = calloc(app_cfg.step_calls, sizeof(double));
+	server_sample(&cpu_start, &rss);
+
+	double begin = clock_ms();
+	double next_start = begin;
+
+	while (finished < started || (started < app_cfg.step_calls && !stopping))
+	{
+		pjsua_call_id hangup[max_calls];
+		pjsua_call_id dial[max_calls];
+		char digit[max_calls];
+		int hangup_count = 0, dial_count = 0, active = 0;
+		double now = clock_ms();
+		double wake = now + LOOP_INTERVAL;
+
+		// collect what is due; pjsua is called without the lock
+		pthread_mutex_lock(&calls_lock);
+		for (i = 0; i < max_calls; i++)
+		{
+			struct bench_call *call = &calls[i];
+			if (!call->in_use) continue;
+
+			if (call->disconnected)
+			{
+				if (call->confirmed == 0)
+				{
+					result->failed++;
+				}
+				else
+				{
+					if (call->hangup_sent) result->ok++;
+					else result->dropped++;
+					if (result->setup) result->setup[result->setup_count++] = call->confirmed - call->started;
+				}
+				call->in_use = 0;
+				finished++;
+				continue;
+			}
+			active++;
+			if (call->hangup_sent || call->call_id == PJSUA_INVALID_ID) continue;
+
+			if (call->confirmed == 0)
+			{
+				if (now - call->started >= SETUP_TIMEOUT || stopping)
+				{
+					call->hangup_sent = 1;
+					hangup[hangup_count++] = call->call_id;
+				}
+				else if (call->started + SETUP_TIMEOUT < wake) wake = call->started + SETUP_TIMEOUT;
+				continue;
+			}
+
+			if (now - call->confirmed >= app_cfg.hold || stopping)
+			{
+				call->hangup_sent = 1;
+				hangup[hangup_count++] = call->call_id;
+				continue;
+			}
+			if (call->confirmed + app_cfg.hold < wake) wake = call->confirmed + app_cfg.hold;
+
+			if (call->digits_sent < digit_count)
+			{
+				if (now >= call->next_digit)
+				{
+					digit[dial_count] = app_cfg.dtmf[call->digits_sent++];
+					dial[dial_count++] = call->call_id;
+					call->next_digit = now + app_cfg.dtmf_delay;
+				}
+				if (call->next_digit < wake) wake = call->next_digit;
+			}
+		}
+		pthread_mutex_unlock(&calls_lock);
+
+		for (i = 0; i < dial_count; i++)
+		{
+			char digits[2] = { digit[i], '\0' };
+			pj_str_t str = pj_str(digits);
+			pjsua_call_dial_dtmf(dial[i], &str);
+		}
+		for (i = 0; i < hangup_count; i++)
+		{
+			pjsua_call_hangup(hangup[i], 0, NULL, NULL);
+		}
+
+		// start new calls within the concurrency and the call rate
+		while (!stopping && started < app_cfg.step_calls && active < concurrency && now >= next_start)
+		{
+			struct bench_call *call = NULL;
+			pthread_mutex_lock(&calls_lock);
+			for (i = 0; i < max_calls; i++)
+			{
+				if (!calls[i].in_use)
+				{
+					call = &calls[i];
+					memset(call, 0, sizeof(struct bench_call));
+					call->in_use = 1;
+					call->call_id = PJSUA_INVALID_ID;
+					call->started = now;
+					break;
+				}
+			}
+			pthread_mutex_unlock(&calls_lock);
+			if (call == NULL) break;
+
+			pj_str_t uri = pj_str(app_cfg.target);
+			pjsua_call_id call_id;
+			if (pjsua_call_make_call(acc_id, &uri, 0, call, NULL, &call_id) != PJ_SUCCESS)
+			{
+				pthread_mutex_lock(&calls_lock);
+				call->disconnected = 1;
+				pthread_mutex_unlock(&calls_lock);
+			}
+			else
+			{
+				pthread_mutex_lock(&calls_lock);
+				call->call_id = call_id;
+				pthread_mutex_unlock(&calls_lock);
+			}
+
+			started++;
+			active++;
+			next_start = interval > 0 ? next_start + interval : now;
+			if (next_start < now - interval) next_start = now;
+		}
+		if (started < app_cfg.step_calls && active < concurrency && next_start < wake) wake = next_start;
+
+		int signo;
+		double timeout = wake - clock_ms();
+		unsigned events = evloop_wait(timeout > 0 ? (int)timeout + 1 : 0, &signo);
+		if (signo == SIGINT || signo == SIGTERM || signo == SIGHUP || (events & EVLOOP_QUIT))
+		{
+			log_message("Stopping, hanging up the calls ...\n");
+			stopping = 1;
+		}
+	}
+
+	result->calls = finished;
+	result->seconds = (clock_ms() - begin) / 1000;
+	server_sample(&cpu_end, &result->rss_kb);
+	result->cpu_ms = cpu_end - cpu_start;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+// nearest rank percentile of sorted values
+static double percentile(const double *values, int count, int p)
+{
+	if (count == 0) return 0;
+	int rank = (count * p + 99) / 100;
+	return values[rank > 0 ? rank - 1 : 0];
+}
+
+// print the table of all steps, and append it to the csv file
+static void report(struct step_result *results, int count, long rss_start)
+{
+	FILE *csv = NULL;
+	int i;
+
+	if (app_cfg.csv_file)
+	{
+		csv = fopen(app_cfg.csv_file, "a");
+		if (csv == NULL)
+		{
+			log_message("Error opening the csv file\n");
+		}
+		else if (ftell(csv) == 0)
+		{
+			fprintf(csv, "step,concurrency,cps,calls,ok,failed,dropped,setup_p50_ms,setup_p90_ms,setup_p99_ms,setup_max_ms,"
+				"calls_per_second,cpu_ms_per_call,rss_kb,rss_growth_kb\n");
+		}
+	}
+
+	printf("step conc   cps calls    ok fail drop  p50 ms  p90 ms  p99 ms  max ms  calls/s  cpu ms/call   rss kB  growth kB\n");
+	for (i = 0; i < count; i++)
+	{
+		struct step_result *r = &results[i];
+		qsort(r->setup, r->setup_count, sizeof(double), &compare_double);
+
+		double p50 = percentile(r->setup, r->setup_count, 50);
+		double p90 = percentile(r->setup, r->setup_count, 90);
+		double p99 = percentile(r->setup, r->setup_count, 99);
+		double max = r->setup_count ? r->setup[r->setup_count - 1] : 0;
+		double rate = r->seconds > 0 ? r->calls / r->seconds : 0;
+		double cpu = r->calls ? r->cpu_ms / r->calls : 0;
+		long growth = r->rss_kb ? r->rss_kb - rss_start : 0;
+
+		printf("%4i %4i %5.1f %5i %5i %4i %4i %7.1f %7.1f %7.1f %7.1f %8.2f %12.2f %8ld %10ld\n",
+			i + 1, r->concurrency, r->cps, r->calls, r->ok, r->failed, r->dropped,
+			p50, p90, p99, max, rate, cpu, r->rss_kb, growth);
+		if (csv)
+		{
+			fprintf(csv, "%i,%i,%.2f,%i,%i,%i,%i,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f,%ld,%ld\n",
+				i + 1, r->concurrency, r->cps, r->calls, r->ok, r->failed, r->dropped,
+				p50, p90, p99, max, rate, cpu, r->rss_kb, growth);
+		}
+	}
+	if (app_cfg.server_pid <= 0) printf("(no server process, cpu and rss not measured)\n");
+	fflush(stdout);
+
+	if (csv) fclose(csv);
+}
+
+// registrar stand-in: accept every REGISTER with its own contact
+static pj_bool_t on_rx_request(pjsip_rx_data *rdata)
+{
+	pjsip_endpoint *endpt = pjsua_get_pjsip_endpt();
+	pjsip_tx_data *tdata;
+
+	if (rdata->msg_info.msg->line.req.method.id != PJSIP_REGISTER_METHOD) return PJ_FALSE;
+
+	if (pjsip_endpt_create_response(endpt, rdata, 200, NULL, &tdata) != PJ_SUCCESS) return PJ_TRUE;
+
+	pjsip_hdr *contact = pjsip_msg_find_hdr(rdata->msg_info.msg, PJSIP_H_CONTACT, NULL);
+	if (contact) pjsip_msg_add_hdr(tdata->msg, pjsip_hdr_clone(tdata->pool, contact));
+	pjsip_hdr *expires = pjsip_msg_find_hdr(rdata->msg_info.msg, PJSIP_H_EXPIRES, NULL);
+	if (expires) pjsip_msg_add_hdr(tdata->msg, pjsip_hdr_clone(tdata->pool, expires));
+
+	pjsip_endpt_send_response2(endpt, rdata, tdata, NULL, NULL);
+
+	pthread_mutex_lock(&calls_lock);
+	registrations++;
+	pthread_mutex_unlock(&calls_lock);
+	evloop_post(EVLOOP_UPDATE);
+
+	return PJ_TRUE;
+}
+
+// handler for call-media-state-change-events
+static void on_call_media_state(pjsua_call_id call_id)
+{
+	pjsua_call_info ci;
+	pjsua_call_get_info(call_id, &ci);
+
+	if (ci.media_status == PJSUA_CALL_MEDIA_ACTIVE && player_id != PJSUA_INVALID_ID)
+	{
+		pjsua_conf_connect(pjsua_player_get_conf_port(player_id), ci.conf_slot);
+	}
+}
+
+// handler for call-state-change-events
+static void on_call_state(pjsua_call_id call_id, pjsip_event *e)
+{
+	PJ_UNUSED_ARG(e);
+
+	struct bench_call *call = pjsua_call_get_user_data(call_id);
+	if (call == NULL) return;
+
+	pjsua_call_info ci;
+	pjsua_call_get_info(call_id, &ci);
+
+	pthread_mutex_lock(&calls_lock);
+	call->call_id = call_id;
+	if (ci.state == PJSIP_INV_STATE_CONFIRMED && call->confirmed == 0 && !call->hangup_sent)
+	{
+		call->confirmed = clock_ms();
+		call->next_digit = call->confirmed + app_cfg.dtmf_delay;
+	}
+	if (ci.state == PJSIP_INV_STATE_DISCONNECTED)
+	{
+		call->status = ci.last_status;
+		call->disconnected = 1;
+	}
+	pthread_mutex_unlock(&calls_lock);
+
+	evloop_post(EVLOOP_UPDATE);
+}
+
+// clean application exit
+static void app_exit()
+{
+	pjsua_call_hangup_all();
+	if (player_id != PJSUA_INVALID_ID) pjsua_player_destroy(player_id);
+	stop_server();
+	pjsua_destroy();
+	evloop_close();
+	free(calls);
+}
+
+// display error and exit application
+static void error_exit(const char *title, pj_status_t status)
+{
+	pjsua_perror("SIP Bench", title, status);
+	stop_server();
+	pjsua_destroy();
+	exit(1);
+}
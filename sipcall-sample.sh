@@ -31,7 +31,6 @@
 sip_domain="fritz.box";
 sip_user="620";
 sip_password="password";
-play_file="play.wav";
 
 # define number to call
 phone_number="**1";
@@ -45,5 +44,5 @@ avgload15="$(uptime |awk -F'average: ' '{print $2}' |awk -F', ' '{print $3}')";
 tts="$(echo This is raspberry pi and the load is high. The average load within the last 5 minutes was $avgload5)";
 
 # make call with sipcall
-$(./sipcall -sd $sip_domain -su $sip_user -sp $sip_password -pn $phone_number -s 1 -mr 2 -tts "$tts" -ttsf $play_file > /dev/null);
+$(./sipcall -sd $sip_domain -su $sip_user -sp $sip_password -pn $phone_number -s 1 -mr 2 -tts "$tts" > /dev/null);
 
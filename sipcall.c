@@ -36,12 +36,26 @@ Lesser General Public License for more details.
 #define PJ_IS_BIG_ENDIAN 0
 
 // includes
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <pjsua-lib/pjsua.h>
+#include "campaign.h"
+#include "ctlsock.h"
+#include "evloop.h"
+#include "log.h"
+#include "media.h"
+#include "pcmport.h"
+#include "recport.h"
+#include "tts.h"
+#include "ttscache.h"
+#include "wavcache.h"
 
 // some espeak options
 #define ESPEAK_LANGUAGE "en"
@@ -50,9 +64,32 @@ Lesser General Public License for more details.
 #define ESPEAK_SPEED 150
 #define ESPEAK_PITCH 75
 
+// bitrate of mp3 recordings (-rcf file name ending in .mp3)
+#define RECORD_MP3_BITRATE 32
+
+// size of the speech cache on disk (option -ttsc)
+#define TTS_CACHE_DISK_LIMIT (64 << 20)
+
+// campaigns with per-target texts keep recent speech in memory as well
+#define TTS_CACHE_MEMORY_LIMIT (8 << 20)
+
+// campaign and daemon defaults (options -cl and -d)
+#define DEFAULT_CAMPAIGN_CALLS 4
+#define DEFAULT_CAMPAIGN_CPS 1.0
+
+// daemon requests waiting for a free call at most
+#define DAEMON_MAX_PENDING 100
+
+// local sip port (option -lp)
+#define DEFAULT_SIP_PORT 5060
+
 // disable pjsua logging
 #define PJSUA_LOG_LEVEL 0
 
+// log file (option -lf) is rotated at this size, the last ones are kept
+#define LOG_ROTATE_SIZE (10 << 20)
+#define LOG_KEEP 3
+
 // struct for app configuration settings
 struct app_config { 
 	char *sip_domain;
@@ -61,39 +98,111 @@ struct app_config {
 	char *phone_number;
 	char *tts;
 	char *tts_file;
+	char *tts_cache;
+	char *wav;
 	int record_call;
 	char *record_file;
 	int repetition_limit;
 	int silent_mode;
+	char *campaign_file;
+	char *outcome_file;
+	int max_calls;
+	double calls_per_second;
+	int ring_timeout;
+	char *daemon_socket;
+	char *daemon_connect;
+	int local_port;
+	char *log_file;
+	int log_level;
+	int wideband;
+	char *codecs;
+	int ptime;
 } app_cfg;  
 
+// a request of a daemon client, waiting for a free call
+struct pending {
+	struct campaign_target target;
+	int client;                     // connection waiting for the outcome
+	struct pending *next;
+};
+
+// a call to one target; a single call is a campaign of one target
+struct call {
+	struct campaign_target *target; // NULL = slot is free
+	struct pending *request;        // daemon request, freed with the call
+	int repetitions;
+	int ring_timeout;
+	char record_file[256];          // empty = no recording
+	pjsua_call_id call_id;
+	int confirmed;
+	int plays;                      // complete repetitions, counted by the media thread
+	int hangup_sent;
+	int timed_out;                  // hung up because nobody answered in time
+	int disconnected;               // the call is over, the slot can be reused
+	double started;                 // ms, see clock_ms()
+	double answered;
+	double ended;
+	int sip_code;
+	char reason[64];
+	struct pcm_buf *speech;         // synthesized text or the samples of the wav file
+	pjsua_conf_port_id play_slot;
+	pj_pool_t *play_pool;
+	pjmedia_port *play_port;
+	pjsua_conf_port_id rec_slot;
+	pj_pool_t *rec_pool;
+	pjmedia_port *rec_port;
+};
+
 // global helper vars
-int call_confirmed = 0;
-int media_counter = 0;
 int app_exiting = 0;
 
 // global vars for pjsua
 pjsua_acc_id acc_id;
-pjsua_player_id play_id = PJSUA_INVALID_ID;
-pjmedia_port *play_port;
-pjsua_recorder_id rec_id = PJSUA_INVALID_ID;
+
+// call slots (app_cfg.max_calls); confirmed, disconnected and the
+// results are set by the pjsua callbacks and guarded by calls_lock
+struct call *calls;
+pthread_mutex_t calls_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// targets to call and where their outcomes go
+struct campaign_target *targets;
+int target_count;
+FILE *outcomes;
+
+// daemon requests, guarded by calls_lock
+struct pending *pending_head;
+struct pending **pending_tail = &pending_head;
+int pending_count;
+
+// synthesized message for targets without own text
+struct pcm_buf *speech;
+struct tts_voice voice;
 
 // header for new functions
 static void default_configs(void);
 void verify_arguments(int argc);
 static void handle_help_request(const char* arg);
 int check_sip_argument(int arg, int argc, char *argv[]);
+int check_campaign_options(int arg, int argc, char *argv[]);
+int check_daemon_options(int arg, int argc, char *argv[]);
 int check_call_options(int arg, int argc, char *argv[]);
 static void parse_arguments(int argc, char *argv[]);
 
 // header of helper-methods
-static void create_player(pjsua_call_id);
-static void create_recorder(pjsua_call_info);
-static void log_message(char *);
-static void make_sip_call();
+static double clock_ms(void);
+static pj_status_t create_player(struct call *, pjsua_call_info *);
+static pj_status_t create_recorder(struct call *, pjsua_call_info *);
+static int daemon_request(void);
+static void finish_call(struct call *, const char *);
+static void load_targets(void);
+static int run_calls(void);
 static void register_sip(void);
 static void setup_sip(void);
-static void synthesize_speech(char *);
+static void reply_outcome(int, const struct campaign_target *, const struct campaign_outcome *);
+static void start_call(struct call *, struct campaign_target *, struct pending *);
+static void synthesize_speech(void);
+static void player_destroy(struct call *);
+static void recorder_destroy(struct call *);
 static void usage(int);
 static int try_get_argument(int, char *, char **, int, char *[]);
 
@@ -101,7 +210,8 @@ static int try_get_argument(int, char *, char **, int, char *[]);
 static void on_call_media_state(pjsua_call_id);
 static void on_call_state(pjsua_call_id, pjsip_event *);
 static pj_status_t on_media_finished(pjmedia_port *, void *);
-static void signal_handler(int);
+static void on_reg_state(pjsua_acc_id);
+static void on_request(int, char *);
 
 // header of app-control-methods
 static void app_exit();
@@ -119,23 +229,54 @@ int main(int argc, char *argv[])
 	// parse arguments
 	parse_arguments(argc, argv);
 	
-	if (!app_cfg.sip_domain || !app_cfg.sip_user || !app_cfg.sip_password || !app_cfg.phone_number || !app_cfg.tts)
+	// a request for a running daemon needs no sip settings
+	if (app_cfg.daemon_connect)
+	{
+		if (!app_cfg.phone_number || (!app_cfg.tts && !app_cfg.wav))
+		{
+			usage(1);
+			exit(1);
+		}
+		return daemon_request();
+	}
+	
+	if (!app_cfg.sip_domain || !app_cfg.sip_user || !app_cfg.sip_password
+		|| (!app_cfg.campaign_file && !app_cfg.daemon_socket && (!app_cfg.phone_number || (!app_cfg.tts && !app_cfg.wav))))
 	{
 		// too few arguments specified - display usage info and exit app
 		usage(1);
 		exit(1);
 	}
 	
+	// signals are taken by the app loop; this must happen before any thread is started
+	if (evloop_init() != 0)
+	{
+		log_error(LOG_NO_CALL, "Error setting up the event loop");
+		exit(1);
+	}
+	
+	// start the log writer, silent mode leaves warnings and errors only
+	struct log_config log_cfg;
+	log_cfg.file = app_cfg.log_file;
+	log_cfg.level = app_cfg.log_level;
+	if (app_cfg.silent_mode && log_cfg.level > LOG_WARN) log_cfg.level = LOG_WARN;
+	log_cfg.max_size = LOG_ROTATE_SIZE;
+	log_cfg.keep = LOG_KEEP;
+	if (log_open(&log_cfg) != 0)
+	{
+		log_error(LOG_NO_CALL, "Error starting the log");
+		exit(1);
+	}
+	atexit(&log_close);
+	
 	// print infos
-	log_message("SIP Call - Simple TTS-based Automated Calls\n");
-	log_message("===========================================\n");
+	log_info(LOG_NO_CALL, "SIP Call - Simple TTS-based Automated Calls");
 	
-	// register signal handler for break-in-keys (e.g. ctrl+c)
-	signal(SIGINT, signal_handler);
-	signal(SIGKILL, signal_handler);
+	// read the campaign list, or make the single call a campaign of one target
+	load_targets();
 	
-	// synthesize speech 
-	synthesize_speech(app_cfg.tts_file);	
+	// synthesize speech, runs in the background while pjsua starts up
+	synthesize_speech();
 	
 	// setup up sip library pjsua
 	setup_sip();
@@ -143,11 +284,16 @@ int main(int argc, char *argv[])
 	// create account and register to sip server
 	register_sip();
 	
-	// initiate call
-	make_sip_call();
+	// the daemon takes requests from now on; a client gone early must not kill us
+	if (app_cfg.daemon_socket)
+	{
+		signal(SIGPIPE, SIG_IGN);
+		if (ctlsock_open(app_cfg.daemon_socket, &on_request) != 0) error_exit("Error opening control socket", PJ_EUNKNOWN);
+		log_info(LOG_NO_CALL, "Waiting for requests on %s", app_cfg.daemon_socket);
+	}
 	
-	// app loop
-	for (;;) { }
+	// app loop: place the calls and sleep until they are over or a signal comes in
+	run_calls();
 	
 	// exit app
 	app_exit();
@@ -170,14 +316,33 @@ static void usage(int error)
     puts  ("  -sd=string    Set sip provider domain.");
 	puts  ("  -su=string    Set sip username.");
 	puts  ("  -sp=string    Set sip password.");
-	puts  ("  -pn=string    Set target phone number to call");
-	puts  ("  -tts=string   Text to speak");
+	puts  ("  -pn=string    Set target phone number to call (not needed with -cl and -d)");
+	puts  ("  -tts=string   Text to speak (with -cl and -d: for targets without own text)");
     puts  ("");
 	puts  ("Optional options:");
-	puts  ("  -ttsf=string  TTS speech file name to save text");
-	puts  ("  -rcf=string   Record call file name to save answer");
+	puts  ("  -ttsf=string  obsolete, speech is no longer written to a file");
+	puts  ("  -ttsc=string  Speech cache directory, the text is synthesized only once");
+	puts  ("  -wav=string   Play this WAV file instead of text");
+	puts  ("  -rcf=string   Record call file name to save answer (.wav or .mp3)");
 	puts  ("  -mr=int       Repeat message x-times");
-	puts  ("  -s=int        Silent mode (hide info messages) (0/1)");
+	puts  ("  -s=int        Silent mode (only warnings and errors) (0/1)");
+	puts  ("  -ct=int       Hang up if the call is not answered within x seconds (0 = never)");
+	puts  ("  -lp=int       Local sip port (default 5060, 0 = any free port)");
+	puts  ("  -lf=string    Log file (default: stderr), rotated at 10 MB");
+	puts  ("  -ll=string    Log level: error, warn, info or debug (default info)");
+	puts  ("  -wb=int       Wideband media profile, 16 kHz and G.722/Opus first (0/1)");
+	puts  ("  -ac=string    Codecs to offer, preferred first (e.g. G722,PCMA), others are disabled");
+	puts  ("  -pt=int       Packet time in ms (default: codec default)");
+	puts  ("");
+	puts  ("Campaign options:");
+	puts  ("  -cl=string    File with the targets to call (CSV or JSON lines)");
+	puts  ("  -cc=int       Calls at the same time (default 4)");
+	puts  ("  -cps=float    New calls per second at most (default 1, 0 = no limit)");
+	puts  ("  -co=string    File to append the call outcomes to (default - = stdout)");
+	puts  ("");
+	puts  ("Daemon options:");
+	puts  ("  -d=string     Stay registered and take call requests on this socket");
+	puts  ("  -dc=string    Send the call to the daemon on this socket and wait for the outcome");
 	puts  ("");
 	
 	fflush(stdout);
@@ -202,13 +367,12 @@ static int try_get_argument(int arg, char *arg_id, char **arg_val, int argc, cha
 	return found;
 }
 
-// helper for logging messages to console (disabled if silent mode is active)
-static void log_message(char *message)
+// milliseconds since some fixed point, for call timings
+static double clock_ms(void)
 {
-	if (!app_cfg.silent_mode)
-	{
-		fprintf(stderr, message);
-	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
 }
 
 // helper for setting up sip library pjsua
@@ -216,8 +380,6 @@ static void setup_sip(void)
 {
 	pj_status_t status;
 	
-	log_message("Setting up pjsua ... ");
-	
 	// create pjsua  
 	status = pjsua_create();
 	if (status != PJ_SUCCESS) error_exit("Error in pjsua_create()", status);
@@ -226,27 +388,36 @@ static void setup_sip(void)
 	pjsua_config cfg;
 	pjsua_config_default(&cfg);
 	
-	// enable just 1 simultaneous call 
-	cfg.max_calls = 1;
+	// enable as many simultaneous calls as the campaign places
+	cfg.max_calls = app_cfg.max_calls;
 		
 	// callback configuration		
 	cfg.cb.on_call_media_state = &on_call_media_state;
 	cfg.cb.on_call_state = &on_call_state;
+	cfg.cb.on_reg_state = &on_reg_state;
 		
 	// logging configuration
 	pjsua_logging_config log_cfg;		
 	pjsua_logging_config_default(&log_cfg);
 	log_cfg.console_level = PJSUA_LOG_LEVEL;
+	
+	// media configuration: narrowband or wideband profile
+	pjsua_media_config media_cfg;
+	pjsua_media_config_default(&media_cfg);
+	media_configure(&media_cfg, app_cfg.wideband, app_cfg.ptime);
 		
 	// initialize pjsua 
-	status = pjsua_init(&cfg, &log_cfg, NULL);
+	status = pjsua_init(&cfg, &log_cfg, &media_cfg);
 	if (status != PJ_SUCCESS) error_exit("Error in pjsua_init()", status);
 	
+	// codec order of the media profile, or the one given by -ac
+	media_set_codecs(app_cfg.codecs, app_cfg.wideband);
+	
 	// add udp transport
 	pjsua_transport_config udpcfg;
 	pjsua_transport_config_default(&udpcfg);
 		
-	udpcfg.port = 5060;
+	udpcfg.port = app_cfg.local_port;
 	status = pjsua_transport_create(PJSIP_TRANSPORT_UDP, &udpcfg, NULL);
 	if (status != PJ_SUCCESS) error_exit("Error creating transport", status);
 	
@@ -258,7 +429,7 @@ static void setup_sip(void)
 	status = pjsua_set_null_snd_dev();
 	if (status != PJ_SUCCESS) error_exit("Error disabling audio", status);
 	
-	log_message("Done.\n");
+	log_info(LOG_NO_CALL, "pjsua set up");
 }
 
 // helper for creating and registering sip-account
@@ -266,8 +437,6 @@ static void register_sip(void)
 {
 	pj_status_t status;
 	
-	log_message("Registering account ... ");
-	
 	// prepare account configuration
 	pjsua_acc_config cfg;
 	pjsua_acc_config_default(&cfg);
@@ -294,113 +463,605 @@ static void register_sip(void)
 	status = pjsua_acc_add(&cfg, PJ_TRUE, &acc_id);
 	if (status != PJ_SUCCESS) error_exit("Error adding account", status);
 	
-	log_message("Done.\n");
+	log_info(LOG_NO_CALL, "Account %s added, registering", sip_user_url);
 }
 
-// helper for making calls over sip-account
-static void make_sip_call()
+// helper for reading the targets
+static void load_targets(void)
+{
+	int i;
+
+	if (app_cfg.campaign_file)
+	{
+		targets = campaign_load(app_cfg.campaign_file, &target_count);
+		if (targets == NULL) exit(1);
+
+		// targets without own text need the default text
+		for (i = 0; i < target_count; i++)
+		{
+			if (targets[i].text == NULL && targets[i].wav == NULL && app_cfg.tts == NULL)
+			{
+				log_error(LOG_NO_CALL, "Target in line %i has no text and -tts is not set", targets[i].line);
+				exit(1);
+			}
+		}
+
+		if (app_cfg.outcome_file == NULL) app_cfg.outcome_file = "-";
+		if (app_cfg.max_calls <= 0) app_cfg.max_calls = DEFAULT_CAMPAIGN_CALLS;
+	}
+	else if (app_cfg.daemon_socket)
+	{
+		// targets come in over the control socket
+		if (app_cfg.max_calls <= 0) app_cfg.max_calls = DEFAULT_CAMPAIGN_CALLS;
+	}
+	else
+	{
+		targets = calloc(1, sizeof(struct campaign_target));
+		if (targets == NULL) exit(1);
+		targets[0].number = strdup(app_cfg.phone_number);
+		if (app_cfg.wav) targets[0].wav = strdup(app_cfg.wav);
+		target_count = 1;
+		app_cfg.max_calls = 1;
+	}
+
+	if (app_cfg.max_calls > PJSUA_MAX_CALLS) app_cfg.max_calls = PJSUA_MAX_CALLS;
+	if (targets && app_cfg.max_calls > target_count) app_cfg.max_calls = target_count;
+
+	calls = calloc(app_cfg.max_calls, sizeof(struct call));
+	if (calls == NULL) exit(1);
+	for (i = 0; i < app_cfg.max_calls; i++)
+	{
+		calls[i].play_slot = PJSUA_INVALID_ID;
+		calls[i].rec_slot = PJSUA_INVALID_ID;
+	}
+
+	if (app_cfg.outcome_file)
+	{
+		outcomes = campaign_open_outcomes(app_cfg.outcome_file);
+		if (outcomes == NULL) exit(1);
+	}
+}
+
+// pick the recording file of a target, file stays empty if there is none
+static void record_file_name(struct campaign_target *target, char *file, size_t size)
+{
+	const char *name = app_cfg.record_call ? app_cfg.record_file : NULL;
+	const char *ext = name ? strrchr(name, '.') : NULL;
+
+	file[0] = '\0';
+	if (target->record)
+	{
+		snprintf(file, size, "%s", target->record);
+	}
+	else if (name == NULL)
+	{
+		// no recording
+	}
+	else if (targets != NULL && target_count == 1 && app_cfg.campaign_file == NULL)
+	{
+		snprintf(file, size, "%s", name);
+	}
+	else if (ext != NULL && strchr(ext, '/') == NULL)
+	{
+		// campaigns and the daemon record each target to its own file: name-<number>.ext
+		snprintf(file, size, "%.*s-%s%s", (int)(ext - name), name, target->number, ext);
+	}
+	else
+	{
+		snprintf(file, size, "%s-%s", name, target->number);
+	}
+}
+
+// helper for making a call to a target over sip-account
+static void start_call(struct call *call, struct campaign_target *target, struct pending *request)
 {
 	pj_status_t status;
 	
-	log_message("Starting call ... ");
+	memset(call, 0, sizeof(struct call));
+	call->target = target;
+	call->request = request;
+	call->repetitions = target->repeat > 0 ? target->repeat : app_cfg.repetition_limit;
+	call->ring_timeout = target->timeout > 0 ? target->timeout : app_cfg.ring_timeout;
+	record_file_name(target, call->record_file, sizeof(call->record_file));
+	call->call_id = PJSUA_INVALID_ID;
+	call->play_slot = PJSUA_INVALID_ID;
+	call->rec_slot = PJSUA_INVALID_ID;
+	call->started = clock_ms();
+	
+	// the speech of a target with own text is rendered while the phone rings,
+	// wav files are read once and shared by all calls playing them
+	if (target->wav)
+	{
+		call->speech = wavcache_get(target->wav, media_clock_rate(app_cfg.wideband));
+	}
+	else
+	{
+		call->speech = target->text ? tts_speak(target->text, &voice) : pcm_buf_ref(speech);
+	}
 	
 	// build target sip-url
-	char sip_target_url[40];
-	sprintf(sip_target_url, "sip:%s@%s", app_cfg.phone_number, app_cfg.sip_domain);
+	char sip_target_url[160];
+	snprintf(sip_target_url, sizeof(sip_target_url), "sip:%s@%s", target->number, app_cfg.sip_domain);
 	
-	// start call with sip-url
+	// start call with sip-url, the callbacks find the call by its user data
 	pj_str_t uri = pj_str(sip_target_url);
-	status = pjsua_call_make_call(acc_id, &uri, 0, NULL, NULL, NULL);
-	if (status != PJ_SUCCESS) error_exit("Error making call", status);
+	status = call->speech ? PJ_SUCCESS : target->wav ? PJ_ENOTFOUND : PJ_ENOMEM;
+	if (status == PJ_SUCCESS) status = pjsua_call_make_call(acc_id, &uri, 0, call, NULL, &call->call_id);
+	if (status != PJ_SUCCESS)
+	{
+		log_error(LOG_NO_CALL, "Error making call to %s (status %i)", target->number, status);
+		pthread_mutex_lock(&calls_lock);
+		if (!call->disconnected)
+		{
+			call->disconnected = 1;
+			call->ended = clock_ms();
+			pj_strerror(status, call->reason, sizeof(call->reason));
+		}
+		pthread_mutex_unlock(&calls_lock);
+		evloop_post(EVLOOP_UPDATE);
+		return;
+	}
 	
-	log_message("Done.\n");
+	log_info(call->call_id, "Calling %s", target->number);
+}
+
+// send an outcome to a daemon client and close the connection
+static void reply_outcome(int client, const struct campaign_target *target, const struct campaign_outcome *outcome)
+{
+	FILE *file = fdopen(client, "w");
+	if (file == NULL)
+	{
+		close(client);
+		return;
+	}
+	campaign_write_outcome(file, target, outcome);
+	fclose(file);
+}
+
+// write the outcome of a call and free its slot; result NULL = from the call state
+static void finish_call(struct call *call, const char *result)
+{
+	struct campaign_outcome outcome;
+	double now = clock_ms();
+
+	pthread_mutex_lock(&calls_lock);
+	if (call->ended == 0) call->ended = now;
+
+	outcome.result = result;
+	outcome.sip_code = call->sip_code;
+	outcome.reason = call->reason[0] ? call->reason : NULL;
+	outcome.plays = __atomic_load_n(&call->plays, __ATOMIC_ACQUIRE);
+	outcome.ring_ms = ((call->confirmed ? call->answered : call->ended) - call->started);
+	outcome.talk_ms = call->confirmed ? (call->ended - call->answered) : 0;
+
+	if (result != NULL)
+	{
+		// given by the caller
+	}
+	else if (call->confirmed)
+	{
+		outcome.result = outcome.plays >= call->repetitions ? "delivered" : "hangup";
+	}
+	else if (call->timed_out)
+	{
+		outcome.result = "no-answer";
+	}
+	else
+	{
+		switch (call->sip_code)
+		{
+		case 486:
+		case 600:
+			outcome.result = "busy";
+			break;
+		case 603:
+			outcome.result = "declined";
+			break;
+		case 408:
+		case 480:
+			outcome.result = "no-answer";
+			break;
+		default:
+			outcome.result = "failed";
+		}
+	}
+
+	campaign_write_outcome(outcomes, call->target, &outcome);
+	struct pending *request = call->request;
+	call->target = NULL;
+	call->request = NULL;
+	pthread_mutex_unlock(&calls_lock);
+
+	if (request != NULL)
+	{
+		reply_outcome(request->client, &request->target, &outcome);
+		campaign_clear(&request->target);
+		free(request);
+	}
+
+	pcm_buf_release(call->speech);
+	call->speech = NULL;
+
+	// the daemon gets any wav file a client names; keep only those still played
+	if (app_cfg.daemon_socket) wavcache_trim();
+}
+
+// place the calls and wait for them to end; returns 1 if stopped by a signal
+static int run_calls(void)
+{
+	int next = 0, done = 0;
+	double next_start = 0;
+	double interval = app_cfg.calls_per_second > 0 ? 1000.0 / app_cfg.calls_per_second : 0;
+	int i;
+
+	// the daemon runs until it is stopped
+	while (app_cfg.daemon_socket || done < target_count)
+	{
+		double now = clock_ms();
+		double wake = -1;
+		pjsua_call_id hangup[app_cfg.max_calls];
+		int hangup_count = 0;
+
+		// collect the ended calls and the ones to hang up
+		for (i = 0; i < app_cfg.max_calls; i++)
+		{
+			struct call *call = &calls[i];
+
+			pthread_mutex_lock(&calls_lock);
+			int in_use = call->target != NULL;
+			int disconnected = call->disconnected;
+			int confirmed = call->confirmed;
+			pthread_mutex_unlock(&calls_lock);
+
+			if (!in_use) continue;
+			if (disconnected)
+			{
+				finish_call(call, NULL);
+				done++;
+				continue;
+			}
+			if (call->hangup_sent) continue;
+
+			double deadline = call->started + call->ring_timeout * 1000.0;
+			if (confirmed && __atomic_load_n(&call->plays, __ATOMIC_ACQUIRE) >= call->repetitions)
+			{
+				hangup[hangup_count++] = call->call_id;
+				call->hangup_sent = 1;
+			}
+			else if (!confirmed && call->ring_timeout > 0 && now >= deadline)
+			{
+				pthread_mutex_lock(&calls_lock);
+				call->timed_out = 1;
+				pthread_mutex_unlock(&calls_lock);
+				hangup[hangup_count++] = call->call_id;
+				call->hangup_sent = 1;
+			}
+			else if (!confirmed && call->ring_timeout > 0 && (wake < 0 || deadline < wake))
+			{
+				wake = deadline;
+			}
+		}
+
+		// without any lock held, the callbacks may run right in here
+		for (i = 0; i < hangup_count; i++) pjsua_call_hangup(hangup[i], 0, NULL, NULL);
+
+		// start new calls as far as the limits allow
+		for (i = 0; i < app_cfg.max_calls; i++)
+		{
+			if (calls[i].target != NULL) continue;
+
+			pthread_mutex_lock(&calls_lock);
+			int available = next < target_count || pending_head != NULL;
+			pthread_mutex_unlock(&calls_lock);
+			if (!available) break;
+
+			if (now < next_start)
+			{
+				if (wake < 0 || next_start < wake) wake = next_start;
+				break;
+			}
+
+			if (next < target_count)
+			{
+				start_call(&calls[i], &targets[next++], NULL);
+			}
+			else
+			{
+				pthread_mutex_lock(&calls_lock);
+				struct pending *request = pending_head;
+				pending_head = request->next;
+				if (pending_head == NULL) pending_tail = &pending_head;
+				pending_count--;
+				pthread_mutex_unlock(&calls_lock);
+				start_call(&calls[i], &request->target, request);
+			}
+			next_start = now + interval;
+		}
+
+		if (!app_cfg.daemon_socket && done == target_count) break;
+
+		// sleep until a callback posts a change, a signal comes in or a timer is due
+		int signo;
+		int timeout = wake < 0 ? -1 : (wake > now ? (int)(wake - now) + 1 : 0);
+		unsigned events = evloop_wait(timeout, &signo);
+		if (signo == SIGINT || signo == SIGTERM || signo == SIGHUP || (events & EVLOOP_QUIT)) return 1;
+	}
+
+	return 0;
+}
+
+// daemon request from the control socket thread, queued for the app loop
+static void on_request(int client, char *line)
+{
+	struct campaign_outcome outcome = { "failed", 0, NULL, 0, 0, 0 };
+	struct pending *request = calloc(1, sizeof(struct pending));
+
+	if (request == NULL)
+	{
+		close(client);
+		return;
+	}
+	request->client = client;
+
+	if (campaign_parse(line, &request->target) != 0)
+	{
+		outcome.reason = "bad request";
+	}
+	else if (request->target.wav == NULL && request->target.text == NULL && app_cfg.tts == NULL)
+	{
+		outcome.reason = "no text";
+	}
+	else if (request->target.wav != NULL && access(request->target.wav, R_OK) != 0)
+	{
+		outcome.reason = "wav not readable";
+	}
+	else
+	{
+		pthread_mutex_lock(&calls_lock);
+		if (app_exiting || pending_count >= DAEMON_MAX_PENDING)
+		{
+			outcome.reason = "queue full";
+		}
+		else
+		{
+			*pending_tail = request;
+			pending_tail = &request->next;
+			pending_count++;
+		}
+		pthread_mutex_unlock(&calls_lock);
+	}
+
+	if (outcome.reason != NULL)
+	{
+		reply_outcome(client, &request->target, &outcome);
+		campaign_clear(&request->target);
+		free(request);
+		return;
+	}
+
+	evloop_post(EVLOOP_UPDATE);
+}
+
+// send the call to a running daemon and wait for its outcome; returns the exit code
+static int daemon_request(void)
+{
+	struct campaign_target target;
+
+	memset(&target, 0, sizeof(target));
+	target.number = app_cfg.phone_number;
+	target.text = app_cfg.tts;
+	target.wav = app_cfg.wav;
+	target.record = app_cfg.record_call ? app_cfg.record_file : NULL;
+	target.repeat = app_cfg.repetition_limit;
+	target.timeout = app_cfg.ring_timeout;
+
+	int fd = ctlsock_connect(app_cfg.daemon_connect);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "r+");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error connecting to sipcall daemon %s: %s\n", app_cfg.daemon_connect, strerror(errno));
+		if (fd >= 0) close(fd);
+		return 1;
+	}
+
+	campaign_write_request(file, &target);
+
+	// the answer comes when the call is over
+	char *line = NULL;
+	size_t line_size = 0;
+	int delivered = 0;
+	if (getline(&line, &line_size, file) > 0)
+	{
+		fputs(line, stdout);
+		delivered = strstr(line, ",delivered,") != NULL;
+	}
+	else
+	{
+		fprintf(stderr, "Error: no answer from sipcall daemon\n");
+	}
+	free(line);
+	fclose(file);
+
+	return delivered ? 0 : 1;
 }
 
 // helper for creating call-media-player
-static void create_player(pjsua_call_id call_id)
+static pj_status_t create_player(struct call *call, pjsua_call_info *ci)
 {
-	// get call infos
-	pjsua_call_info ci; 
-	pjsua_call_get_info(call_id, &ci);
-	
-	pj_str_t name;
 	pj_status_t status = PJ_ENOTFOUND;
+	pj_pool_t *pool;
+	pjmedia_port *port = NULL;
+	pjsua_conf_port_id slot;
 	
-	log_message("Creating player ... ");
+	// create looping player for the wav file or the synthesized message
+	pool = pjsua_pool_create("speech", 512, 512);
+	if (pool == NULL) return PJ_ENOMEM;
+	status = pcmport_create(pool, call->speech, 1, &port);
+	if (status == PJ_SUCCESS) status = pcmport_set_eof_cb(port, call, &on_media_finished);
+	if (status == PJ_SUCCESS) status = pjsua_conf_add_port(pool, port, &slot);
+	if (status != PJ_SUCCESS)
+	{
+		if (port) pjmedia_port_destroy(port);
+		pj_pool_release(pool);
+		return status;
+	}
 	
-	// create player for playback media		
-	status = pjsua_player_create(pj_cstr(&name, app_cfg.tts_file), 0, &play_id);
-	if (status != PJ_SUCCESS) error_exit("Error playing sound-playback", status);
+	pthread_mutex_lock(&calls_lock);
+	call->play_pool = pool;
+	call->play_port = port;
+	call->play_slot = slot;
+	pthread_mutex_unlock(&calls_lock);
 		
 	// connect active call to media player
-	pjsua_conf_connect(pjsua_player_get_conf_port(play_id), ci.conf_slot);
-	
-	// get media port (play_port) from play_id
-    status = pjsua_player_get_port(play_id, &play_port);
-	if (status != PJ_SUCCESS) error_exit("Error getting sound player port", status);
-	
-	// register media finished callback	
-    status = pjmedia_wav_player_set_eof_cb(play_port, NULL, &on_media_finished);
-	if (status != PJ_SUCCESS) error_exit("Error adding sound-playback callback", status);
+	pjsua_conf_connect(slot, ci->conf_slot);
 	
-	log_message("Done.\n");
+	log_debug(ci->id, "Player created");
+	return PJ_SUCCESS;
 }
 
 // helper for creating call-recorder
-static void create_recorder(pjsua_call_info ci)
+static pj_status_t create_recorder(struct call *call, pjsua_call_info *ci)
 {
-	// specify target file
-	pj_str_t rec_file = pj_str(app_cfg.record_file);
-	pj_status_t status = PJ_ENOTFOUND;
+	pj_status_t status;
+	pj_pool_t *pool;
+	pjmedia_port *port;
+	pjsua_conf_port_id slot;
 	
-	log_message("Creating recorder ... ");
+	// mp3 is encoded while recording, no lame run needed afterwards
+	enum recport_format format = RECPORT_WAV;
+	size_t len = strlen(call->record_file);
+	if (len > 4 && !strcasecmp(call->record_file + len - 4, ".mp3")) format = RECPORT_MP3;
+
+	// record at the clock rate of the conference bridge
+	pjsua_conf_port_info bridge;
+	status = pjsua_conf_get_port_info(0, &bridge);
+	if (status != PJ_SUCCESS) return status;
+
+	pool = pjsua_pool_create("recorder", 1024, 1024);
+	if (pool == NULL) return PJ_ENOMEM;
+
+	status = recport_create(pool, call->record_file, format, bridge.clock_rate, RECORD_MP3_BITRATE, 0, &port);
+	if (status != PJ_SUCCESS)
+	{
+		pj_pool_release(pool);
+		return status;
+	}
+
+	status = pjsua_conf_add_port(pool, port, &slot);
+	if (status != PJ_SUCCESS)
+	{
+		pjmedia_port_destroy(port);
+		pj_pool_release(pool);
+		return status;
+	}
 	
-	// Create recorder for call
-	status = pjsua_recorder_create(&rec_file, 0, NULL, 0, 0, &rec_id);
-	if (status != PJ_SUCCESS) error_exit("Error recording answer", status);
+	pthread_mutex_lock(&calls_lock);
+	call->rec_pool = pool;
+	call->rec_port = port;
+	call->rec_slot = slot;
+	pthread_mutex_unlock(&calls_lock);
 	
 	// connect active call to call recorder
-	pjsua_conf_port_id rec_port = pjsua_recorder_get_conf_port(rec_id);		
-	pjsua_conf_connect(ci.conf_slot, rec_port);
+	pjsua_conf_connect(ci->conf_slot, slot);
 	
-	log_message("Done.\n");
+	log_debug(ci->id, "Recorder created");
+	return PJ_SUCCESS;
 }
 
 // synthesize speech / create message via espeak
-static void synthesize_speech(char *file)
+static void synthesize_speech(void)
 {
-	log_message("Synthesizing speech ... ");
-	
-	int speech_status = -1;
-	char speech_command[200];
-	sprintf(speech_command, "espeak -v%s -a%i -k%i -s%i -p%i -w %s '%s'", ESPEAK_LANGUAGE, ESPEAK_AMPLITUDE, ESPEAK_CAPITALS_PITCH, ESPEAK_SPEED, ESPEAK_PITCH, file, app_cfg.tts);
-	speech_status = system(speech_command);
-	if (speech_status != 0) error_exit("Error while creating phone text", speech_status);
+	if (tts_init(media_clock_rate(app_cfg.wideband)) != 0) error_exit("Error loading espeak", PJ_EUNKNOWN);
+
+	// a single call plays one message, so only campaigns and the daemon use a memory cache
+	if (app_cfg.tts_cache)
+	{
+		struct ttscache_config cache_cfg;
+		cache_cfg.dir = app_cfg.tts_cache;
+		cache_cfg.memory_limit = (app_cfg.campaign_file || app_cfg.daemon_socket) ? TTS_CACHE_MEMORY_LIMIT : 0;
+		cache_cfg.disk_limit = TTS_CACHE_DISK_LIMIT;
+		if (ttscache_open(&cache_cfg) != 0) log_warn(LOG_NO_CALL, "Error opening speech cache, speech is synthesized without cache");
+	}
+
+	voice.language = ESPEAK_LANGUAGE;
+	voice.amplitude = ESPEAK_AMPLITUDE;
+	voice.capitals_pitch = ESPEAK_CAPITALS_PITCH;
+	voice.speed = ESPEAK_SPEED;
+	voice.pitch = ESPEAK_PITCH;
+
+	// the default text is shared by all targets without own text
+	if (app_cfg.tts)
+	{
+		speech = tts_speak(app_cfg.tts, &voice);
+		if (speech == NULL) error_exit("Error while creating phone text", PJ_ENOMEM);
+	}
 	
-	log_message("Done.\n");
+	log_info(LOG_NO_CALL, "Speech synthesis started");
+}
+
+// helper for removing the message player
+static void player_destroy(struct call *call)
+{
+	// take the port over, so callbacks and app exit don't destroy it twice
+	pthread_mutex_lock(&calls_lock);
+	pjsua_conf_port_id slot = call->play_slot;
+	call->play_slot = PJSUA_INVALID_ID;
+	pthread_mutex_unlock(&calls_lock);
+
+	if (slot != PJSUA_INVALID_ID)
+	{
+		pjsua_conf_remove_port(slot);
+		pjmedia_port_destroy(call->play_port);
+		pj_pool_release(call->play_pool);
+	}
+}
+
+// helper for removing the recorder, this finishes the file
+static void recorder_destroy(struct call *call)
+{
+	pthread_mutex_lock(&calls_lock);
+	pjsua_conf_port_id slot = call->rec_slot;
+	call->rec_slot = PJSUA_INVALID_ID;
+	pthread_mutex_unlock(&calls_lock);
+
+	if (slot != PJSUA_INVALID_ID)
+	{
+		pjsua_conf_remove_port(slot);
+		pjmedia_port_destroy(call->rec_port);
+		pj_pool_release(call->rec_pool);
+	}
 }
 
 // handler for call-media-state-change-events
 static void on_call_media_state(pjsua_call_id call_id)
 {
+	struct call *call = pjsua_call_get_user_data(call_id);
+	if (call == NULL) return;
+
 	// get call infos
 	pjsua_call_info ci; 
 	pjsua_call_get_info(call_id, &ci);
-	
-	pj_status_t status = PJ_ENOTFOUND;
 
-	// check state if call is established/active
-	if (ci.media_status == PJSUA_CALL_MEDIA_ACTIVE) {
+	// check state if call is established/active; re-invites come here too
+	if (ci.media_status == PJSUA_CALL_MEDIA_ACTIVE && call->play_slot == PJSUA_INVALID_ID) {
 	
-		log_message("Call media activated.\n");
+		log_debug(call_id, "Call media activated.");
 		
-		// create and start media player
-		create_player(call_id);
+		// create and start media player and call recorder
+		pj_status_t status = create_player(call, &ci);
+		if (status == PJ_SUCCESS && call->record_file[0])
+		{
+			status = create_recorder(call, &ci);
+		}
 		
-		// create and start call recorder
-		if (app_cfg.record_call)
+		// a broken request must not stop the other calls
+		if (status != PJ_SUCCESS)
 		{
-			create_recorder(ci);
+			log_error(call_id, "Error creating player or recorder (status %i)", status);
+			pthread_mutex_lock(&calls_lock);
+			pj_strerror(status, call->reason, sizeof(call->reason));
+			pthread_mutex_unlock(&calls_lock);
+			pjsua_call_hangup(call_id, 0, NULL, NULL);
 		}
 	} 
 }
@@ -408,6 +1069,14 @@ static void on_call_media_state(pjsua_call_id call_id)
 // handler for call-state-change-events
 static void on_call_state(pjsua_call_id call_id, pjsip_event *e)
 {
+	struct call *call = pjsua_call_get_user_data(call_id);
+	if (call == NULL) return;
+
+	// the outcome of a cancelled call is already written
+	pthread_mutex_lock(&calls_lock);
+	const char *number = call->target ? call->target->number : "-";
+	pthread_mutex_unlock(&calls_lock);
+
 	// get call infos
 	pjsua_call_info ci;
 	pjsua_call_get_info(call_id, &ci);
@@ -418,52 +1087,83 @@ static void on_call_state(pjsua_call_id call_id, pjsip_event *e)
 	// check call state
 	if (ci.state == PJSIP_INV_STATE_CONFIRMED) 
 	{
-		log_message("Call confirmed.\n");
+		log_info(call_id, "Call to %s confirmed.", number);
 		
-		call_confirmed = 1;
+		pthread_mutex_lock(&calls_lock);
+		call->confirmed = 1;
+		call->answered = clock_ms();
+		pjsua_conf_port_id play_slot = call->play_slot;
+		pthread_mutex_unlock(&calls_lock);
 		
 		// ensure that message is played from start
-		if (play_id != PJSUA_INVALID_ID)
+		if (play_slot != PJSUA_INVALID_ID)
 		{
-			pjmedia_wav_player_port_set_pos(play_port, 0);
+			pcmport_rewind(call->play_port);
 		}
 	}
 	if (ci.state == PJSIP_INV_STATE_DISCONNECTED) 
 	{
-		log_message("Call disconnected.\n");
+		log_info(call_id, "Call to %s disconnected, status %i.", number, ci.last_status);
 		
-		// exit app if call is finished/disconnected
-		app_exit();
+		// the recording is complete once the recorder is gone
+		player_destroy(call);
+		recorder_destroy(call);
+		
+		pthread_mutex_lock(&calls_lock);
+		call->disconnected = 1;
+		call->ended = clock_ms();
+		call->sip_code = ci.last_status;
+		if (call->reason[0] == '\0') snprintf(call->reason, sizeof(call->reason), "%.*s", (int)ci.last_status_text.slen, ci.last_status_text.ptr);
+		pthread_mutex_unlock(&calls_lock);
+		
+		// the slot is reused by the app loop
+		evloop_post(EVLOOP_UPDATE);
 	}
 }
 
-// handler for media-finished-events
+// handler for media-finished-events, runs in the media thread
 static pj_status_t on_media_finished(pjmedia_port *media_port, void *user_data)
 {
+	struct call *call = user_data;
+	
 	PJ_UNUSED_ARG(media_port);
-	PJ_UNUSED_ARG(user_data);
 	
-	if (call_confirmed)
+	if (__atomic_load_n(&call->confirmed, __ATOMIC_ACQUIRE))
 	{
 		// count repetition
-		media_counter++;
+		int plays = __atomic_add_fetch(&call->plays, 1, __ATOMIC_RELEASE);
 		
-		// exit app if repetition limit is reached
-		if (app_cfg.repetition_limit <= media_counter)
+		// hang up if repetition limit is reached, that's done by the app loop
+		if (call->repetitions <= plays)
 		{
-			app_exit();
+			evloop_post(EVLOOP_UPDATE);
 		}
 	}
 	
-	pj_status_t status;
-	return status;
+	return PJ_SUCCESS;
 }
 
-// handler for "break-in-key"-events (e.g. ctrl+c)
-static void signal_handler(int signal) 
+// handler for registration-state-change-events; pjsua keeps the account
+// registered, so the daemon only reports changes
+static void on_reg_state(pjsua_acc_id acc_id)
 {
-	// exit app
-	app_exit();
+	static int registered = -1;
+	pjsua_acc_info info;
+
+	if (pjsua_acc_get_info(acc_id, &info) != PJ_SUCCESS) return;
+
+	int ok = info.status / 100 == 2;
+	if (ok == registered) return;
+	registered = ok;
+
+	if (ok)
+	{
+		log_info(LOG_NO_CALL, "Registered.");
+	}
+	else
+	{
+		log_error(LOG_NO_CALL, "Registration failed: %i %.*s", info.status, (int)info.status_text.slen, info.status_text.ptr);
+	}
 }
 
 // clean application exit
@@ -472,17 +1172,52 @@ static void app_exit()
 	if (!app_exiting)
 	{
 		app_exiting = 1;
-		log_message("Stopping application ... ");
+		log_info(LOG_NO_CALL, "Stopping application ...");
 		
-		// check if player/recorder is active and stop them
-		if (play_id != -1) pjsua_player_destroy(play_id);
-		if (rec_id != -1) pjsua_recorder_destroy(rec_id);
+		// no more daemon requests; the queued ones and the calls still
+		// running when a signal came in are cancelled
+		ctlsock_close();
+		struct campaign_outcome cancelled = { "cancelled", 0, NULL, 0, 0, 0 };
+		while (pending_head)
+		{
+			struct pending *request = pending_head;
+			pending_head = request->next;
+			reply_outcome(request->client, &request->target, &cancelled);
+			campaign_clear(&request->target);
+			free(request);
+		}
+		pending_tail = &pending_head;
 		
-		// hangup open calls and stop pjsua
+		int i;
+		for (i = 0; i < app_cfg.max_calls; i++)
+		{
+			pthread_mutex_lock(&calls_lock);
+			int in_use = calls[i].target != NULL;
+			int disconnected = calls[i].disconnected;
+			pthread_mutex_unlock(&calls_lock);
+			if (in_use) finish_call(&calls[i], disconnected ? NULL : "cancelled");
+		}
+		
+		// hangup open calls, check if players/recorders are active and stop them
 		pjsua_call_hangup_all();
+		for (i = 0; i < app_cfg.max_calls; i++)
+		{
+			player_destroy(&calls[i]);
+			recorder_destroy(&calls[i]);
+		}
+		
+		// stop pjsua
 		pjsua_destroy();
+		pcm_buf_release(speech);
+		tts_shutdown();
+		ttscache_close();
+		wavcache_close();
+		
+		if (outcomes && outcomes != stdout) fclose(outcomes);
+		campaign_free(targets, target_count);
+		free(calls);
 		
-		log_message("Done.\n");
+		log_info(LOG_NO_CALL, "Stopped.");
 		
 		exit(0);
 	}
@@ -495,15 +1230,20 @@ static void error_exit(const char *title, pj_status_t status)
 	{
 		app_exiting = 1;
 		
-		pjsua_perror("SIP Call", title, status);
+		log_error(LOG_NO_CALL, "%s (status %i)", title, status);
 		
 		// check if player/recorder is active and stop them
-		if (play_id != -1) pjsua_player_destroy(play_id);
-		if (rec_id != -1) pjsua_recorder_destroy(rec_id);
+		int i;
+		for (i = 0; calls && i < app_cfg.max_calls; i++)
+		{
+			player_destroy(&calls[i]);
+			recorder_destroy(&calls[i]);
+		}
 		
 		// hangup open calls and stop pjsua
 		pjsua_call_hangup_all();
 		pjsua_destroy();
+		tts_shutdown();
 		
 		exit(1);
 	}
@@ -512,10 +1252,13 @@ static void error_exit(const char *title, pj_status_t status)
 // sets default values for app_cfg
 static void default_configs(void)
 {
-	app_cfg.tts_file = "play.wav";
 	app_cfg.record_call = 0;
 	app_cfg.repetition_limit = 3;
 	app_cfg.silent_mode = 0; 
+	app_cfg.calls_per_second = DEFAULT_CAMPAIGN_CPS;
+	app_cfg.ring_timeout = 0;
+	app_cfg.local_port = DEFAULT_SIP_PORT;
+	app_cfg.log_level = LOG_INFO;
 }
 
 void verify_arguments(int argc)
@@ -549,6 +1292,18 @@ static void parse_arguments(int argc, char *argv[])
 			continue;
 		}
 
+		// check for target list, call limits, outcome file and ring timeout
+		if (check_campaign_options(arg, argc, argv) == 1)
+		{
+			continue;
+		}
+
+		// check for daemon socket and local sip port
+		if (check_daemon_options(arg, argc, argv) == 1)
+		{
+			continue;
+		}
+
 		// check for text to speak, record call option, message repetition option, and silent mode option
 		if (check_call_options(arg, argc, argv) == 1)
 		{
@@ -591,6 +1346,116 @@ int check_sip_argument(int arg, int argc, char *argv[])
 	return 0;
 }
 
+int check_campaign_options(int arg, int argc, char *argv[])
+{
+	// check for target list
+	if (try_get_argument(arg, "-cl", &app_cfg.campaign_file, argc, argv) == 1)
+	{
+		return 1;
+	}
+
+	// check for outcome file
+	if (try_get_argument(arg, "-co", &app_cfg.outcome_file, argc, argv) == 1)
+	{
+		return 1;
+	}
+
+	// check for number of calls at the same time
+	char *cc;
+	if (try_get_argument(arg, "-cc", &cc, argc, argv) == 1)
+	{
+		app_cfg.max_calls = atoi(cc);
+		return 1;
+	}
+
+	// check for calls per second
+	char *cps;
+	if (try_get_argument(arg, "-cps", &cps, argc, argv) == 1)
+	{
+		app_cfg.calls_per_second = atof(cps);
+		return 1;
+	}
+
+	// check for ring timeout
+	char *ct;
+	if (try_get_argument(arg, "-ct", &ct, argc, argv) == 1)
+	{
+		app_cfg.ring_timeout = atoi(ct);
+		return 1;
+	}
+
+	return 0;
+}
+
+int check_daemon_options(int arg, int argc, char *argv[])
+{
+	// check for daemon socket
+	if (try_get_argument(arg, "-d", &app_cfg.daemon_socket, argc, argv) == 1)
+	{
+		return 1;
+	}
+
+	// check for socket of a running daemon
+	if (try_get_argument(arg, "-dc", &app_cfg.daemon_connect, argc, argv) == 1)
+	{
+		return 1;
+	}
+
+	// check for local sip port
+	char *lp;
+	if (try_get_argument(arg, "-lp", &lp, argc, argv) == 1)
+	{
+		app_cfg.local_port = atoi(lp);
+		return 1;
+	}
+
+	// check for log file
+	if (try_get_argument(arg, "-lf", &app_cfg.log_file, argc, argv) == 1)
+	{
+		return 1;
+	}
+
+	// check for log level
+	char *ll;
+	if (try_get_argument(arg, "-ll", &ll, argc, argv) == 1)
+	{
+		int level = log_parse_level(ll);
+		if (level < 0) log_warn(LOG_NO_CALL, "Unknown log level '%s', using info", ll);
+		else app_cfg.log_level = level;
+		return 1;
+	}
+
+	// check for wideband media profile
+	char *wb;
+	if (try_get_argument(arg, "-wb", &wb, argc, argv) == 1)
+	{
+		app_cfg.wideband = atoi(wb) != 0;
+		return 1;
+	}
+
+	// check for codec priority list
+	if (try_get_argument(arg, "-ac", &app_cfg.codecs, argc, argv) == 1)
+	{
+		return 1;
+	}
+
+	// check for packet time
+	char *pt;
+	if (try_get_argument(arg, "-pt", &pt, argc, argv) == 1)
+	{
+		app_cfg.ptime = atoi(pt);
+		return 1;
+	}
+
+	// check for wav file to play
+	if (try_get_argument(arg, "-wav", &app_cfg.wav, argc, argv) == 1)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
 int check_call_options(int arg, int argc, char *argv[])
 {
 	// check for text to speak
@@ -604,6 +1469,12 @@ int check_call_options(int arg, int argc, char *argv[])
 	{
 		return 1;
 	}
+
+	// check for speech cache option
+	if (try_get_argument(arg, "-ttsc", &app_cfg.tts_cache, argc, argv) == 1)
+	{
+		return 1;
+	}
 			
 	// check for record call option
 	if (try_get_argument(arg, "-rcf", &app_cfg.record_file, argc, argv) == 1)
@@ -41,4 +41,11 @@ if [ $1 = "stop" ]; then
 	pid="$(ps aux | awk '/[s]ipserv/ {print $2}' | head -1)";
 	$(kill $pid  > /dev/null);
 	echo "sipserv stopped.";
+fi
+
+if [ $1 = "reload" ]; then 
+	# read the config file again, calls and registration stay
+	pid="$(ps aux | awk '/[s]ipserv/ {print $2}' | head -1)";
+	$(kill -HUP $pid  > /dev/null);
+	echo "sipserv config reloaded.";
 fi
\ No newline at end of file
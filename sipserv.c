@@ -38,6 +38,7 @@ Lesser General Public License for more details.
 #define PJ_IS_BIG_ENDIAN 0
 
 // includes
+#include <ctype.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
@@ -45,7 +46,25 @@ Lesser General Public License for more details.
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
 #include <pjsua-lib/pjsua.h>
+#include "cdr.h"
+#include "config.h"
+#include "directport.h"
+#include "evloop.h"
+#include "jobqueue.h"
+#include "log.h"
+#include "media.h"
+#include "metrics.h"
+#include "numscreen.h"
+#include "pcmport.h"
+#include "proc.h"
+#include "recport.h"
+#include "rtpstat.h"
+#include "tts.h"
+#include "ttscache.h"
+#include "wavcache.h"
+#include "workpool.h"
 
 // some espeak options
 #define ESPEAK_AMPLITUDE 100
@@ -56,63 +75,314 @@ Lesser General Public License for more details.
 // disable pjsua logging
 #define PJSUA_LOG_LEVEL 0
 
-// define max supported dtmf settings
-#define MAX_DTMF_SETTINGS 9
+// dtmf keys which can have an action (config options dtmf.X.*), in the order of dtmf_cfg
+#define DTMF_KEYS "0123456789*#ABCD"
+#define MAX_DTMF_SETTINGS 16
+
+// menus of a config (config options menu.<name>.*), the top level included;
+// the top level is named "top" as a target of dtmf.X.menu
+#define MAX_MENUS 64
+#define MENU_TOP "top"
+
+// default number of simultaneous calls (config option mc)
+#define DEFAULT_MAX_CALLS 4
+
+// sip accounts of one process; account 0 is set by the top level options,
+// the others by acc.N.* (N = 1 .. MAX_ACCOUNTS - 1)
+#define MAX_ACCOUNTS 8
+
+// defaults for the screening command (config options ct, cd, cw)
+#define DEFAULT_CHECK_TIMEOUT 5000
+#define DEFAULT_CHECK_DECISION 1
+#define DEFAULT_CHECK_WORKERS 2
+
+// defaults for the aftermath queue (config options aq, aw, ar, ab)
+#define DEFAULT_AFTERMATH_QUEUE "aftermath.queue"
+#define DEFAULT_AFTERMATH_WORKERS 1
+#define DEFAULT_AFTERMATH_ATTEMPTS 5
+#define DEFAULT_AFTERMATH_BACKOFF 60
+#define AFTERMATH_BACKOFF_MAX 3600
+#define AFTERMATH_TIMEOUT 600
+
+// defaults for dtmf actions (config option dtmf.X.timeout)
+#define DEFAULT_DTMF_TIMEOUT 10000
+#define DTMF_WORKERS 2
+
+// recording formats (config option rf)
+#define RECORD_WAV 0
+#define RECORD_MP3 1
+#define RECORD_MP3_BITRATE 32
+
+// defaults for the speech cache (config options tc, tm, td), sizes in MB
+#define DEFAULT_TTS_CACHE "tts-cache"
+#define DEFAULT_TTS_CACHE_MEMORY 8
+#define DEFAULT_TTS_CACHE_DISK 64
+
+// metrics endpoint on localhost, 0 = off
+#define DEFAULT_METRICS_PORT 0
+
+// defaults for the log (config options lf, ll, lr), size in MB
+#define DEFAULT_LOG_LEVEL LOG_INFO
+#define DEFAULT_LOG_ROTATE 10
+#define LOG_KEEP 3
 
 // struct for app dtmf settings
 struct dtmf_config {
-	int id;
+	char key;
 	int active;
-	int processing_active;
 	char *description;
 	char *tts_intro;
 	char *tts_answer;
 	char *cmd;
+	int timeout;
+	char *menu;      // enter this menu instead of running cmd
+	int next;        // index of that menu in app_config.menus, -1 = none
 };
 
-// struct for app configuration settings
-struct app_config {
+// node of the menu graph, compiled at load; menus[0] is the top level
+struct menu_node {
+	char *name;
+	char *tts;
+	struct dtmf_config *keys;   // MAX_DTMF_SETTINGS, of the top level: dtmf_cfg
+	struct pcm_buf *prompt;     // tts and the key intros, in memory; the top level plays the intro
+};
+
+// settings of one sip account (line or trunk); an account other than 0
+// takes the settings it doesn't set from account 0 (-1 / NULL = not set)
+struct account_config {
 	char *sip_domain;
 	char *sip_user;
 	char *sip_password;
-	char *language;
-	int record_calls;
-	int silent_mode;
 	char *tts;
 	char *announcement_file;
 	char *CallCmd;
+	char *numbers_file;
+	int record_calls;
+	int record_format;
+	int record_trim;
 	char *AfterMath;
-	char *log_file;
+	struct pcm_buf *intro_speech; // tts and the dtmf intros, NULL in announcement mode
+	struct pcm_buf *announcement; // samples of af, shared through the wav cache
+};
+
+// struct for app configuration settings
+struct app_config {
+	char *language;
+	int silent_mode;
+	int max_calls;
+	int check_timeout;
+	int check_default;
+	int check_workers;
+	char *calls_log;
+	char *aftermath_queue;
+	int aftermath_workers;
+	int aftermath_attempts;
+	int aftermath_backoff;
+	char *tts_cache;
+	int tts_cache_memory;
+	int tts_cache_disk;
+	int metrics_port;
+	char *cdr_file;
+	char *log_output;
+	int log_level;
+	int log_rotate;
+	int wideband;
+	char *codecs;
+	int ptime;
+	int bypass;
+	char *config_file;
+	struct account_config acc[MAX_ACCOUNTS];
+	int account_count;
 	struct dtmf_config dtmf_cfg[MAX_DTMF_SETTINGS];
-} app_cfg;
+	struct menu_node *menus;
+	int menu_count;
+	struct config_file *source;   // holds the strings
+	int refs;                     // guarded by settings_lock
+};
+
+// settings at startup; those which can't be reloaded are always read from here
+struct app_config app_cfg;
+
+// settings for new calls, replaced by a reload (SIGHUP); calls keep the
+// settings they started with (see settings_get)
+struct app_config *active_cfg = &app_cfg;
+pthread_mutex_t settings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// dtmf action running on the dtmf workers
+struct dtmf_job {
+	pjsua_call_id call_id;
+	unsigned generation;
+	struct app_config *cfg;     // reference, d_cfg points into it
+	struct dtmf_config *d_cfg;
+	int digit;                  // index in the call record, -1 = not recorded
+	volatile int cancel;
+};
+
+// struct for per-call state, one slot per pjsua call id
+struct call_session {
+	int in_use;
+	unsigned generation;
+	pjsua_call_id call_id;
+	struct app_config *cfg;     // settings of the call, a reference
+	struct account_config *acc; // account called, in cfg
+	pthread_mutex_t media_lock; // guards player, recorder, conf_slot and the direct path
+	pthread_mutex_t decide_lock; // held by the screening worker from the check to the answer
+	pjsua_conf_port_id conf_slot;
+	pjsua_conf_port_id play_slot; // speech or announcement player, none on the direct path
+	pj_pool_t *play_pool;
+	pjmedia_port *play_port;
+	pjsua_conf_port_id rec_slot;  // recorder
+	pj_pool_t *rec_pool;
+	pjmedia_port *rec_port;
+	char rec_file[200];
+	unsigned long speech_ms;      // speech in the recording, set by recorder_destroy
+	pj_pool_t *direct_pool;       // bridge bypass (bp=1), lives as long as the stream
+	pjmedia_master_port *direct_clock;
+	pjmedia_port *direct_port;    // player and recorder are attached here
+	pjmedia_port *direct_dummy;   // stands in for the stream in the bridge
+	char number[100];
+	int menu;                  // menu node the caller is in, guarded by media_lock
+	struct dtmf_job *dtmf_job; // latest dtmf action, guarded by sessions_lock
+	int prompt_pending;        // media came up before the prompts were loaded
+	struct cdr cdr;            // stages of the call for the call record
+};
+
+// startup phases for the timing report
+enum startup_phase {
+	PHASE_CONFIG,
+	PHASE_SCREENING,
+	PHASE_AFTERMATH,
+	PHASE_SIP,
+	PHASE_WORKERS,
+	PHASE_REGISTER,
+	PHASE_ANNOUNCEMENT,
+	PHASE_ESPEAK,
+	PHASE_INTRO,
+	PHASE_COUNT
+};
+
+static const char *phase_names[PHASE_COUNT] = {
+	"config", "screening", "aftermath", "pjsua", "workers",
+	"registration", "announcement", "espeak", "intro"
+};
+
+// startup state; the prompts are loaded on a thread while pjsua comes up
+struct startup_state {
+	pthread_mutex_t lock;
+	struct timespec origin;
+	double begin[PHASE_COUNT];  // ms since origin
+	double end[PHASE_COUNT];
+	int done[PHASE_COUNT];
+	pthread_t preload;
+	int preload_ok;
+	int prompts_ready;          // intro or announcement can be played
+	int registered;
+	int reported;
+};
 
 // global holder vars for further app arguments
-char *tts_file = "play.wav";
-char *tts_answer_file = "ans.wav";
-char rec_ans_file[100] = "rec.wav"; // will be overwritten!
-char lastNumber[100] = "000"; // will be overwritten!
+struct tts_voice voice;
+struct startup_state startup = { PTHREAD_MUTEX_INITIALIZER };
 
 // global helper vars
 int app_exiting = 0;
 
-// global vars for pjsua
-pjsua_acc_id acc_id;
-pjsua_player_id play_id = PJSUA_INVALID_ID;
-pjmedia_port *play_port;
-pjsua_recorder_id rec_id = PJSUA_INVALID_ID;
-pjsua_call_id current_call = PJSUA_INVALID_ID;
+// global vars for pjsua, one account per acc entry of the settings
+pjsua_acc_id acc_ids[MAX_ACCOUNTS];
+
+// screening rules of the accounts with nf, shared by accounts of the same file
+struct numscreen *screens[MAX_ACCOUNTS];
+
+// session table, indexed by pjsua_call_id (size app_cfg.max_calls)
+struct call_session *sessions;
+pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned session_generation = 0;
+
+// workers running the screening command
+struct workpool *screen_pool;
+
+// durable queue running the aftermath command
+struct jobqueue *aftermath_queue;
+
+// workers running dtmf actions
+struct workpool *dtmf_pool;
+
+// metrics, served if a port is configured (see metrics.h)
+struct server_metrics {
+	struct metric *received;
+	struct metric *answered;
+	struct metric *rejected;
+	struct metric *busy;
+	struct metric *screened;
+	struct metric *screening_seconds;
+	struct metric *tts_seconds;
+	struct metric *tts_failures;
+	struct metric *aftermath_seconds;
+	struct metric *aftermath_ok;
+	struct metric *aftermath_failed;
+	struct metric *aftermath_timeout;
+	struct metric *aftermath_given_up;
+	struct metric *registered[MAX_ACCOUNTS];
+	struct metric *registration_status[MAX_ACCOUNTS];
+	struct metric *call_mos;
+	struct metric *call_loss;
+	struct metric *call_jitter;
+	struct metric *media_bridge;
+	struct metric *media_direct;
+} meter;
 
 // header of helper-methods
-static void create_player(pjsua_call_id, char *);
-static void create_recorder(pjsua_call_info);
-static void log_message(char *);
-static void parse_config_file(char *);
+static pj_status_t create_speech_player(struct call_session *, struct pcm_buf *, double *);
+static pj_status_t create_recorder(struct call_session *);
+static void player_destroy(struct call_session *);
+static int recorder_destroy(struct call_session *);
+static struct call_session *session_open(pjsua_call_id, struct app_config *, int);
+static struct call_session *session_get(pjsua_call_id);
+static void session_close(struct call_session *);
+static void session_close_all(void);
+static void session_cancel_all(void);
+static int session_is_current(pjsua_call_id, unsigned);
+static void default_config(struct app_config *);
+static int parse_config_file(const char *, struct app_config *);
+static struct app_config *settings_get(void);
+static struct app_config *settings_ref(struct app_config *);
+static void settings_release(struct app_config *);
+static void reload_config(void);
+static struct pcm_buf *render_prompt(const char *, const struct dtmf_config *);
+static int render_menus(struct app_config *);
+static void menus_free(struct app_config *);
+static int load_announcements(struct app_config *);
+static int render_intros(struct app_config *);
+static void greetings_free(struct app_config *);
+static int has_intro(const struct app_config *);
+static int intros_pending(const struct app_config *);
+static int screening_files(const struct app_config *);
+static int has_aftermath(const struct app_config *);
+static void screens_open(void);
+static void screens_reload(const struct app_config *);
+static void screens_close(void);
 static void register_sip(void);
+static int account_index(pjsua_acc_id);
 static void setup_sip(void);
-static int synthesize_speech(char *, char *, char *);
 static void usage(int);
 static int try_get_argument(int, char *, char **, int, char *[]);
-static int callBash(char* command, char* result);
+static void worker_thread_register(void);
+static void screen_job_run(void *);
+static void dtmf_job_run(void *);
+static void dtmf_job_free(void *);
+static void dtmf_cancel(struct call_session *);
+static void phase_begin(enum startup_phase);
+static void phase_end(enum startup_phase);
+static void startup_report(void);
+static void metrics_setup(void);
+static void metrics_collect(FILE *);
+static void on_tts_run(double, int);
+static void on_aftermath_run(unsigned long, int, int, double);
+static void *preload_thread(void *);
+static void start_prompt(struct call_session *);
+static void start_pending_prompts(void);
+static struct pcm_buf *menu_prompt(const struct call_session *, int);
+static void menu_enter(struct call_session *, int, double *);
 
 
 // header of callback-methods
@@ -120,8 +390,10 @@ static void on_incoming_call(pjsua_acc_id, pjsua_call_id, pjsip_rx_data *);
 static void on_call_media_state(pjsua_call_id);
 static void on_call_state(pjsua_call_id, pjsip_event *);
 static void on_dtmf_digit(pjsua_call_id, int);
-static void signal_handler(int);
-static char *trim_string(char *);
+static void on_reg_state(pjsua_acc_id);
+static void on_play_start(pjmedia_port *, void *);
+static void on_stream_created(pjsua_call_id, pjmedia_stream *, unsigned, pjmedia_port **);
+static void on_stream_destroyed(pjsua_call_id, pjmedia_stream *, unsigned);
 
 // header of app-control-methods
 static void app_exit();
@@ -130,28 +402,25 @@ static void error_exit(const char *, pj_status_t);
 // main application
 int main(int argc, char *argv[])
 {
-	// first set some default values
-	app_cfg.record_calls = 0;
-	app_cfg.silent_mode = 0;
-
-	// print infos
-	log_message("SIP Call - Simple TTS/DTMF-based answering machine\n");
-	log_message("==================================================\n");
-
-	// register signal handler for break-in-keys (e.g. ctrl+c)
-	signal(SIGINT, signal_handler);
-	signal(SIGKILL, signal_handler);
-
-	// init dtmf settings (dtmf 0 is reserved for exit call)
-	int i;
-	for (i = 0; i < MAX_DTMF_SETTINGS; i++)
+	// all startup timings are relative to this
+	clock_gettime(CLOCK_MONOTONIC, &startup.origin);
+	phase_begin(PHASE_CONFIG);
+
+	// first set some default values; the startup settings are never freed:
+	// app_cfg holds a reference of its own besides the one of active_cfg,
+	// so a reload or the last call using them can't drop the count to 0
+	default_config(&app_cfg);
+	app_cfg.refs = 2;
+
+	// signals are taken by the app loop; this must happen before any thread is started
+	if (evloop_init() != 0)
 	{
-		struct dtmf_config *d_cfg = &app_cfg.dtmf_cfg[i];
-		d_cfg->id = i+1;
-		d_cfg->active = 0;
-		d_cfg->processing_active = 0;
+		log_error(LOG_NO_CALL, "Error setting up the event loop");
+		exit(1);
 	}
 
+	int i;
+
 	// parse arguments
 	if (argc > 1)
 	{
@@ -171,7 +440,7 @@ int main(int argc, char *argv[])
 			{
 				if (argc >= (arg+1))
 				{
-					app_cfg.log_file = argv[arg+1];
+					app_cfg.config_file = argv[arg+1];
 				}
 				continue;
 			}
@@ -187,7 +456,7 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (!app_cfg.log_file)
+	if (!app_cfg.config_file)
 	{
 		// too few arguments specified - display usage info and exit app
 		usage(1);
@@ -195,77 +464,156 @@ int main(int argc, char *argv[])
 	}
 
 	// read app configuration from config file
-	parse_config_file(app_cfg.log_file);
+	if (parse_config_file(app_cfg.config_file, &app_cfg) != 0)
+	{
+		log_error(LOG_NO_CALL, "Error in config file %s, see sipserv -h", app_cfg.config_file);
+		exit(1);
+	}
 
-	if (!app_cfg.sip_domain || !app_cfg.sip_user || !app_cfg.sip_password || !app_cfg.language)
+	// start the log writer, silent mode leaves warnings and errors only
+	struct log_config log_cfg;
+	log_cfg.file = app_cfg.log_output;
+	log_cfg.level = app_cfg.log_level;
+	if (app_cfg.silent_mode && log_cfg.level > LOG_WARN) log_cfg.level = LOG_WARN;
+	log_cfg.max_size = app_cfg.log_rotate * 1024L * 1024L;
+	log_cfg.keep = LOG_KEEP;
+	if (log_open(&log_cfg) != 0)
 	{
-		log_message("Not enough stuff in config file\nsee sipserv -h\n");
-		// display usage info and exit app
-		usage(2); // fixme does not show after file has been opened.
+		log_error(LOG_NO_CALL, "Error starting the log");
 		exit(1);
 	}
+	atexit(&log_close);
+
+	// print infos
+	log_info(LOG_NO_CALL, "SIP Call - Simple TTS/DTMF-based answering machine");
 
-	if	(app_cfg.announcement_file)
+	// allocate session table, pjsua call ids are always below max_calls
+	sessions = calloc(app_cfg.max_calls, sizeof(struct call_session));
+	if (sessions == NULL)
 	{
-		log_message("Announcement mode\n");
+		log_error(LOG_NO_CALL, "Error allocating call sessions");
+		exit(1);
+	}
+	for (i = 0; i < app_cfg.max_calls; i++)
+	{
+		pthread_mutex_init(&sessions[i].media_lock, NULL);
+		pthread_mutex_init(&sessions[i].decide_lock, NULL);
+	}
 
-		FILE *file;
-		if ((file = fopen(app_cfg.announcement_file, "r")) == NULL)
-		{
-			if (errno == ENOENT)
-			{
-				log_message("Announcement file doesn't exist");
-			}
-			else
-			{
-				// Check for other errors too, like EACCES and EISDIR
-				log_message("Announcement file: some other error occured");
-			}
-			exit(1);
-		}
-		else
-		{
-			fclose(file);
-		}
+	for (i = 0; i < app_cfg.account_count; i++)
+	{
+		if (app_cfg.acc[i].announcement_file) log_info(LOG_NO_CALL, "Account %i: announcement mode", i);
 	}
 
-	// generate texts
-	log_message("Generating texts ... ");
+	voice.language = app_cfg.language;
+	voice.amplitude = ESPEAK_AMPLITUDE;
+	voice.capitals_pitch = ESPEAK_CAPITALS_PITCH;
+	voice.speed = ESPEAK_SPEED;
+	voice.pitch = ESPEAK_PITCH;
+	phase_end(PHASE_CONFIG);
 
-	char tts_buffer[1024];
-	strcpy(tts_buffer, app_cfg.tts);
-	strcat(tts_buffer, " ");
+	if (app_cfg.cdr_file && cdr_open(app_cfg.cdr_file) != 0)
+	{
+		log_warn(LOG_NO_CALL, "Call record file not writable, no call records");
+	}
 
-	for (i = 0; i < MAX_DTMF_SETTINGS; i++)
+	// metrics are counted always, the endpoint is optional
+	metrics_setup();
+	if (app_cfg.metrics_port > 0 && metrics_serve(app_cfg.metrics_port) != 0)
+	{
+		log_warn(LOG_NO_CALL, "Metrics endpoint on port %i not available", app_cfg.metrics_port);
+	}
+
+	// load espeak and the prompts in the background, pjsua starts meanwhile
+	if (pthread_create(&startup.preload, NULL, &preload_thread, NULL) != 0)
+	{
+		log_error(LOG_NO_CALL, "Error starting preload thread");
+		exit(1);
+	}
+
+	// load screening rules
+	if (screening_files(&app_cfg) > 0)
 	{
-		struct dtmf_config *d_cfg = &app_cfg.dtmf_cfg[i];
+		phase_begin(PHASE_SCREENING);
+		screens_open();
+		phase_end(PHASE_SCREENING);
+	}
 
-		if (d_cfg->active == 1)
+	// start aftermath queue, this also picks up jobs left over from the last run
+	if (has_aftermath(&app_cfg))
+	{
+		phase_begin(PHASE_AFTERMATH);
+		struct jobqueue_config queue_cfg;
+		queue_cfg.journal = app_cfg.aftermath_queue;
+		queue_cfg.workers = app_cfg.aftermath_workers;
+		queue_cfg.max_attempts = app_cfg.aftermath_attempts;
+		queue_cfg.backoff_base = app_cfg.aftermath_backoff;
+		queue_cfg.backoff_max = AFTERMATH_BACKOFF_MAX;
+		queue_cfg.timeout = AFTERMATH_TIMEOUT;
+		queue_cfg.on_run = &on_aftermath_run;
+
+		aftermath_queue = jobqueue_open(&queue_cfg);
+		if (aftermath_queue == NULL)
 		{
-			strcat(tts_buffer, d_cfg->tts_intro);
-			strcat(tts_buffer, " ");
+			log_error(LOG_NO_CALL, "Error starting aftermath queue");
+			exit(1);
 		}
+		log_info(LOG_NO_CALL, "Aftermath queue started");
+		phase_end(PHASE_AFTERMATH);
 	}
 
-	log_message("Done.\n");
+	// setup up sip library pjsua
+	phase_begin(PHASE_SIP);
+	setup_sip();
+	phase_end(PHASE_SIP);
+
+	// start workers for the screening command, they need pjlib for answering calls
+	phase_begin(PHASE_WORKERS);
+	// also without cmd or with nf everywhere, a reload may switch to cmd
+	screen_pool = workpool_create(app_cfg.check_workers, app_cfg.max_calls, &worker_thread_register);
+	if (screen_pool == NULL) error_exit("Error starting screening workers", PJ_ENOMEM);
+
+	// start workers for dtmf actions
+	dtmf_pool = workpool_create(DTMF_WORKERS, app_cfg.max_calls * 2, &worker_thread_register);
+	if (dtmf_pool == NULL) error_exit("Error starting dtmf workers", PJ_ENOMEM);
+	phase_end(PHASE_WORKERS);
+
+	// create account and register to sip server; calls are taken as soon as
+	// the registration succeeds (see on_reg_state)
+	phase_begin(PHASE_REGISTER);
+	register_sip();
 
-	// synthesizing speech
-	log_message("Synthesizing speech ... ");
+	// wait for the prompts; calls which came in meanwhile get them now
+	pthread_join(startup.preload, NULL);
+	if (!startup.preload_ok) error_exit("Error loading prompts", PJ_EUNKNOWN);
+	pthread_mutex_lock(&startup.lock);
+	startup.prompts_ready = 1;
+	pthread_mutex_unlock(&startup.lock);
+	start_pending_prompts();
 
-	int synth_status = -1;
-	synth_status = synthesize_speech(tts_buffer, tts_file, app_cfg.language);
-	if (synth_status != 0) error_exit("Error while creating phone text", synth_status);
-	log_message("Done.\n");
+	// the intro streams while it is rendered, its end is only needed for the report
+	int intro_pending = has_intro(&app_cfg);
+	if (!intro_pending) startup_report();
 
-	// setup up sip library pjsua
-	setup_sip();
+	// app loop: sleep until a signal or an event from the callbacks comes in
+	for (;;)
+	{
+		int signo;
+		unsigned events = evloop_wait(intro_pending ? 10 : -1, &signo);
 
-	// create account and register to sip server
-	register_sip();
+		if (signo == SIGINT || signo == SIGTERM || (events & EVLOOP_QUIT)) break;
+
+		if (signo == SIGHUP) reload_config();
 
-	// app loop
-	for (;;) {
-	    sleep(10); // avoid locking up the system
+		if (intro_pending)
+		{
+			intro_pending = intros_pending(&app_cfg);
+			if (!intro_pending)
+			{
+				phase_end(PHASE_INTRO);
+				startup_report();
+			}
+		}
 	}
 
 	// exit app
@@ -283,11 +631,6 @@ static void usage(int error)
 		puts("Error, too few arguments.");
 		puts  ("");
 	}
-	if (error == 2)
-	{
-		puts("Missing mandatory items in config file.");
-		puts  ("");
-	}
 	puts  ("Usage:");
     puts  ("  sipserv [options]");
     puts  ("");
@@ -296,7 +639,7 @@ static void usage(int error)
     puts  ("  --config-file=string   Set config file");
     puts  ("");
 	puts  ("Optional options:");
-	puts  ("  -s=int       Silent mode (hide info messages) (0||1)");
+	puts  ("  -s=int       Silent mode (only warnings and errors) (0||1)");
 	puts  ("");
 	puts  ("");
 	puts  ("Config file:");
@@ -306,21 +649,60 @@ static void usage(int error)
 	puts  ("  sp=string   Set sip password.");
 	puts  ("  ln=string   Language identifier for espeak TTS (e.g. en = English or de = German)");
 	puts  ("");
-	puts  (" and at least one dtmf configuration (X = dtmf-key index):");
+	puts  (" and at least one dtmf configuration (X = dtmf key 0-9, *, # or A-D):");
 	puts  ("  dtmf.X.active=int           Set dtmf-setting active (0||1).");
 	puts  ("  dtmf.X.description=string   Set description.");
 	puts  ("  dtmf.X.tts-intro=string     Set tts intro.");
 	puts  ("  dtmf.X.tts-answer=string    Set tts answer.");
 	puts  ("  dtmf.X.cmd=string           Set dtmf command.");
+	puts  ("  dtmf.X.timeout=int          Set timeout of command and speech in ms (optional, default 10000).");
+	puts  ("  dtmf.X.menu=string          Enter a menu instead of running a command.");
+	puts  ("");
+	puts  (" menus (optional, NAME = menu name):");
+	puts  ("  menu.NAME.tts=string        Prompt of the menu.");
+	puts  ("  menu.NAME.X.*               Key X in the menu, settings as dtmf.X.*; menu=top goes back.");
+	puts  ("");
+	puts  (" more accounts (optional, N = 1-7, numbered without gaps):");
+	puts  ("  acc.N.su=string   acc.N.sp=string   Set sip username and password of account N.");
+	puts  ("  acc.N.sd, acc.N.tts, acc.N.af, acc.N.cmd, acc.N.nf, acc.N.rc, acc.N.rf, acc.N.vd, acc.N.am");
+	puts  ("                    Settings of account N as above, the ones not given are taken from the top level.");
 	puts  ("");
 	puts  ("Optional options:");
 	puts  ("  rc=int      Record call (0||1)");
+	puts  ("  rf=string   Format of recordings (wav||mp3, default wav)");
+	puts  ("  vd=int      Trim silence from recordings and drop recordings without speech (0||1)");
+	puts  ("  mc=int      Maximum number of simultaneous calls (default 4)");
 	puts  ("  af=string   announcement wav file to play; tts will not be read, if this parameter is given.");
-	puts  ("              file format is Microsoft WAV (signed 16 bit) Mono, 22 kHz");
+	puts  ("              file format is Microsoft WAV (signed 16 bit) Mono or Stereo, 22 kHz; read into memory once");
 	puts  ("  cmd=string  command to check if the call should be taken");
 	puts  ("              should return a \"1\" as first char, if yes.");
 	puts  ("              the wildcard # will be replaced with the calling phone number in the command");
-	puts  ("  am=string   aftermath: command to be executed after call ends. Will be called with two parameters: $1 = Phone number $2 = recorded file name");
+	puts  ("  ct=int      timeout of the cmd check in ms (default 5000)");
+	puts  ("  cd=int      take the call, if the cmd check times out or fails (0||1, default 1)");
+	puts  ("  cw=int      number of cmd checks running in parallel (default 2)");
+	puts  ("  nf=string   numbers file for built-in screening (replaces cmd=./numcheck.py)");
+	puts  ("              the call is taken, if the calling number starts with a listed number");
+	puts  ("  nl=string   log file of built-in screening (default calls.log)");
+	puts  ("  am=string   aftermath: command to be executed after call ends. Will be called with four parameters:");
+	puts  ("              $1 = own sip uri $2 = calling phone number $3 = recorded file name $4 = seconds of speech");
+	puts  ("  aq=string   aftermath queue file, keeps jobs over restarts (default aftermath.queue)");
+	puts  ("  aw=int      number of aftermath commands running in parallel (default 1)");
+	puts  ("  ar=int      number of attempts for a failing aftermath command (default 5)");
+	puts  ("  ab=int      seconds to wait after the first failure, doubled on every retry (default 60)");
+	puts  ("  tc=string   directory of the speech cache, empty to disable (default tts-cache)");
+	puts  ("  tm=int      MB of cached speech kept in memory (default 8)");
+	puts  ("  td=int      MB of cached speech kept on disk (default 64)");
+	puts  ("  mp=int      port of the metrics endpoint http://127.0.0.1:<port>/metrics (default 0 = off)");
+	puts  ("  cr=string   file of call records, one JSON line with the timing of all stages per call (default off)");
+	puts  ("  lf=string   log file (default: stderr)");
+	puts  ("  ll=string   log level: error, warn, info or debug (default info)");
+	puts  ("  lr=int      MB after which the log file is rotated, 3 old files are kept (default 10, 0 = never)");
+	puts  ("  wb=int      Wideband media profile, 16 kHz and G.722/Opus first (0/1, default 0)");
+	puts  ("  ac=string   Codecs to use, preferred first (e.g. G722,PCMA), others are disabled");
+	puts  ("  pt=int      Packet time in ms (default 0 = codec default)");
+	puts  ("  bp=int      Bypass the conference bridge, stream straight to player and recorder (0/1, default 0)");
+	puts  ("");
+	puts  ("SIGHUP reads the config file again; new calls get the new settings.");
 
 	fflush(stdout);
 }
@@ -344,249 +726,1048 @@ static int try_get_argument(int arg, char *arg_id, char **arg_val, int argc, cha
 	return found;
 }
 
-// helper for parsing config file
-static void parse_config_file(char *cfg_file)
+// sets default values of a config
+static void default_config(struct app_config *cfg)
 {
-	// open config file
-	char line[200];
-	FILE *file = fopen(cfg_file, "r");
+	int i;
 
-	if (file!=NULL)
+	memset(cfg, 0, sizeof(struct app_config));
+	cfg->account_count = 1;
+	cfg->acc[0].record_format = RECORD_WAV;
+	for (i = 1; i < MAX_ACCOUNTS; i++)
 	{
-		// start parsing file
-		while(fgets(line, 200, file) != NULL)
-		{
-			char *arg, *val;
-
-			// ignore comments and just new lines
-			if(line[0] == '#') continue;
-			if(line[0] == '\n') continue;
+		cfg->acc[i].record_calls = -1;
+		cfg->acc[i].record_format = -1;
+		cfg->acc[i].record_trim = -1;
+	}
+	cfg->max_calls = DEFAULT_MAX_CALLS;
+	cfg->calls_log = "calls.log";
+	cfg->check_timeout = DEFAULT_CHECK_TIMEOUT;
+	cfg->check_default = DEFAULT_CHECK_DECISION;
+	cfg->check_workers = DEFAULT_CHECK_WORKERS;
+	cfg->aftermath_queue = DEFAULT_AFTERMATH_QUEUE;
+	cfg->aftermath_workers = DEFAULT_AFTERMATH_WORKERS;
+	cfg->aftermath_attempts = DEFAULT_AFTERMATH_ATTEMPTS;
+	cfg->aftermath_backoff = DEFAULT_AFTERMATH_BACKOFF;
+	cfg->tts_cache = DEFAULT_TTS_CACHE;
+	cfg->tts_cache_memory = DEFAULT_TTS_CACHE_MEMORY;
+	cfg->tts_cache_disk = DEFAULT_TTS_CACHE_DISK;
+	cfg->metrics_port = DEFAULT_METRICS_PORT;
+	cfg->log_level = DEFAULT_LOG_LEVEL;
+	cfg->log_rotate = DEFAULT_LOG_ROTATE;
 
-			// split string at '='-char
-			arg = strtok(line, "=");
-			if (arg == NULL) continue;
-			val = strtok(NULL, "=");
+	for (i = 0; i < MAX_DTMF_SETTINGS; i++)
+	{
+		cfg->dtmf_cfg[i].key = DTMF_KEYS[i];
+		cfg->dtmf_cfg[i].next = -1;
+	}
+}
 
-			// check for new line char and remove it
-			char *nl_check;
-			nl_check = strstr (val, "\n");
-			if (nl_check != NULL) strncpy(nl_check, " ", 1);
+// check that a tts answer has at most one %s (for the command output) and no other conversion
+static int check_answer_format(const char *format)
+{
+	int strings = 0;
 
-			// remove trailing spaces
+	for (; *format; format++)
+	{
+		if (*format != '%') continue;
+		format++;
+		if (*format == '%') continue;
+		if (*format != 's' || ++strings > 1) return 1;
+	}
+	return 0;
+}
 
+// parse a setting of a dtmf key (dtmf.X.<setting> or menu.<name>.X.<setting>);
+// returns 1 if the setting is unknown
+static int parse_dtmf_setting(struct config_file *file, struct config_item *item, struct dtmf_config *d_cfg, const char *setting)
+{
+	char *val = item->value;
 
-			// duplicate string for having own instance of it
-			char *arg_val = strdup(val);
+	// check for dtmf active setting
+	if (!strcasecmp(setting, "active"))
+	{
+		config_int(file, item, 0, 1, &d_cfg->active);
+		return 0;
+	}
 
-			// check for sip domain argument
-			if (!strcasecmp(arg, "sd"))
-			{
-				app_cfg.sip_domain = trim_string(arg_val);
-				continue;
-			}
+	// check for dtmf description setting
+	if (!strcasecmp(setting, "description"))
+	{
+		d_cfg->description = val;
+		return 0;
+	}
 
-			// check for sip user argument
-			if (!strcasecmp(arg, "su"))
-			{
-				app_cfg.sip_user = trim_string(arg_val);
-				continue;
-			}
+	// check for dtmf tts intro setting
+	if (!strcasecmp(setting, "tts-intro"))
+	{
+		d_cfg->tts_intro = val;
+		return 0;
+	}
 
-			// check for sip domain argument
-			if (!strcasecmp(arg, "sp"))
-			{
-				app_cfg.sip_password = trim_string(arg_val);
-				continue;
-			}
+	// check for dtmf tts answer setting
+	if (!strcasecmp(setting, "tts-answer"))
+	{
+		if (check_answer_format(val) != 0) config_error(file, item, "only one %s allowed");
+		else d_cfg->tts_answer = val;
+		return 0;
+	}
 
-			// check for language argument
-			if (!strcasecmp(arg, "ln"))
-			{
-				app_cfg.language = trim_string(arg_val);
-				continue;
-			}
+	// check for dtmf cmd setting
+	if (!strcasecmp(setting, "cmd"))
+	{
+		d_cfg->cmd = val;
+		return 0;
+	}
 
-			// check for record calls argument
-			if (!strcasecmp(arg, "rc"))
-			{
-				app_cfg.record_calls = atoi(val);
-				continue;
-			}
+	// check for dtmf menu setting, the target is resolved by compile_menus
+	if (!strcasecmp(setting, "menu"))
+	{
+		d_cfg->menu = val;
+		return 0;
+	}
 
-			// check for announcement file argument
-			if (!strcasecmp(arg, "af"))
-			{
-				app_cfg.announcement_file = trim_string(arg_val);
-				continue;
-			}
+	// check for dtmf timeout setting
+	if (!strcasecmp(setting, "timeout"))
+	{
+		config_int(file, item, 0, 3600000, &d_cfg->timeout);
+		return 0;
+	}
 
-			// check for call command
-			if (!strcasecmp(arg, "cmd"))
-			{
-				app_cfg.CallCmd = trim_string(arg_val);
-				continue;
-			}
+	return 1;
+}
 
-			// check for aftermath
-			if (!strcasecmp(arg, "am"))
-			{
-				app_cfg.AfterMath = trim_string(arg_val);
-				continue;
-			}
+// parse a setting of an account (top level, or acc.N.<setting>);
+// returns 1 if the setting is unknown
+static int parse_account_setting(struct config_file *file, struct config_item *item, struct account_config *acc, const char *setting)
+{
+	static const char *const record_formats[] = { "wav", "mp3", NULL };
+	char *val = item->value;
 
-			// check for silent mode argument
-			if (!strcasecmp(arg, "s"))
-			{
-				app_cfg.silent_mode = atoi(val);
-				continue;
-			}
+	// check for sip domain argument
+	if (!strcasecmp(setting, "sd"))
+	{
+		acc->sip_domain = val;
+		return 0;
+	}
 
-			// check for tts intro
-			if (!strcasecmp(arg, "tts"))
-			{
-				app_cfg.tts = arg_val;
-				continue;
-			}
+	// check for sip user argument
+	if (!strcasecmp(setting, "su"))
+	{
+		acc->sip_user = val;
+		return 0;
+	}
 
-			// check for a dtmf argument
-			char dtmf_id[1];
-			char dtmf_setting[25];
-			if(sscanf(arg, "dtmf.%1[^.].%s", dtmf_id, dtmf_setting) == 2)
-			{
-				// parse dtmf id (key)
-				int d_id;
-				d_id = atoi(dtmf_id);
+	// check for sip password argument
+	if (!strcasecmp(setting, "sp"))
+	{
+		acc->sip_password = val;
+		return 0;
+	}
 
-				// check if actual dtmf id blasts maxium settings
-				if (d_id >= MAX_DTMF_SETTINGS) continue;
+	// check for tts intro
+	if (!strcasecmp(setting, "tts"))
+	{
+		acc->tts = val;
+		return 0;
+	}
 
-				// get pointer to actual dtmf_cfg entry
-				struct dtmf_config *d_cfg = &app_cfg.dtmf_cfg[d_id-1];
+	// check for announcement file argument
+	if (!strcasecmp(setting, "af"))
+	{
+		acc->announcement_file = val;
+		return 0;
+	}
 
-				// check for dtmf active setting
-				if (!strcasecmp(dtmf_setting, "active"))
-				{
-					d_cfg->active = atoi(val);
-					continue;
-				}
+	// check for call command
+	if (!strcasecmp(setting, "cmd"))
+	{
+		acc->CallCmd = val;
+		return 0;
+	}
 
-				// check for dtmf description setting
-				if (!strcasecmp(dtmf_setting, "description"))
-				{
-					d_cfg->description = arg_val;
-					continue;
-				}
+	// check for numbers file
+	if (!strcasecmp(setting, "nf"))
+	{
+		acc->numbers_file = val;
+		return 0;
+	}
 
-				// check for dtmf tts intro setting
-				if (!strcasecmp(dtmf_setting, "tts-intro"))
-				{
-					d_cfg->tts_intro = arg_val;
-					continue;
-				}
+	// check for record calls argument
+	if (!strcasecmp(setting, "rc"))
+	{
+		config_int(file, item, 0, 1, &acc->record_calls);
+		return 0;
+	}
 
-				// check for dtmf tts answer setting
-				if (!strcasecmp(dtmf_setting, "tts-answer"))
-				{
-					d_cfg->tts_answer = arg_val;
-					continue;
-				}
+	// check for recording format
+	if (!strcasecmp(setting, "rf"))
+	{
+		config_choice(file, item, record_formats, &acc->record_format);
+		return 0;
+	}
 
-				// check for dtmf cmd setting
-				if (!strcasecmp(dtmf_setting, "cmd"))
-				{
-					d_cfg->cmd = arg_val;
-					continue;
-				}
-			}
+	// check for voice detection
+	if (!strcasecmp(setting, "vd"))
+	{
+		config_int(file, item, 0, 1, &acc->record_trim);
+		return 0;
+	}
 
-			// write warning if unknown configuration setting is found
-			char warning[200];
-			sprintf(warning, "Warning: Unknown configuration with arg '%s' and val '%s'\n", arg, val);
-			log_message(warning);
+	// check for aftermath command
+	if (!strcasecmp(setting, "am"))
+	{
+		acc->AfterMath = val;
+		return 0;
+	}
 
-		}
+	return 1;
+}
 
-		fclose(file);
+// fill in the settings an account doesn't set from account 0; greeting
+// (tts, af) and screening (cmd, nf) are taken as a whole
+static void account_inherit(struct account_config *acc, const struct account_config *top)
+{
+	if (!acc->sip_domain) acc->sip_domain = top->sip_domain;
+	if (!acc->tts && !acc->announcement_file)
+	{
+		acc->tts = top->tts;
+		acc->announcement_file = top->announcement_file;
 	}
-	else
+	if (!acc->CallCmd && !acc->numbers_file)
 	{
-		// return if config file not found
-		log_message("Error while parsing config file: Not found.\n");
-		exit(1);
+		acc->CallCmd = top->CallCmd;
+		acc->numbers_file = top->numbers_file;
 	}
+	if (acc->record_calls < 0) acc->record_calls = top->record_calls;
+	if (acc->record_format < 0) acc->record_format = top->record_format;
+	if (acc->record_trim < 0) acc->record_trim = top->record_trim;
+	if (!acc->AfterMath) acc->AfterMath = top->AfterMath;
 }
 
-// helper for removing leading and trailing strings (source taken from kernel source, lib/string.c)
-static char *trim_string(char *str)
+// find a menu by name; returns its index, -1 if there is none
+static int menu_find(const struct app_config *cfg, const char *name, size_t len)
 {
-	while (isspace(*str)) ++str;
-
-	char *s = (char *)str;
-
-	size_t size;
-	char *end;
-
-	size = strlen(s);
-	if (!size) return s;
-
-	end = s + size - 1;
-	while (end >= s && isspace(*end)) end--;
-	*(end + 1) = '\0';
+	int i;
 
-	return s;
+	for (i = 0; i < cfg->menu_count; i++)
+	{
+		if (strlen(cfg->menus[i].name) == len && !strncasecmp(cfg->menus[i].name, name, len)) return i;
+	}
+	return -1;
 }
 
-
-// helper for logging messages to console (disabled if silent mode is active)
-static void log_message(char *message)
+// find a menu by name or add it; returns its index, 0 for the top level
+// and -1 if the name is empty or there are too many menus
+static int menu_add(struct app_config *cfg, const char *name, size_t len)
 {
-	if (!app_cfg.silent_mode)
+	int i = menu_find(cfg, name, len);
+
+	if (i >= 0) return i;
+	if (len == 0 || cfg->menu_count == MAX_MENUS) return -1;
+
+	struct menu_node *node = &cfg->menus[cfg->menu_count];
+	node->name = strndup(name, len);
+	node->keys = calloc(MAX_DTMF_SETTINGS, sizeof(struct dtmf_config));
+	if (node->name == NULL || node->keys == NULL)
+	{
+		free(node->name);
+		free(node->keys);
+		memset(node, 0, sizeof(struct menu_node));
+		return -1;
+	}
+	for (i = 0; i < MAX_DTMF_SETTINGS; i++)
 	{
-		fprintf(stderr, message);
+		node->keys[i].key = DTMF_KEYS[i];
+		node->keys[i].active = -1;  // set by compile_menus unless given
+		node->keys[i].next = -1;
 	}
+	return cfg->menu_count++;
 }
 
-// helper for setting up sip library pjsua
-static void setup_sip(void)
+// check the keys of all menus and resolve their targets to menu indexes,
+// so that a digit is a table lookup during the call
+static void compile_menus(struct app_config *cfg, struct config_file *file)
 {
-	pj_status_t status;
-
-	log_message("Setting up pjsua ... ");
+	int reached[MAX_MENUS] = { 1 };
+	char where[80];
+	int i, k;
 
-	// create pjsua
-	status = pjsua_create();
-	if (status != PJ_SUCCESS) error_exit("Error in pjsua_create()", status);
+	for (i = 0; i < cfg->menu_count; i++)
+	{
+		struct menu_node *node = &cfg->menus[i];
 
-	// configure pjsua
-	pjsua_config cfg;
-	pjsua_config_default(&cfg);
+		if (i > 0 && !node->tts)
+		{
+			log_error(LOG_NO_CALL, "%s: menu.%s needs tts", file->path, node->name);
+			file->errors++;
+		}
 
-	// enable just 1 simultaneous call
-	cfg.max_calls = 1;
+		for (k = 0; k < MAX_DTMF_SETTINGS; k++)
+		{
+			struct dtmf_config *d_cfg = &node->keys[k];
 
-	// callback configuration
-	cfg.cb.on_incoming_call = &on_incoming_call;
-	cfg.cb.on_call_media_state = &on_call_media_state;
-	cfg.cb.on_call_state = &on_call_state;
-	cfg.cb.on_dtmf_digit = &on_dtmf_digit;
+			// keys of a submenu are active once they have any setting
+			if (d_cfg->active < 0) d_cfg->active = (d_cfg->cmd || d_cfg->menu || d_cfg->tts_answer || d_cfg->tts_intro);
+			if (!d_cfg->active) continue;
 
-	// logging configuration
-	pjsua_logging_config log_cfg;
-	pjsua_logging_config_default(&log_cfg);
-	log_cfg.console_level = PJSUA_LOG_LEVEL;
+			if (i == 0) snprintf(where, sizeof(where), "dtmf.%c", d_cfg->key);
+			else snprintf(where, sizeof(where), "menu.%s.%c", node->name, d_cfg->key);
 
-	// media configuration
-	pjsua_media_config media_cfg;
-	pjsua_media_config_default(&media_cfg);
-	media_cfg.snd_play_latency = 100;
-	media_cfg.clock_rate = 8000;
-	media_cfg.snd_clock_rate = 8000;
-	media_cfg.quality = 10;
+			if (i == 0 && !d_cfg->tts_intro)
+			{
+				log_error(LOG_NO_CALL, "%s: %s needs tts-intro", file->path, where);
+				file->errors++;
+			}
+			if (d_cfg->menu)
+			{
+				d_cfg->next = menu_find(cfg, d_cfg->menu, strlen(d_cfg->menu));
+				if (d_cfg->next < 0)
+				{
+					log_error(LOG_NO_CALL, "%s: %s.menu: no menu %s", file->path, where, d_cfg->menu);
+					file->errors++;
+				}
+				else
+				{
+					reached[d_cfg->next] = 1;
+				}
+			}
+			else if (!d_cfg->tts_answer || !d_cfg->cmd)
+			{
+				log_error(LOG_NO_CALL, "%s: %s needs menu or tts-answer and cmd", file->path, where);
+				file->errors++;
+			}
+		}
+	}
+
+	for (i = 1; i < cfg->menu_count; i++)
+	{
+		if (!reached[i]) log_warn(LOG_NO_CALL, "%s: no key leads to menu.%s", file->path, cfg->menus[i].name);
+	}
+}
+
+// helper for parsing config file into cfg (set to defaults before);
+// returns the number of errors, cfg->source is set in any case
+static int parse_config_file(const char *cfg_file, struct app_config *cfg)
+{
+	struct config_file *file = config_read(cfg_file);
+	int i;
+
+	cfg->source = file;
+	if (file == NULL)
+	{
+		log_error(LOG_NO_CALL, "Error while parsing config file %s: %s", cfg_file, strerror(errno));
+		return 1;
+	}
+
+	// the top level menu, its keys are dtmf.X
+	cfg->menus = calloc(MAX_MENUS, sizeof(struct menu_node));
+	if (cfg->menus == NULL || (cfg->menus[0].name = strdup(MENU_TOP)) == NULL)
+	{
+		log_error(LOG_NO_CALL, "Error while parsing config file %s: %s", cfg_file, strerror(ENOMEM));
+		return 1;
+	}
+	cfg->menus[0].keys = cfg->dtmf_cfg;
+	cfg->menu_count = 1;
+
+	for (i = 0; i < file->count; i++)
+	{
+		struct config_item *item = &file->items[i];
+		char *arg = item->key;
+		char *val = item->value;
+
+		// settings of account 0: sd, su, sp, tts, af, cmd, nf, rc, rf, vd, am
+		if (parse_account_setting(file, item, &cfg->acc[0], arg) == 0) continue;
+
+		// check for an account argument: acc.<N>.<setting>
+		if (!strncasecmp(arg, "acc.", 4) && isdigit((unsigned char)arg[4]) && arg[5] == '.')
+		{
+			int n = arg[4] - '0';
+			if (n < 1 || n >= MAX_ACCOUNTS)
+			{
+				config_error(file, item, "accounts are numbered from 1 to 7, 0 is set without acc.");
+				continue;
+			}
+			if (n >= cfg->account_count) cfg->account_count = n + 1;
+			if (parse_account_setting(file, item, &cfg->acc[n], arg + 6) == 0) continue;
+		}
+
+		// check for language argument
+		if (!strcasecmp(arg, "ln"))
+		{
+			cfg->language = val;
+			continue;
+		}
+
+		// check for max calls argument
+		if (!strcasecmp(arg, "mc"))
+		{
+			config_int(file, item, 1, PJSUA_MAX_CALLS, &cfg->max_calls);
+			continue;
+		}
+
+		// check for call command timeout
+		if (!strcasecmp(arg, "ct"))
+		{
+			config_int(file, item, 1, 3600000, &cfg->check_timeout);
+			continue;
+		}
+
+		// check for call command default decision
+		if (!strcasecmp(arg, "cd"))
+		{
+			config_int(file, item, 0, 1, &cfg->check_default);
+			continue;
+		}
+
+		// check for number of call command workers
+		if (!strcasecmp(arg, "cw"))
+		{
+			config_int(file, item, 1, 64, &cfg->check_workers);
+			continue;
+		}
+
+		// check for screening log file
+		if (!strcasecmp(arg, "nl"))
+		{
+			cfg->calls_log = val;
+			continue;
+		}
+
+		// check for aftermath queue file
+		if (!strcasecmp(arg, "aq"))
+		{
+			cfg->aftermath_queue = val;
+			continue;
+		}
+
+		// check for number of parallel aftermath commands
+		if (!strcasecmp(arg, "aw"))
+		{
+			config_int(file, item, 1, 64, &cfg->aftermath_workers);
+			continue;
+		}
+
+		// check for aftermath attempts
+		if (!strcasecmp(arg, "ar"))
+		{
+			config_int(file, item, 1, 1000, &cfg->aftermath_attempts);
+			continue;
+		}
+
+		// check for aftermath backoff
+		if (!strcasecmp(arg, "ab"))
+		{
+			config_int(file, item, 1, AFTERMATH_BACKOFF_MAX, &cfg->aftermath_backoff);
+			continue;
+		}
+
+		// check for speech cache directory
+		if (!strcasecmp(arg, "tc"))
+		{
+			cfg->tts_cache = val;
+			continue;
+		}
+
+		// check for speech cache memory limit
+		if (!strcasecmp(arg, "tm"))
+		{
+			config_int(file, item, 0, 4096, &cfg->tts_cache_memory);
+			continue;
+		}
+
+		// check for speech cache disk limit
+		if (!strcasecmp(arg, "td"))
+		{
+			config_int(file, item, 0, 1 << 20, &cfg->tts_cache_disk);
+			continue;
+		}
+
+		// check for metrics port
+		if (!strcasecmp(arg, "mp"))
+		{
+			config_int(file, item, 0, 65535, &cfg->metrics_port);
+			continue;
+		}
+
+		// check for call record file
+		if (!strcasecmp(arg, "cr"))
+		{
+			cfg->cdr_file = val;
+			continue;
+		}
+
+		// check for log file
+		if (!strcasecmp(arg, "lf"))
+		{
+			cfg->log_output = val;
+			continue;
+		}
+
+		// check for log level
+		if (!strcasecmp(arg, "ll"))
+		{
+			int level = log_parse_level(val);
+			if (level < 0) config_error(file, item, "use error, warn, info or debug");
+			else cfg->log_level = level;
+			continue;
+		}
+
+		// check for log rotation size
+		if (!strcasecmp(arg, "lr"))
+		{
+			config_int(file, item, 0, 4096, &cfg->log_rotate);
+			continue;
+		}
+
+		// check for wideband media profile
+		if (!strcasecmp(arg, "wb"))
+		{
+			config_int(file, item, 0, 1, &cfg->wideband);
+			continue;
+		}
+
+		// check for codec priority list
+		if (!strcasecmp(arg, "ac"))
+		{
+			cfg->codecs = val;
+			continue;
+		}
+
+		// check for packet time
+		if (!strcasecmp(arg, "pt"))
+		{
+			config_int(file, item, 0, 120, &cfg->ptime);
+			continue;
+		}
+
+		// check for conference bridge bypass
+		if (!strcasecmp(arg, "bp"))
+		{
+			config_int(file, item, 0, 1, &cfg->bypass);
+			continue;
+		}
+
+		// check for silent mode argument
+		if (!strcasecmp(arg, "s"))
+		{
+			config_int(file, item, 0, 1, &cfg->silent_mode);
+			continue;
+		}
+
+		// check for a dtmf argument: dtmf.<key>.<setting>
+		if (!strncasecmp(arg, "dtmf.", 5) && arg[5] != '\0' && arg[6] == '.')
+		{
+			const char *key = strchr(DTMF_KEYS, toupper((unsigned char)arg[5]));
+			char *dtmf_setting = arg + 7;
+			if (key == NULL)
+			{
+				config_error(file, item, "no dtmf key, use 0-9, *, # or A-D");
+				continue;
+			}
+
+			// get pointer to actual dtmf_cfg entry
+			struct dtmf_config *d_cfg = &cfg->dtmf_cfg[key - DTMF_KEYS];
+
+			if (parse_dtmf_setting(file, item, d_cfg, dtmf_setting) == 0) continue;
+		}
+
+		// check for a menu argument: menu.<name>.tts or menu.<name>.<key>.<setting>
+		if (!strncasecmp(arg, "menu.", 5) && strchr(arg + 5, '.') != NULL)
+		{
+			char *name = arg + 5;
+			char *menu_setting = strchr(name, '.') + 1;
+			int menu = menu_add(cfg, name, menu_setting - name - 1);
+			if (menu <= 0)
+			{
+				config_error(file, item, menu == 0 ? "the top menu is set by tts and dtmf.X" : "empty menu name or too many menus");
+				continue;
+			}
+			struct menu_node *node = &cfg->menus[menu];
+
+			// check for menu prompt
+			if (!strcasecmp(menu_setting, "tts"))
+			{
+				node->tts = val;
+				continue;
+			}
+
+			// check for a key of the menu
+			if (menu_setting[0] != '\0' && menu_setting[1] == '.')
+			{
+				const char *key = strchr(DTMF_KEYS, toupper((unsigned char)menu_setting[0]));
+				if (key == NULL)
+				{
+					config_error(file, item, "no dtmf key, use 0-9, *, # or A-D");
+					continue;
+				}
+				if (parse_dtmf_setting(file, item, &node->keys[key - DTMF_KEYS], menu_setting + 2) == 0) continue;
+			}
+		}
+
+		// write warning if unknown configuration setting is found
+		log_warn(LOG_NO_CALL, "%s:%i: Unknown configuration with arg '%s' and val '%s'", cfg_file, item->line, arg, val);
+	}
+
+	// settings needed to take calls at all
+	if (!cfg->acc[0].sip_domain || !cfg->acc[0].sip_user || !cfg->acc[0].sip_password || !cfg->language)
+	{
+		log_error(LOG_NO_CALL, "%s: sd, su, sp and ln are mandatory", cfg_file);
+		file->errors++;
+	}
+	if (!cfg->acc[0].tts && !cfg->acc[0].announcement_file)
+	{
+		log_error(LOG_NO_CALL, "%s: tts or af is mandatory", cfg_file);
+		file->errors++;
+	}
+	for (i = 1; i < cfg->account_count; i++)
+	{
+		struct account_config *acc = &cfg->acc[i];
+		if (!acc->sip_user || !acc->sip_password)
+		{
+			log_error(LOG_NO_CALL, "%s: acc.%i.su and acc.%i.sp are mandatory", cfg_file, i, i);
+			file->errors++;
+		}
+		account_inherit(acc, &cfg->acc[0]);
+	}
+	cfg->menus[0].tts = cfg->acc[0].tts;
+	compile_menus(cfg, file);
+
+	return file->errors;
+}
+
+// take a reference to the settings for a new call
+static struct app_config *settings_get(void)
+{
+	pthread_mutex_lock(&settings_lock);
+	struct app_config *cfg = active_cfg;
+	cfg->refs++;
+	pthread_mutex_unlock(&settings_lock);
+
+	return cfg;
+}
+
+// take another reference, e.g. for a job of a call
+static struct app_config *settings_ref(struct app_config *cfg)
+{
+	pthread_mutex_lock(&settings_lock);
+	cfg->refs++;
+	pthread_mutex_unlock(&settings_lock);
+
+	return cfg;
+}
+
+// drop a reference; the last one of reloaded settings frees them
+static void settings_release(struct app_config *cfg)
+{
+	int last;
+
+	if (cfg == NULL) return;
+
+	pthread_mutex_lock(&settings_lock);
+	last = (--cfg->refs == 0);
+	pthread_mutex_unlock(&settings_lock);
+
+	if (!last) return;
+	greetings_free(cfg);
+	menus_free(cfg);
+	config_free(cfg->source);
+	free(cfg);
+}
+
+// synthesize the prompt of a menu: its tts and the intros of its active keys
+static struct pcm_buf *render_prompt(const char *tts, const struct dtmf_config *keys)
+{
+	size_t len = strlen(tts) + 2;
+	int i;
+
+	for (i = 0; i < MAX_DTMF_SETTINGS; i++)
+	{
+		if (keys[i].active && keys[i].tts_intro) len += strlen(keys[i].tts_intro) + 1;
+	}
+
+	char *tts_buffer = malloc(len);
+	if (tts_buffer == NULL) return NULL;
+
+	strcpy(tts_buffer, tts);
+	strcat(tts_buffer, " ");
+	for (i = 0; i < MAX_DTMF_SETTINGS; i++)
+	{
+		const struct dtmf_config *d_cfg = &keys[i];
+
+		if (d_cfg->active && d_cfg->tts_intro)
+		{
+			strcat(tts_buffer, d_cfg->tts_intro);
+			strcat(tts_buffer, " ");
+		}
+	}
+
+	struct pcm_buf *speech = tts_speak(tts_buffer, &voice);
+	free(tts_buffer);
+	return speech;
+}
+
+// synthesize the prompts of the submenus, they are kept in memory while
+// the settings are in use; returns 0 if all could be started
+static int render_menus(struct app_config *cfg)
+{
+	int i;
+
+	for (i = 1; i < cfg->menu_count; i++)
+	{
+		cfg->menus[i].prompt = render_prompt(cfg->menus[i].tts, cfg->menus[i].keys);
+		if (cfg->menus[i].prompt == NULL) return 1;
+	}
+	return 0;
+}
+
+// free the menu graph and its prompts
+static void menus_free(struct app_config *cfg)
+{
+	int i;
+
+	if (cfg->menus == NULL) return;
+	for (i = 0; i < cfg->menu_count; i++)
+	{
+		free(cfg->menus[i].name);
+		if (i == 0) continue;
+		free(cfg->menus[i].keys);
+		pcm_buf_release(cfg->menus[i].prompt);
+	}
+	free(cfg->menus);
+	cfg->menus = NULL;
+	cfg->menu_count = 0;
+}
+
+// load the announcements of the accounts in announcement mode, read again
+// only if a file changed; returns 0 on success
+static int load_announcements(struct app_config *cfg)
+{
+	int i;
+
+	for (i = 0; i < cfg->account_count; i++)
+	{
+		struct account_config *acc = &cfg->acc[i];
+		if (!acc->announcement_file) continue;
+
+		// accounts with the same file get the same samples from the cache
+		acc->announcement = wavcache_get(acc->announcement_file, media_clock_rate(app_cfg.wideband));
+		if (acc->announcement == NULL)
+		{
+			log_error(LOG_NO_CALL, "Announcement file %s can't be played", acc->announcement_file);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// synthesize the intros of the accounts without announcement; accounts with
+// the same text share it. Returns 0 if all could be started
+static int render_intros(struct app_config *cfg)
+{
+	int i, j;
+
+	for (i = 0; i < cfg->account_count; i++)
+	{
+		struct account_config *acc = &cfg->acc[i];
+		if (acc->announcement_file) continue;
+
+		for (j = 0; j < i && acc->intro_speech == NULL; j++)
+		{
+			if (cfg->acc[j].intro_speech && !strcmp(cfg->acc[j].tts, acc->tts))
+			{
+				acc->intro_speech = pcm_buf_ref(cfg->acc[j].intro_speech);
+			}
+		}
+		if (acc->intro_speech == NULL) acc->intro_speech = render_prompt(acc->tts, cfg->dtmf_cfg);
+		if (acc->intro_speech == NULL) return 1;
+	}
+	return 0;
+}
+
+// release the intros and announcements of the accounts
+static void greetings_free(struct app_config *cfg)
+{
+	int i;
+
+	for (i = 0; i < MAX_ACCOUNTS; i++)
+	{
+		pcm_buf_release(cfg->acc[i].intro_speech);
+		pcm_buf_release(cfg->acc[i].announcement);
+		cfg->acc[i].intro_speech = NULL;
+		cfg->acc[i].announcement = NULL;
+	}
+}
+
+// 1 if an account plays a synthesized intro
+static int has_intro(const struct app_config *cfg)
+{
+	int i;
+
+	for (i = 0; i < cfg->account_count; i++)
+	{
+		if (cfg->acc[i].intro_speech) return 1;
+	}
+	return 0;
+}
+
+// 1 while an intro is still being synthesized
+static int intros_pending(const struct app_config *cfg)
+{
+	int i, pending = 0;
+
+	for (i = 0; i < cfg->account_count && !pending; i++)
+	{
+		struct pcm_buf *intro = cfg->acc[i].intro_speech;
+		if (intro == NULL) continue;
+		pthread_mutex_lock(&intro->lock);
+		pending = !intro->complete;
+		pthread_mutex_unlock(&intro->lock);
+	}
+	return pending;
+}
+
+// number of accounts screening with a numbers file
+static int screening_files(const struct app_config *cfg)
+{
+	int i, count = 0;
+
+	for (i = 0; i < cfg->account_count; i++)
+	{
+		if (cfg->acc[i].numbers_file) count++;
+	}
+	return count;
+}
+
+// 1 if an account runs an aftermath command
+static int has_aftermath(const struct app_config *cfg)
+{
+	int i;
+
+	for (i = 0; i < cfg->account_count; i++)
+	{
+		if (cfg->acc[i].AfterMath) return 1;
+	}
+	return 0;
+}
+
+// load the numbers files of the accounts which have none loaded yet, one
+// instance per file; returns 1 if out of memory. An instance is kept until
+// the exit, calls may be checking with it
+static int screens_attach(const struct app_config *cfg)
+{
+	int i, j;
+
+	for (i = 0; i < cfg->account_count; i++)
+	{
+		const char *file = cfg->acc[i].numbers_file;
+		struct numscreen *screen = NULL;
+		if (!file || screens[i]) continue;
+
+		for (j = 0; j < cfg->account_count && screen == NULL; j++)
+		{
+			if (screens[j] && !strcmp(numscreen_file(screens[j]), file)) screen = screens[j];
+		}
+		if (screen == NULL)
+		{
+			screen = numscreen_open(file, app_cfg.calls_log);
+			if (screen == NULL) return 1;
+			log_info(LOG_NO_CALL, "Loaded screening rules of %s, %i numbers", file, numscreen_count(screen));
+		}
+		__atomic_store_n(&screens[i], screen, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+static void screens_open(void)
+{
+	if (screens_attach(&app_cfg) != 0) error_exit("Error loading screening rules", PJ_ENOMEM);
+}
+
+// load the numbers files accounts got by a reload, and read the others again,
+// each shared instance once
+static void screens_reload(const struct app_config *cfg)
+{
+	int i, j;
+
+	for (i = 0; i < cfg->account_count; i++)
+	{
+		for (j = 0; j < i && screens[j] != screens[i]; j++);
+		if (screens[i] && j == i) numscreen_reload(screens[i]);
+	}
+	if (screens_attach(cfg) != 0) log_error(LOG_NO_CALL, "Error loading screening rules, out of memory");
+}
+
+static void screens_close(void)
+{
+	int i, j;
+
+	for (i = 0; i < MAX_ACCOUNTS; i++)
+	{
+		for (j = 0; j < i && screens[j] != screens[i]; j++);
+		if (j == i) numscreen_close(screens[i]);
+	}
+	memset(screens, 0, sizeof(screens));
+}
+
+// compare a setting which is only read at startup
+static void check_restart(const char *key, int changed)
+{
+	if (changed) log_warn(LOG_NO_CALL, "Setting %s changed, it takes effect after a restart", key);
+}
+
+// the same for a setting of an account, prefix is "" or "acc.N."
+static void check_restart_account(const char *prefix, const char *key, int changed)
+{
+	if (changed) log_warn(LOG_NO_CALL, "Setting %s%s changed, it takes effect after a restart", prefix, key);
+}
+
+static int string_changed(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL) return a != b;
+	return strcmp(a, b) != 0;
+}
+
+// read the config file again (on SIGHUP); new calls get the new settings,
+// running calls keep theirs. The registration is not touched.
+static void reload_config(void)
+{
+	int i;
+	struct app_config *cfg = malloc(sizeof(struct app_config));
+	if (cfg == NULL) return;
+	default_config(cfg);
+	cfg->config_file = app_cfg.config_file;
+	cfg->refs = 1;
+
+	log_info(LOG_NO_CALL, "Reloading %s", app_cfg.config_file);
+	if (parse_config_file(app_cfg.config_file, cfg) != 0)
+	{
+		log_error(LOG_NO_CALL, "Reload failed, keeping the running configuration");
+		settings_release(cfg);
+		return;
+	}
+
+	// calls are routed to the accounts by their index
+	if (cfg->account_count != app_cfg.account_count)
+	{
+		log_error(LOG_NO_CALL, "Number of accounts changed, restart to apply; keeping the running configuration");
+		settings_release(cfg);
+		return;
+	}
+	for (i = 0; i < cfg->account_count; i++)
+	{
+		char key[16] = "";
+		struct account_config *acc = &cfg->acc[i], *running = &app_cfg.acc[i];
+
+		if (i > 0) snprintf(key, sizeof(key), "acc.%i.", i);
+		check_restart_account(key, "sd", string_changed(acc->sip_domain, running->sip_domain));
+		check_restart_account(key, "su", string_changed(acc->sip_user, running->sip_user));
+		check_restart_account(key, "sp", string_changed(acc->sip_password, running->sip_password));
+		// a numbers file is loaded on reload, another file than the running one needs a restart
+		check_restart_account(key, "nf", acc->numbers_file && screens[i] && strcmp(acc->numbers_file, numscreen_file(screens[i])));
+	}
+	check_restart("ln", string_changed(cfg->language, app_cfg.language));
+	check_restart("mc", cfg->max_calls != app_cfg.max_calls);
+	check_restart("cw", cfg->check_workers != app_cfg.check_workers);
+	check_restart("nl", string_changed(cfg->calls_log, app_cfg.calls_log));
+	check_restart("am", has_aftermath(cfg) != has_aftermath(&app_cfg));
+	check_restart("aq", string_changed(cfg->aftermath_queue, app_cfg.aftermath_queue));
+	check_restart("aw", cfg->aftermath_workers != app_cfg.aftermath_workers);
+	check_restart("tc", string_changed(cfg->tts_cache, app_cfg.tts_cache));
+	check_restart("tm", cfg->tts_cache_memory != app_cfg.tts_cache_memory);
+	check_restart("td", cfg->tts_cache_disk != app_cfg.tts_cache_disk);
+	check_restart("mp", cfg->metrics_port != app_cfg.metrics_port);
+	check_restart("cr", string_changed(cfg->cdr_file, app_cfg.cdr_file));
+	check_restart("lf", string_changed(cfg->log_output, app_cfg.log_output));
+	check_restart("lr", cfg->log_rotate != app_cfg.log_rotate);
+	check_restart("wb", cfg->wideband != app_cfg.wideband);
+	check_restart("ac", string_changed(cfg->codecs, app_cfg.codecs));
+	check_restart("pt", cfg->ptime != app_cfg.ptime);
+
+	// the prompts are ready before the first new call gets them
+	if (load_announcements(cfg) != 0)
+	{
+		log_error(LOG_NO_CALL, "Keeping the running configuration");
+		settings_release(cfg);
+		return;
+	}
+	if (render_intros(cfg) != 0)
+	{
+		log_error(LOG_NO_CALL, "Error while creating phone text, keeping the running configuration");
+		settings_release(cfg);
+		return;
+	}
+	if (render_menus(cfg) != 0)
+	{
+		log_error(LOG_NO_CALL, "Error while creating menu prompts, keeping the running configuration");
+		settings_release(cfg);
+		return;
+	}
+
+	// settings of the running services
+	log_set_level(app_cfg.silent_mode && cfg->log_level > LOG_WARN ? LOG_WARN : cfg->log_level);
+	if (aftermath_queue) jobqueue_set_retry(aftermath_queue, cfg->aftermath_attempts, cfg->aftermath_backoff);
+	screens_reload(cfg);
+
+	pthread_mutex_lock(&settings_lock);
+	struct app_config *old = active_cfg;
+	active_cfg = cfg;
+	pthread_mutex_unlock(&settings_lock);
+	settings_release(old);
+
+	// announcements neither the old nor the new settings play
+	wavcache_trim();
+
+	log_info(LOG_NO_CALL, "Configuration reloaded");
+}
+
+// helper for setting up sip library pjsua
+static void setup_sip(void)
+{
+	pj_status_t status;
+
+	// create pjsua
+	status = pjsua_create();
+	if (status != PJ_SUCCESS) error_exit("Error in pjsua_create()", status);
+
+	// configure pjsua
+	pjsua_config cfg;
+	pjsua_config_default(&cfg);
+
+	// enable configured number of simultaneous calls
+	cfg.max_calls = app_cfg.max_calls;
+
+	// callback configuration
+	cfg.cb.on_incoming_call = &on_incoming_call;
+	cfg.cb.on_call_media_state = &on_call_media_state;
+	cfg.cb.on_call_state = &on_call_state;
+	cfg.cb.on_dtmf_digit = &on_dtmf_digit;
+	cfg.cb.on_reg_state = &on_reg_state;
+	cfg.cb.on_stream_created = &on_stream_created;
+	cfg.cb.on_stream_destroyed = &on_stream_destroyed;
+
+	// logging configuration
+	pjsua_logging_config log_cfg;
+	pjsua_logging_config_default(&log_cfg);
+	log_cfg.console_level = PJSUA_LOG_LEVEL;
+
+	// media configuration
+	pjsua_media_config media_cfg;
+	pjsua_media_config_default(&media_cfg);
+	media_cfg.snd_play_latency = 100;
+	media_cfg.quality = 10;
+	media_configure(&media_cfg, app_cfg.wideband, app_cfg.ptime);
+
+	// every call needs a conference slot for itself, its player and its recorder
+	media_cfg.max_media_ports = app_cfg.max_calls * 3 + 1;
 
 	// initialize pjsua
 	status = pjsua_init(&cfg, &log_cfg, &media_cfg);
 	if (status != PJ_SUCCESS) error_exit("Error in pjsua_init()", status);
 
+	// codec order of the media profile, or the one given by ac
+	media_set_codecs(app_cfg.codecs, app_cfg.wideband);
+
 	// add udp transport
 	pjsua_transport_config udpcfg;
 	pjsua_transport_config_default(&udpcfg);
@@ -603,232 +1784,820 @@ static void setup_sip(void)
 	status = pjsua_set_null_snd_dev();
 	if (status != PJ_SUCCESS) error_exit("Error disabling audio", status);
 
-	log_message("Done.\n");
+	log_info(LOG_NO_CALL, "pjsua set up");
+}
+
+// helper for creating and registering the sip-accounts; they share the
+// transport, account 0 gets the requests no other account matches
+static void register_sip(void)
+{
+	pj_status_t status;
+	int i;
+
+	for (i = 0; i < app_cfg.account_count; i++)
+	{
+		struct account_config *acc = &app_cfg.acc[i];
+
+		// prepare account configuration
+		pjsua_acc_config cfg;
+		pjsua_acc_config_default(&cfg);
+
+		// build sip-user-url
+		char sip_user_url[256];
+		snprintf(sip_user_url, sizeof(sip_user_url), "sip:%s@%s", acc->sip_user, acc->sip_domain);
+
+		// build sip-provder-url
+		char sip_provider_url[256];
+		snprintf(sip_provider_url, sizeof(sip_provider_url), "sip:%s", acc->sip_domain);
+
+		// create and define account
+		cfg.id = pj_str(sip_user_url);
+		cfg.reg_uri = pj_str(sip_provider_url);
+		cfg.cred_count = 1;
+		cfg.cred_info[0].realm = pj_str(acc->sip_domain);
+		cfg.cred_info[0].scheme = pj_str("digest");
+		cfg.cred_info[0].username = pj_str(acc->sip_user);
+		cfg.cred_info[0].data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+		cfg.cred_info[0].data = pj_str(acc->sip_password);
+
+		// add account
+		status = pjsua_acc_add(&cfg, i == 0 ? PJ_TRUE : PJ_FALSE, &acc_ids[i]);
+		if (status != PJ_SUCCESS) error_exit("Error adding account", status);
+
+		log_info(LOG_NO_CALL, "Account %i: %s added, registering", i, sip_user_url);
+	}
+}
+
+// index of the account of a pjsua account id; 0 for unknown ones
+static int account_index(pjsua_acc_id acc_id)
+{
+	int i;
+
+	for (i = 0; i < app_cfg.account_count; i++)
+	{
+		if (acc_ids[i] == acc_id) return i;
+	}
+	return 0;
+}
+
+// helper for playing synthesized speech to the call (call with media_lock held)
+// started is set to the time the first frame goes out, if not NULL
+static pj_status_t create_speech_player(struct call_session *session, struct pcm_buf *speech, double *started)
+{
+	pj_status_t status;
+
+	session->play_pool = pjsua_pool_create("speech", 512, 512);
+	if (session->play_pool == NULL) return PJ_ENOMEM;
+
+	status = pcmport_create(session->play_pool, speech, 0, &session->play_port);
+	if (status == PJ_SUCCESS)
+	{
+		if (started) pcmport_set_start_cb(session->play_port, started, &on_play_start);
+
+		// the stream takes the frames straight from the player, or via the bridge
+		if (session->direct_port)
+		{
+			status = directport_set_player(session->direct_port, session->play_port);
+		}
+		else
+		{
+			status = pjsua_conf_add_port(session->play_pool, session->play_port, &session->play_slot);
+		}
+		if (status != PJ_SUCCESS)
+		{
+			pjmedia_port_destroy(session->play_port);
+		}
+	}
+	if (status != PJ_SUCCESS)
+	{
+		log_error(session->call_id, "Error playing speech (status %i)", status);
+		pj_pool_release(session->play_pool);
+		session->play_pool = NULL;
+		session->play_port = NULL;
+		session->play_slot = PJSUA_INVALID_ID;
+		return status;
+	}
+
+	// connect active call to speech player
+	if (session->play_slot != PJSUA_INVALID_ID)
+	{
+		pjsua_conf_connect(session->play_slot, session->conf_slot);
+	}
+
+	log_debug(session->call_id, "Speech player created");
+	return PJ_SUCCESS;
+}
+
+// helper for creating call-recorder (call with media_lock held)
+static pj_status_t create_recorder(struct call_session *session)
+{
+	pj_status_t status;
+
+	// record at the clock rate of the conference bridge
+	pjsua_conf_port_info bridge;
+	status = pjsua_conf_get_port_info(0, &bridge);
+
+	session->rec_pool = pjsua_pool_create("recorder", 1024, 1024);
+	if (session->rec_pool == NULL) status = PJ_ENOMEM;
+
+	// frames are written to disk by the recorder's own thread, not the media clock
+	if (status == PJ_SUCCESS)
+	{
+		status = recport_create(session->rec_pool, session->rec_file,
+			session->acc->record_format == RECORD_MP3 ? RECPORT_MP3 : RECPORT_WAV,
+			bridge.clock_rate, RECORD_MP3_BITRATE, session->acc->record_trim, &session->rec_port);
+		if (status == PJ_SUCCESS)
+		{
+			if (session->direct_port)
+			{
+				status = directport_set_recorder(session->direct_port, session->rec_port);
+			}
+			else
+			{
+				status = pjsua_conf_add_port(session->rec_pool, session->rec_port, &session->rec_slot);
+			}
+			if (status != PJ_SUCCESS) pjmedia_port_destroy(session->rec_port);
+		}
+	}
+	if (status != PJ_SUCCESS)
+	{
+		log_error(session->call_id, "Error recording answer (status %i)", status);
+		if (session->rec_pool) pj_pool_release(session->rec_pool);
+		session->rec_pool = NULL;
+		session->rec_port = NULL;
+		session->rec_slot = PJSUA_INVALID_ID;
+		return status;
+	}
+
+	// connect active call to call recorder
+	if (session->rec_slot != PJSUA_INVALID_ID)
+	{
+		pjsua_conf_connect(session->conf_slot, session->rec_slot);
+	}
+
+	log_debug(session->call_id, "Recorder created");
+	return PJ_SUCCESS;
+}
+
+static void player_destroy(struct call_session *session) {
+	if (session->play_port != NULL)
+	{
+		if (session->play_slot != PJSUA_INVALID_ID) pjsua_conf_remove_port(session->play_slot);
+		else if (session->direct_port) directport_set_player(session->direct_port, NULL);
+		pjmedia_port_destroy(session->play_port);
+		pj_pool_release(session->play_pool);
+		session->play_slot = PJSUA_INVALID_ID;
+		session->play_pool = NULL;
+	}
+	session->play_port = NULL;
+}
+
+static int recorder_destroy(struct call_session *session) {
+	if (session->rec_port != NULL)
+	{
+		// write the rest of the buffer and close the file
+		if (session->rec_slot != PJSUA_INVALID_ID) pjsua_conf_remove_port(session->rec_slot);
+		else if (session->direct_port) directport_set_recorder(session->direct_port, NULL);
+		recport_stop(session->rec_port);
+
+		struct recport_stats stats;
+		recport_get_stats(session->rec_port, &stats);
+		session->speech_ms = stats.speech_ms;
+		session->cdr.speech_ms = stats.speech_ms;
+		cdr_mark(&session->cdr.recorder_closed);
+		if (stats.overruns > 0)
+		{
+			log_warn(session->call_id, "Recorder dropped %lu of %lu frames, buffer high water %u of %u ms",
+				stats.overruns, stats.frames, stats.high_water_ms, stats.capacity_ms);
+		}
+
+		pjmedia_port_destroy(session->rec_port);
+		pj_pool_release(session->rec_pool);
+		session->rec_slot = PJSUA_INVALID_ID;
+		session->rec_pool = NULL;
+		session->rec_port = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+// claim the session slot of a new call
+static struct call_session *session_open(pjsua_call_id call_id, struct app_config *cfg, int account)
+{
+	if (call_id < 0 || call_id >= app_cfg.max_calls) return NULL;
+
+	struct call_session *session = &sessions[call_id];
+
+	pthread_mutex_lock(&sessions_lock);
+	if (session->in_use)
+	{
+		pthread_mutex_unlock(&sessions_lock);
+		return NULL;
+	}
+	session->in_use = 1;
+	session->generation = ++session_generation;
+	session->dtmf_job = NULL;
+	session->cfg = cfg;
+	session->acc = &cfg->acc[account];
+	pthread_mutex_unlock(&sessions_lock);
+
+	// media_lock is not reset, old dtmf jobs may still be holding it
+	pthread_mutex_lock(&session->media_lock);
+	session->call_id = call_id;
+	session->conf_slot = PJSUA_INVALID_ID;
+	session->play_slot = PJSUA_INVALID_ID;
+	session->play_pool = NULL;
+	session->play_port = NULL;
+	session->rec_slot = PJSUA_INVALID_ID;
+	session->rec_pool = NULL;
+	session->rec_port = NULL;
+	session->rec_file[0] = '\0';
+	session->speech_ms = 0;
+	session->number[0] = '\0';
+	session->prompt_pending = 0;
+	session->menu = 0;
+	pthread_mutex_unlock(&session->media_lock);
+
+	return session;
+}
+
+// look up the session of a running call
+static struct call_session *session_get(pjsua_call_id call_id)
+{
+	if (call_id < 0 || call_id >= app_cfg.max_calls) return NULL;
+	if (!sessions[call_id].in_use) return NULL;
+	return &sessions[call_id];
+}
+
+// release media of a session and free its slot
+static void session_close(struct call_session *session)
+{
+	dtmf_cancel(session);
+
+	pthread_mutex_lock(&session->media_lock);
+	player_destroy(session);
+	recorder_destroy(session);
+	pthread_mutex_unlock(&session->media_lock);
+
+	// a screening worker answering the call finishes first; pjsua frees the
+	// call id only after this returns, so the worker can't answer a new call
+	pthread_mutex_lock(&session->decide_lock);
+	pthread_mutex_lock(&sessions_lock);
+	session->in_use = 0;
+	struct app_config *cfg = session->cfg;
+	session->cfg = NULL;
+	pthread_mutex_unlock(&sessions_lock);
+	pthread_mutex_unlock(&session->decide_lock);
+
+	settings_release(cfg);
+}
+
+// check if a call is still the one a background job was started for
+static int session_is_current(pjsua_call_id call_id, unsigned generation)
+{
+	int current;
+
+	if (call_id < 0 || call_id >= app_cfg.max_calls) return 0;
+
+	pthread_mutex_lock(&sessions_lock);
+	current = sessions[call_id].in_use && sessions[call_id].generation == generation;
+	pthread_mutex_unlock(&sessions_lock);
+
+	return current;
+}
+
+// cancel the dtmf actions of all open sessions (on exit)
+static void session_cancel_all(void)
+{
+	int i;
+	if (sessions == NULL) return;
+	for (i = 0; i < app_cfg.max_calls; i++)
+	{
+		if (sessions[i].in_use) dtmf_cancel(&sessions[i]);
+	}
+}
+
+// release all open sessions (on exit)
+static void session_close_all(void)
+{
+	int i;
+	if (sessions == NULL) return;
+	for (i = 0; i < app_cfg.max_calls; i++)
+	{
+		if (sessions[i].in_use) session_close(&sessions[i]);
+	}
+}
+
+static void extractdelimited(char* dest, char* src, char cBeg, char cEnd)
+{
+	char* pBeg = strchr(src,cBeg);
+	char* pEnd = strrchr(src,cEnd);
+	if( pBeg == NULL || pEnd == NULL)
+	{
+		// leave dest alone.
+		return;
+	}
+	int len = pEnd - pBeg;
+	strncpy(dest,pBeg+1,len-1);
+}
+
+static void getTimestamp(char* dest)
+{
+
+	time_t ltime;
+	struct tm *Tm;
+
+	ltime=time(NULL);
+	Tm=localtime(&ltime);
+
+	sprintf(dest, "%04d-%02d-%02d %02d-%02d-%02d",
+			Tm->tm_year+1900,
+			Tm->tm_mon+1,
+			Tm->tm_mday,
+			Tm->tm_hour,
+			Tm->tm_min,
+			Tm->tm_sec);
+
+}
+
+static void stringRemoveChars(char *string, char *spanset) {
+	char *ptr = string;
+	ptr = strpbrk(ptr, spanset);
+
+	while(ptr != NULL) {
+		*ptr = '_';
+		ptr = strpbrk(ptr, spanset);
+	}
+}
+
+static void FileNameFromCallInfo(char* filename, char* sipNr, pjsua_call_info ci, int record_format) {
+	// log call info
+	char sipTxt[100] = "";
+
+	char PhoneBookText[100] = "NoEntry";
+	char tmp[100];
+	char* ptr;
+	strcpy(tmp, ci.remote_info.ptr);
+
+	// get elements
+	extractdelimited(PhoneBookText, tmp, '\"', '\"');
+	extractdelimited(sipTxt, tmp, '<', '>');
+
+	// extract phone number
+	if (strncmp(sipTxt, "sip:", 4) == 0) {
+		int i = strcspn(sipTxt, "@") - 4;
+		strncpy(sipNr, &sipTxt[4], i);
+		sipNr[i] = '\0';
+	} else {
+		log_warn(ci.id, "SIP does not start with sip:<%s>", sipTxt);
+	}
+
+	getTimestamp(tmp);
+
+	// build filename
+	strcpy(filename, tmp);
+	strcat(filename, " ");
+	strcat(filename, sipNr);
+	if (strlen(PhoneBookText) > 0) {
+		strcat(filename, " ");
+		strcat(filename, PhoneBookText);
+	}
+	strcat(filename, record_format == RECORD_MP3 ? ".mp3" : ".wav");
+
+	//sanitize string for filename
+	stringRemoveChars(filename, "\":\\/*?|<>$%&'`{}[]()@");
+}
+
+#define RESULTSIZE 20
+
+// make worker threads known to pjlib, so they may call pjsua
+static void worker_thread_register(void)
+{
+	static __thread pj_thread_desc desc;
+	pj_thread_t *thread;
+
+	if (!pj_thread_is_registered())
+	{
+		pj_thread_register("worker", desc, &thread);
+	}
+}
+
+// milliseconds since the start of the application
+static double startup_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - startup.origin.tv_sec) * 1000.0 + (now.tv_nsec - startup.origin.tv_nsec) / 1000000.0;
+}
+
+static void phase_begin(enum startup_phase phase)
+{
+	double now = startup_clock();
+	pthread_mutex_lock(&startup.lock);
+	startup.begin[phase] = now;
+	pthread_mutex_unlock(&startup.lock);
+}
+
+static void phase_end(enum startup_phase phase)
+{
+	double now = startup_clock();
+	pthread_mutex_lock(&startup.lock);
+	startup.end[phase] = now;
+	startup.done[phase] = 1;
+	pthread_mutex_unlock(&startup.lock);
+}
+
+// print the startup timings once the registration succeeded and the intro is rendered
+static void startup_report(void)
+{
+	char report[1024], *line, *save;
+	int len, i;
+
+	pthread_mutex_lock(&startup.lock);
+	if (startup.reported || !startup.registered || !startup.prompts_ready
+			|| (has_intro(&app_cfg) && !startup.done[PHASE_INTRO]))
+	{
+		pthread_mutex_unlock(&startup.lock);
+		return;
+	}
+	startup.reported = 1;
+
+	len = sprintf(report, "Startup timing (ms):\n");
+	for (i = 0; i < PHASE_COUNT; i++)
+	{
+		if (!startup.done[i]) continue;
+		len += sprintf(report + len, "  %-13s %8.1f .. %8.1f  %8.1f\n", phase_names[i],
+			startup.begin[i], startup.end[i], startup.end[i] - startup.begin[i]);
+	}
+	sprintf(report + len, "Ready for calls after %.1f ms\n", startup.end[PHASE_REGISTER]);
+	pthread_mutex_unlock(&startup.lock);
+
+	// one log message per line
+	for (line = strtok_r(report, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+	{
+		log_info(LOG_NO_CALL, "%s", line);
+	}
+}
+
+// register the metrics and hook them into tts and the aftermath queue
+static void metrics_setup(void)
+{
+	static const double screening_bounds[] = { 0.001, 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+	static const double tts_bounds[] = { 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+	static const double aftermath_bounds[] = { 0.1, 0.5, 1, 5, 10, 30, 60, 300, 600 };
+	static const double mos_bounds[] = { 1.5, 2, 2.5, 3, 3.5, 4, 4.3 };
+	static const double loss_bounds[] = { 0.001, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2 };
+	static const double jitter_bounds[] = { 0.005, 0.01, 0.02, 0.04, 0.08, 0.16 };
+	static char registered_names[MAX_ACCOUNTS][64], status_names[MAX_ACCOUNTS][64];
+	int i;
+
+	meter.received = metrics_counter("sipserv_calls_received_total", "Incoming calls.");
+	meter.answered = metrics_counter("sipserv_calls_total{result=\"answered\"}", "Incoming calls by result.");
+	meter.rejected = metrics_counter("sipserv_calls_total{result=\"rejected\"}", "Incoming calls by result.");
+	meter.busy = metrics_counter("sipserv_calls_total{result=\"busy\"}", "Incoming calls by result.");
+	meter.screened = metrics_counter("sipserv_calls_screened_total", "Incoming calls checked by nf= or cmd=.");
+	meter.screening_seconds = metrics_histogram("sipserv_screening_seconds", "Time from the incoming call to the screening decision.",
+		screening_bounds, sizeof(screening_bounds) / sizeof(double));
+	meter.tts_seconds = metrics_histogram("sipserv_tts_synthesis_seconds", "Time espeak takes to render a text.",
+		tts_bounds, sizeof(tts_bounds) / sizeof(double));
+	meter.tts_failures = metrics_counter("sipserv_tts_failures_total", "Texts espeak failed to render.");
+	meter.aftermath_seconds = metrics_histogram("sipserv_aftermath_seconds", "Run time of the aftermath command.",
+		aftermath_bounds, sizeof(aftermath_bounds) / sizeof(double));
+	meter.aftermath_ok = metrics_counter("sipserv_aftermath_runs_total{result=\"ok\"}", "Aftermath runs by result.");
+	meter.aftermath_failed = metrics_counter("sipserv_aftermath_runs_total{result=\"failed\"}", "Aftermath runs by result.");
+	meter.aftermath_timeout = metrics_counter("sipserv_aftermath_runs_total{result=\"timeout\"}", "Aftermath runs by result.");
+	meter.aftermath_given_up = metrics_counter("sipserv_aftermath_given_up_total", "Aftermath jobs dropped after the last attempt.");
+	// one gauge per account, labelled once there are several; the names are kept by pointer
+	for (i = 0; i < app_cfg.account_count; i++)
+	{
+		if (app_cfg.account_count == 1)
+		{
+			strcpy(registered_names[i], "sipserv_registered");
+			strcpy(status_names[i], "sipserv_registration_status");
+		}
+		else
+		{
+			sprintf(registered_names[i], "sipserv_registered{account=\"%i\"}", i);
+			sprintf(status_names[i], "sipserv_registration_status{account=\"%i\"}", i);
+		}
+		meter.registered[i] = metrics_gauge(registered_names[i], "1 if the account is registered.");
+		meter.registration_status[i] = metrics_gauge(status_names[i], "SIP status code of the last registration.");
+	}
+	meter.call_mos = metrics_histogram("sipserv_call_mos", "Estimated MOS of ended calls.",
+		mos_bounds, sizeof(mos_bounds) / sizeof(double));
+	meter.call_loss = metrics_histogram("sipserv_call_rtp_loss_ratio", "RTP packet loss of ended calls.",
+		loss_bounds, sizeof(loss_bounds) / sizeof(double));
+	meter.call_jitter = metrics_histogram("sipserv_call_rtp_jitter_seconds", "Mean RTP receive jitter of ended calls.",
+		jitter_bounds, sizeof(jitter_bounds) / sizeof(double));
+	meter.media_bridge = metrics_counter("sipserv_call_media_total{path=\"bridge\"}", "Call media streams by path, see bp=.");
+	meter.media_direct = metrics_counter("sipserv_call_media_total{path=\"direct\"}", "Call media streams by path, see bp=.");
+
+	metrics_set_collector(&metrics_collect);
+	tts_set_observer(&on_tts_run);
 }
 
-// helper for creating and registering sip-account
-static void register_sip(void)
+// metrics read at scrape time: running calls, caches and queues
+static void metrics_collect(FILE *out)
 {
-	pj_status_t status;
+	pjsua_call_id active[app_cfg.max_calls];
+	int count = 0, i;
 
-	log_message("Registering account ... ");
+	// the server thread asks pjsua for the stream stats
+	worker_thread_register();
 
-	// prepare account configuration
-	pjsua_acc_config cfg;
-	pjsua_acc_config_default(&cfg);
+	pthread_mutex_lock(&sessions_lock);
+	for (i = 0; i < app_cfg.max_calls; i++)
+	{
+		if (sessions[i].in_use) active[count++] = sessions[i].call_id;
+	}
+	pthread_mutex_unlock(&sessions_lock);
 
-	// build sip-user-url
-	char sip_user_url[40];
-	sprintf(sip_user_url, "sip:%s@%s", app_cfg.sip_user, app_cfg.sip_domain);
+	metrics_write_family(out, "sipserv_active_calls", "gauge", "Calls in progress.");
+	fprintf(out, "sipserv_active_calls %i\n", count);
 
-	// build sip-provder-url
-	char sip_provider_url[40];
-	sprintf(sip_provider_url, "sip:%s", app_cfg.sip_domain);
+	struct rtp_quality quality[app_cfg.max_calls];
+	int valid[app_cfg.max_calls];
+	for (i = 0; i < count; i++)
+	{
+		valid[i] = (rtpstat_get(active[i], &quality[i]) == 0);
+	}
 
-	// create and define account
-	cfg.id = pj_str(sip_user_url);
-	cfg.reg_uri = pj_str(sip_provider_url);
-	cfg.cred_count = 1;
-	cfg.cred_info[0].realm = pj_str(app_cfg.sip_domain);
-	cfg.cred_info[0].scheme = pj_str("digest");
-	cfg.cred_info[0].username = pj_str(app_cfg.sip_user);
-	cfg.cred_info[0].data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
-	cfg.cred_info[0].data = pj_str(app_cfg.sip_password);
+	metrics_write_family(out, "sipserv_active_call_jitter_ms", "gauge", "Mean RTP receive jitter of a running call.");
+	for (i = 0; i < count; i++)
+	{
+		if (valid[i]) fprintf(out, "sipserv_active_call_jitter_ms{call=\"%i\"} %.3f\n", active[i], quality[i].jitter_ms);
+	}
+	metrics_write_family(out, "sipserv_active_call_loss_ratio", "gauge", "RTP packet loss of a running call.");
+	for (i = 0; i < count; i++)
+	{
+		if (valid[i]) fprintf(out, "sipserv_active_call_loss_ratio{call=\"%i\"} %.4f\n", active[i], quality[i].loss);
+	}
+	metrics_write_family(out, "sipserv_active_call_rtt_ms", "gauge", "Mean RTCP round trip of a running call.");
+	for (i = 0; i < count; i++)
+	{
+		if (valid[i]) fprintf(out, "sipserv_active_call_rtt_ms{call=\"%i\"} %.3f\n", active[i], quality[i].rtt_ms);
+	}
+	metrics_write_family(out, "sipserv_active_call_mos", "gauge", "Estimated MOS of a running call.");
+	for (i = 0; i < count; i++)
+	{
+		if (valid[i]) fprintf(out, "sipserv_active_call_mos{call=\"%i\"} %.2f\n", active[i], quality[i].mos);
+	}
 
-	// add account
-	status = pjsua_acc_add(&cfg, PJ_TRUE, &acc_id);
-	if (status != PJ_SUCCESS) error_exit("Error adding account", status);
+	struct ttscache_stats stats;
+	ttscache_get_stats(&stats);
+	metrics_write_family(out, "sipserv_tts_cache_lookups_total", "counter", "Speech cache lookups by result.");
+	fprintf(out, "sipserv_tts_cache_lookups_total{result=\"memory\"} %lu\n", stats.memory_hits);
+	fprintf(out, "sipserv_tts_cache_lookups_total{result=\"disk\"} %lu\n", stats.disk_hits);
+	fprintf(out, "sipserv_tts_cache_lookups_total{result=\"miss\"} %lu\n", stats.misses);
+	metrics_write_family(out, "sipserv_tts_cache_bytes", "gauge", "Size of the speech cache.");
+	fprintf(out, "sipserv_tts_cache_bytes{store=\"memory\"} %lu\n", (unsigned long)stats.memory_used);
+	fprintf(out, "sipserv_tts_cache_bytes{store=\"disk\"} %lu\n", (unsigned long)stats.disk_used);
+
+	// loads only grow on startup and reloads: calls play the prompts from memory
+	struct wavcache_stats wav_stats;
+	wavcache_get_stats(&wav_stats);
+	metrics_write_family(out, "sipserv_prompt_file_loads_total", "counter", "WAV prompts read from disk.");
+	fprintf(out, "sipserv_prompt_file_loads_total %lu\n", wav_stats.loads);
+	metrics_write_family(out, "sipserv_prompt_cache_bytes", "gauge", "Samples of the WAV prompts held in memory.");
+	fprintf(out, "sipserv_prompt_cache_bytes %lu\n", (unsigned long)wav_stats.memory_used);
+
+	if (aftermath_queue != NULL)
+	{
+		metrics_write_family(out, "sipserv_aftermath_pending", "gauge", "Aftermath jobs waiting or running.");
+		fprintf(out, "sipserv_aftermath_pending %i\n", jobqueue_pending(aftermath_queue));
+	}
 
-	log_message("Done.\n");
+	struct recport_stats rec_stats;
+	recport_get_totals(&rec_stats);
+	metrics_write_family(out, "sipserv_recorder_frames_total", "counter", "Frames passed to the recorders.");
+	fprintf(out, "sipserv_recorder_frames_total %lu\n", rec_stats.frames);
+	metrics_write_family(out, "sipserv_recorder_dropped_frames_total", "counter", "Frames dropped because the writer fell behind.");
+	fprintf(out, "sipserv_recorder_dropped_frames_total %lu\n", rec_stats.overruns);
 }
 
-// helper for creating call-media-player
-static void create_player(pjsua_call_id call_id, char *file)
+// espeak run finished (synthesis thread)
+static void on_tts_run(double seconds, int failed)
 {
-	// get call infos
-	pjsua_call_info ci;
-	pjsua_call_get_info(call_id, &ci);
-
-	pj_str_t name;
-	pj_status_t status = PJ_ENOTFOUND;
-
-	log_message("Creating player ... ");
-
-	// create player for playback media
-	status = pjsua_player_create(pj_cstr(&name, file), PJMEDIA_FILE_NO_LOOP, &play_id);
-	if (status != PJ_SUCCESS) error_exit("Error playing sound-playback", status);
+	metrics_observe(meter.tts_seconds, seconds);
+	if (failed) metrics_add(meter.tts_failures, 1);
+}
 
-	// connect active call to media player
-	pjsua_conf_connect(pjsua_player_get_conf_port(play_id), ci.conf_slot);
+// aftermath run finished (aftermath worker)
+static void on_aftermath_run(unsigned long id, int status, int final, double seconds)
+{
+	metrics_observe(meter.aftermath_seconds, seconds);
+	if (status == PROC_OK) metrics_add(meter.aftermath_ok, 1);
+	else if (status == PROC_TIMEOUT) metrics_add(meter.aftermath_timeout, 1);
+	else metrics_add(meter.aftermath_failed, 1);
 
-	// get media port (play_port) from play_id
-    status = pjsua_player_get_port(play_id, &play_port);
-	if (status != PJ_SUCCESS) error_exit("Error getting sound player port", status);
+	if (final && status != PROC_OK) metrics_add(meter.aftermath_given_up, 1);
 
-	log_message("Done.\n");
+	cdr_aftermath_run(id, status == PROC_OK ? "ok" : status == PROC_TIMEOUT ? "timeout" : "failed", final);
 }
 
-// helper for creating call-recorder
-static void create_recorder(pjsua_call_info ci)
+// preload thread: load espeak and the prompts, overlapping with the pjsua setup
+static void *preload_thread(void *arg)
 {
-	// specify target file
-	pj_str_t rec_file = pj_str(rec_ans_file);
-	pj_status_t status = PJ_ENOTFOUND;
-
-	log_message("Creating recorder ... ");
+	(void)arg;
 
-	// Create recorder for call
-	status = pjsua_recorder_create(&rec_file, 0, NULL, 0, 0, &rec_id); // don't forget to destroy recorder, to have the file written.
-	if (status != PJ_SUCCESS) error_exit("Error recording answer", status);
+	int i, announcements = 0, intros = 0;
 
-	// connect active call to call recorder
-	pjsua_conf_port_id rec_port = pjsua_recorder_get_conf_port(rec_id);
-	pjsua_conf_connect(ci.conf_slot, rec_port);
+	for (i = 0; i < app_cfg.account_count; i++)
+	{
+		if (app_cfg.acc[i].announcement_file) announcements++;
+		else intros++;
+	}
 
-	log_message("Done.\n");
-}
+	// announcement mode: make sure the files are there, their intros aren't needed
+	if (announcements > 0)
+	{
+		phase_begin(PHASE_ANNOUNCEMENT);
+		// read once, every call plays the same samples from memory
+		if (load_announcements(&app_cfg) != 0) return NULL;
+		phase_end(PHASE_ANNOUNCEMENT);
+	}
 
-void player_destroy(pjsua_player_id id) {
-	if (id != PJSUA_INVALID_ID)
+	// load speech synthesis, dtmf answers need it in both modes
+	phase_begin(PHASE_ESPEAK);
+	if (tts_init(media_clock_rate(app_cfg.wideband)) != 0)
 	{
-		pjsua_player_destroy(id);
-		play_id = PJSUA_INVALID_ID;
+		log_error(LOG_NO_CALL, "Error loading espeak");
+		return NULL;
 	}
-}
 
-int recorder_destroy(pjsua_player_id id) {
-	if (id != PJSUA_INVALID_ID)
+	// speech cache, phrases rendered before are not synthesized again
+	if (app_cfg.tts_cache && app_cfg.tts_cache[0])
 	{
-		pjsua_recorder_destroy(id);
-		rec_id = PJSUA_INVALID_ID;
-		return 0;
+		struct ttscache_config cache_cfg;
+		cache_cfg.dir = app_cfg.tts_cache;
+		cache_cfg.memory_limit = (size_t)app_cfg.tts_cache_memory << 20;
+		cache_cfg.disk_limit = (size_t)app_cfg.tts_cache_disk << 20;
+
+		if (ttscache_open(&cache_cfg) != 0)
+		{
+			log_warn(LOG_NO_CALL, "Error opening speech cache, speech is synthesized without cache");
+		}
 	}
-	return 1;
-}
+	phase_end(PHASE_ESPEAK);
 
-// synthesize speech / create message via espeak
-static int synthesize_speech(char *speech, char *file, char* language)
-{
-	int speech_status = -1;
+	// synthesizing speech, calls can already play it while it is being rendered
+	if (intros > 0)
+	{
+		phase_begin(PHASE_INTRO);
+
+		if (render_intros(&app_cfg) != 0)
+		{
+			log_error(LOG_NO_CALL, "Error while creating phone text");
+			return NULL;
+		}
+	}
 
-	char speech_command[1024];
-	sprintf(speech_command, "espeak -v%s -a%i -k%i -s%i -p%i -w %s '%s'", language, ESPEAK_AMPLITUDE, ESPEAK_CAPITALS_PITCH, ESPEAK_SPEED, ESPEAK_PITCH, file, speech);
-	speech_status = system(speech_command);
+	// the menu prompts too, a digit only switches the buffer a call plays
+	if (render_menus(&app_cfg) != 0)
+	{
+		log_error(LOG_NO_CALL, "Error while creating menu prompts");
+		return NULL;
+	}
 
-	return speech_status;
+	startup.preload_ok = 1;
+	return NULL;
 }
 
+// start the intro or announcement of a call (call with media_lock held);
+// a caller who went into a menu before the prompts were loaded gets its prompt
+static void start_prompt(struct call_session *session)
+{
+	create_speech_player(session, menu_prompt(session, session->menu), &session->cdr.first_frame);
+}
 
-static void extractdelimited(char* dest, char* src, char cBeg, char cEnd)
+// prompt of a menu; the top level plays the intro or the announcement of
+// the account called, the menus below are the same for all accounts
+static struct pcm_buf *menu_prompt(const struct call_session *session, int menu)
 {
-	char* pBeg = strchr(src,cBeg);
-	char* pEnd = strrchr(src,cEnd);
-	if( pBeg == NULL || pEnd == NULL)
-	{
-		// leave dest alone.
-		return;
-	}
-	int len = pEnd - pBeg;
-	strncpy(dest,pBeg+1,len-1);
+	if (menu > 0) return session->cfg->menus[menu].prompt;
+	return session->acc->announcement ? session->acc->announcement : session->acc->intro_speech;
 }
 
-static void getTimestamp(char* dest)
+// move a call to another menu and play its prompt (call with media_lock held);
+// the prompts are in memory, a running speech player just switches its buffer
+static void menu_enter(struct call_session *session, int menu, double *started)
 {
+	struct pcm_buf *prompt = menu_prompt(session, menu);
 
-	time_t ltime;
-	struct tm *Tm;
+	session->menu = menu;
 
-	ltime=time(NULL);
-	Tm=localtime(&ltime);
+	// no media yet, or start_pending_prompts plays it
+	if (session->conf_slot == PJSUA_INVALID_ID || session->prompt_pending) return;
 
-	sprintf(dest, "%04d-%02d-%02d %02d-%02d-%02d",
-			Tm->tm_year+1900,
-			Tm->tm_mon+1,
-			Tm->tm_mday,
-			Tm->tm_hour,
-			Tm->tm_min,
-			Tm->tm_sec);
+	if (session->play_port != NULL)
+	{
+		pcmport_set_start_cb(session->play_port, started, started ? &on_play_start : NULL);
+		if (pcmport_set_buf(session->play_port, prompt) == PJ_SUCCESS) return;
+	}
 
+	// no player yet, or one of another clock rate (e.g. a wav announcement)
+	player_destroy(session);
+	create_speech_player(session, prompt, started);
 }
 
-static void stringRemoveChars(char *string, char *spanset) {
-	char *ptr = string;
-	ptr = strpbrk(ptr, spanset);
+// start the prompts of calls which got media before the prompts were loaded
+static void start_pending_prompts(void)
+{
+	int i;
+	for (i = 0; i < app_cfg.max_calls; i++)
+	{
+		struct call_session *session = &sessions[i];
 
-	while(ptr != NULL) {
-		*ptr = '_';
-		ptr = strpbrk(ptr, spanset);
+		pthread_mutex_lock(&session->media_lock);
+		if (session->prompt_pending)
+		{
+			session->prompt_pending = 0;
+			if (session->conf_slot != PJSUA_INVALID_ID) start_prompt(session);
+		}
+		pthread_mutex_unlock(&session->media_lock);
 	}
 }
 
-static void FileNameFromCallInfo(char* filename, char* sipNr, pjsua_call_info ci) {
-	// log call info
-	char sipTxt[100] = "";
-
-	char PhoneBookText[100] = "NoEntry";
-	char tmp[100];
-	char* ptr;
-	strcpy(tmp, ci.remote_info.ptr);
+// screening job, handed to the worker pool
+struct screen_job {
+	pjsua_call_id call_id;
+	unsigned generation;
+	double received; // cdr_clock() when the call came in
+	int timeout;     // ms, settings of the call
+	int default_take;
+	char command[];
+};
 
-	// get elements
-	extractdelimited(PhoneBookText, tmp, '\"', '\"');
-	extractdelimited(sipTxt, tmp, '<', '>');
+// take or leave the call after screening
+static void screen_decide(pjsua_call_id call_id, int take)
+{
+	struct call_session *session = session_get(call_id);
 
-	// extract phone number
-	if (strncmp(sipTxt, "sip:", 4) == 0) {
-		int i = strcspn(sipTxt, "@") - 4;
-		strncpy(sipNr, &sipTxt[4], i);
-		sipNr[i] = '\0';
-	} else {
-		//sprintf(tmp,"SIP invalid");
-		sprintf(tmp, "SIP does not start with sip:<%s>\n", sipTxt);
-		log_message(tmp);
+	if(take)
+	{
+		// answer incoming call with 200 status/OK
+		pjsua_call_answer(call_id, 200, NULL, NULL);
+		metrics_add(meter.answered, 1);
+		if (session)
+		{
+			cdr_mark(&session->cdr.answer);
+			session->cdr.result = "answered";
+		}
 	}
-
-	getTimestamp(tmp);
-
-	// build filename
-	strcpy(filename, tmp);
-	strcat(filename, " ");
-	strcat(filename, sipNr);
-	if (strlen(PhoneBookText) > 0) {
-		strcat(filename, " ");
-		strcat(filename, PhoneBookText);
+	else
+	{
+		log_info(call_id, "Will not take call.");
+		metrics_add(meter.rejected, 1);
+		if (session) session->cdr.result = "rejected";
 	}
-	strcat(filename, ".wav");
-
-	//sanitize string for filename
-	stringRemoveChars(filename, "\":\\/*?|<>$%&'`{}[]()@");
 }
 
-#define RESULTSIZE 20
-
-// helper for calling BASH
-static int callBash(char* command, char* result) {
-
-	int error=0;
-	FILE* fp;
-
-	fp = popen(command, "r");
-	if (fp == NULL) {
-		error = 1;
-		log_message(" (Failed to run command) \n");
+// run the screening command on a worker thread
+static void screen_job_run(void *arg)
+{
+	struct screen_job *job = arg;
+	char result[RESULTSIZE] = "";
+	int take;
+
+	double started = cdr_clock();
+	int status = proc_run(job->command, result, sizeof(result), job->timeout, NULL);
+	double ended = cdr_clock();
+	if (status == PROC_TIMEOUT || result[0] == '\0')
+	{
+		// no answer from the command, use the configured decision
+		log_warn(job->call_id, "Check %s, using default decision.", status == PROC_TIMEOUT ? "timed out" : "failed");
+		take = job->default_take;
+	}
+	else
+	{
+		log_info(job->call_id, "Check result: %s", result);
+		take = (result[0] == '1');
 	}
+	metrics_observe(meter.screening_seconds, (ended - job->received) / 1000);
 
-	if (!error) {
-		if (fgets(result, RESULTSIZE - 1, fp) == NULL) {
-			error = 1;
-			log_message(" (Failed to read result) \n");
+	// the caller may have hung up meanwhile; decide_lock keeps the session
+	// from being closed until the call is answered. Not media_lock, answering
+	// may run on_call_media_state in this thread. If the hangup is handled
+	// at this moment, pjsua gives up on the answer after its lock timeout
+	if (job->call_id >= 0 && job->call_id < app_cfg.max_calls)
+	{
+		struct call_session *session = &sessions[job->call_id];
+		pthread_mutex_lock(&session->decide_lock);
+		if (session_is_current(job->call_id, job->generation))
+		{
+			cdr_mark_at(&session->cdr.screen_start, started);
+			cdr_mark_at(&session->cdr.screen_end, ended);
+			screen_decide(job->call_id, take);
 		}
+		pthread_mutex_unlock(&session->decide_lock);
 	}
 
-	return error;
+	free(job);
 }
 
 // handler for incoming-call-events
 static void on_incoming_call(pjsua_acc_id acc_id, pjsua_call_id call_id, pjsip_rx_data *rdata)
 {
-	char info[200];
 	char filename[200];
 	char sipNr[100] = "";
 
@@ -836,33 +2605,71 @@ static void on_incoming_call(pjsua_acc_id acc_id, pjsua_call_id call_id, pjsip_r
 	pjsua_call_info ci;
 	pjsua_call_get_info(call_id, &ci);
 
-	PJ_UNUSED_ARG(acc_id);
 	PJ_UNUSED_ARG(rdata);
 
-	current_call = call_id;
+	double received = cdr_clock();
+	metrics_add(meter.received, 1);
+
+	// settings of the call, kept by the session until it ends
+	struct app_config *cfg = settings_get();
 
-	FileNameFromCallInfo(filename,sipNr,ci);
+	// the account called decides about screening, greeting and recording
+	int account = account_index(acc_id);
+	struct account_config *acc = &cfg->acc[account];
+
+	FileNameFromCallInfo(filename,sipNr,ci,acc->record_format);
+
+	struct call_session *session = session_open(call_id, cfg, account);
+	if (session == NULL)
+	{
+		settings_release(cfg);
+		log_limited(LOG_WARN, call_id, "No free call session, rejecting call.");
+		pjsua_call_answer(call_id, 486, NULL, NULL);
+		metrics_add(meter.busy, 1);
+
+		struct cdr busy;
+		cdr_begin(&busy, call_id, sipNr, received);
+		busy.account = account;
+		busy.result = "busy";
+		busy.status = 486;
+		cdr_write(&busy);
+		return;
+	}
+	cdr_begin(&session->cdr, call_id, sipNr, received);
+	session->cdr.account = account;
 
 	// log call info
-	sprintf(info, "Incoming call from |%s|\n>%s<\n",ci.remote_info.ptr,filename);
-	log_message(info);
+	log_limited(LOG_INFO, call_id, "Incoming call for account %i from |%s| >%s<", account, ci.remote_info.ptr, filename);
 
-	// store filename for call into global variable for recorder
-	strcpy(rec_ans_file, filename);
-	strcpy(lastNumber, sipNr); // remember number as well
+	// store filename for call into the session for recorder
+	strcpy(session->rec_file, filename);
+	strcpy(session->number, sipNr); // remember number as well
 
     // fire external job to check, if we take the call
 
-    char result[RESULTSIZE];
-    result[0] = '1'; result[1] = '\0'; // preset with "take call
-    int error;
+    int take = 1; // preset with "take call"
 
-	if(app_cfg.CallCmd)
+	struct numscreen *screen = __atomic_load_n(&screens[account], __ATOMIC_ACQUIRE);
+	if(acc->numbers_file && screen)
+	{
+		// built-in screening, no need to fork anything
+		char match[64];
+		cdr_mark(&session->cdr.screen_start);
+		take = numscreen_check(screen, sipNr, match, sizeof(match));
+		cdr_mark(&session->cdr.screen_end);
+		metrics_add(meter.screened, 1);
+		metrics_observe(meter.screening_seconds, (cdr_clock() - received) / 1000);
+		if (take)
+		{
+			log_info(call_id, "Number found as %s", match);
+		}
+	}
+	else if(acc->CallCmd)
 	{
-		char cmdOut[200];
 		char* cmd;
 		int lLen;
-		cmd = app_cfg.CallCmd; // copy ptr, just for beauty
+		cmd = acc->CallCmd; // copy ptr, just for beauty
+		char cmdOut[strlen(cmd) + strlen(sipNr) + 1];
 
 		// modify cmd
 		char* rHalf = strchr(cmd,'#'); // get ptr to right half of string (assuming one '#')
@@ -880,23 +2687,66 @@ static void on_incoming_call(pjsua_acc_id acc_id, pjsua_call_id call_id, pjsip_r
 			strcpy(cmdOut,cmd); // just copy
 		}
 
-		sprintf(info, "Checking with \"%s\"\n",cmdOut);
-		log_message(info);
+		log_debug(call_id, "Checking with \"%s\"", cmdOut);
+
+		// let the caller hear ringing, the decision follows from the worker
+		pjsua_call_answer(call_id, 180, NULL, NULL);
 
-		error = callBash(cmdOut, result);
+		metrics_add(meter.screened, 1);
+		struct screen_job *job = malloc(sizeof(struct screen_job) + strlen(cmdOut) + 1);
+		if (job != NULL)
+		{
+			job->call_id = call_id;
+			job->generation = session->generation;
+			job->received = received;
+			job->timeout = cfg->check_timeout;
+			job->default_take = cfg->check_default;
+			strcpy(job->command, cmdOut);
+			if (workpool_submit(screen_pool, &screen_job_run, job) == 0) return;
+			free(job);
+		}
 
-		sprintf(info, "check result:\n%s\n",result,error);
-		log_message(info);
+		log_limited(LOG_WARN, call_id, "Screening queue full, using default decision.");
+		take = cfg->check_default;
 	}
 
-	if(result[0]=='1')
+	screen_decide(call_id, take);
+}
+
+// handler for registration-state-change-events
+static void on_reg_state(pjsua_acc_id acc_id)
+{
+	pjsua_acc_info info;
+
+	if (pjsua_acc_get_info(acc_id, &info) != PJ_SUCCESS) return;
+
+	int account = account_index(acc_id);
+	metrics_set(meter.registered[account], info.status / 100 == 2);
+	metrics_set(meter.registration_status[account], info.status);
+
+	if (info.status / 100 != 2)
 	{
-		// answer incoming call with 200 status/OK
-		pjsua_call_answer(call_id, 200, NULL, NULL);
+		log_error(LOG_NO_CALL, "Account %i: registration failed: %i %.*s", account, info.status, (int)info.status_text.slen, info.status_text.ptr);
+		return;
 	}
-	else
+	log_debug(LOG_NO_CALL, "Account %i: registered", account);
+
+	// re-registrations end up here too, only the first one of any account counts for startup
+	double now = startup_clock();
+	pthread_mutex_lock(&startup.lock);
+	int first = !startup.registered;
+	if (first)
+	{
+		startup.registered = 1;
+		startup.end[PHASE_REGISTER] = now;
+		startup.done[PHASE_REGISTER] = 1;
+	}
+	pthread_mutex_unlock(&startup.lock);
+
+	if (first)
 	{
-		log_message("Will not take call.\n");
+		log_info(LOG_NO_CALL, "Registered, ready for calls.");
+		startup_report();
 	}
 }
 
@@ -907,29 +2757,38 @@ static void on_call_media_state(pjsua_call_id call_id)
 	pjsua_call_info ci;
 	pjsua_call_get_info(call_id, &ci);
 
-	pj_status_t status = PJ_ENOTFOUND;
+	struct call_session *session = session_get(call_id);
+	if (session == NULL) return;
 
 	// check state if call is established/active
-	if (ci.media_status == PJSUA_CALL_MEDIA_ACTIVE) {
-
-		log_message("Call media activated.\n");
-
-		// create and start media player
-		if(app_cfg.announcement_file)
+	pthread_mutex_lock(&session->media_lock);
+	if (ci.media_status == PJSUA_CALL_MEDIA_ACTIVE && session->conf_slot == PJSUA_INVALID_ID) {
+
+		log_debug(call_id, "Call media activated.");
+		session->conf_slot = ci.conf_slot;
+		cdr_mark(&session->cdr.media);
+
+		// create and start media player; right after startup the prompts
+		// may still be loading, then main starts the player later
+		pthread_mutex_lock(&startup.lock);
+		int ready = startup.prompts_ready;
+		pthread_mutex_unlock(&startup.lock);
+		if (ready)
 		{
-			create_player(call_id, app_cfg.announcement_file);
+			start_prompt(session);
 		}
 		else
 		{
-			create_player(call_id, tts_file);
+			session->prompt_pending = 1;
 		}
 
 		// create and start call recorder
-		if (app_cfg.record_calls)
+		if (session->acc->record_calls)
 		{
-			create_recorder(ci);
+			create_recorder(session);
 		}
 	}
+	pthread_mutex_unlock(&session->media_lock);
 }
 
 // handler for call-state-change-events
@@ -942,115 +2801,329 @@ static void on_call_state(pjsua_call_id call_id, pjsip_event *e)
 	// prevent warning about unused argument e
     PJ_UNUSED_ARG(e);
 
+	struct call_session *session = session_get(call_id);
+	if (session == NULL) return;
+
 	// check call state
 	if (ci.state == PJSIP_INV_STATE_CONFIRMED)
 	{
-		log_message("Call confirmed.\n");
+		log_info(call_id, "Call confirmed.");
 
 		// ensure that message is played from start
-		if (play_id != PJSUA_INVALID_ID)
+		pthread_mutex_lock(&session->media_lock);
+		if (session->play_port != NULL)
 		{
-			pjmedia_wav_player_port_set_pos(play_port, 0);
+			pcmport_rewind(session->play_port);
 		}
+		pthread_mutex_unlock(&session->media_lock);
 	}
 	if (ci.state == PJSIP_INV_STATE_DISCONNECTED)
 	{
-		log_message("Call disconnected.\n");
+		log_info(call_id, "Call disconnected, status %i.", ci.last_status);
+		cdr_mark(&session->cdr.hangup);
+		session->cdr.status = ci.last_status;
+		if (session->cdr.result == NULL) session->cdr.result = "cancelled";
+		int deferred = 0;
+
+		// stop dtmf actions still running for this call
+		dtmf_cancel(session);
 
 		// disable player
-		player_destroy(play_id);
+		pthread_mutex_lock(&session->media_lock);
+		player_destroy(session);
         // dont't forget the recorder!
-		if(recorder_destroy(rec_id) == 0)
+		int recorded = (recorder_destroy(session) == 0);
+		pthread_mutex_unlock(&session->media_lock);
+
+		if(recorded && session->acc->record_trim && session->speech_ms == 0)
+		{
+			// nobody said anything (e.g. a robocall), no need to keep or mail it
+			log_info(call_id, "No speech recorded, dropping the file.");
+			unlink(session->rec_file);
+		}
+		else if(recorded)
 		{
 			// ok, recorder has been destroyed successfully, there should be a file too.
-			log_message("a file has been recorded.\n");
+			log_info(call_id, "Recorded %s", session->rec_file);
 
 			// process the Aftermath, if we have any.
-			if(app_cfg.AfterMath)
+			if(session->acc->AfterMath && aftermath_queue)
 			{
-				char result[RESULTSIZE];
-				char command[300];
-				sprintf(command,"%s \"%s\" \"%s\" \"%s\"", app_cfg.AfterMath, ci.local_info.ptr, lastNumber, rec_ans_file);
-
-				log_message(command);
-				log_message("\n");
-				// do it.
-				callBash(command, result);
+				char command[600];
+				snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" %lu.%lu", session->acc->AfterMath, ci.local_info.ptr, session->number, session->rec_file,
+					session->speech_ms / 1000, session->speech_ms % 1000 / 100);
+
+				log_debug(call_id, "Aftermath: %s", command);
+				// queue it, the workers run it and retry on failure.
+				// the call record waits for the end of the command
+				struct cdr *cdr = cdr_defer(&session->cdr);
+				if (jobqueue_add(aftermath_queue, command, cdr ? &cdr->aftermath_id : NULL) != 0)
+				{
+					log_error(call_id, "Error queueing aftermath");
+					if (cdr) cdr->aftermath = "failed";
+					cdr_release(cdr);
+				}
+				deferred = 1;
 			}
 		}
+
+		if (!deferred) cdr_write(&session->cdr);
+		session_close(session);
 	}
 }
 
+// first frame of a speech player went out (media thread)
+static void on_play_start(pjmedia_port *port, void *stage)
+{
+	PJ_UNUSED_ARG(port);
+	cdr_mark(stage);
+}
 
+// handler for a new media stream: with bp=1 the stream is clocked by its own
+// master port against the player and recorder of the call, and the bridge
+// only gets a null port in its place. Calls whose codec runs at another rate
+// than the prompts stay on the bridge, which resamples them
+static void on_stream_created(pjsua_call_id call_id, pjmedia_stream *strm, unsigned stream_idx, pjmedia_port **p_port)
+{
+	pj_status_t status;
 
+	PJ_UNUSED_ARG(strm);
+	PJ_UNUSED_ARG(stream_idx);
 
+	struct call_session *session = session_get(call_id);
+	if (session == NULL) return;
 
-// handler for dtmf-events
-static void on_dtmf_digit(pjsua_call_id call_id, int digit)
-{
-	// get call infos
-	pjsua_call_info ci;
-	pjsua_call_get_info(call_id, &ci);
-
-	// work on detected dtmf digit
-	int dtmf_key = digit - 48;
+	pjmedia_port *stream = *p_port;
+	unsigned rate = PJMEDIA_PIA_SRATE(&stream->info);
+	unsigned spf = PJMEDIA_PIA_SPF(&stream->info);
 
-	char info[100];
-	sprintf(info, "DTMF command detected: %i\n", dtmf_key);
-	log_message(info);
+	pthread_mutex_lock(&session->media_lock);
+	if (!session->cfg->bypass || session->direct_pool != NULL
+		|| PJMEDIA_PIA_CCNT(&stream->info) != 1 || rate != media_clock_rate(app_cfg.wideband))
+	{
+		if (session->cfg->bypass) log_debug(call_id, "Stream at %u Hz, using the conference bridge", rate);
+		pthread_mutex_unlock(&session->media_lock);
+		metrics_add(meter.media_bridge, 1);
+		return;
+	}
 
-	struct dtmf_config *d_cfg = &app_cfg.dtmf_cfg[dtmf_key-1];
-	if (d_cfg->processing_active == 0)
+	session->direct_pool = pjsua_pool_create("direct", 512, 512);
+	status = session->direct_pool ? PJ_SUCCESS : PJ_ENOMEM;
+	if (status == PJ_SUCCESS) status = directport_create(session->direct_pool, rate, spf, &session->direct_port);
+	if (status == PJ_SUCCESS) status = pjmedia_null_port_create(session->direct_pool, rate, 1, spf, 16, &session->direct_dummy);
+	if (status == PJ_SUCCESS) status = pjmedia_master_port_create(session->direct_pool, stream, session->direct_port, 0, &session->direct_clock);
+	if (status == PJ_SUCCESS) status = pjmedia_master_port_start(session->direct_clock);
+	if (status != PJ_SUCCESS)
 	{
-		d_cfg->processing_active = 1;
+		log_error(call_id, "Error bypassing the conference bridge (status %i), using it", status);
+		if (session->direct_clock) pjmedia_master_port_destroy(session->direct_clock, PJ_FALSE);
+		if (session->direct_dummy) pjmedia_port_destroy(session->direct_dummy);
+		if (session->direct_port) pjmedia_port_destroy(session->direct_port);
+		if (session->direct_pool) pj_pool_release(session->direct_pool);
+		session->direct_clock = NULL;
+		session->direct_dummy = NULL;
+		session->direct_port = NULL;
+		session->direct_pool = NULL;
+		pthread_mutex_unlock(&session->media_lock);
+		metrics_add(meter.media_bridge, 1);
+		return;
+	}
+
+	// a renegotiated stream takes over the player and recorder of the call
+	if (session->play_port && session->play_slot == PJSUA_INVALID_ID) directport_set_player(session->direct_port, session->play_port);
+	if (session->rec_port && session->rec_slot == PJSUA_INVALID_ID) directport_set_recorder(session->direct_port, session->rec_port);
+	pthread_mutex_unlock(&session->media_lock);
+
+	*p_port = session->direct_dummy;
+	metrics_add(meter.media_direct, 1);
+	log_debug(call_id, "Stream at %u Hz bypasses the conference bridge", rate);
+}
 
-		if (d_cfg->active == 1)
+// handler for the end of a media stream, the last chance to read its statistics
+static void on_stream_destroyed(pjsua_call_id call_id, pjmedia_stream *strm, unsigned stream_idx)
+{
+	pjmedia_rtcp_stat stat;
+	struct rtp_quality quality;
+
+	PJ_UNUSED_ARG(stream_idx);
+
+	// the direct path must stop before the stream goes; pjsua has already
+	// removed the null port from the bridge. The session may be closed by now
+	if (call_id >= 0 && call_id < app_cfg.max_calls)
+	{
+		struct call_session *session = &sessions[call_id];
+		pthread_mutex_lock(&session->media_lock);
+		if (session->direct_clock != NULL)
 		{
-			log_message("Active DTMF command found for received digit.\n");
-			log_message("Creating answer ... ");
+			pjmedia_master_port_stop(session->direct_clock);
+			pjmedia_master_port_destroy(session->direct_clock, PJ_FALSE);
+			pjmedia_port_destroy(session->direct_port);
+			pjmedia_port_destroy(session->direct_dummy);
+			pj_pool_release(session->direct_pool);
+			session->direct_clock = NULL;
+			session->direct_port = NULL;
+			session->direct_dummy = NULL;
+			session->direct_pool = NULL;
+		}
+		pthread_mutex_unlock(&session->media_lock);
+	}
+
+	if (pjmedia_stream_get_stat(strm, &stat) != PJ_SUCCESS) return;
+
+	// calls without any audio received tell nothing about the network
+	rtpstat_quality(&stat, &quality);
+	if (quality.packets == 0) return;
+
+	metrics_observe(meter.call_mos, quality.mos);
+	metrics_observe(meter.call_loss, quality.loss);
+	metrics_observe(meter.call_jitter, quality.jitter_ms / 1000);
+}
+
 
-			int error = 0;
-			char command[100];
-			char result[RESULTSIZE];
 
-			strcpy(command, d_cfg->cmd);
 
-			error = callBash(command, result);
-			if (!error)
-			{
-				player_destroy(play_id);
-				recorder_destroy(rec_id);
 
-				char tts_buffer[200];
-				sprintf(tts_buffer, d_cfg->tts_answer, result);
+// cancel the running dtmf action of a call, if any
+static void dtmf_cancel(struct call_session *session)
+{
+	pthread_mutex_lock(&sessions_lock);
+	if (session->dtmf_job != NULL)
+	{
+		session->dtmf_job->cancel = 1;
+		session->dtmf_job = NULL;
+	}
+	pthread_mutex_unlock(&sessions_lock);
+}
 
-				int synth_status = -1;
-				synth_status = synthesize_speech(tts_buffer, tts_answer_file, app_cfg.language);
-				if (synth_status != 0) log_message(" (Failed to synthesize speech) ");
+// run a dtmf action on a worker thread: command, then play the spoken answer
+static void dtmf_job_run(void *arg)
+{
+	struct dtmf_job *job = arg;
+	struct dtmf_config *d_cfg = job->d_cfg;
+	struct call_session *session = &sessions[job->call_id];
+	int timeout = d_cfg->timeout > 0 ? d_cfg->timeout : DEFAULT_DTMF_TIMEOUT;
+	char result[RESULTSIZE] = "";
+
+	int status = proc_run(d_cfg->cmd, result, sizeof(result), timeout, &job->cancel);
+	if (status == PROC_TIMEOUT)
+	{
+		log_warn(job->call_id, "DTMF command timed out.");
+	}
+	else if (status != PROC_CANCELLED && result[0] != '\0')
+	{
+		char tts_buffer[200];
+		snprintf(tts_buffer, sizeof(tts_buffer), d_cfg->tts_answer, result);
 
-				create_player(call_id, tts_answer_file);
+		// the answer streams into the call while it is being synthesized
+		struct pcm_buf *speech = tts_speak(tts_buffer, &voice);
+		if (speech != NULL)
+		{
+			// a hangup or a newer digit may have come in meanwhile
+			pthread_mutex_lock(&session->media_lock);
+			if (!job->cancel && session_is_current(job->call_id, job->generation))
+			{
+				player_destroy(session);
+				recorder_destroy(session);
+				create_speech_player(session, speech, job->digit >= 0 ? &session->cdr.digits[job->digit].audio : NULL);
 			}
+			pthread_mutex_unlock(&session->media_lock);
 
-			log_message("Done.\n");
+			// the player holds its own reference; if there is none, synthesis stops
+			pcm_buf_release(speech);
 		}
 		else
 		{
-			log_message("No active DTMF command found for received digit.\n");
+			log_error(job->call_id, "Failed to synthesize speech");
 		}
-
-		d_cfg->processing_active = 0;
 	}
-	else
+	else if (status != PROC_CANCELLED)
 	{
-		log_message("DTMF command dropped - state is actual processing.\n");
+		log_error(job->call_id, "Failed to run DTMF command");
 	}
+
+	if (job->cancel)
+	{
+		log_info(job->call_id, "DTMF action cancelled.");
+	}
+
+	pthread_mutex_lock(&sessions_lock);
+	if (session->dtmf_job == job) session->dtmf_job = NULL;
+	pthread_mutex_unlock(&sessions_lock);
+
+	dtmf_job_free(job);
 }
 
-// handler for "break-in-key"-events (e.g. ctrl+c)
-static void signal_handler(int signal)
+static void dtmf_job_free(void *arg)
 {
-	// exit app
-	app_exit();
+	struct dtmf_job *job = arg;
+
+	settings_release(job->cfg);
+	free(job);
+}
+
+// handler for dtmf-events
+static void on_dtmf_digit(pjsua_call_id call_id, int digit)
+{
+	// work on detected dtmf digit
+	const char *dtmf_key = digit ? strchr(DTMF_KEYS, digit) : NULL;
+
+	log_info(call_id, "DTMF command detected: %c", digit);
+
+	struct call_session *session = session_get(call_id);
+	if (session == NULL) return;
+	int digit_index = cdr_digit(&session->cdr, digit);
+
+	// keys of the menu the caller is in
+	pthread_mutex_lock(&session->media_lock);
+	struct menu_node *node = &session->cfg->menus[session->menu];
+	pthread_mutex_unlock(&session->media_lock);
+	struct dtmf_config *d_cfg = dtmf_key ? &node->keys[dtmf_key - DTMF_KEYS] : NULL;
+
+	if (d_cfg == NULL || d_cfg->active != 1)
+	{
+		log_debug(call_id, "No active DTMF command found for received digit.");
+		return;
+	}
+
+	// a menu key: the prompt is loaded already, nothing runs on the workers
+	if (d_cfg->next >= 0)
+	{
+		dtmf_cancel(session);
+		pthread_mutex_lock(&session->media_lock);
+		menu_enter(session, d_cfg->next, digit_index >= 0 ? &session->cdr.digits[digit_index].audio : NULL);
+		pthread_mutex_unlock(&session->media_lock);
+		log_info(call_id, "Entered menu %s.", session->cfg->menus[d_cfg->next].name);
+		return;
+	}
+
+	log_debug(call_id, "Active DTMF command found for received digit.");
+
+	struct dtmf_job *job = calloc(1, sizeof(struct dtmf_job));
+	if (job == NULL) return;
+	job->call_id = call_id;
+	job->cfg = settings_ref(session->cfg);
+	job->d_cfg = d_cfg;
+	job->digit = digit_index;
+
+	// the new digit preempts the action still running for this call
+	pthread_mutex_lock(&sessions_lock);
+	if (session->dtmf_job != NULL)
+	{
+		session->dtmf_job->cancel = 1;
+		log_info(call_id, "Previous DTMF action preempted.");
+	}
+	job->generation = session->generation;
+	session->dtmf_job = job;
+	pthread_mutex_unlock(&sessions_lock);
+
+	if (workpool_submit(dtmf_pool, &dtmf_job_run, job) != 0)
+	{
+		log_limited(LOG_WARN, call_id, "DTMF command dropped - too many actions pending.");
+		pthread_mutex_lock(&sessions_lock);
+		if (session->dtmf_job == job) session->dtmf_job = NULL;
+		pthread_mutex_unlock(&sessions_lock);
+		dtmf_job_free(job);
+	}
 }
 
 // clean application exit
@@ -1059,17 +3132,52 @@ static void app_exit()
 	if (!app_exiting)
 	{
 		app_exiting = 1;
-		log_message("Stopping application ... \n");
+		log_info(LOG_NO_CALL, "Stopping application ...");
+		metrics_close();
+
+		// stop background jobs before pjsua goes away
+		session_cancel_all();
+		workpool_destroy(screen_pool, &free);
+		screen_pool = NULL;
+		workpool_destroy(dtmf_pool, &dtmf_job_free);
+		dtmf_pool = NULL;
+		jobqueue_close(aftermath_queue);
+		aftermath_queue = NULL;
 
-		// check if player/recorder is active and stop them
-		player_destroy(play_id);
-		recorder_destroy(rec_id);
+		// check if players/recorders are active and stop them
+		session_close_all();
 
 		// hangup open calls and stop pjsua
 		pjsua_call_hangup_all();
 		pjsua_destroy();
+		screens_close();
+		if (active_cfg != &app_cfg) settings_release(active_cfg);
+		greetings_free(&app_cfg);
+		menus_free(&app_cfg);
+		tts_shutdown();
+
+		struct ttscache_stats stats;
+		ttscache_get_stats(&stats);
+		log_info(LOG_NO_CALL, "Speech cache: %lu memory hits, %lu disk hits, %lu misses, %lu evictions",
+			stats.memory_hits, stats.disk_hits, stats.misses, stats.evictions);
+		ttscache_close();
+
+		struct wavcache_stats wav_stats;
+		wavcache_get_stats(&wav_stats);
+		log_info(LOG_NO_CALL, "Prompt cache: %lu file loads (%lu resampled), %lu hits, %lu bytes",
+			wav_stats.loads, wav_stats.resampled, wav_stats.hits, (unsigned long)wav_stats.memory_used);
+		wavcache_close();
+		cdr_close();
+
+		struct recport_stats rec_stats;
+		recport_get_totals(&rec_stats);
+		if (rec_stats.frames > 0)
+		{
+			log_info(LOG_NO_CALL, "Recorder: %lu frames, %lu dropped, buffer high water %u of %u ms",
+				rec_stats.frames, rec_stats.overruns, rec_stats.high_water_ms, rec_stats.capacity_ms);
+		}
 
-		log_message("Done.\n");
+		log_info(LOG_NO_CALL, "Stopped.");
 
 		exit(0);
 	}
@@ -1081,13 +3189,13 @@ static void error_exit(const char *title, pj_status_t status)
 	if (!app_exiting)
 	{
 		app_exiting = 1;
-		log_message("App Error Exit\n");
+		log_error(LOG_NO_CALL, "App Error Exit: %s (status %i)", title, status);
+		metrics_close();
 
 		pjsua_perror("SIP Call", title, status);
 
-		// check if player/recorder is active and stop them
-		player_destroy(play_id);
-		recorder_destroy(rec_id);
+		// check if players/recorders are active and stop them
+		session_close_all();
 
 		// hangup open calls and stop pjsua
 		pjsua_call_hangup_all();
@@ -0,0 +1,285 @@
+/*
+=================================================================================
+ Name        : tts.c
+ Version     : 0.1
+
+ Description :
+     In-process speech synthesis with libespeak-ng. Text is rendered on a
+     background thread into a pcm_buf, which can be played with a pcmport
+     while the synthesis is still running.
+
+ References  :
+ https://github.com/espeak-ng/espeak-ng/blob/master/src/include/espeak-ng/speak_lib.h
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <espeak-ng/speak_lib.h>
+#include "resample.h"
+#include "tts.h"
+#include "ttscache.h"
+
+// length of the chunks espeak hands to the callback, in ms
+#define TTS_CHUNK_MS 40
+
+// queued synthesis request
+struct tts_request {
+	struct tts_request *next;
+	char *text;
+	struct tts_voice voice;
+	char language[32];
+	char *cache_key; // NULL if the speech cache is not used
+	struct pcm_buf *buf;
+	int aborted;
+};
+
+// state of the synthesis thread (espeak itself is a single global instance)
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int running;
+	int stopping;
+	unsigned sample_rate;      // of the buffers
+	struct resampler *resampler; // NULL if espeak renders at sample_rate
+	struct tts_request *head;
+	struct tts_request *tail;
+	char language[32];
+	tts_observer observer;
+} tts = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// espeak hands over synthesized samples chunk by chunk
+static int tts_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	struct tts_request *request = events ? events->user_data : NULL;
+	if (request == NULL) return 0;
+	struct pcm_buf *buf = request->buf;
+
+	// end of synthesis is signalled by wav == NULL
+	if (wav == NULL || numsamples <= 0) return 0;
+
+	// nobody is listening anymore (e.g. caller hung up): abort.
+	// The cache holds a reference too, that one doesn't count.
+	if (pcm_buf_refcount(buf) <= (request->cache_key ? 2 : 1)) request->aborted = 1;
+	else if (tts.resampler) request->aborted = (resampler_run(tts.resampler, wav, numsamples, buf) != 0);
+	else if (pcm_buf_append(buf, wav, numsamples) != 0) request->aborted = 1;
+
+	return request->aborted;
+}
+
+static void tts_request_free(struct tts_request *request)
+{
+	pcm_buf_release(request->buf);
+	free(request->cache_key);
+	free(request->text);
+	free(request);
+}
+
+// synthesis thread: render the queued texts one after another
+static void *tts_thread(void *data)
+{
+	(void)data;
+
+	pthread_mutex_lock(&tts.lock);
+	for (;;)
+	{
+		while (tts.head == NULL && !tts.stopping)
+		{
+			pthread_cond_wait(&tts.cond, &tts.lock);
+		}
+		if (tts.stopping) break;
+
+		struct tts_request *request = tts.head;
+		tts.head = request->next;
+		if (tts.head == NULL) tts.tail = NULL;
+		pthread_mutex_unlock(&tts.lock);
+
+		// voice changes are expensive, only switch if needed
+		if (strcmp(request->language, tts.language) != 0)
+		{
+			espeak_SetVoiceByName(request->language);
+			strcpy(tts.language, request->language);
+		}
+		espeak_SetParameter(espeakVOLUME, request->voice.amplitude, 0);
+		espeak_SetParameter(espeakCAPITALS, request->voice.capitals_pitch, 0);
+		espeak_SetParameter(espeakRATE, request->voice.speed, 0);
+		espeak_SetParameter(espeakPITCH, request->voice.pitch, 0);
+
+		struct timespec begin, end;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		espeak_ERROR error = espeak_Synth(request->text, strlen(request->text) + 1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, request);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		// the tail of the filter, this also resets it for the next text
+		if (tts.resampler && resampler_flush(tts.resampler, request->buf) != 0) request->aborted = 1;
+
+		pcm_buf_finish(request->buf, error != EE_OK || request->aborted);
+		if (request->cache_key) ttscache_complete(request->cache_key, request->buf);
+
+		if (tts.observer)
+		{
+			tts.observer(end.tv_sec - begin.tv_sec + (end.tv_nsec - begin.tv_nsec) / 1e9, error != EE_OK);
+		}
+
+		tts_request_free(request);
+		pthread_mutex_lock(&tts.lock);
+	}
+	pthread_mutex_unlock(&tts.lock);
+
+	return NULL;
+}
+
+int tts_init(unsigned rate)
+{
+	if (tts.running) return 0;
+
+	int espeak_rate = espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, TTS_CHUNK_MS, NULL, espeakINITIALIZE_DONT_EXIT);
+	if (espeak_rate <= 0) return 1;
+	tts.sample_rate = espeak_rate;
+	if (rate > 0 && rate != (unsigned)espeak_rate)
+	{
+		tts.resampler = resampler_create(espeak_rate, rate);
+		if (tts.resampler) tts.sample_rate = rate;
+	}
+	espeak_SetSynthCallback(&tts_callback);
+	tts.language[0] = '\0';
+
+	tts.stopping = 0;
+	if (pthread_create(&tts.thread, NULL, &tts_thread, NULL) != 0)
+	{
+		resampler_destroy(tts.resampler);
+		tts.resampler = NULL;
+		espeak_Terminate();
+		return 1;
+	}
+	tts.running = 1;
+
+	return 0;
+}
+
+unsigned tts_sample_rate(void)
+{
+	return tts.sample_rate;
+}
+
+// cache key: everything that changes the rendered samples
+static char *tts_cache_key(const char *text, const struct tts_voice *voice)
+{
+	char *key = NULL;
+	if (asprintf(&key, "%s|%i|%i|%i|%i|%u|%s", voice->language, voice->amplitude,
+			voice->capitals_pitch, voice->speed, voice->pitch, tts.sample_rate, text) < 0)
+	{
+		return NULL;
+	}
+	return key;
+}
+
+struct pcm_buf *tts_speak(const char *text, const struct tts_voice *voice)
+{
+	if (!tts.running) return NULL;
+
+	char *cache_key = tts_cache_key(text, voice);
+	if (cache_key)
+	{
+		struct pcm_buf *cached = ttscache_lookup(cache_key);
+		if (cached)
+		{
+			free(cache_key);
+			return cached;
+		}
+	}
+
+	struct tts_request *request = calloc(1, sizeof(struct tts_request));
+	if (request == NULL)
+	{
+		free(cache_key);
+		return NULL;
+	}
+
+	request->cache_key = cache_key;
+	request->text = strdup(text);
+	request->buf = pcm_buf_create(tts.sample_rate);
+	if (request->text == NULL || request->buf == NULL)
+	{
+		tts_request_free(request);
+		return NULL;
+	}
+	request->voice = *voice;
+	snprintf(request->language, sizeof(request->language), "%s", voice->language);
+	request->voice.language = request->language;
+
+	// one reference for the synthesis thread, one for the caller
+	struct pcm_buf *buf = pcm_buf_ref(request->buf);
+
+	// concurrent requests for the same text share this buffer; if another
+	// one got in first since the lookup, take its buffer instead
+	if (request->cache_key)
+	{
+		struct pcm_buf *existing;
+		if (ttscache_insert(request->cache_key, request->buf, &existing) != 0)
+		{
+			if (existing)
+			{
+				pcm_buf_release(buf);
+				tts_request_free(request);
+				return existing;
+			}
+			free(request->cache_key);
+			request->cache_key = NULL;
+		}
+	}
+
+	pthread_mutex_lock(&tts.lock);
+	if (tts.tail) tts.tail->next = request;
+	else tts.head = request;
+	tts.tail = request;
+	pthread_cond_signal(&tts.cond);
+	pthread_mutex_unlock(&tts.lock);
+
+	return buf;
+}
+
+void tts_set_observer(tts_observer observer)
+{
+	tts.observer = observer;
+}
+
+void tts_shutdown(void)
+{
+	if (!tts.running) return;
+
+	pthread_mutex_lock(&tts.lock);
+	tts.stopping = 1;
+	pthread_cond_broadcast(&tts.cond);
+	pthread_mutex_unlock(&tts.lock);
+
+	pthread_join(tts.thread, NULL);
+	tts.running = 0;
+
+	// drop requests which never got rendered
+	while (tts.head)
+	{
+		struct tts_request *request = tts.head;
+		tts.head = request->next;
+		pcm_buf_finish(request->buf, 1);
+		if (request->cache_key) ttscache_complete(request->cache_key, request->buf);
+		tts_request_free(request);
+	}
+	tts.tail = NULL;
+
+	espeak_Terminate();
+	resampler_destroy(tts.resampler);
+	tts.resampler = NULL;
+}
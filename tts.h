@@ -0,0 +1,54 @@
+/*
+=================================================================================
+ Name        : tts.h
+ Version     : 0.1
+
+ Description :
+     In-process speech synthesis with libespeak-ng. Text is rendered on a
+     background thread into a pcm_buf, which can be played with a pcmport
+     while the synthesis is still running.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef TTS_H
+#define TTS_H
+
+#include "pcmbuf.h"
+
+// voice settings, same meaning as the espeak command line options
+struct tts_voice {
+	const char *language; // -v
+	int amplitude;        // -a
+	int capitals_pitch;   // -k
+	int speed;            // -s
+	int pitch;            // -p
+};
+
+// load espeak and start the synthesis thread; returns 0 on success.
+// Speech is converted to rate while it is synthesized (0 = espeak's own rate),
+// e.g. to the rate of the conference bridge, which then plays it as it is.
+int tts_init(unsigned rate);
+
+// sample rate of the synthesized speech
+unsigned tts_sample_rate(void);
+
+// queue text for synthesis; the returned buffer (one reference for the caller)
+// fills in the background. Synthesis stops early if all other references are dropped.
+// If the speech cache is open (see ttscache.h), cached speech is returned right away.
+struct pcm_buf *tts_speak(const char *text, const struct tts_voice *voice);
+
+// called on the synthesis thread after each espeak run with its duration,
+// e.g. for metrics; speech from the cache doesn't get here
+typedef void (*tts_observer)(double seconds, int failed);
+void tts_set_observer(tts_observer observer);
+
+// stop the synthesis thread and unload espeak
+void tts_shutdown(void);
+
+#endif
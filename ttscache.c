@@ -0,0 +1,496 @@
+/*
+=================================================================================
+ Name        : ttscache.c
+ Version     : 0.1
+
+ Description :
+     Content addressed cache of synthesized speech. Entries are keyed by a hash
+     of the text and all voice settings, kept in an in-memory LRU list and
+     stored as raw PCM files on disk, so repeated phrases cost a lookup instead
+     of an espeak run.
+
+     Cache files are named <dir>/<hash>.pcm and contain a header, the full key
+     (checked on load, so hash collisions are harmless) and the samples in host
+     byte order. The file mtime is bumped on every hit; if the directory grows
+     beyond its limit, the oldest files are deleted.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include "log.h"
+#include "ttscache.h"
+
+#define CACHE_BUCKETS 256
+#define CACHE_MAGIC "TTC1"
+
+// cache file header, followed by key_len bytes of key and count samples
+struct cache_header {
+	char magic[4];
+	uint32_t clock_rate;
+	uint32_t key_len;
+	uint32_t count;
+};
+
+struct cache_entry {
+	struct cache_entry *hash_next;
+	struct cache_entry *prev;    // towards the most recently used
+	struct cache_entry *next;    // towards the least recently used
+	uint64_t hash;
+	char *key;
+	struct pcm_buf *buf;
+	size_t bytes;                // 0 while the buffer is still being filled
+};
+
+// state of the cache
+static struct {
+	pthread_mutex_t lock;
+	int open;
+	char *dir;
+	size_t memory_limit;
+	size_t disk_limit;
+	struct cache_entry *buckets[CACHE_BUCKETS];
+	struct cache_entry *head;    // most recently used
+	struct cache_entry *tail;    // least recently used
+	int trimming;
+	struct ttscache_stats stats;
+} cache = { PTHREAD_MUTEX_INITIALIZER };
+
+// 64 bit FNV-1a
+static uint64_t key_hash(const char *key)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (; *key; key++)
+	{
+		hash ^= (unsigned char)*key;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static void cache_path(char *path, size_t size, uint64_t hash, const char *suffix)
+{
+	snprintf(path, size, "%s/%016llx.pcm%s", cache.dir, (unsigned long long)hash, suffix);
+}
+
+static void lru_unlink(struct cache_entry *entry)
+{
+	if (entry->prev) entry->prev->next = entry->next;
+	else cache.head = entry->next;
+	if (entry->next) entry->next->prev = entry->prev;
+	else cache.tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void lru_push(struct cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache.head;
+	if (cache.head) cache.head->prev = entry;
+	cache.head = entry;
+	if (cache.tail == NULL) cache.tail = entry;
+}
+
+// find an entry, call with the lock held
+static struct cache_entry *entry_find(const char *key, uint64_t hash)
+{
+	struct cache_entry *entry;
+	for (entry = cache.buckets[hash % CACHE_BUCKETS]; entry; entry = entry->hash_next)
+	{
+		if (entry->hash == hash && strcmp(entry->key, key) == 0) return entry;
+	}
+	return NULL;
+}
+
+// remove an entry from the table and the LRU list and free it, call with the lock held
+static void entry_remove(struct cache_entry *entry)
+{
+	struct cache_entry **link = &cache.buckets[entry->hash % CACHE_BUCKETS];
+	while (*link != entry) link = &(*link)->hash_next;
+	*link = entry->hash_next;
+
+	lru_unlink(entry);
+	cache.stats.memory_used -= entry->bytes;
+	pcm_buf_release(entry->buf);
+	free(entry->key);
+	free(entry);
+}
+
+// add a new entry as most recently used, call with the lock held
+static struct cache_entry *entry_add(const char *key, uint64_t hash, struct pcm_buf *buf, size_t bytes)
+{
+	struct cache_entry *entry = calloc(1, sizeof(struct cache_entry));
+	if (entry == NULL) return NULL;
+	entry->key = strdup(key);
+	if (entry->key == NULL)
+	{
+		free(entry);
+		return NULL;
+	}
+	entry->hash = hash;
+	entry->buf = pcm_buf_ref(buf);
+	entry->bytes = bytes;
+	cache.stats.memory_used += bytes;
+
+	entry->hash_next = cache.buckets[hash % CACHE_BUCKETS];
+	cache.buckets[hash % CACHE_BUCKETS] = entry;
+	lru_push(entry);
+	return entry;
+}
+
+// drop least recently used entries until the memory limit is kept, call with the lock held
+static void memory_trim(void)
+{
+	struct cache_entry *entry = cache.tail;
+	while (entry && cache.stats.memory_used > cache.memory_limit)
+	{
+		struct cache_entry *prev = entry->prev;
+		// entries still being filled are not accounted yet, leave them
+		if (entry->bytes > 0)
+		{
+			entry_remove(entry);
+			cache.stats.evictions++;
+		}
+		entry = prev;
+	}
+}
+
+struct disk_file {
+	char name[32];
+	struct timespec mtime;
+	off_t size;
+};
+
+static int disk_file_compare(const void *a, const void *b)
+{
+	const struct disk_file *fa = a, *fb = b;
+	if (fa->mtime.tv_sec != fb->mtime.tv_sec) return fa->mtime.tv_sec < fb->mtime.tv_sec ? -1 : 1;
+	return (fa->mtime.tv_nsec > fb->mtime.tv_nsec) - (fa->mtime.tv_nsec < fb->mtime.tv_nsec);
+}
+
+// sum up the cache files and delete the oldest ones, until the directory is
+// below 90% of its limit (so it doesn't get scanned on every store)
+static void disk_trim(void)
+{
+	pthread_mutex_lock(&cache.lock);
+	if (cache.trimming)
+	{
+		pthread_mutex_unlock(&cache.lock);
+		return;
+	}
+	cache.trimming = 1;
+	size_t limit = cache.disk_limit;
+	pthread_mutex_unlock(&cache.lock);
+
+	DIR *dir = opendir(cache.dir);
+	struct disk_file *files = NULL;
+	size_t count = 0, size = 0, total = 0, removed = 0;
+
+	struct dirent *dirent;
+	while (dir && (dirent = readdir(dir)) != NULL)
+	{
+		size_t len = strlen(dirent->d_name);
+		if (len < 5 || len >= sizeof(files->name) || strcmp(dirent->d_name + len - 4, ".pcm") != 0) continue;
+
+		char path[strlen(cache.dir) + len + 2];
+		sprintf(path, "%s/%s", cache.dir, dirent->d_name);
+		struct stat st;
+		if (stat(path, &st) != 0) continue;
+
+		if (count == size)
+		{
+			size = size ? size * 2 : 64;
+			struct disk_file *more = realloc(files, size * sizeof(struct disk_file));
+			if (more == NULL) break;
+			files = more;
+		}
+		strcpy(files[count].name, dirent->d_name);
+		files[count].mtime = st.st_mtim;
+		files[count].size = st.st_size;
+		total += st.st_size;
+		count++;
+	}
+	if (dir) closedir(dir);
+
+	if (total > limit && count > 0)
+	{
+		size_t keep = limit / 10 * 9;
+		size_t i;
+		qsort(files, count, sizeof(struct disk_file), disk_file_compare);
+		for (i = 0; i < count && total > keep; i++)
+		{
+			char path[strlen(cache.dir) + strlen(files[i].name) + 2];
+			sprintf(path, "%s/%s", cache.dir, files[i].name);
+			if (unlink(path) == 0)
+			{
+				total -= files[i].size;
+				removed++;
+			}
+		}
+	}
+	free(files);
+
+	pthread_mutex_lock(&cache.lock);
+	cache.stats.disk_used = total;
+	cache.stats.evictions += removed;
+	cache.trimming = 0;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+// read a cache file, returns a complete buffer or NULL
+static struct pcm_buf *disk_load(const char *key, uint64_t hash)
+{
+	char path[strlen(cache.dir) + 32];
+	cache_path(path, sizeof(path), hash, "");
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) return NULL;
+
+	struct pcm_buf *buf = NULL;
+	struct cache_header header;
+	size_t key_len = strlen(key);
+	char *file_key = NULL;
+	short *samples = NULL;
+
+	if (fread(&header, sizeof(header), 1, file) != 1
+			|| memcmp(header.magic, CACHE_MAGIC, 4) != 0
+			|| header.key_len != key_len) goto out;
+
+	// a different key with the same hash is just a miss
+	file_key = malloc(key_len);
+	if (file_key == NULL || fread(file_key, 1, key_len, file) != key_len
+			|| memcmp(file_key, key, key_len) != 0) goto out;
+
+	samples = malloc(header.count * sizeof(short) + 1);
+	if (samples == NULL || fread(samples, sizeof(short), header.count, file) != header.count) goto out;
+
+	buf = pcm_buf_create(header.clock_rate);
+	if (buf == NULL) goto out;
+	if (pcm_buf_append(buf, samples, header.count) != 0)
+	{
+		pcm_buf_release(buf);
+		buf = NULL;
+		goto out;
+	}
+	pcm_buf_finish(buf, 0);
+
+	// keep recently used files from being trimmed
+	utime(path, NULL);
+
+out:
+	free(samples);
+	free(file_key);
+	fclose(file);
+	return buf;
+}
+
+// write a complete buffer to its cache file, returns the file size or 0
+static size_t disk_store(const char *key, uint64_t hash, struct pcm_buf *buf)
+{
+	char path[strlen(cache.dir) + 32];
+	char tmp_path[strlen(cache.dir) + 32];
+	cache_path(path, sizeof(path), hash, "");
+	cache_path(tmp_path, sizeof(tmp_path), hash, ".tmp");
+
+	FILE *file = fopen(tmp_path, "wb");
+	if (file == NULL) return 0;
+
+	// the buffer is complete, so its samples don't change anymore
+	struct cache_header header;
+	memcpy(header.magic, CACHE_MAGIC, 4);
+	header.clock_rate = buf->clock_rate;
+	header.key_len = strlen(key);
+	header.count = buf->count;
+
+	int error = fwrite(&header, sizeof(header), 1, file) != 1
+		|| fwrite(key, 1, header.key_len, file) != header.key_len
+		|| fwrite(buf->samples, sizeof(short), header.count, file) != header.count;
+	error |= fclose(file) != 0;
+
+	// rename, so readers never see a half written file
+	if (error || rename(tmp_path, path) != 0)
+	{
+		unlink(tmp_path);
+		return 0;
+	}
+	return sizeof(header) + header.key_len + header.count * sizeof(short);
+}
+
+int ttscache_open(const struct ttscache_config *cfg)
+{
+	ttscache_close();
+
+	if (mkdir(cfg->dir, 0755) != 0 && errno != EEXIST)
+	{
+		log_error(LOG_NO_CALL, "Error creating speech cache %s: %s", cfg->dir, strerror(errno));
+		return 1;
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	cache.dir = strdup(cfg->dir);
+	cache.memory_limit = cfg->memory_limit;
+	cache.disk_limit = cfg->disk_limit;
+	memset(&cache.stats, 0, sizeof(cache.stats));
+	cache.open = cache.dir != NULL;
+	pthread_mutex_unlock(&cache.lock);
+
+	// count what is on disk already, and trim it if the limit was lowered
+	if (cache.open) disk_trim();
+
+	return !cache.open;
+}
+
+struct pcm_buf *ttscache_lookup(const char *key)
+{
+	uint64_t hash = key_hash(key);
+	struct cache_entry *entry;
+	struct pcm_buf *buf;
+
+	pthread_mutex_lock(&cache.lock);
+	if (!cache.open)
+	{
+		pthread_mutex_unlock(&cache.lock);
+		return NULL;
+	}
+	entry = entry_find(key, hash);
+	if (entry)
+	{
+		lru_unlink(entry);
+		lru_push(entry);
+		cache.stats.memory_hits++;
+		buf = pcm_buf_ref(entry->buf);
+		pthread_mutex_unlock(&cache.lock);
+		return buf;
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	// file IO without the lock
+	buf = disk_load(key, hash);
+
+	pthread_mutex_lock(&cache.lock);
+	if (buf == NULL)
+	{
+		cache.stats.misses++;
+		pthread_mutex_unlock(&cache.lock);
+		return NULL;
+	}
+	cache.stats.disk_hits++;
+	entry = entry_find(key, hash);
+	if (entry)
+	{
+		// loaded by someone else meanwhile, share theirs
+		pcm_buf_release(buf);
+		buf = pcm_buf_ref(entry->buf);
+	}
+	else
+	{
+		entry_add(key, hash, buf, buf->count * sizeof(short));
+		memory_trim();
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	return buf;
+}
+
+int ttscache_insert(const char *key, struct pcm_buf *buf, struct pcm_buf **existing)
+{
+	uint64_t hash = key_hash(key);
+	struct cache_entry *entry = NULL;
+
+	*existing = NULL;
+	pthread_mutex_lock(&cache.lock);
+	if (cache.open)
+	{
+		// an entry being rendered is never replaced: its synthesis counts
+		// on the reference of the cache to tell if anybody still listens
+		entry = entry_find(key, hash);
+		if (entry)
+		{
+			*existing = pcm_buf_ref(entry->buf);
+			lru_unlink(entry);
+			lru_push(entry);
+			cache.stats.memory_hits++;
+			entry = NULL;
+		}
+		else
+		{
+			entry = entry_add(key, hash, buf, 0);
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	return entry == NULL;
+}
+
+void ttscache_complete(const char *key, struct pcm_buf *buf)
+{
+	uint64_t hash = key_hash(key);
+
+	pthread_mutex_lock(&cache.lock);
+	if (!cache.open)
+	{
+		pthread_mutex_unlock(&cache.lock);
+		return;
+	}
+	struct cache_entry *entry = entry_find(key, hash);
+	if (entry && entry->buf == buf)
+	{
+		if (buf->failed)
+		{
+			// aborted or broken synthesis, render it again next time
+			entry_remove(entry);
+		}
+		else
+		{
+			entry->bytes = buf->count * sizeof(short);
+			cache.stats.memory_used += entry->bytes;
+			memory_trim();
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	if (buf->failed || buf->count == 0) return;
+
+	size_t stored = disk_store(key, hash, buf);
+
+	pthread_mutex_lock(&cache.lock);
+	cache.stats.disk_used += stored;
+	int trim = cache.stats.disk_used > cache.disk_limit;
+	pthread_mutex_unlock(&cache.lock);
+
+	if (trim) disk_trim();
+}
+
+void ttscache_get_stats(struct ttscache_stats *stats)
+{
+	pthread_mutex_lock(&cache.lock);
+	*stats = cache.stats;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void ttscache_close(void)
+{
+	pthread_mutex_lock(&cache.lock);
+	while (cache.head) entry_remove(cache.head);
+	cache.open = 0;
+	free(cache.dir);
+	cache.dir = NULL;
+	pthread_mutex_unlock(&cache.lock);
+}
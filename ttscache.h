@@ -0,0 +1,62 @@
+/*
+=================================================================================
+ Name        : ttscache.h
+ Version     : 0.1
+
+ Description :
+     Content addressed cache of synthesized speech. Entries are keyed by a hash
+     of the text and all voice settings, kept in an in-memory LRU list and
+     stored as raw PCM files on disk, so repeated phrases cost a lookup instead
+     of an espeak run.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef TTSCACHE_H
+#define TTSCACHE_H
+
+#include <stddef.h>
+#include "pcmbuf.h"
+
+struct ttscache_config {
+	const char *dir;      // directory of the cache files
+	size_t memory_limit;  // bytes of PCM kept in memory
+	size_t disk_limit;    // bytes of PCM kept on disk
+};
+
+struct ttscache_stats {
+	unsigned long memory_hits;
+	unsigned long disk_hits;
+	unsigned long misses;
+	unsigned long evictions;
+	size_t memory_used;
+	size_t disk_used;
+};
+
+// open the cache directory (created if missing); returns 0 on success
+int ttscache_open(const struct ttscache_config *cfg);
+
+// look up a key; returns a new reference to the speech or NULL.
+// The buffer may still be incomplete, if it is being rendered right now.
+struct pcm_buf *ttscache_lookup(const char *key);
+
+// remember a buffer which is going to be filled for key; returns 0 if the
+// cache took a reference. If key is there already (e.g. being rendered for
+// another caller), *existing gets a new reference to its buffer instead
+int ttscache_insert(const char *key, struct pcm_buf *buf, struct pcm_buf **existing);
+
+// the buffer for key is complete: account it and write it to disk;
+// failed buffers are dropped from the cache
+void ttscache_complete(const char *key, struct pcm_buf *buf);
+
+void ttscache_get_stats(struct ttscache_stats *stats);
+
+// drop all entries from memory, the files stay
+void ttscache_close(void);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+=================================================================================
+ Name        : vad.c
+ Version     : 0.1
+
+ Description :
+     Voice activity detection on 16 bit mono audio, based on frame energy and
+     zero crossing rate. Used by the recorder to trim silence and to tell
+     empty voicemails from real ones.
+
+     A frame counts as speech, if it is clearly louder than the background
+     and its zero crossing rate is not that of hiss or line noise. While
+     speech is active, very loud frames count regardless of the crossing
+     rate, so fricatives aren't cut off. Speech starts after a few speech
+     frames in a row and ends after a hangover of non-speech frames.
+
+     The background follows the non-speech frames, and it is raised to the
+     quietest frame of the last one to two seconds, whatever they were
+     classified as: speech always has pauses between words, steady hum or
+     line noise hasn't. A second in which nothing stood out from the raised
+     background is taken back from the speech time, so a recording of noise
+     only ends up without speech.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <math.h>
+#include "vad.h"
+
+// frames below this level are never speech (dB full scale)
+#define VAD_MIN_DB -45.0
+
+// speech has to be this much above the background
+#define VAD_MARGIN_DB 10.0
+
+// during speech, above background plus this the crossing rate isn't checked
+#define VAD_LOUD_DB 25.0
+
+// crossings per sample; noise is around 0.5, voiced speech far below
+#define VAD_MAX_ZCR 0.35
+
+// initial background level and how fast it follows
+#define VAD_NOISE_INIT_DB -60.0
+#define VAD_NOISE_ADAPT 0.05
+
+// frames of a window of the minimum tracking
+#define VAD_WINDOW_FRAMES (1000 / VAD_FRAME_MS)
+
+// speech frames needed to start speech, silent frames to end it
+#define VAD_ONSET_FRAMES 3
+#define VAD_HANGOVER_FRAMES 15
+
+void vad_init(struct vad *vad, unsigned clock_rate)
+{
+	vad->frame_size = clock_rate * VAD_FRAME_MS / 1000;
+	vad->noise_db = VAD_NOISE_INIT_DB;
+	vad->onset = 0;
+	vad->hangover = 0;
+	vad->active = 0;
+	vad->speech_frames = 0;
+	vad->window_frames = 0;
+	vad->window_speech = 0;
+	vad->window_min_db = 0;
+	vad->window_max_db = -120;
+	vad->prev_min_db = 0;
+}
+
+// end of a window: raise the background to the minimum of this and the
+// last window, and take back speech that didn't stand out from it
+static void vad_window_end(struct vad *vad)
+{
+	double floor_db = vad->window_min_db < vad->prev_min_db ? vad->window_min_db : vad->prev_min_db;
+
+	if (floor_db > vad->noise_db) vad->noise_db = floor_db;
+
+	if (vad->window_max_db < vad->noise_db + VAD_MARGIN_DB)
+	{
+		vad->speech_frames -= vad->window_speech;
+		vad->active = 0;
+		vad->onset = 0;
+		vad->hangover = 0;
+	}
+
+	vad->prev_min_db = vad->window_min_db;
+	vad->window_frames = 0;
+	vad->window_speech = 0;
+	vad->window_min_db = 0;
+	vad->window_max_db = -120;
+}
+
+int vad_process(struct vad *vad, const short *frame)
+{
+	double energy = 0;
+	unsigned crossings = 0;
+	unsigned i;
+
+	for (i = 0; i < vad->frame_size; i++)
+	{
+		energy += (double)frame[i] * frame[i];
+		if (i > 0 && (frame[i] < 0) != (frame[i - 1] < 0)) crossings++;
+	}
+	energy /= vad->frame_size;
+
+	double db = 10.0 * log10(energy / (32768.0 * 32768.0) + 1e-12);
+	double zcr = (double)crossings / vad->frame_size;
+
+	int speech = db > VAD_MIN_DB && db > vad->noise_db + VAD_MARGIN_DB
+		&& (zcr < VAD_MAX_ZCR || (vad->active && db > vad->noise_db + VAD_LOUD_DB));
+
+	if (speech)
+	{
+		if (++vad->onset >= VAD_ONSET_FRAMES)
+		{
+			vad->active = 1;
+			vad->hangover = VAD_HANGOVER_FRAMES;
+		}
+	}
+	else
+	{
+		vad->onset = 0;
+		if (vad->hangover > 0) vad->hangover--;
+		else vad->active = 0;
+
+		// follow the background, faster downwards than upwards
+		double adapt = db < vad->noise_db ? 4 * VAD_NOISE_ADAPT : VAD_NOISE_ADAPT;
+		vad->noise_db += (db - vad->noise_db) * adapt;
+	}
+
+	if (vad->active)
+	{
+		vad->speech_frames++;
+		vad->window_speech++;
+	}
+
+	if (db < vad->window_min_db) vad->window_min_db = db;
+	if (db > vad->window_max_db) vad->window_max_db = db;
+	if (++vad->window_frames >= VAD_WINDOW_FRAMES) vad_window_end(vad);
+
+	return vad->active;
+}
+
+unsigned long vad_speech_ms(const struct vad *vad)
+{
+	return vad->speech_frames * VAD_FRAME_MS;
+}
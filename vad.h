@@ -0,0 +1,48 @@
+/*
+=================================================================================
+ Name        : vad.h
+ Version     : 0.1
+
+ Description :
+     Voice activity detection on 16 bit mono audio, based on frame energy and
+     zero crossing rate. Used by the recorder to trim silence and to tell
+     empty voicemails from real ones.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef VAD_H
+#define VAD_H
+
+// frame length the detector works on
+#define VAD_FRAME_MS 20
+
+struct vad {
+	unsigned frame_size;  // samples per frame
+	double noise_db;      // running estimate of the background level
+	int onset;            // speech frames in a row
+	int hangover;         // frames left until speech ends
+	int active;
+	unsigned long speech_frames;
+	unsigned window_frames;     // frames of the current window of the minimum tracking
+	unsigned long window_speech; // active frames in it
+	double window_min_db;
+	double window_max_db;
+	double prev_min_db;         // minimum of the window before
+};
+
+void vad_init(struct vad *vad, unsigned clock_rate);
+
+// classify one frame of frame_size samples; returns 1 while speech is active
+// (speech continues for a short hangover after the last speech frame)
+int vad_process(struct vad *vad, const short *frame);
+
+// duration of all active frames so far
+unsigned long vad_speech_ms(const struct vad *vad);
+
+#endif
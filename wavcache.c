@@ -0,0 +1,289 @@
+/*
+=================================================================================
+ Name        : wavcache.c
+ Version     : 0.1
+
+ Description :
+     Prompts from WAV files, loaded into memory once and shared by all calls
+     playing them. A file is read again only if it changed on disk, so a
+     call never opens or parses it.
+
+     Entries are keyed by path and rate and remember size and mtime of the
+     file. The samples are decoded (and resampled, if the file has another
+     rate) into a complete pcm_buf, which players only read; the cache holds
+     one reference, every player one more.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "log.h"
+#include "resample.h"
+#include "wavcache.h"
+
+// frames decoded per read
+#define WAV_CHUNK 4096
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+struct wav_entry {
+	struct wav_entry *next;
+	char *path;
+	unsigned rate;
+	off_t size;
+	time_t mtime;
+	struct pcm_buf *buf;
+	size_t bytes;
+};
+
+// state of the cache
+static struct {
+	pthread_mutex_t lock;
+	struct wav_entry *entries;
+	struct wavcache_stats stats;
+} cache = { PTHREAD_MUTEX_INITIALIZER };
+
+// little endian fields of the headers
+static unsigned le16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// decode the data chunk into buf, mixing the channels down to mono
+static int read_samples(FILE *in, uint32_t size, unsigned channels, struct pcm_buf *buf)
+{
+	unsigned char raw[WAV_CHUNK * 2 * 2];
+	short mono[WAV_CHUNK];
+	size_t frame = 2 * channels;
+	size_t left = size / frame;
+
+	while (left > 0)
+	{
+		size_t want = left < WAV_CHUNK ? left : WAV_CHUNK;
+		size_t got = fread(raw, frame, want, in);
+		size_t i;
+		unsigned c;
+
+		for (i = 0; i < got; i++)
+		{
+			int sum = 0;
+			for (c = 0; c < channels; c++) sum += (int16_t)le16(raw + i * frame + c * 2);
+			mono[i] = sum / (int)channels;
+		}
+		if (got > 0 && pcm_buf_append(buf, mono, got) != 0) return 1;
+
+		// a streamed file may say more than it has
+		if (got < want) break;
+		left -= got;
+	}
+	return 0;
+}
+
+// read a whole WAV file; NULL if it isn't 16 bit PCM with one or two channels
+static struct pcm_buf *wav_read(const char *path)
+{
+	unsigned char header[40];
+	unsigned format = 0, channels = 0, bits = 0;
+	uint32_t rate = 0;
+	struct pcm_buf *buf = NULL;
+	int data = 0;
+
+	FILE *in = fopen(path, "rb");
+	if (in == NULL)
+	{
+		log_error(LOG_NO_CALL, "Prompt %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fread(header, 1, 12, in) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+	{
+		log_error(LOG_NO_CALL, "Prompt %s: not a WAV file", path);
+		fclose(in);
+		return NULL;
+	}
+
+	// walk the chunks up to the samples
+	while (fread(header, 1, 8, in) == 8)
+	{
+		uint32_t size = le32(header + 4);
+
+		if (!memcmp(header, "fmt ", 4) && size >= 16)
+		{
+			size_t len = size < sizeof(header) ? size : sizeof(header);
+			if (fread(header, 1, len, in) != len) break;
+			format = le16(header);
+			channels = le16(header + 2);
+			rate = le32(header + 4);
+			bits = le16(header + 14);
+			if (format == WAV_FORMAT_EXTENSIBLE && len >= 26) format = le16(header + 24);
+			if (fseek(in, size - len + (size & 1), SEEK_CUR) != 0) break;
+			continue;
+		}
+
+		if (!memcmp(header, "data", 4))
+		{
+			data = 1;
+			if (format != WAV_FORMAT_PCM || bits != 16 || channels < 1 || channels > 2 || rate == 0)
+			{
+				log_error(LOG_NO_CALL, "Prompt %s: only 16 bit PCM with one or two channels can be played", path);
+				break;
+			}
+			buf = pcm_buf_create(rate);
+			if (buf == NULL || read_samples(in, size, channels, buf) != 0)
+			{
+				log_error(LOG_NO_CALL, "Prompt %s: out of memory", path);
+				pcm_buf_release(buf);
+				buf = NULL;
+				break;
+			}
+			pcm_buf_finish(buf, 0);
+			break;
+		}
+
+		// chunks are padded to an even size
+		if (fseek(in, size + (size & 1), SEEK_CUR) != 0) break;
+	}
+
+	if (!data) log_error(LOG_NO_CALL, "Prompt %s: no samples found", path);
+	fclose(in);
+	return buf;
+}
+
+static void entry_free(struct wav_entry *entry)
+{
+	cache.stats.entries--;
+	cache.stats.memory_used -= entry->bytes;
+	pcm_buf_release(entry->buf);
+	free(entry->path);
+	free(entry);
+}
+
+struct pcm_buf *wavcache_get(const char *path, unsigned rate)
+{
+	struct wav_entry **link, *entry;
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+	{
+		log_error(LOG_NO_CALL, "Prompt %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	for (link = &cache.entries; (entry = *link) != NULL; link = &entry->next)
+	{
+		if (strcmp(entry->path, path) != 0 || entry->rate != rate) continue;
+
+		if (entry->size == st.st_size && entry->mtime == st.st_mtime)
+		{
+			struct pcm_buf *buf = pcm_buf_ref(entry->buf);
+			cache.stats.hits++;
+			pthread_mutex_unlock(&cache.lock);
+			return buf;
+		}
+
+		// changed on disk: calls playing the old samples keep them
+		*link = entry->next;
+		entry_free(entry);
+		break;
+	}
+
+	// loads are rare (startup, reload), the lock is kept while reading
+	struct pcm_buf *buf = wav_read(path);
+	cache.stats.loads++;
+	if (buf != NULL && rate > 0 && buf->clock_rate != rate)
+	{
+		struct pcm_buf *converted = resample_buf(buf, rate);
+		if (converted == NULL) log_error(LOG_NO_CALL, "Prompt %s: can't convert from %u to %u Hz", path, buf->clock_rate, rate);
+		pcm_buf_release(buf);
+		buf = converted;
+		cache.stats.resampled++;
+	}
+	if (buf == NULL)
+	{
+		pthread_mutex_unlock(&cache.lock);
+		return NULL;
+	}
+
+	entry = calloc(1, sizeof(struct wav_entry));
+	if (entry != NULL && (entry->path = strdup(path)) != NULL)
+	{
+		entry->rate = rate;
+		entry->size = st.st_size;
+		entry->mtime = st.st_mtime;
+		entry->buf = pcm_buf_ref(buf);
+		entry->bytes = buf->count * sizeof(short);
+		entry->next = cache.entries;
+		cache.entries = entry;
+		cache.stats.entries++;
+		cache.stats.memory_used += entry->bytes;
+	}
+	else
+	{
+		// still playable, just not shared
+		free(entry);
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	log_debug(LOG_NO_CALL, "Prompt %s loaded, %lu samples at %u Hz", path, (unsigned long)buf->count, buf->clock_rate);
+	return buf;
+}
+
+void wavcache_trim(void)
+{
+	struct wav_entry **link, *entry;
+
+	pthread_mutex_lock(&cache.lock);
+	link = &cache.entries;
+	while ((entry = *link) != NULL)
+	{
+		if (pcm_buf_refcount(entry->buf) == 1)
+		{
+			*link = entry->next;
+			entry_free(entry);
+		}
+		else
+		{
+			link = &entry->next;
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void wavcache_get_stats(struct wavcache_stats *stats)
+{
+	pthread_mutex_lock(&cache.lock);
+	*stats = cache.stats;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void wavcache_close(void)
+{
+	pthread_mutex_lock(&cache.lock);
+	while (cache.entries != NULL)
+	{
+		struct wav_entry *entry = cache.entries;
+		cache.entries = entry->next;
+		entry_free(entry);
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,46 @@
+/*
+=================================================================================
+ Name        : wavcache.h
+ Version     : 0.1
+
+ Description :
+     Prompts from WAV files, loaded into memory once and shared by all calls
+     playing them. A file is read again only if it changed on disk, so a
+     call never opens or parses it.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef WAVCACHE_H
+#define WAVCACHE_H
+
+#include <stddef.h>
+#include "pcmbuf.h"
+
+struct wavcache_stats {
+	unsigned long loads;      // files opened and decoded
+	unsigned long resampled;  // loads converted to another rate
+	unsigned long hits;       // lookups served from memory
+	unsigned long entries;
+	size_t memory_used;       // bytes of samples held by the cache
+};
+
+// get the samples of a 16 bit PCM WAV file (mono, or stereo mixed down) at
+// rate (0 = the rate of the file); the converted samples are cached.
+// Returns a new reference to the complete buffer or NULL if it can't be read
+struct pcm_buf *wavcache_get(const char *path, unsigned rate);
+
+// drop the files nobody plays any more, e.g. after a reload
+void wavcache_trim(void);
+
+void wavcache_get_stats(struct wavcache_stats *stats);
+
+// drop all entries; buffers still played are freed by their last player
+void wavcache_close(void);
+
+#endif
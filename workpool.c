@@ -0,0 +1,165 @@
+/*
+=================================================================================
+ Name        : workpool.c
+ Version     : 0.1
+
+ Description :
+     Small bounded worker pool, used to keep blocking jobs (shell commands,
+     speech synthesis) away from the pjsua callback threads.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+// includes
+#include <pthread.h>
+#include <stdlib.h>
+#include "workpool.h"
+
+struct workpool_job {
+	workpool_fn fn;
+	void *arg;
+};
+
+struct workpool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int thread_count;
+	void (*thread_init)(void);
+
+	// ring of queued jobs
+	struct workpool_job *jobs;
+	int queue_size;
+	int head;
+	int count;
+
+	int stopping;
+};
+
+// thread main: take jobs from the queue until the pool is stopped
+static void *workpool_thread(void *data)
+{
+	struct workpool *pool = data;
+
+	if (pool->thread_init) pool->thread_init();
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		while (pool->count == 0 && !pool->stopping)
+		{
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		if (pool->stopping) break;
+
+		struct workpool_job job = pool->jobs[pool->head];
+		pool->head = (pool->head + 1) % pool->queue_size;
+		pool->count--;
+
+		pthread_mutex_unlock(&pool->lock);
+		job.fn(job.arg);
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct workpool *workpool_create(int threads, int queue_size, void (*thread_init)(void))
+{
+	if (threads < 1 || queue_size < 1) return NULL;
+
+	struct workpool *pool = calloc(1, sizeof(struct workpool));
+	if (pool == NULL) return NULL;
+
+	pool->jobs = calloc(queue_size, sizeof(struct workpool_job));
+	pool->threads = calloc(threads, sizeof(pthread_t));
+	if (pool->jobs == NULL || pool->threads == NULL)
+	{
+		free(pool->jobs);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+	pool->queue_size = queue_size;
+	pool->thread_init = thread_init;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (pool->thread_count = 0; pool->thread_count < threads; pool->thread_count++)
+	{
+		if (pthread_create(&pool->threads[pool->thread_count], NULL, workpool_thread, pool) != 0) break;
+	}
+	if (pool->thread_count == 0)
+	{
+		workpool_destroy(pool, NULL);
+		return NULL;
+	}
+
+	return pool;
+}
+
+int workpool_submit(struct workpool *pool, workpool_fn fn, void *arg)
+{
+	int error = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->stopping || pool->count == pool->queue_size)
+	{
+		error = 1;
+	}
+	else
+	{
+		struct workpool_job *job = &pool->jobs[(pool->head + pool->count) % pool->queue_size];
+		job->fn = fn;
+		job->arg = arg;
+		pool->count++;
+		pthread_cond_signal(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return error;
+}
+
+int workpool_pending(struct workpool *pool)
+{
+	int count;
+	pthread_mutex_lock(&pool->lock);
+	count = pool->count;
+	pthread_mutex_unlock(&pool->lock);
+	return count;
+}
+
+void workpool_destroy(struct workpool *pool, workpool_fn discard)
+{
+	int i;
+
+	if (pool == NULL) return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	// running jobs are finished, queued ones are discarded
+	for (i = 0; i < pool->thread_count; i++)
+	{
+		pthread_join(pool->threads[i], NULL);
+	}
+	for (i = 0; i < pool->count; i++)
+	{
+		struct workpool_job *job = &pool->jobs[(pool->head + i) % pool->queue_size];
+		if (discard) discard(job->arg);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+	free(pool->jobs);
+	free(pool->threads);
+	free(pool);
+}
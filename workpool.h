@@ -0,0 +1,39 @@
+/*
+=================================================================================
+ Name        : workpool.h
+ Version     : 0.1
+
+ Description :
+     Small bounded worker pool, used to keep blocking jobs (shell commands,
+     speech synthesis) away from the pjsua callback threads.
+
+================================================================================
+This tool is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+================================================================================
+*/
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+struct workpool;
+
+// job function, called on one of the pool threads
+typedef void (*workpool_fn)(void *arg);
+
+// create a pool with a fixed number of threads and a bounded queue;
+// thread_init (may be NULL) is called once on every new thread
+struct workpool *workpool_create(int threads, int queue_size, void (*thread_init)(void));
+
+// queue a job, returns 0 on success and 1 if the queue is full or the pool stopped
+int workpool_submit(struct workpool *pool, workpool_fn fn, void *arg);
+
+// number of jobs waiting for a thread
+int workpool_pending(struct workpool *pool);
+
+// stop the threads and free the pool; queued jobs are handed to discard (may be NULL)
+void workpool_destroy(struct workpool *pool, workpool_fn discard);
+
+#endif